@@ -0,0 +1,44 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#define JOURNAL_TEXT_LEN 48
+
+typedef struct JournalEntry {
+    uint32_t boot;
+    uint32_t ms;
+    char text[JOURNAL_TEXT_LEN];
+} JournalEntry_t;
+
+/**
+ * Check whether the journal survived the reset, and record the reset reason for this boot.
+ */
+void journalInit(void);
+
+/**
+ * Add an entry, safe to call from any task. Text is truncated at JOURNAL_TEXT_LEN - 1 characters, a newline or an
+ * escape character.
+ */
+void journalAdd(const char *text, size_t len);
+
+/**
+ * Number of entries currently in the journal.
+ */
+int journalCount(void);
+
+/**
+ * Copy an entry, 0 being the oldest. Returns 0 on success or -1 if index is out of range.
+ */
+int journalGet(int index, JournalEntry_t *entry);
+
+/**
+ * Boot number stored in entries added since this boot.
+ */
+uint32_t journalBoot(void);
+
+/**
+ * Name of the reason for the last reset.
+ */
+const char *journalResetReason(void);
+#endif
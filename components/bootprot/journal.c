@@ -0,0 +1,158 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "journal.h"
+
+#define MAGIC 0x6a726e6c
+
+#define NROF_ENTRIES CONFIG_JOURNAL_ENTRIES
+
+#ifndef __NOINIT_ATTR
+#define __NOINIT_ATTR _SECTION_ATTR_IMPL(".noinit", __COUNTER__)
+#endif
+
+#if CONFIG_IDF_TARGET_ESP32
+static portMUX_TYPE journalMux = portMUX_INITIALIZER_UNLOCKED;
+#define JOURNAL_LOCK() portENTER_CRITICAL(&journalMux)
+#define JOURNAL_UNLOCK() portEXIT_CRITICAL(&journalMux)
+#else
+#define JOURNAL_LOCK() portENTER_CRITICAL()
+#define JOURNAL_UNLOCK() portEXIT_CRITICAL()
+#endif
+
+/*
+ * Kept in RAM that isn't cleared at startup, so the entries written before a panic or watchdog reset can be
+ * published once the device is back online. Like bootProtection it doesn't survive a power cycle.
+ */
+__NOINIT_ATTR static struct Journal {
+    uint32_t magic;
+    uint32_t boot;
+    uint32_t next; /* Total number of entries ever added, the oldest entry is at next - count */
+    uint32_t count;
+    JournalEntry_t entries[NROF_ENTRIES];
+} journal;
+
+static const char TAG[] = "journal";
+
+static bool initialised = false;
+static const char *resetReason = "unknown";
+
+void journalInit(void)
+{
+    char text[JOURNAL_TEXT_LEN];
+    int len, i;
+
+    if ((journal.magic != MAGIC) || (journal.count > NROF_ENTRIES)) {
+        memset(&journal, 0, sizeof(journal));
+        journal.magic = MAGIC;
+    } else {
+        journal.boot ++;
+        /* A matching magic doesn't mean the text survived the reset intact, so make sure it is terminated */
+        for (i = 0; i < NROF_ENTRIES; i++) {
+            journal.entries[i].text[JOURNAL_TEXT_LEN - 1] = 0;
+        }
+    }
+
+    switch (esp_reset_reason()) {
+    case ESP_RST_POWERON:
+        resetReason = "poweron";
+        break;
+    case ESP_RST_EXT:
+        resetReason = "external";
+        break;
+    case ESP_RST_SW:
+        resetReason = "software";
+        break;
+    case ESP_RST_PANIC:
+        resetReason = "panic";
+        break;
+    case ESP_RST_INT_WDT:
+        resetReason = "intwdt";
+        break;
+    case ESP_RST_TASK_WDT:
+        resetReason = "taskwdt";
+        break;
+    case ESP_RST_WDT:
+        resetReason = "wdt";
+        break;
+    case ESP_RST_DEEPSLEEP:
+        resetReason = "deepsleep";
+        break;
+    case ESP_RST_BROWNOUT:
+        resetReason = "brownout";
+        break;
+    default:
+        break;
+    }
+    initialised = true;
+    ESP_LOGI(TAG, "Boot %u, reset reason %s, %u entries", journal.boot, resetReason, journal.count);
+
+    len = snprintf(text, sizeof(text), "Boot, reset reason %s", resetReason);
+    journalAdd(text, len);
+}
+
+void journalAdd(const char *text, size_t len)
+{
+    JournalEntry_t *entry;
+    uint32_t ms;
+    size_t i;
+
+    if (!initialised) {
+        return;
+    }
+    ms = (uint32_t)(esp_timer_get_time() / 1000);
+
+    JOURNAL_LOCK();
+    entry = &journal.entries[journal.next % NROF_ENTRIES];
+    journal.next ++;
+    if (journal.count < NROF_ENTRIES) {
+        journal.count ++;
+    }
+    entry->boot = journal.boot;
+    entry->ms = ms;
+    for (i = 0; (i < len) && (i < JOURNAL_TEXT_LEN - 1); i++) {
+        if ((text[i] == '\n') || (text[i] == '\033')) {
+            break;
+        }
+        entry->text[i] = text[i];
+    }
+    entry->text[i] = 0;
+    JOURNAL_UNLOCK();
+}
+
+int journalCount(void)
+{
+    return journal.count;
+}
+
+int journalGet(int index, JournalEntry_t *entry)
+{
+    int result = -1;
+
+    JOURNAL_LOCK();
+    if ((index >= 0) && (index < journal.count)) {
+        memcpy(entry, &journal.entries[(journal.next - journal.count + index) % NROF_ENTRIES], sizeof(JournalEntry_t));
+        result = 0;
+    }
+    JOURNAL_UNLOCK();
+    return result;
+}
+
+uint32_t journalBoot(void)
+{
+    return journal.boot;
+}
+
+const char *journalResetReason(void)
+{
+    return resetReason;
+}
@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+
+#include "cJSON_AddOns.h"
+#include "wifi.h"
+#include "iot.h"
+#include "iotDevice.h"
+#include "sensors.h"
+#include "deepsleep.h"
+
+#define MAGIC 0x736c6570
+
+#define DEFAULT_MAX_AWAKE_SECS 20
+#define RECOVERY_AWAKE_SECS (5 * 60) /* Time to stay awake after repeated failures, to allow provisioning/updates */
+#define MAX_FAILED_CYCLES 3
+#define MIN_SLEEP_SECS 1
+
+#define CHECK_MS 50
+#define FLUSH_MS 100 /* Time allowed for the last QoS 0 publishes to leave the network stack */
+
+#define THREAD_NAME "deepsleep"
+#define THREAD_STACK_WORDS 2048
+#define THREAD_PRIO 1
+
+RTC_DATA_ATTR static struct DeepSleepState {
+    uint32_t magic;
+    uint32_t cycles;
+    uint32_t failedCycles;
+    uint32_t lastAwakeMs;
+} deepSleepState;
+
+static const char TAG[] = "deepsleep";
+
+static bool enabled = false;
+static uint32_t intervalSecs;
+static uint32_t maxAwakeSecs;
+
+static void deepSleepThread(void *pvParameters);
+static void deepSleepEnter(bool published);
+
+int deepSleepInit(DeviceProfile_DeepSleepConfig_t *config)
+{
+    if (config->interval == 0) {
+        ESP_LOGE(TAG, "Sleep interval must be greater than 0");
+        return -1;
+    }
+    if ((deepSleepState.magic != MAGIC) || (esp_reset_reason() != ESP_RST_DEEPSLEEP)) {
+        deepSleepState.magic = MAGIC;
+        deepSleepState.cycles = 0;
+        deepSleepState.failedCycles = 0;
+        deepSleepState.lastAwakeMs = 0;
+    }
+    intervalSecs = config->interval;
+
+    if (deepSleepState.failedCycles >= MAX_FAILED_CYCLES) {
+        ESP_LOGW(TAG, "%u failed cycles, staying awake for %d seconds", deepSleepState.failedCycles, RECOVERY_AWAKE_SECS);
+        maxAwakeSecs = RECOVERY_AWAKE_SECS;
+    } else {
+        enabled = true;
+        maxAwakeSecs = config->maxAwake ? config->maxAwake : DEFAULT_MAX_AWAKE_SECS;
+        wifiEnableFastResume();
+        iotMqttEnablePersistentSession();
+        sensorsSampleNow();
+    }
+    ESP_LOGI(TAG, "Cycle %u, sleep interval %u seconds (last awake %ums)", deepSleepState.cycles, intervalSecs, deepSleepState.lastAwakeMs);
+    iotDeviceAddDiagCallback(deepSleepDiag);
+
+    if (xTaskCreate(deepSleepThread, THREAD_NAME, THREAD_STACK_WORDS, NULL, THREAD_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create thread");
+        enabled = false;
+        return -1;
+    }
+    return 0;
+}
+
+bool deepSleepIsEnabled(void)
+{
+    return enabled;
+}
+
+void deepSleepDiag(cJSON *diag)
+{
+    cJSON *object = cJSON_AddObjectToObjectCS(diag, "deepSleep");
+    if (object == NULL) {
+        return;
+    }
+    cJSON_AddUIntToObjectCS(object, "cycles", deepSleepState.cycles);
+    cJSON_AddUIntToObjectCS(object, "failedCycles", deepSleepState.failedCycles);
+    cJSON_AddUIntToObjectCS(object, "lastAwakeMs", deepSleepState.lastAwakeMs);
+}
+
+static void deepSleepThread(void *pvParameters)
+{
+    int64_t deadline = (int64_t)maxAwakeSecs * 1000000;
+
+    while (esp_timer_get_time() < deadline) {
+        if (enabled && iotMqttIsConnected() && sensorsAllPublished()) {
+            deepSleepEnter(true);
+        }
+        vTaskDelay(CHECK_MS / portTICK_RATE_MS);
+    }
+    if (enabled) {
+        ESP_LOGW(TAG, "Failed to publish within %u seconds", maxAwakeSecs);
+    }
+    deepSleepEnter(!enabled);
+}
+
+static void deepSleepEnter(bool published)
+{
+    int64_t awakeUs;
+    uint64_t sleepUs;
+
+    if (published) {
+        deepSleepState.failedCycles = 0;
+    } else {
+        deepSleepState.failedCycles ++;
+    }
+    deepSleepState.cycles ++;
+
+    vTaskDelay(FLUSH_MS / portTICK_RATE_MS);
+    iotMqttStop();
+    esp_wifi_stop();
+
+    awakeUs = esp_timer_get_time();
+    deepSleepState.lastAwakeMs = (uint32_t)(awakeUs / 1000);
+    /* Keep the cycle period constant by removing the time spent awake */
+    sleepUs = (uint64_t)intervalSecs * 1000000;
+    if (sleepUs > (uint64_t)awakeUs + MIN_SLEEP_SECS * 1000000) {
+        sleepUs -= awakeUs;
+    } else {
+        sleepUs = MIN_SLEEP_SECS * 1000000;
+    }
+    ESP_LOGI(TAG, "Awake for %ums, sleeping for %ums", deepSleepState.lastAwakeMs, (uint32_t)(sleepUs / 1000));
+    esp_deep_sleep(sleepUs);
+}
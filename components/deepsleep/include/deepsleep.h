@@ -0,0 +1,24 @@
+#ifndef _DEEPSLEEP_H_
+#define _DEEPSLEEP_H_
+#include <stdbool.h>
+#include "deviceprofile.h"
+#include "cJSON.h"
+
+/**
+ * Start measure-publish-sleep mode as described by the profile.
+ * Once MQTT is connected and every sensor has published the device deep sleeps for the configured interval.
+ * Returns 0 on success, -1 on error.
+ */
+int deepSleepInit(DeviceProfile_DeepSleepConfig_t *config);
+
+/**
+ * Returns true if the device will go back to deep sleep as soon as it has published its readings, in which case
+ * long running services such as the provisioning server should not be started.
+ */
+bool deepSleepIsEnabled(void);
+
+/**
+ * Add the sleep cycle statistics to the diag object.
+ */
+void deepSleepDiag(cJSON *diag);
+#endif
@@ -8,598 +8,1081 @@ static const struct choice Choices_Switch_TypeStrings[] = {
     { "motion", DeviceProfile_Choices_Switch_Type_Motion },
     { NULL, 0 }
 };
+static const uint8_t Choices_Switch_TypeSlots[] = { 0, 3, 4, 5, 1, 0, 0, 2 };
+
+static const uint8_t keySlots_Switch[] = { 5, 4, 1, 7, 6, 2, 3, 0 };
 
 struct field fields_Switch[] = {
     {
         .key = "pin",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_SwitchConfig, pin),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "type",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_SwitchConfig, type),
+        .type = FIELD_TYPE_CHOICE,
         .choices = Choices_Switch_TypeStrings,
+        .choiceHash = { .seed = 0x0002, .mask = 7, .slots = Choices_Switch_TypeSlots },
         .validateAndSet = validateAndSetChoice
     },
     {
         .key = "relay",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_SwitchConfig, relay),
+        .type = FIELD_TYPE_ID,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "icon",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_SwitchConfig, icon),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "noiseFilter",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_SwitchConfig, noiseFilter),
+        .type = FIELD_TYPE_UINT,
         .validateAndSet = validateAndSetUInt
     },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_SwitchConfig, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_SwitchConfig, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 /**** relay ****/
+static const uint8_t keySlots_Relay[] = { 5, 0, 3, 0, 2, 1, 0, 4 };
+
 struct field fields_Relay[] = {
     {
         .key = "pin",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_RelayConfig, pin),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "level",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_RelayConfig, level),
+        .type = FIELD_TYPE_GPIOLEVEL,
         .validateAndSet = validateAndSetGPIOLevel
     },
+    {
+        .key = "restore",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_RelayConfig, restore),
+        .type = FIELD_TYPE_BOOL,
+        .validateAndSet = validateAndSetBool
+    },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_RelayConfig, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_RelayConfig, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 /**** dht22 ****/
 #if defined(CONFIG_DHT22)
+static const uint8_t keySlots_Dht22[] = { 0, 7, 8, 5, 4, 0, 1, 0, 6, 3, 0, 0, 9, 0, 2, 0 };
+
 struct field fields_Dht22[] = {
     {
         .key = "pin",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Dht22Config, pin),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
+    {
+        .key = "oversample",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Dht22Config, oversample),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "median",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Dht22Config, median),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "smoothing",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Dht22Config, smoothing),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "minInterval",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Dht22Config, minInterval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "maxInterval",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Dht22Config, maxInterval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "changeThreshold",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Dht22Config, changeThreshold),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Dht22Config, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Dht22Config, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 #endif
 /**** si7021 ****/
 #if defined(CONFIG_SI7021)
+static const uint8_t keySlots_Si7021[] = { 9, 0, 4, 0, 0, 2, 7, 8, 0, 6, 0, 3, 1, 10, 5, 11 };
+
 struct field fields_Si7021[] = {
     {
         .key = "sda",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Si7021Config, sda),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "scl",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Si7021Config, scl),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "addr",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Si7021Config, addr),
+        .type = FIELD_TYPE_I2CADDR,
         .validateAndSet = validateAndSetI2CAddr
     },
+    {
+        .key = "oversample",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Si7021Config, oversample),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "median",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Si7021Config, median),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "smoothing",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Si7021Config, smoothing),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "minInterval",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Si7021Config, minInterval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "maxInterval",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Si7021Config, maxInterval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "changeThreshold",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Si7021Config, changeThreshold),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Si7021Config, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Si7021Config, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 #endif
 /**** tsl2561 ****/
 #if defined(CONFIG_TSL2561)
+static const uint8_t keySlots_Tsl2561[] = { 9, 0, 4, 0, 0, 2, 7, 8, 0, 6, 0, 3, 1, 10, 5, 11 };
+
 struct field fields_Tsl2561[] = {
     {
         .key = "sda",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, sda),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "scl",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, scl),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "addr",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, addr),
+        .type = FIELD_TYPE_I2CADDR,
         .validateAndSet = validateAndSetI2CAddr
     },
+    {
+        .key = "oversample",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, oversample),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "median",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, median),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "smoothing",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, smoothing),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "minInterval",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, minInterval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "maxInterval",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, maxInterval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "changeThreshold",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, changeThreshold),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Tsl2561Config, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 #endif
 /**** bme280 ****/
 #if defined(CONFIG_BME280)
+static const uint8_t keySlots_Bme280[] = { 9, 0, 4, 0, 0, 2, 7, 8, 0, 6, 0, 3, 1, 10, 5, 11 };
+
 struct field fields_Bme280[] = {
     {
         .key = "sda",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Bme280Config, sda),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "scl",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Bme280Config, scl),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "addr",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Bme280Config, addr),
+        .type = FIELD_TYPE_I2CADDR,
         .validateAndSet = validateAndSetI2CAddr
     },
+    {
+        .key = "oversample",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Bme280Config, oversample),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "median",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Bme280Config, median),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "smoothing",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Bme280Config, smoothing),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "minInterval",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Bme280Config, minInterval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "maxInterval",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Bme280Config, maxInterval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "changeThreshold",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Bme280Config, changeThreshold),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Bme280Config, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Bme280Config, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 #endif
 /**** ds18x20 ****/
 #if defined(CONFIG_DS18x20)
+static const uint8_t keySlots_Ds18x20[] = { 9, 7, 3, 1, 0, 0, 8, 11, 4, 5, 0, 10, 6, 0, 2, 0 };
+
 struct field fields_Ds18x20[] = {
     {
         .key = "pin",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, pin),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "temperatureCorrection",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, temperatureCorrection),
+        .type = FIELD_TYPE_FLOAT,
         .validateAndSet = validateAndSetFloat
     },
+    {
+        .key = "resolution",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, resolution),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "oversample",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, oversample),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "median",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, median),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "smoothing",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, smoothing),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "minInterval",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, minInterval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "maxInterval",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, maxInterval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "changeThreshold",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, changeThreshold),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_Ds18x20Config, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 #endif
 /**** led ****/
+static const uint8_t keySlots_Led[] = { 3, 1, 0, 2 };
+
 struct field fields_Led[] = {
     {
         .key = "pin",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_LedConfig, pin),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_LedConfig, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_LedConfig, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 /**** led_strip_spi ****/
+static const uint8_t keySlots_LedStripSpi[] = { 2, 1, 0, 3 };
+
 struct field fields_LedStripSpi[] = {
     {
         .key = "numberOfLEDs",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_LedStripSpiConfig, numberOfLEDs),
+        .type = FIELD_TYPE_UINT,
         .validateAndSet = validateAndSetUInt
     },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_LedStripSpiConfig, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_LedStripSpiConfig, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 /**** draytonscr ****/
 #if defined(CONFIG_DRAYTONSCR)
+static const uint8_t keySlots_Draytonscr[] = { 0, 2, 0, 0, 5, 1, 4, 3 };
+
 struct field fields_Draytonscr[] = {
     {
         .key = "pin",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_DraytonscrConfig, pin),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "onCode",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_DraytonscrConfig, onCode),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "offCode",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_DraytonscrConfig, offCode),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_DraytonscrConfig, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_DraytonscrConfig, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 #endif
 /**** humidistat ****/
 #if defined(CONFIG_HUMIDISTAT)
+static const uint8_t keySlots_Humidistat[] = { 4, 1, 2, 3 };
+
 struct field fields_Humidistat[] = {
     {
         .key = "sensor",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_HumidistatConfig, sensor),
+        .type = FIELD_TYPE_ID,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "relay",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_HumidistatConfig, relay),
+        .type = FIELD_TYPE_ID,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_HumidistatConfig, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_HumidistatConfig, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 #endif
 /**** thermostat ****/
 #if defined(CONFIG_THERMOSTAT)
+static const uint8_t keySlots_Thermostat[] = { 4, 1, 2, 3 };
+
 struct field fields_Thermostat[] = {
     {
         .key = "sensor",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_ThermostatConfig, sensor),
+        .type = FIELD_TYPE_ID,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "relay",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_ThermostatConfig, relay),
+        .type = FIELD_TYPE_ID,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_ThermostatConfig, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_ThermostatConfig, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 #endif
 /**** gpiox ****/
 #if defined(CONFIG_GPIOX_EXPANDERS)
+static const uint8_t keySlots_Gpiox[] = { 0, 4, 5, 1, 3, 2, 0, 0 };
+
 struct field fields_Gpiox[] = {
     {
         .key = "sda",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_GpioxConfig, sda),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "scl",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_GpioxConfig, scl),
+        .type = FIELD_TYPE_GPIOPIN,
         .validateAndSet = validateAndSetGPIOPin
     },
     {
         .key = "number",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_GpioxConfig, number),
+        .type = FIELD_TYPE_UINT,
         .validateAndSet = validateAndSetUInt
     },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_GpioxConfig, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_GpioxConfig, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 #endif
 /**** relay_lockout ****/
+static const uint8_t keySlots_RelayLockout[] = { 3, 0, 1, 2 };
+
 struct field fields_RelayLockout[] = {
     {
         .key = "relay",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_RelayLockoutConfig, relay),
+        .type = FIELD_TYPE_ID,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_RelayLockoutConfig, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_RelayLockoutConfig, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
 /**** relay_timeout ****/
+static const uint8_t keySlots_RelayTimeout[] = { 1, 0, 4, 0, 5, 0, 2, 3 };
+
 struct field fields_RelayTimeout[] = {
     {
         .key = "relay",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_RelayTimeoutConfig, relay),
+        .type = FIELD_TYPE_ID,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "timeout",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_RelayTimeoutConfig, timeout),
+        .type = FIELD_TYPE_UINT,
         .validateAndSet = validateAndSetUInt
     },
     {
         .key = "value",
         .flags =  FIELD_FLAG_DEFAULT,
         .dataOffset = offsetof(struct DeviceProfile_RelayTimeoutConfig, value),
+        .type = FIELD_TYPE_BOOL,
         .validateAndSet = validateAndSetBool
     },
     {
         .key = "name",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_RelayTimeoutConfig, name),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
     {
         .key = "id",
         .flags =  FIELD_FLAG_OPTIONAL,
         .dataOffset = offsetof(struct DeviceProfile_RelayTimeoutConfig, id),
+        .type = FIELD_TYPE_STRING,
         .validateAndSet = validateAndSetString
     },
 };
+/**** deep_sleep ****/
+#if defined(CONFIG_DEEP_SLEEP)
+static const uint8_t keySlots_DeepSleep[] = { 3, 2, 1, 4 };
+
+struct field fields_DeepSleep[] = {
+    {
+        .key = "interval",
+        .flags =  FIELD_FLAG_DEFAULT,
+        .dataOffset = offsetof(struct DeviceProfile_DeepSleepConfig, interval),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "maxAwake",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_DeepSleepConfig, maxAwake),
+        .type = FIELD_TYPE_UINT,
+        .validateAndSet = validateAndSetUInt
+    },
+    {
+        .key = "name",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_DeepSleepConfig, name),
+        .type = FIELD_TYPE_STRING,
+        .validateAndSet = validateAndSetString
+    },
+    {
+        .key = "id",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_DeepSleepConfig, id),
+        .type = FIELD_TYPE_STRING,
+        .validateAndSet = validateAndSetString
+    },
+};
+#endif
+/**** rule ****/
+#if defined(CONFIG_RULES)
+static const uint8_t keySlots_Rule[] = { 5, 0, 2, 4, 1, 3, 6, 7 };
+
+struct field fields_Rule[] = {
+    {
+        .key = "when",
+        .flags =  FIELD_FLAG_DEFAULT,
+        .dataOffset = offsetof(struct DeviceProfile_RuleConfig, when),
+        .type = FIELD_TYPE_STRING,
+        .validateAndSet = validateAndSetString
+    },
+    {
+        .key = "then",
+        .flags =  FIELD_FLAG_DEFAULT,
+        .dataOffset = offsetof(struct DeviceProfile_RuleConfig, then),
+        .type = FIELD_TYPE_STRING,
+        .validateAndSet = validateAndSetString
+    },
+    {
+        .key = "otherwise",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_RuleConfig, otherwise),
+        .type = FIELD_TYPE_STRING,
+        .validateAndSet = validateAndSetString
+    },
+    {
+        .key = "refs",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_RuleConfig, refs),
+        .type = FIELD_TYPE_STRING,
+        .validateAndSet = validateAndSetString
+    },
+    {
+        .key = "code",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_RuleConfig, code),
+        .type = FIELD_TYPE_STRING,
+        .validateAndSet = validateAndSetString
+    },
+    {
+        .key = "name",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_RuleConfig, name),
+        .type = FIELD_TYPE_STRING,
+        .validateAndSet = validateAndSetString
+    },
+    {
+        .key = "id",
+        .flags =  FIELD_FLAG_OPTIONAL,
+        .dataOffset = offsetof(struct DeviceProfile_RuleConfig, id),
+        .type = FIELD_TYPE_STRING,
+        .validateAndSet = validateAndSetString
+    },
+};
+#endif
 
 struct component componentDefinitions[] = {
     {
         .name = "switch",
+        .schemaHash = 0xd89a2483,
         .structSize = sizeof(struct DeviceProfile_SwitchConfig),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, switchConfig),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, switchCount),
         .fields = fields_Switch,
+        .keyHash = { .seed = 0x002a, .mask = 7, .slots = keySlots_Switch },
+        .mandatoryMask = 0x00000003,
         .fieldsCount = sizeof(fields_Switch) / sizeof(struct field)
     },
     {
         .name = "relay",
+        .schemaHash = 0x37fe269b,
         .structSize = sizeof(struct DeviceProfile_RelayConfig),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, relayConfig),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, relayCount),
         .fields = fields_Relay,
+        .keyHash = { .seed = 0x0000, .mask = 7, .slots = keySlots_Relay },
+        .mandatoryMask = 0x00000003,
         .fieldsCount = sizeof(fields_Relay) / sizeof(struct field)
     },
 #if defined(CONFIG_DHT22)
     {
         .name = "dht22",
+        .schemaHash = 0x34e554de,
         .structSize = sizeof(struct DeviceProfile_Dht22Config),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, dht22Config),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, dht22Count),
         .fields = fields_Dht22,
+        .keyHash = { .seed = 0x0008, .mask = 15, .slots = keySlots_Dht22 },
+        .mandatoryMask = 0x00000001,
         .fieldsCount = sizeof(fields_Dht22) / sizeof(struct field)
     },
 #endif
 #if defined(CONFIG_SI7021)
     {
         .name = "si7021",
+        .schemaHash = 0x6174e23b,
         .structSize = sizeof(struct DeviceProfile_Si7021Config),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, si7021Config),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, si7021Count),
         .fields = fields_Si7021,
+        .keyHash = { .seed = 0x0050, .mask = 15, .slots = keySlots_Si7021 },
+        .mandatoryMask = 0x00000007,
         .fieldsCount = sizeof(fields_Si7021) / sizeof(struct field)
     },
 #endif
 #if defined(CONFIG_TSL2561)
     {
         .name = "tsl2561",
+        .schemaHash = 0xe1637b4c,
         .structSize = sizeof(struct DeviceProfile_Tsl2561Config),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, tsl2561Config),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, tsl2561Count),
         .fields = fields_Tsl2561,
+        .keyHash = { .seed = 0x0050, .mask = 15, .slots = keySlots_Tsl2561 },
+        .mandatoryMask = 0x00000007,
         .fieldsCount = sizeof(fields_Tsl2561) / sizeof(struct field)
     },
 #endif
 #if defined(CONFIG_BME280)
     {
         .name = "bme280",
+        .schemaHash = 0x67724f73,
         .structSize = sizeof(struct DeviceProfile_Bme280Config),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, bme280Config),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, bme280Count),
         .fields = fields_Bme280,
+        .keyHash = { .seed = 0x0050, .mask = 15, .slots = keySlots_Bme280 },
+        .mandatoryMask = 0x00000007,
         .fieldsCount = sizeof(fields_Bme280) / sizeof(struct field)
     },
 #endif
 #if defined(CONFIG_DS18x20)
     {
         .name = "ds18x20",
+        .schemaHash = 0xa4815af2,
         .structSize = sizeof(struct DeviceProfile_Ds18x20Config),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, ds18x20Config),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, ds18x20Count),
         .fields = fields_Ds18x20,
+        .keyHash = { .seed = 0x00ce, .mask = 15, .slots = keySlots_Ds18x20 },
+        .mandatoryMask = 0x00000001,
         .fieldsCount = sizeof(fields_Ds18x20) / sizeof(struct field)
     },
 #endif
     {
         .name = "led",
+        .schemaHash = 0x3cb8f93a,
         .structSize = sizeof(struct DeviceProfile_LedConfig),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, ledConfig),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, ledCount),
         .fields = fields_Led,
+        .keyHash = { .seed = 0x0000, .mask = 3, .slots = keySlots_Led },
+        .mandatoryMask = 0x00000001,
         .fieldsCount = sizeof(fields_Led) / sizeof(struct field)
     },
     {
         .name = "led_strip_spi",
+        .schemaHash = 0x0ac7611b,
         .structSize = sizeof(struct DeviceProfile_LedStripSpiConfig),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, ledStripSpiConfig),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, ledStripSpiCount),
         .fields = fields_LedStripSpi,
+        .keyHash = { .seed = 0x0002, .mask = 3, .slots = keySlots_LedStripSpi },
+        .mandatoryMask = 0x00000001,
         .fieldsCount = sizeof(fields_LedStripSpi) / sizeof(struct field)
     },
 #if defined(CONFIG_DRAYTONSCR)
     {
         .name = "draytonscr",
+        .schemaHash = 0x1c754136,
         .structSize = sizeof(struct DeviceProfile_DraytonscrConfig),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, draytonscrConfig),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, draytonscrCount),
         .fields = fields_Draytonscr,
+        .keyHash = { .seed = 0x0003, .mask = 7, .slots = keySlots_Draytonscr },
+        .mandatoryMask = 0x00000007,
         .fieldsCount = sizeof(fields_Draytonscr) / sizeof(struct field)
     },
 #endif
 #if defined(CONFIG_HUMIDISTAT)
     {
         .name = "humidistat",
+        .schemaHash = 0xec7af6e5,
         .structSize = sizeof(struct DeviceProfile_HumidistatConfig),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, humidistatConfig),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, humidistatCount),
         .fields = fields_Humidistat,
+        .keyHash = { .seed = 0x0000, .mask = 3, .slots = keySlots_Humidistat },
+        .mandatoryMask = 0x00000003,
         .fieldsCount = sizeof(fields_Humidistat) / sizeof(struct field)
     },
 #endif
 #if defined(CONFIG_THERMOSTAT)
     {
         .name = "thermostat",
+        .schemaHash = 0xe9b1b934,
         .structSize = sizeof(struct DeviceProfile_ThermostatConfig),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, thermostatConfig),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, thermostatCount),
         .fields = fields_Thermostat,
+        .keyHash = { .seed = 0x0000, .mask = 3, .slots = keySlots_Thermostat },
+        .mandatoryMask = 0x00000003,
         .fieldsCount = sizeof(fields_Thermostat) / sizeof(struct field)
     },
 #endif
 #if defined(CONFIG_GPIOX_EXPANDERS)
     {
         .name = "gpiox",
+        .schemaHash = 0xcab948ec,
         .structSize = sizeof(struct DeviceProfile_GpioxConfig),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, gpioxConfig),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, gpioxCount),
         .fields = fields_Gpiox,
+        .keyHash = { .seed = 0x0006, .mask = 7, .slots = keySlots_Gpiox },
+        .mandatoryMask = 0x00000007,
         .fieldsCount = sizeof(fields_Gpiox) / sizeof(struct field)
     },
 #endif
     {
         .name = "relay_lockout",
+        .schemaHash = 0x5c49ce51,
         .structSize = sizeof(struct DeviceProfile_RelayLockoutConfig),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, relayLockoutConfig),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, relayLockoutCount),
         .fields = fields_RelayLockout,
+        .keyHash = { .seed = 0x0000, .mask = 3, .slots = keySlots_RelayLockout },
+        .mandatoryMask = 0x00000001,
         .fieldsCount = sizeof(fields_RelayLockout) / sizeof(struct field)
     },
     {
         .name = "relay_timeout",
+        .schemaHash = 0xe28985d7,
         .structSize = sizeof(struct DeviceProfile_RelayTimeoutConfig),
         .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, relayTimeoutConfig),
         .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, relayTimeoutCount),
         .fields = fields_RelayTimeout,
+        .keyHash = { .seed = 0x0008, .mask = 7, .slots = keySlots_RelayTimeout },
+        .mandatoryMask = 0x00000007,
         .fieldsCount = sizeof(fields_RelayTimeout) / sizeof(struct field)
     },
+#if defined(CONFIG_DEEP_SLEEP)
+    {
+        .name = "deep_sleep",
+        .schemaHash = 0x24102a94,
+        .structSize = sizeof(struct DeviceProfile_DeepSleepConfig),
+        .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, deepSleepConfig),
+        .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, deepSleepCount),
+        .fields = fields_DeepSleep,
+        .keyHash = { .seed = 0x0001, .mask = 3, .slots = keySlots_DeepSleep },
+        .mandatoryMask = 0x00000001,
+        .fieldsCount = sizeof(fields_DeepSleep) / sizeof(struct field)
+    },
+#endif
+#if defined(CONFIG_RULES)
+    {
+        .name = "rule",
+        .schemaHash = 0x65fde897,
+        .structSize = sizeof(struct DeviceProfile_RuleConfig),
+        .arrayOffset = offsetof(struct DeviceProfile_DeviceConfig, ruleConfig),
+        .arrayCountOffset = offsetof(struct DeviceProfile_DeviceConfig, ruleCount),
+        .fields = fields_Rule,
+        .keyHash = { .seed = 0x003b, .mask = 7, .slots = keySlots_Rule },
+        .mandatoryMask = 0x00000003,
+        .fieldsCount = sizeof(fields_Rule) / sizeof(struct field)
+    },
+#endif
 };
\ No newline at end of file
@@ -1,57 +1,70 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include "sdkconfig.h"
 #include "esp_log.h"
 #include "cJSON.h"
 #include "component_config.h"
+#include "deviceprofile.h"
 #include "field_types_used.h"
+#include "deserializeInternal.h"
 #define SUPPORTED_VERSION "1.0"
+
+#define BINARY_MAGIC "HTPB"
+#define BINARY_MAGIC_LEN 4
+#define BINARY_VERSION 1
+#define BINARY_HEADER_LEN (BINARY_MAGIC_LEN + 4)
+#define BINARY_MAX_FIELDS 32
+
 static const char TAG[] = "compcfg";
 
-/* Enum Mappings */
-struct choice {
-    const char *str;
-    int val;
-};
+#ifdef CONFIG_DEVICEPROFILE_CJSON_PARSER
+static int deserializeTree(const char *profile, struct DeviceProfile_DeviceConfig *config);
+#endif
 
-enum field_flags {
-    FIELD_FLAG_DEFAULT,
-    FIELD_FLAG_OPTIONAL
+/* Cursor over a binary profile */
+struct reader {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
 };
 
-struct field;
-
-typedef int (*validateAndSet_t)(cJSON *, struct field *, void *);
+/* Must match key_hash() in tools/gencomponents.py */
+static uint32_t hashKey(const char *key, uint32_t seed)
+{
+    uint32_t value = 0x811c9dc5 ^ seed;
+    for (; *key; key++) {
+        value = (value ^ (uint8_t)tolower((unsigned char)*key)) * 0x01000193;
+    }
+    return value ^ (value >> 16);
+}
 
-struct field {
-    char *key;
-    enum field_flags flags;
-    size_t dataOffset;
-    const struct choice *choices;
-    validateAndSet_t validateAndSet;
-};
+int keyHashLookup(const struct keyHash *hash, const char *key)
+{
+    uint8_t slot = hash->slots[hashKey(key, hash->seed) & hash->mask];
+    return (int)slot - 1;
+}
 
-struct component {
-    char *name;
-    size_t structSize;
-    size_t arrayOffset;
-    size_t arrayCountOffset;
-    struct field *fields;
-    size_t fieldsCount;
-};
+int deserializeFindField(struct component *componentDef, const char *key)
+{
+    int index = keyHashLookup(&componentDef->keyHash, key);
+    if ((index == -1) || (strcasecmp(componentDef->fields[index].key, key) != 0)) {
+        return -1;
+    }
+    return index;
+}
 
 #ifdef FIELD_TYPE_USED_CHOICE
-static int findChoice(const struct choice *choices, char *input, int *output)
+static int findChoice(struct field *field, char *input, int *output)
 {
-    int i;
-    for (i = 0; choices[i].str != NULL; i++) {
-        if (strcmp(choices[i].str, input) == 0) {
-            *output = choices[i].val;
-            return 0;
-        }
+    int index = keyHashLookup(&field->choiceHash, input);
+    if ((index == -1) || (strcmp(field->choices[index].str, input) != 0)) {
+        return -1;
     }
-    return -1;
+    *output = field->choices[index].val;
+    return 0;
 }
 static int validateAndSetChoice(cJSON *value, struct field *field, void *output)
 {
@@ -61,7 +74,7 @@ static int validateAndSetChoice(cJSON *value, struct field *field, void *output)
         return -1;
     }
 
-    if (findChoice(field->choices, text, output)) {
+    if (findChoice(field, text, output)) {
         return -1;
     }
     return 0;
@@ -174,18 +187,61 @@ static int validateAndSetFloat(cJSON *value, struct field *field, void *output)
 
 #include "component_config_internal.h"
 
-int deserializeComponent(struct component *componentDef, cJSON *object, void *structPtr)
+const size_t nrofComponentDefinitions = sizeof(componentDefinitions) / sizeof(struct component);
+
+void deserializeFreeComponents(struct component *componentDef, void *structs, size_t count)
 {
-    int i;
-    for (i = 0; i < componentDef->fieldsCount; i++) {
-        cJSON *value;
-        value = cJSON_GetObjectItem(object, componentDef->fields[i].key);
-        if (value == NULL) {
-            if ((componentDef->fields[i].flags & FIELD_FLAG_OPTIONAL) != 0) {
-                continue;
+    size_t i;
+    int j;
+    for (i = 0; i < count; i++) {
+        void *structPtr = structs + (i * componentDef->structSize);
+        for (j = 0; j < componentDef->fieldsCount; j++) {
+            enum field_type type = componentDef->fields[j].type;
+            if ((type == FIELD_TYPE_STRING) || (type == FIELD_TYPE_ID)) {
+                free(*(char **)(structPtr + componentDef->fields[j].dataOffset));
             }
-            return -1;
         }
+    }
+    free(structs);
+}
+
+void deviceProfileFree(DeviceProfile_DeviceConfig_t *config)
+{
+    int i;
+    for (i = 0; i < nrofComponentDefinitions; i++) {
+        struct component *componentDef = &componentDefinitions[i];
+        void **structs = ((void *)config) + componentDef->arrayOffset;
+        size_t *count = ((void *)config) + componentDef->arrayCountOffset;
+        if (*structs != NULL) {
+            deserializeFreeComponents(componentDef, *structs, *count);
+        }
+        *structs = NULL;
+        *count = 0;
+    }
+}
+
+int deviceProfileDeserialize(const char *profile, struct DeviceProfile_DeviceConfig *config)
+{
+#ifdef CONFIG_DEVICEPROFILE_CJSON_PARSER
+    return deserializeTree(profile, config);
+#else
+    return deserializeStream(profile, config);
+#endif
+}
+
+#ifdef CONFIG_DEVICEPROFILE_CJSON_PARSER
+int deserializeComponent(struct component *componentDef, cJSON *object, void *structPtr)
+{
+    uint32_t seen = 0;
+    cJSON *value;
+
+    cJSON_ArrayForEach(value, object) {
+        int i = deserializeFindField(componentDef, value->string);
+        /* Only the first occurrence of a key is used */
+        if ((i == -1) || ((seen & (1 << i)) != 0)) {
+            continue;
+        }
+        seen |= 1 << i;
         if (componentDef->fields[i].validateAndSet(value,
                 &componentDef->fields[i],
                 structPtr + componentDef->fields[i].dataOffset)) {
@@ -193,6 +249,9 @@ int deserializeComponent(struct component *componentDef, cJSON *object, void *st
             return -1;
         }
     }
+    if ((seen & componentDef->mandatoryMask) != componentDef->mandatoryMask) {
+        return -1;
+    }
     return 0;
 }
 
@@ -248,7 +307,7 @@ static bool checkVersionSupported(cJSON *object)
     return false;
 }
 
-int deviceProfileDeserialize(const char *profile, struct DeviceProfile_DeviceConfig *config)
+static int deserializeTree(const char *profile, struct DeviceProfile_DeviceConfig *config)
 {
     int i;
     cJSON *object, *components;
@@ -261,16 +320,18 @@ int deviceProfileDeserialize(const char *profile, struct DeviceProfile_DeviceCon
     }
 
     if (!checkVersionSupported(object)) {
+        cJSON_Delete(object);
         return -1;
     }
 
     components = cJSON_GetObjectItem(object, "components");
     if ((components == NULL) || (!cJSON_IsObject(components))) {
         ESP_LOGE(TAG, "No components section");
+        cJSON_Delete(object);
         return -1;
     }
 
-    for (i = 0; i < sizeof(componentDefinitions) / sizeof(struct component); i ++) {
+    for (i = 0; i < nrofComponentDefinitions; i ++) {
         cJSON *componentArray = cJSON_GetObjectItem(components, componentDefinitions[i].name);
         if (componentArray == NULL) {
             continue;
@@ -281,5 +342,234 @@ int deviceProfileDeserialize(const char *profile, struct DeviceProfile_DeviceCon
         }
         deserializeComponents(config, &componentDefinitions[i], componentArray);
     }
+    /* All strings have been copied so the tree is no longer needed */
+    cJSON_Delete(object);
+    return 0;
+}
+#endif
+
+static const uint8_t *readBytes(struct reader *reader, size_t len)
+{
+    const uint8_t *bytes;
+    if (reader->len - reader->pos < len) {
+        return NULL;
+    }
+    bytes = reader->data + reader->pos;
+    reader->pos += len;
+    return bytes;
+}
+
+static int readU8(struct reader *reader, uint8_t *value)
+{
+    const uint8_t *bytes = readBytes(reader, 1);
+    if (bytes == NULL) {
+        return -1;
+    }
+    *value = bytes[0];
     return 0;
-}
\ No newline at end of file
+}
+
+static int readU16(struct reader *reader, uint16_t *value)
+{
+    const uint8_t *bytes = readBytes(reader, 2);
+    if (bytes == NULL) {
+        return -1;
+    }
+    *value = bytes[0] | (bytes[1] << 8);
+    return 0;
+}
+
+static int readU32(struct reader *reader, uint32_t *value)
+{
+    const uint8_t *bytes = readBytes(reader, 4);
+    if (bytes == NULL) {
+        return -1;
+    }
+    *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    return 0;
+}
+
+static int decodeField(struct reader *reader, struct field *field, void *output)
+{
+    uint8_t u8;
+    uint32_t u32;
+
+    switch (field->type) {
+    case FIELD_TYPE_UINT:
+    case FIELD_TYPE_INT:
+    case FIELD_TYPE_FLOAT:
+        /* uint32_t, int32_t and float all share the same little endian 4 byte encoding */
+        if (readU32(reader, &u32)) {
+            return -1;
+        }
+        memcpy(output, &u32, sizeof(u32));
+        return 0;
+
+    case FIELD_TYPE_GPIOPIN:
+    case FIELD_TYPE_GPIOLEVEL:
+    case FIELD_TYPE_I2CADDR:
+        return readU8(reader, (uint8_t *)output);
+
+    case FIELD_TYPE_BOOL:
+        if (readU8(reader, &u8)) {
+            return -1;
+        }
+        *((bool *)output) = u8 != 0;
+        return 0;
+
+    case FIELD_TYPE_CHOICE: {
+        int i;
+        if (readU8(reader, &u8)) {
+            return -1;
+        }
+        for (i = 0; (field->choices[i].str != NULL) && (i < u8); i++);
+        if (field->choices[i].str == NULL) {
+            return -1;
+        }
+        *((int *)output) = field->choices[i].val;
+        return 0;
+    }
+
+    case FIELD_TYPE_STRING:
+    case FIELD_TYPE_ID: {
+        const uint8_t *str;
+        char *copy;
+        if (readU8(reader, &u8)) {
+            return -1;
+        }
+        str = readBytes(reader, u8);
+        if (str == NULL) {
+            return -1;
+        }
+        copy = malloc(u8 + 1);
+        if (copy == NULL) {
+            return -1;
+        }
+        memcpy(copy, str, u8);
+        copy[u8] = 0;
+        *((char **)output) = copy;
+        return 0;
+    }
+    }
+    return -1;
+}
+
+static int decodeComponent(struct reader *reader, struct component *componentDef, void *structPtr)
+{
+    uint8_t nrofFields, index;
+    uint32_t seen = 0;
+    int i;
+
+    if (readU8(reader, &nrofFields)) {
+        return -1;
+    }
+    for (i = 0; i < nrofFields; i++) {
+        /* fieldsCount is at most BINARY_MAX_FIELDS so every index has a bit in seen */
+        if (readU8(reader, &index) || (index >= componentDef->fieldsCount) || (index >= BINARY_MAX_FIELDS)) {
+            return -1;
+        }
+        /* A second value would replace, and leak, a string from the first */
+        if (seen & (1u << index)) {
+            ESP_LOGI(TAG, "Component %s->%s repeated", componentDef->name, componentDef->fields[index].key);
+            return -1;
+        }
+        if (decodeField(reader, &componentDef->fields[index], structPtr + componentDef->fields[index].dataOffset)) {
+            ESP_LOGI(TAG, "Component %s->%s failed validation", componentDef->name, componentDef->fields[index].key);
+            return -1;
+        }
+        seen |= 1u << index;
+    }
+    for (i = 0; i < componentDef->fieldsCount; i++) {
+        if (((seen & (1u << i)) == 0) && ((componentDef->fields[i].flags & FIELD_FLAG_OPTIONAL) == 0)) {
+            ESP_LOGI(TAG, "Component %s->%s missing", componentDef->name, componentDef->fields[i].key);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static struct component *findComponentByHash(uint32_t schemaHash)
+{
+    int i;
+    for (i = 0; i < nrofComponentDefinitions; i ++) {
+        if (componentDefinitions[i].schemaHash == schemaHash) {
+            return &componentDefinitions[i];
+        }
+    }
+    return NULL;
+}
+
+bool deviceProfileIsBinary(const uint8_t *profile, size_t len)
+{
+    return (len >= BINARY_HEADER_LEN) && (memcmp(profile, BINARY_MAGIC, BINARY_MAGIC_LEN) == 0);
+}
+
+int deviceProfileDecode(const uint8_t *profile, size_t len, struct DeviceProfile_DeviceConfig *config)
+{
+    struct reader reader = {.data = profile, .len = len, .pos = BINARY_MAGIC_LEN};
+    uint8_t version, nrofComponents;
+    uint16_t totalLen;
+    int i;
+
+    memset(config, 0, sizeof(struct DeviceProfile_DeviceConfig));
+    if (!deviceProfileIsBinary(profile, len)) {
+        return -1;
+    }
+    readU8(&reader, &version);
+    readU8(&reader, &nrofComponents);
+    readU16(&reader, &totalLen);
+    if ((version != BINARY_VERSION) || (totalLen != len)) {
+        ESP_LOGE(TAG, "Unsupported binary profile (version %u length %u/%u)", version, totalLen, len);
+        return -1;
+    }
+
+    for (i = 0; i < nrofComponents; i++) {
+        struct component *componentDef;
+        struct reader componentReader;
+        uint32_t schemaHash;
+        uint8_t count;
+        uint16_t componentLen;
+        void *structs;
+        int j;
+
+        if (readU32(&reader, &schemaHash) || readU8(&reader, &count) || readU16(&reader, &componentLen)) {
+            goto error;
+        }
+        componentReader.data = readBytes(&reader, componentLen);
+        componentReader.len = componentLen;
+        componentReader.pos = 0;
+        if (componentReader.data == NULL) {
+            goto error;
+        }
+        /* The binary profile is only valid for a firmware with exactly the same component definitions */
+        componentDef = findComponentByHash(schemaHash);
+        if ((componentDef == NULL) || (componentDef->fieldsCount > BINARY_MAX_FIELDS)) {
+            ESP_LOGE(TAG, "Binary profile component %08x not supported", schemaHash);
+            goto error;
+        }
+        if (*((void **)(((void*)config) + componentDef->arrayOffset)) != NULL) {
+            ESP_LOGE(TAG, "Binary profile component %s repeated", componentDef->name);
+            goto error;
+        }
+
+        structs = calloc(count, componentDef->structSize);
+        if (structs == NULL) {
+            goto error;
+        }
+        for (j = 0; j < count; j++) {
+            if (decodeComponent(&componentReader, componentDef, structs + (j * componentDef->structSize))) {
+                ESP_LOGI(TAG, "Processing of %s failed", componentDef->name);
+                deserializeFreeComponents(componentDef, structs, count);
+                goto error;
+            }
+        }
+        *((void **)(((void*)config) + componentDef->arrayOffset)) = structs;
+        *((size_t *)(((void*)config) + componentDef->arrayCountOffset)) = count;
+    }
+    return 0;
+error:
+    ESP_LOGE(TAG, "Failed to decode binary profile");
+    /* Components decoded before the error */
+    deviceProfileFree(config);
+    return -1;
+}
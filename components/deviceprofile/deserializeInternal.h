@@ -0,0 +1,89 @@
+#ifndef _DESERIALIZE_INTERNAL_H_
+#define _DESERIALIZE_INTERNAL_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "cJSON.h"
+#include "component_config.h"
+
+/* Enum Mappings */
+struct choice {
+    const char *str;
+    int val;
+};
+
+enum field_flags {
+    FIELD_FLAG_DEFAULT,
+    FIELD_FLAG_OPTIONAL
+};
+
+enum field_type {
+    FIELD_TYPE_CHOICE,
+    FIELD_TYPE_UINT,
+    FIELD_TYPE_INT,
+    FIELD_TYPE_GPIOPIN,
+    FIELD_TYPE_GPIOLEVEL,
+    FIELD_TYPE_I2CADDR,
+    FIELD_TYPE_BOOL,
+    FIELD_TYPE_STRING,
+    FIELD_TYPE_ID,
+    FIELD_TYPE_FLOAT
+};
+
+/* Perfect hash generated by gencomponents.py, slots hold the index + 1 of the entry for that slot or 0 if unused */
+struct keyHash {
+    uint32_t seed;
+    uint32_t mask;
+    const uint8_t *slots;
+};
+
+struct field;
+
+typedef int (*validateAndSet_t)(cJSON *, struct field *, void *);
+
+struct field {
+    char *key;
+    enum field_flags flags;
+    size_t dataOffset;
+    enum field_type type;
+    const struct choice *choices;
+    struct keyHash choiceHash;
+    validateAndSet_t validateAndSet;
+};
+
+struct component {
+    char *name;
+    uint32_t schemaHash;
+    size_t structSize;
+    size_t arrayOffset;
+    size_t arrayCountOffset;
+    struct field *fields;
+    size_t fieldsCount;
+    struct keyHash keyHash;
+    uint32_t mandatoryMask; /* Bit per field index, set for fields that must be present */
+};
+
+/* Generated component definitions, see component_config_internal.h */
+extern struct component componentDefinitions[];
+extern const size_t nrofComponentDefinitions;
+
+/**
+ * Find the only entry that key could match, the caller must still compare the key against the entry.
+ * Returns the index of the entry or -1 if no entry hashes to the same slot.
+ */
+int keyHashLookup(const struct keyHash *hash, const char *key);
+
+/**
+ * Find the index of the field matching key (ignoring case), or -1 if there is no such field.
+ */
+int deserializeFindField(struct component *componentDef, const char *key);
+
+/**
+ * Free the instances of a component along with any strings they reference.
+ */
+void deserializeFreeComponents(struct component *componentDef, void *structs, size_t count);
+
+/**
+ * Deserialize a JSON profile in a single pass without building a cJSON tree.
+ */
+int deserializeStream(const char *profile, DeviceProfile_DeviceConfig_t *config);
+#endif
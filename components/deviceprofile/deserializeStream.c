@@ -0,0 +1,411 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "cJSON.h"
+#include "jsonStream.h"
+#include "deviceprofile.h"
+#include "deserializeInternal.h"
+
+/*
+ * Single pass profile deserializer.
+ *
+ * Follows the same rules as the cJSON tree parser: keys are matched case insensitively and only the first
+ * occurrence of a key is used, a component that fails validation is dropped and the rest of the profile is
+ * still processed. Values are validated with the same validateAndSet functions using a cJSON item on the
+ * stack, so no heap is used apart from the config structures themselves, and strings too long for the token
+ * buffer which are joined together in longValue.
+ */
+
+#define SUPPORTED_VERSION "1.0"
+#define MAX_TOKEN_LEN 256
+
+/* Nesting depth of each part of the profile */
+#define DEPTH_ROOT      1
+#define DEPTH_COMPONENTS 2
+#define DEPTH_ARRAY     3
+#define DEPTH_INSTANCE  4
+
+enum rootKey {
+    ROOT_KEY_NONE,
+    ROOT_KEY_VERSION,
+    ROOT_KEY_COMPONENTS
+};
+
+struct streamContext {
+    DeviceProfile_DeviceConfig_t *config;
+    int depth;
+    int skipDepth; /* When non-zero events are ignored until depth returns to skipDepth */
+    enum rootKey rootKey;
+    bool versionSeen;
+    bool versionOk;
+    bool componentsSeen;
+    bool componentsOk;
+    uint32_t componentsDone; /* Bit per component definition */
+    struct component *componentDef;
+    struct component *pendingComponent;
+    void *structs;
+    size_t count;
+    size_t allocated;
+    uint32_t fieldsSeen;
+    int fieldIndex;
+    char *longValue; /* Start of a string longer than the token buffer */
+    size_t longLen;
+    bool longKey;
+};
+
+static const char TAG[] = "compcfgstream";
+
+static int streamEvent(void *user, JsonStreamEvent_e event, const char *value, size_t len);
+static int streamLongValue(struct streamContext *context, const char *value, size_t len);
+static void streamRootValue(struct streamContext *context, JsonStreamEvent_e event, const char *value);
+static void streamComponentsValue(struct streamContext *context, JsonStreamEvent_e event);
+static void streamArrayValue(struct streamContext *context, JsonStreamEvent_e event);
+static void streamInstanceValue(struct streamContext *context, JsonStreamEvent_e event, const char *value);
+static void streamSkip(struct streamContext *context, JsonStreamEvent_e event, int untilDepth);
+static void streamComponentFailed(struct streamContext *context);
+static void streamComponentFinished(struct streamContext *context);
+
+int deserializeStream(const char *profile, DeviceProfile_DeviceConfig_t *config)
+{
+    struct streamContext context;
+    JsonStream_t stream;
+    char token[MAX_TOKEN_LEN];
+    int result;
+
+    memset(config, 0, sizeof(DeviceProfile_DeviceConfig_t));
+    memset(&context, 0, sizeof(context));
+    context.config = config;
+    context.fieldIndex = -1;
+
+    jsonStreamInit(&stream, token, sizeof(token), streamEvent, &context);
+    jsonStreamSplitStrings(&stream, true);
+    result = jsonStreamFeed(&stream, profile, strlen(profile));
+    if (result == 0) {
+        result = jsonStreamFinish(&stream);
+    }
+    free(context.longValue);
+    if (result != 0) {
+        ESP_LOGE(TAG, "Failed to parse json");
+    } else if (!context.versionOk) {
+        result = -1;
+    } else if (!context.componentsOk) {
+        ESP_LOGE(TAG, "No components section");
+        result = -1;
+    }
+    if (result != 0) {
+        if (context.structs != NULL) {
+            deserializeFreeComponents(context.componentDef, context.structs, context.count);
+        }
+        deviceProfileFree(config);
+        return -1;
+    }
+    return 0;
+}
+
+static int streamEvent(void *user, JsonStreamEvent_e event, const char *value, size_t len)
+{
+    struct streamContext *context = user;
+    bool start = (event == JSON_STREAM_OBJECT_START) || (event == JSON_STREAM_ARRAY_START);
+    bool end = (event == JSON_STREAM_OBJECT_END) || (event == JSON_STREAM_ARRAY_END);
+
+    /* No key is long enough to be split, so a split key matches nothing */
+    if (event == JSON_STREAM_KEY_PART) {
+        context->longKey = true;
+        return 0;
+    }
+    if ((event == JSON_STREAM_KEY) && context->longKey) {
+        context->longKey = false;
+        value = "";
+    }
+
+    if (context->skipDepth) {
+        if (start) {
+            context->depth ++;
+        } else if (end) {
+            context->depth --;
+        }
+        if (context->depth == context->skipDepth) {
+            context->skipDepth = 0;
+            if ((context->depth == DEPTH_COMPONENTS) && (context->componentDef != NULL)) {
+                streamComponentFinished(context);
+            }
+        }
+        return 0;
+    }
+
+    if ((event == JSON_STREAM_STRING_PART) || ((event == JSON_STREAM_STRING) && (context->longValue != NULL))) {
+        if (streamLongValue(context, value, len)) {
+            return -1;
+        }
+        if (event == JSON_STREAM_STRING_PART) {
+            return 0;
+        }
+        value = context->longValue;
+    }
+
+    if (end) {
+        context->depth --;
+        if ((context->depth == DEPTH_ARRAY) && (context->componentDef != NULL)) {
+            uint32_t mandatory = context->componentDef->mandatoryMask;
+            if ((context->fieldsSeen & mandatory) != mandatory) {
+                streamComponentFailed(context);
+            }
+        } else if (context->depth == DEPTH_COMPONENTS) {
+            streamComponentFinished(context);
+        }
+        return 0;
+    }
+
+    switch (context->depth) {
+    case 0:
+        if (event != JSON_STREAM_OBJECT_START) {
+            /* Not an object so there can be no version */
+            return 0;
+        }
+        context->depth ++;
+        break;
+
+    case DEPTH_ROOT:
+        if (event == JSON_STREAM_KEY) {
+            context->rootKey = ROOT_KEY_NONE;
+            if (!context->versionSeen && (strcasecmp(value, "version") == 0)) {
+                context->rootKey = ROOT_KEY_VERSION;
+            } else if (!context->componentsSeen && (strcasecmp(value, "components") == 0)) {
+                context->rootKey = ROOT_KEY_COMPONENTS;
+            }
+        } else {
+            streamRootValue(context, event, value);
+        }
+        break;
+
+    case DEPTH_COMPONENTS:
+        if (event == JSON_STREAM_KEY) {
+            int i;
+            context->pendingComponent = NULL;
+            for (i = 0; i < nrofComponentDefinitions; i++) {
+                if (strcasecmp(value, componentDefinitions[i].name) == 0) {
+                    if ((context->componentsDone & (1 << i)) == 0) {
+                        context->componentsDone |= 1 << i;
+                        context->pendingComponent = &componentDefinitions[i];
+                    }
+                    break;
+                }
+            }
+        } else {
+            streamComponentsValue(context, event);
+        }
+        break;
+
+    case DEPTH_ARRAY:
+        streamArrayValue(context, event);
+        break;
+
+    case DEPTH_INSTANCE:
+        if (event == JSON_STREAM_KEY) {
+            int i = deserializeFindField(context->componentDef, value);
+            if ((i != -1) && ((context->fieldsSeen & (1 << i)) != 0)) {
+                i = -1;
+            }
+            context->fieldIndex = i;
+        } else {
+            streamInstanceValue(context, event, value);
+        }
+        break;
+    }
+    if ((value != NULL) && (value == context->longValue)) {
+        free(context->longValue);
+        context->longValue = NULL;
+        context->longLen = 0;
+    }
+    return 0;
+}
+
+/*
+ * Add part of a string to longValue, returns -1 if out of memory.
+ */
+static int streamLongValue(struct streamContext *context, const char *value, size_t len)
+{
+    char *longValue = realloc(context->longValue, context->longLen + len + 1);
+
+    if (longValue == NULL) {
+        return -1;
+    }
+    memcpy(longValue + context->longLen, value, len + 1);
+    context->longValue = longValue;
+    context->longLen = context->longLen + len;
+    return 0;
+}
+
+static void streamRootValue(struct streamContext *context, JsonStreamEvent_e event, const char *value)
+{
+    switch (context->rootKey) {
+    case ROOT_KEY_VERSION:
+        context->versionSeen = true;
+        if (event == JSON_STREAM_STRING) {
+            ESP_LOGI(TAG, "Profile version %s", value);
+            context->versionOk = strcmp(value, SUPPORTED_VERSION) == 0;
+        }
+        streamSkip(context, event, DEPTH_ROOT);
+        break;
+
+    case ROOT_KEY_COMPONENTS:
+        context->componentsSeen = true;
+        if (event == JSON_STREAM_OBJECT_START) {
+            context->componentsOk = true;
+            context->depth ++;
+        } else {
+            streamSkip(context, event, DEPTH_ROOT);
+        }
+        break;
+
+    default:
+        streamSkip(context, event, DEPTH_ROOT);
+        break;
+    }
+    context->rootKey = ROOT_KEY_NONE;
+}
+
+static void streamComponentsValue(struct streamContext *context, JsonStreamEvent_e event)
+{
+    struct component *componentDef = context->pendingComponent;
+
+    context->pendingComponent = NULL;
+    if (componentDef == NULL) {
+        streamSkip(context, event, DEPTH_COMPONENTS);
+        return;
+    }
+    if (event != JSON_STREAM_ARRAY_START) {
+        ESP_LOGE(TAG, "Component %s incorrectly formatted", componentDef->name);
+        streamSkip(context, event, DEPTH_COMPONENTS);
+        return;
+    }
+    context->componentDef = componentDef;
+    context->structs = NULL;
+    context->count = 0;
+    context->allocated = 0;
+    context->depth ++;
+}
+
+static void streamArrayValue(struct streamContext *context, JsonStreamEvent_e event)
+{
+    struct component *componentDef = context->componentDef;
+
+    if (event != JSON_STREAM_OBJECT_START) {
+        streamComponentFailed(context);
+        streamSkip(context, event, DEPTH_COMPONENTS);
+        return;
+    }
+    if (context->count == context->allocated) {
+        size_t allocated = context->allocated ? context->allocated * 2 : 2;
+        void *structs = realloc(context->structs, allocated * componentDef->structSize);
+        if (structs == NULL) {
+            streamComponentFailed(context);
+            streamSkip(context, event, DEPTH_COMPONENTS);
+            return;
+        }
+        context->structs = structs;
+        context->allocated = allocated;
+    }
+    memset(context->structs + (context->count * componentDef->structSize), 0, componentDef->structSize);
+    context->count ++;
+    context->fieldsSeen = 0;
+    context->fieldIndex = -1;
+    context->depth ++;
+}
+
+static void streamInstanceValue(struct streamContext *context, JsonStreamEvent_e event, const char *value)
+{
+    struct component *componentDef = context->componentDef;
+    struct field *field;
+    void *structPtr;
+    cJSON item;
+
+    if (context->fieldIndex == -1) {
+        streamSkip(context, event, DEPTH_INSTANCE);
+        return;
+    }
+    field = &componentDef->fields[context->fieldIndex];
+    context->fieldsSeen |= 1 << context->fieldIndex;
+    context->fieldIndex = -1;
+
+    memset(&item, 0, sizeof(item));
+    switch (event) {
+    case JSON_STREAM_STRING:
+        item.type = cJSON_String;
+        item.valuestring = (char *)value;
+        break;
+    case JSON_STREAM_NUMBER:
+        item.type = cJSON_Number;
+        item.valuedouble = strtod(value, NULL);
+        item.valueint = (int)item.valuedouble;
+        break;
+    case JSON_STREAM_TRUE:
+        item.type = cJSON_True;
+        break;
+    case JSON_STREAM_FALSE:
+        item.type = cJSON_False;
+        break;
+    case JSON_STREAM_NULL:
+        item.type = cJSON_NULL;
+        break;
+    case JSON_STREAM_OBJECT_START:
+        item.type = cJSON_Object;
+        break;
+    default:
+        item.type = cJSON_Array;
+        break;
+    }
+
+    structPtr = context->structs + ((context->count - 1) * componentDef->structSize);
+    if (field->validateAndSet(&item, field, structPtr + field->dataOffset)) {
+        ESP_LOGI(TAG, "Component %s->%s failed validation", componentDef->name, field->key);
+        streamComponentFailed(context);
+        streamSkip(context, event, DEPTH_COMPONENTS);
+    }
+}
+
+/*
+ * Ignore the value just started by event, and everything else until the parser returns to untilDepth.
+ */
+static void streamSkip(struct streamContext *context, JsonStreamEvent_e event, int untilDepth)
+{
+    if ((event == JSON_STREAM_OBJECT_START) || (event == JSON_STREAM_ARRAY_START)) {
+        context->depth ++;
+    }
+    if (context->depth != untilDepth) {
+        context->skipDepth = untilDepth;
+    }
+}
+
+static void streamComponentFailed(struct streamContext *context)
+{
+    ESP_LOGI(TAG, "Processing of %s failed", context->componentDef->name);
+    deserializeFreeComponents(context->componentDef, context->structs, context->count);
+    context->structs = NULL;
+    context->count = 0;
+    context->allocated = 0;
+    /* Skip the rest of this component's array */
+    if (context->depth > DEPTH_COMPONENTS) {
+        context->skipDepth = DEPTH_COMPONENTS;
+    }
+}
+
+static void streamComponentFinished(struct streamContext *context)
+{
+    struct component *componentDef = context->componentDef;
+
+    if (componentDef == NULL) {
+        return;
+    }
+    if (context->structs != NULL) {
+        *((void **)(((void *)context->config) + componentDef->arrayOffset)) = context->structs;
+        *((size_t *)(((void *)context->config) + componentDef->arrayCountOffset)) = context->count;
+    }
+    context->componentDef = NULL;
+    context->structs = NULL;
+    context->count = 0;
+    context->allocated = 0;
+}
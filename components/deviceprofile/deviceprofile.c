@@ -9,14 +9,21 @@
 #include "utils.h"
 
 #include "deviceprofile.h"
+#include "deserializeInternal.h"
 
 #define SUPPORTED_VERSION 1
 
 static const char TAG[] = "devprofile";
 static const char THING[] = "thing";
 static const char PROFILE[] = "deviceprofile";
+static const char BINARY_PROFILE[] = "profilebin";
 static char *deviceProfile = NULL;
 
+static int deviceProfileLoadBinary(DeviceProfile_DeviceConfig_t *config);
+static struct component *deviceProfileFindComponent(const char *name);
+static bool deviceProfileInstancesEqual(struct component *componentDef, const DeviceProfile_DeviceConfig_t *a,
+                                        const DeviceProfile_DeviceConfig_t *b);
+
 int deviceProfileGetProfile(const char **profile)
 {
     nvs_handle handle;
@@ -56,7 +63,210 @@ int deviceProfileSetProfile(const char *profile)
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to set profile str, err %d", err);
         ret = -1;
+    } else if (deviceProfile != NULL) {
+        /* Reloaded from NVS on next use */
+        free(deviceProfile);
+        deviceProfile = NULL;
+    }
+    nvs_close(handle);
+    return ret;
+}
+
+int deviceProfileSetBinaryProfile(const uint8_t *profile, size_t len)
+{
+    nvs_handle handle;
+    esp_err_t err;
+    int ret = 0;
+    err = nvs_open(THING, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open thing section, err %d", err);
+        return -1;
+    }
+    if (len == 0) {
+        err = nvs_erase_key(handle, BINARY_PROFILE);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    } else {
+        err = nvs_set_blob(handle, BINARY_PROFILE, profile, len);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set binary profile, err %d", err);
+        ret = -1;
+    }
+    nvs_close(handle);
+    return ret;
+}
+
+int deviceProfileLoad(DeviceProfile_DeviceConfig_t *config)
+{
+    const char *profile;
+
+    if (deviceProfileLoadBinary(config) == 0) {
+        return 0;
+    }
+    if (deviceProfileGetProfile(&profile)) {
+        return -1;
+    }
+    return deviceProfileDeserialize(profile, config);
+}
+
+static int deviceProfileLoadBinary(DeviceProfile_DeviceConfig_t *config)
+{
+    nvs_handle handle;
+    esp_err_t err;
+    uint8_t *profile;
+    size_t len = 0;
+    int ret;
+
+    err = nvs_open(THING, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return -1;
+    }
+    err = nvs_get_blob(handle, BINARY_PROFILE, NULL, &len);
+    if ((err != ESP_OK) || (len == 0)) {
+        nvs_close(handle);
+        return -1;
+    }
+    profile = malloc(len);
+    if (profile == NULL) {
+        nvs_close(handle);
+        return -1;
     }
+    err = nvs_get_blob(handle, BINARY_PROFILE, profile, &len);
     nvs_close(handle);
+    if (err != ESP_OK) {
+        free(profile);
+        return -1;
+    }
+    ret = deviceProfileDecode(profile, len, config);
+    free(profile);
+    if (ret == 0) {
+        ESP_LOGI(TAG, "Using binary profile (%u bytes)", len);
+    } else {
+        ESP_LOGW(TAG, "Binary profile not usable, falling back to JSON profile");
+    }
     return ret;
 }
+
+const char *deviceProfileFindChange(const DeviceProfile_DeviceConfig_t *a, const DeviceProfile_DeviceConfig_t *b,
+                                    const char * const *ignore)
+{
+    int i, j;
+    for (i = 0; i < nrofComponentDefinitions; i++) {
+        bool ignored = false;
+        for (j = 0; (ignore != NULL) && (ignore[j] != NULL); j++) {
+            if (strcmp(ignore[j], componentDefinitions[i].name) == 0) {
+                ignored = true;
+                break;
+            }
+        }
+        if (!ignored && !deviceProfileInstancesEqual(&componentDefinitions[i], a, b)) {
+            return componentDefinitions[i].name;
+        }
+    }
+    return NULL;
+}
+
+bool deviceProfileComponentEqual(const DeviceProfile_DeviceConfig_t *a, const DeviceProfile_DeviceConfig_t *b,
+                                 const char *component)
+{
+    struct component *componentDef = deviceProfileFindComponent(component);
+    if (componentDef == NULL) {
+        /* Not supported by this build so never present */
+        return true;
+    }
+    return deviceProfileInstancesEqual(componentDef, a, b);
+}
+
+void deviceProfileMoveComponent(DeviceProfile_DeviceConfig_t *to, DeviceProfile_DeviceConfig_t *from,
+                                const char *component)
+{
+    struct component *componentDef = deviceProfileFindComponent(component);
+    void **toStructs, **fromStructs;
+    size_t *toCount, *fromCount;
+
+    if (componentDef == NULL) {
+        return;
+    }
+    toStructs = ((void *)to) + componentDef->arrayOffset;
+    toCount = ((void *)to) + componentDef->arrayCountOffset;
+    fromStructs = ((void *)from) + componentDef->arrayOffset;
+    fromCount = ((void *)from) + componentDef->arrayCountOffset;
+    if (*toStructs != NULL) {
+        deserializeFreeComponents(componentDef, *toStructs, *toCount);
+    }
+    *toStructs = *fromStructs;
+    *toCount = *fromCount;
+    *fromStructs = NULL;
+    *fromCount = 0;
+}
+
+static struct component *deviceProfileFindComponent(const char *name)
+{
+    int i;
+    for (i = 0; i < nrofComponentDefinitions; i++) {
+        if (strcmp(componentDefinitions[i].name, name) == 0) {
+            return &componentDefinitions[i];
+        }
+    }
+    return NULL;
+}
+
+static bool deviceProfileInstancesEqual(struct component *componentDef, const DeviceProfile_DeviceConfig_t *a,
+                                        const DeviceProfile_DeviceConfig_t *b)
+{
+    void *structsA = *(void **)(((void *)a) + componentDef->arrayOffset);
+    void *structsB = *(void **)(((void *)b) + componentDef->arrayOffset);
+    size_t count = *(size_t *)(((void *)a) + componentDef->arrayCountOffset);
+    size_t i;
+    int j;
+
+    if (count != *(size_t *)(((void *)b) + componentDef->arrayCountOffset)) {
+        return false;
+    }
+    for (i = 0; i < count; i++) {
+        void *instanceA = structsA + (i * componentDef->structSize);
+        void *instanceB = structsB + (i * componentDef->structSize);
+        for (j = 0; j < componentDef->fieldsCount; j++) {
+            struct field *field = &componentDef->fields[j];
+            void *valueA = instanceA + field->dataOffset;
+            void *valueB = instanceB + field->dataOffset;
+            size_t size;
+
+            switch (field->type) {
+            case FIELD_TYPE_STRING:
+            case FIELD_TYPE_ID: {
+                const char *strA = *(char **)valueA;
+                const char *strB = *(char **)valueB;
+                if ((strA == NULL) || (strB == NULL)) {
+                    if (strA != strB) {
+                        return false;
+                    }
+                } else if (strcmp(strA, strB) != 0) {
+                    return false;
+                }
+                continue;
+            }
+            case FIELD_TYPE_GPIOPIN:
+            case FIELD_TYPE_GPIOLEVEL:
+            case FIELD_TYPE_I2CADDR:
+                size = sizeof(uint8_t);
+                break;
+            case FIELD_TYPE_BOOL:
+                size = sizeof(bool);
+                break;
+            case FIELD_TYPE_CHOICE:
+                size = sizeof(int);
+                break;
+            default:
+                size = sizeof(uint32_t);
+                break;
+            }
+            if (memcmp(valueA, valueB, size) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -28,12 +28,19 @@ typedef struct DeviceProfile_SwitchConfig {
 typedef struct DeviceProfile_RelayConfig {
     uint8_t pin;
     uint8_t level;
+    bool restore;
     char *name;
     char *id;
 } DeviceProfile_RelayConfig_t;
 
 typedef struct DeviceProfile_Dht22Config {
     uint8_t pin;
+    uint32_t oversample;
+    uint32_t median;
+    uint32_t smoothing;
+    uint32_t minInterval;
+    uint32_t maxInterval;
+    uint32_t changeThreshold;
     char *name;
     char *id;
 } DeviceProfile_Dht22Config_t;
@@ -42,6 +49,12 @@ typedef struct DeviceProfile_Si7021Config {
     uint8_t sda;
     uint8_t scl;
     uint8_t addr;
+    uint32_t oversample;
+    uint32_t median;
+    uint32_t smoothing;
+    uint32_t minInterval;
+    uint32_t maxInterval;
+    uint32_t changeThreshold;
     char *name;
     char *id;
 } DeviceProfile_Si7021Config_t;
@@ -50,6 +63,12 @@ typedef struct DeviceProfile_Tsl2561Config {
     uint8_t sda;
     uint8_t scl;
     uint8_t addr;
+    uint32_t oversample;
+    uint32_t median;
+    uint32_t smoothing;
+    uint32_t minInterval;
+    uint32_t maxInterval;
+    uint32_t changeThreshold;
     char *name;
     char *id;
 } DeviceProfile_Tsl2561Config_t;
@@ -58,6 +77,12 @@ typedef struct DeviceProfile_Bme280Config {
     uint8_t sda;
     uint8_t scl;
     uint8_t addr;
+    uint32_t oversample;
+    uint32_t median;
+    uint32_t smoothing;
+    uint32_t minInterval;
+    uint32_t maxInterval;
+    uint32_t changeThreshold;
     char *name;
     char *id;
 } DeviceProfile_Bme280Config_t;
@@ -65,6 +90,13 @@ typedef struct DeviceProfile_Bme280Config {
 typedef struct DeviceProfile_Ds18x20Config {
     uint8_t pin;
     float temperatureCorrection;
+    uint32_t resolution;
+    uint32_t oversample;
+    uint32_t median;
+    uint32_t smoothing;
+    uint32_t minInterval;
+    uint32_t maxInterval;
+    uint32_t changeThreshold;
     char *name;
     char *id;
 } DeviceProfile_Ds18x20Config_t;
@@ -125,6 +157,23 @@ typedef struct DeviceProfile_RelayTimeoutConfig {
     char *id;
 } DeviceProfile_RelayTimeoutConfig_t;
 
+typedef struct DeviceProfile_DeepSleepConfig {
+    uint32_t interval;
+    uint32_t maxAwake;
+    char *name;
+    char *id;
+} DeviceProfile_DeepSleepConfig_t;
+
+typedef struct DeviceProfile_RuleConfig {
+    char *when;
+    char *then;
+    char *otherwise;
+    char *refs;
+    char *code;
+    char *name;
+    char *id;
+} DeviceProfile_RuleConfig_t;
+
 typedef struct DeviceProfile_DeviceConfig {
     DeviceProfile_SwitchConfig_t *switchConfig;
     uint32_t switchCount;
@@ -156,5 +205,9 @@ typedef struct DeviceProfile_DeviceConfig {
     uint32_t relayLockoutCount;
     DeviceProfile_RelayTimeoutConfig_t *relayTimeoutConfig;
     uint32_t relayTimeoutCount;
+    DeviceProfile_DeepSleepConfig_t *deepSleepConfig;
+    uint32_t deepSleepCount;
+    DeviceProfile_RuleConfig_t *ruleConfig;
+    uint32_t ruleCount;
 } DeviceProfile_DeviceConfig_t;
 #endif
@@ -3,10 +3,58 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "component_config.h"
 
 int deviceProfileGetProfile(const char **profile);
 int deviceProfileSetProfile(const char *profile);
 int deviceProfileDeserialize(const char *profile, DeviceProfile_DeviceConfig_t *config);
 
+/**
+ * Store the precompiled binary form of the profile, a len of 0 removes any stored binary profile.
+ * Returns 0 on success, -1 on error.
+ */
+int deviceProfileSetBinaryProfile(const uint8_t *profile, size_t len);
+
+/**
+ * Returns true if profile starts with the binary profile header.
+ */
+bool deviceProfileIsBinary(const uint8_t *profile, size_t len);
+
+/**
+ * Decode a binary profile (as produced by tools/updateprofile.py) into config.
+ * Returns 0 on success, -1 if the profile is invalid or was built for different component definitions.
+ */
+int deviceProfileDecode(const uint8_t *profile, size_t len, DeviceProfile_DeviceConfig_t *config);
+
+/**
+ * Load the device profile into config, using the binary profile if one is stored and matches this firmware,
+ * otherwise the JSON profile.
+ * Returns 0 on success, -1 on error.
+ */
+int deviceProfileLoad(DeviceProfile_DeviceConfig_t *config);
+
+/**
+ * Free all the component instances in config.
+ */
+void deviceProfileFree(DeviceProfile_DeviceConfig_t *config);
+
+/**
+ * Compare two configs, ignoring the components named in ignore (NULL terminated, may be NULL).
+ * Returns the name of the first component whose instances differ or NULL if they are the same.
+ */
+const char *deviceProfileFindChange(const DeviceProfile_DeviceConfig_t *a, const DeviceProfile_DeviceConfig_t *b,
+                                    const char * const *ignore);
+
+/**
+ * Returns true if the instances of the named component are the same in both configs.
+ */
+bool deviceProfileComponentEqual(const DeviceProfile_DeviceConfig_t *a, const DeviceProfile_DeviceConfig_t *b,
+                                 const char *component);
+
+/**
+ * Replace the instances of the named component in to with those from from, leaving from without any.
+ */
+void deviceProfileMoveComponent(DeviceProfile_DeviceConfig_t *to, DeviceProfile_DeviceConfig_t *from,
+                                const char *component);
 #endif
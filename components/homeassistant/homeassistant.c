@@ -28,6 +28,7 @@ struct DeviceDetails {
 };
 
 static void onMqttStatusUpdated(void *user,  NotificationsMessage_t *message);
+static void onSystemStateUpdated(void *user,  NotificationsMessage_t *message);
 static void sendDiscoveryMessages();
 static char* deviceGetDescription(void);
 static void getDeviceDetails(struct DeviceDetails *details);
@@ -42,6 +43,7 @@ static void sendDiscoveryMessage(struct DeviceDetails *deviceDetails, const char
 void homeAssistantDiscoveryInit(void)
 {
     notificationsRegister(Notifications_Class_Network, NOTIFICATIONS_ID_MQTT, onMqttStatusUpdated, NULL);
+    notificationsRegister(Notifications_Class_System, NOTIFICATIONS_ID_ALL, onSystemStateUpdated, NULL);
 }
 
 void homeAssistantDiscoveryAnnounce(const char* type, iotElement_t element, const char *pubName, cJSON *details, bool addBasePath)
@@ -61,6 +63,14 @@ static void onMqttStatusUpdated(void *user,  NotificationsMessage_t *message)
     }
 }
 
+static void onSystemStateUpdated(void *user,  NotificationsMessage_t *message)
+{
+    /* Elements may have been added by a profile change */
+    if ((message->data.systemState == Notifications_SystemState_ProfileApplied) && iotMqttIsConnected()) {
+        sendDiscoveryMessages();
+    }
+}
+
 static void sendDiscoveryMessages()
 {
     iotElementIterator_t iterator = IOT_ELEMENT_ITERATOR_START;
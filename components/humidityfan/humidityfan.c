@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "esp_log.h"
+#include "sdkconfig.h"
 #include "humidityfan.h"
 
 
@@ -14,17 +15,22 @@
 
 #define AUTO_CMD "auto"
 
+/* Ask for fast sensor updates when humidity is within this many % of the threshold */
+#define FAST_SAMPLING_BAND 5
+
 static void humidityFanUpdateHumidity(HumidityFan_t *fan, NotificationsMessage_t *message);
 static void humidityFanElementCallback(void *userData, iotElement_t element, iotElementCallbackReason_t reason,
                                        iotElementCallbackDetails_t *details);
 static void humidityFanCtrl(HumidityFan_t *fan, iotValue_t value);
 static void humidityFanRunOnTimeout(TimerHandle_t xTimer);
 static void humidityFanOverThresholdTimeout(TimerHandle_t xTimer);
-static void humidityFanManualModeSecsTimeout(TimerHandle_t xTimer);
+static void humidityFanManualModeCountdown(void *user, uint32_t secondsLeft);
 static void humidityFanManualModeDisable(HumidityFan_t *fan);
+static void humidityFanUpdateSampling(HumidityFan_t *fan);
 
 static const char TAG[] = "HFAN";
 static int fanCount=0;
+static HumidityFanSamplingRequest_t samplingRequest = NULL;
 
 #define PUB_ID_STATE       0
 #define PUB_ID_HUMIDITY    1
@@ -61,6 +67,8 @@ void humidityFanInit(HumidityFan_t *fan, Relay_t *relay, Notifications_ID_t humi
     fan->manualMode = false;
     fan->manualModeSecsLeft = 0u;
     fan->relay = relay;
+    fan->sensor = humiditySensor;
+    fan->fastSampling = false;
 
     fan->element = iotNewElement(&elementDescription, 0, humidityFanElementCallback, fan, "fan%d", fanCount);
     fanCount ++;
@@ -74,10 +82,15 @@ void humidityFanInit(HumidityFan_t *fan, Relay_t *relay, Notifications_ID_t humi
 
     fan->runOnTimer = xTimerCreate("fRO", SECS_TO_TICKS(fan->runOnSeconds), pdFALSE, fan, humidityFanRunOnTimeout);
     fan->overThresholdTimer = xTimerCreate("fOT", SECS_TO_TICKS(fan->overThresholdSeconds), pdFALSE, fan, humidityFanOverThresholdTimeout);
-    fan->manualModeTimer = xTimerCreate("fMM", SECS_TO_TICKS(1), pdTRUE, fan, humidityFanManualModeSecsTimeout);
+    timerWheelEntryInit(&fan->manualModeTimer, humidityFanManualModeCountdown, fan);
     notificationsRegister(Notifications_Class_Humidity, humiditySensor, (NotificationsCallback_t)humidityFanUpdateHumidity, fan);
 }
 
+void humidityFanSetSamplingRequest(HumidityFanSamplingRequest_t request)
+{
+    samplingRequest = request;
+}
+
 static void humidityFanSetState(HumidityFan_t *fan, bool state)
 {
     iotValue_t value;
@@ -128,6 +141,21 @@ static void humidityFanUpdateHumidity(HumidityFan_t *fan, NotificationsMessage_t
     }
     value.i = humidityTenths;
     iotElementPublish(fan->element, PUB_ID_HUMIDITY, value);
+    humidityFanUpdateSampling(fan);
+}
+
+static void humidityFanUpdateSampling(HumidityFan_t *fan)
+{
+    int delta = (fan->lastHumidity / 100) - fan->threshold;
+    bool fast = relayIsOn(fan->relay) || (xTimerIsTimerActive(fan->overThresholdTimer) == pdTRUE) ||
+                ((delta <= FAST_SAMPLING_BAND) && (delta >= -FAST_SAMPLING_BAND));
+
+    if ((samplingRequest == NULL) || (fast == fan->fastSampling)) {
+        return;
+    }
+    ESP_LOGI(TAG, "%d: %s fast sensor updates", fan->id, fast ? "Requesting" : "Releasing");
+    fan->fastSampling = fast;
+    samplingRequest(fan->sensor, fast);
 }
 
 static void humidityFanElementCallback(void *userData, iotElement_t element, iotElementCallbackReason_t reason,
@@ -161,7 +189,7 @@ static void humidityFanCtrl(HumidityFan_t *fan, iotValue_t value)
         uint32_t secs;
         if (sscanf(value.s + MANUAL_CMD_LEN, "%u", &secs) == 1) {
             iotValue_t value;
-            xTimerReset(fan->manualModeTimer, 0);
+            timerWheelStart(&fan->manualModeTimer, secs, CONFIG_TIMER_WHEEL_PROGRESS_SECS);
             fan->manualMode = true;
             fan->manualModeSecsLeft = secs;
             value.b = true;
@@ -191,11 +219,11 @@ static void humidityFanOverThresholdTimeout(TimerHandle_t xTimer)
     humidityFanSetState(fan, true);
 }
 
-static void humidityFanManualModeSecsTimeout(TimerHandle_t xTimer)
+static void humidityFanManualModeCountdown(void *user, uint32_t secondsLeft)
 {
     iotValue_t value;
-    HumidityFan_t *fan = pvTimerGetTimerID(xTimer);
-    fan->manualModeSecsLeft --;
+    HumidityFan_t *fan = user;
+    fan->manualModeSecsLeft = secondsLeft;
     value.i = fan->manualModeSecsLeft;
     iotElementPublish(fan->element, PUB_ID_MANUAL_SECS, value);
 
@@ -210,7 +238,7 @@ static void humidityFanManualModeDisable(HumidityFan_t *fan)
     iotValue_t value;
     NotificationsMessage_t message;
     fan->manualMode = false;
-    xTimerStop(fan->manualModeTimer, 0);
+    timerWheelStop(&fan->manualModeTimer);
     message.data.humidity = fan->lastHumidity;
     humidityFanUpdateHumidity(fan, &message);
     value.b = false;
@@ -6,6 +6,9 @@
 #include "iot.h"
 #include "relay.h"
 #include "notifications.h"
+#include "timerWheel.h"
+
+typedef void (*HumidityFanSamplingRequest_t)(Notifications_ID_t sensor, bool fast);
 
 typedef struct HumidityFan {
     int id;
@@ -17,13 +20,20 @@ typedef struct HumidityFan {
     int threshold;
     uint32_t runOnSeconds;
     uint32_t overThresholdSeconds;
-    uint32_t manualModeSecsLeft;
+    uint32_t manualModeSecsLeft; // As last published
     bool manualMode;
+    Notifications_ID_t sensor;
+    bool fastSampling;
     TimerHandle_t runOnTimer;
     TimerHandle_t overThresholdTimer;
-    TimerHandle_t manualModeTimer;
+    TimerWheelEntry_t manualModeTimer;
 } HumidityFan_t;
 
 void humidityFanInit(HumidityFan_t *fan, Relay_t *relay, Notifications_ID_t humiditySensor, int threshold);
 
+/**
+ * Set the function used to ask for fast humidity updates while the fan is running or close to the threshold.
+ */
+void humidityFanSetSamplingRequest(HumidityFanSamplingRequest_t request);
+
 #endif
\ No newline at end of file
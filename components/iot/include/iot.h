@@ -40,6 +40,8 @@ typedef void *iotElementIterator_t;
 
 typedef void (*iotElementCallback_t)(void *userData, iotElement_t element, iotElementCallbackReason_t reason, iotElementCallbackDetails_t *details);
 
+typedef void (*iotPubListener_t)(iotElement_t element, int pubId, iotValue_t value);
+
 typedef struct iotElementPubSubDescription {
     int type: 31;
     int retained: 1;
@@ -111,6 +113,8 @@ typedef struct iotElementDescription {
 
 #define IOT_ELEMENT_FLAGS_DONT_ANNOUNCE 1
 
+#define IOT_VALUE_STR_LEN 30 /* Buffer length needed by iotValueToString for non string values */
+
 #define IOT_ELEMENT_ITERATOR_START (NULL)
 
 const char *IOT_DEFAULT_CONTROL_STR;
@@ -130,10 +134,55 @@ int iotInit(void);
 iotElement_t iotNewElement(const iotElementDescription_t *desc, uint32_t flags, iotElementCallback_t callback,
                            void *userContext, const char *nameFormat, ...);
 
+/** Remove an element, clearing its retained values from the MQTT server if connected.
+ * The element must not be used after this call.
+ */
+void iotDeleteElement(iotElement_t element);
+
+/** Resend the current value of every pub of every element, as is done when connecting.
+ * Used after elements have been added or removed while connected.
+ */
+void iotResendAll(void);
+
 /** Publish a value to the specified element and pubId.
  */
 void iotElementPublish(iotElement_t element, int pubId, iotValue_t value);
 
+/** Set a function to be called whenever iotElementPublish changes a value, whether or not MQTT is connected.
+ * The listener is called from the task publishing the value so must not block, string values are only valid for
+ * the duration of the call.
+ */
+void iotSetPubListener(iotPubListener_t listener);
+
+/** Hold the element list, so elements can't be added or removed, while iterating over it or passing controls to
+ * elements from a task other than the MQTT task. Controls from the MQTT server are delivered with the list held.
+ * May be taken more than once by the same task.
+ */
+void iotElementsLock(void);
+
+void iotElementsUnlock(void);
+
+/** Get the last value passed to iotElementPublish for the element and pubId.
+ * Returns false if pubId is invalid.
+ */
+bool iotElementGetPubValue(iotElement_t element, int pubId, iotValueType_t *type, iotValue_t *value);
+
+/** Pass a control message to the element as if it had been received from the MQTT server.
+ * subName is the name of the sub, NULL for the default control sub. payload must be \0 terminated.
+ * Returns 0 if the message was delivered, -1 if there is no such sub or the payload was invalid.
+ */
+int iotElementSubDispatch(iotElement_t element, const char *subName, char *payload, size_t len);
+
+/** Find an element by name, returns NULL if not found.
+ */
+iotElement_t iotFindElement(const char *name);
+
+/** Format a value as it is published to the MQTT server.
+ * buffer should be at least IOT_VALUE_STR_LEN long, the returned string may be buffer or a constant/the string value.
+ * Returns NULL for value types that can't be converted (binary and on connect).
+ */
+const char *iotValueToString(iotValueType_t type, iotValue_t value, char *buffer, size_t bufferLen);
+
 /** Convert a string value to a boolean
  * Accepts "on"/"off", "true"/"false" (ignoring case) and returns 0;
  * Invalid values return 1
@@ -155,6 +204,16 @@ int iotMqttPublish(const char *topic, const char *data, int len, int qos, int re
  */
 bool iotMqttIsConnected(void);
 
+/** Ask the MQTT server to keep our session (subscriptions and queued controls) while we are disconnected.
+ * When the server reports the session is still present on reconnect the subscribe step is skipped.
+ * Must be called before the network is connected.
+ */
+void iotMqttEnablePersistentSession(void);
+
+/** Disconnect from the MQTT server, for example before entering deep sleep.
+ */
+void iotMqttStop(void);
+
 /**
  * Allows iterating over the list of registered iotElements, optionally selecting only those that should be announced
  * (ie not system element).
@@ -175,6 +234,11 @@ const iotElementDescription_t *iotElementGetDescription(iotElement_t element);
  */
 char *iotElementGetName(iotElement_t element);
 
+/**
+ * Get the flags the element was created with.
+ */
+uint32_t iotElementGetFlags(iotElement_t element);
+
 /**
  * Get Element base topic path.
  * buffer should be a pointer to a string buffer of length specified in bufferLne or NULL.
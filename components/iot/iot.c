@@ -31,10 +31,20 @@ iotElement_t iotElementsHead = NULL;
 static char mqttPathPrefix[MQTT_PATH_PREFIX_LEN];
 static char mqttCommonCtrlSub[MQTT_COMMON_CTRL_SUB_LEN];
 static iotValueUpdatePolicy_e valueUpdatePolicy = IOT_VALUE_UPDATE_POLICY_ON_CHANGE;
+static iotPubListener_t pubListener = NULL;
+/*
+ * Held while the element list is changed or walked, recursive as controls are delivered with it held and may add or
+ * remove elements (ie a profile change).
+ */
+static SemaphoreHandle_t elementsMutex = NULL;
 
 static bool iotElementPubSendUpdate(iotElement_t element, int pubId, iotValue_t value);
 static bool iotElementSendUpdate(iotElement_t element);
 static bool iotElementSubscribe(iotElement_t element);
+static void iotElementUnsubscribe(iotElement_t element);
+static void iotElementClearRetained(iotElement_t element);
+static int iotElementFindSub(iotElement_t element, const char *name);
+static int iotElementSubUpdate(iotElement_t element, int subId, char *payload, size_t len);
 static void iotWifiConnectionStatus(void *user,  NotificationsMessage_t *message);
 static char *checkedPathBuffer(const char *elementName, const char *subTopic, char *buffer, size_t *bufferLen);
 
@@ -48,6 +58,12 @@ int iotInit(void)
 
     ESP_LOGI(TAG, "device path: %s", mqttPathPrefix);
 
+    elementsMutex = xSemaphoreCreateRecursiveMutex();
+    if (elementsMutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create elements mutex");
+        return -1;
+    }
+
     notificationsRegister(Notifications_Class_Network, NOTIFICATIONS_ID_WIFI_STATION, iotWifiConnectionStatus, NULL);
     return mqttInit();
 }
@@ -57,6 +73,21 @@ void iotSetValueUpdatePolicy(iotValueUpdatePolicy_e policy)
     valueUpdatePolicy = policy;
 }
 
+void iotSetPubListener(iotPubListener_t listener)
+{
+    pubListener = listener;
+}
+
+void iotElementsLock(void)
+{
+    xSemaphoreTakeRecursive(elementsMutex, portMAX_DELAY);
+}
+
+void iotElementsUnlock(void)
+{
+    xSemaphoreGiveRecursive(elementsMutex);
+}
+
 iotElement_t iotNewElement(const iotElementDescription_t *desc, uint32_t flags, iotElementCallback_t callback,
                            void *userContext, const char *nameFormat, ...)
 {
@@ -81,10 +112,51 @@ iotElement_t iotNewElement(const iotElementDescription_t *desc, uint32_t flags,
     newElement->userContext = userContext;
     newElement->next = iotElementsHead;
     newElement->humanDescription = NULL;
+    iotElementsLock();
     iotElementsHead = newElement;
+    if (mqttIsConnected) {
+        /* Created after connecting (ie a profile change), so the subscribe on connect has been missed */
+        iotElementSubscribe(newElement);
+    }
+    iotElementsUnlock();
     return newElement;
 }
 
+void iotDeleteElement(iotElement_t element)
+{
+    iotElement_t *current;
+
+    if (element == NULL) {
+        return;
+    }
+    iotElementsLock();
+    for (current = &iotElementsHead; *current != NULL; current = &(*current)->next) {
+        if (*current == element) {
+            *current = element->next;
+            break;
+        }
+    }
+    if (mqttIsConnected) {
+        iotElementUnsubscribe(element);
+        iotElementClearRetained(element);
+    }
+    iotElementsUnlock();
+    free(element->name);
+    free(element);
+}
+
+void iotResendAll(void)
+{
+    if (!mqttIsConnected) {
+        return;
+    }
+    iotElementsLock();
+    for (iotElement_t element = iotElementsHead; (element != NULL); element = element->next) {
+        iotElementSendUpdate(element);
+    }
+    iotElementsUnlock();
+}
+
 void iotElementPublish(iotElement_t element, int pubId, iotValue_t value)
 {
     bool updateRequired = false;
@@ -127,6 +199,9 @@ void iotElementPublish(iotElement_t element, int pubId, iotValue_t value)
         if (mqttIsConnected) {
             iotElementPubSendUpdate(element, pubId, value);
         }
+        if (pubListener != NULL) {
+            pubListener(element, pubId, value);
+        }
     }
 }
 
@@ -167,53 +242,19 @@ static bool iotElementPubSendUpdate(iotElement_t element, int pubId, iotValue_t
         value = details.value;
     }
 
-    switch(valueType) {
-    case IOT_VALUE_TYPE_BOOL:
-        message = (value.b) ? "on":"off";
-        break;
-
-    case IOT_VALUE_TYPE_LUX:
-    case IOT_VALUE_TYPE_INT:
-        sprintf(payload, "%d", value.i);
-        break;
-
-    case IOT_VALUE_TYPE_FLOAT:
-        sprintf(payload, "%f", value.f);
-        break;
-
-    case IOT_VALUE_TYPE_HUNDREDTHS:
-    case IOT_VALUE_TYPE_PERCENT_RH:
-    case IOT_VALUE_TYPE_CELSIUS:
-    case IOT_VALUE_TYPE_KPA: {
-        char *str = payload;
-        int hundredths = value.i;
-        if (hundredths < 0) {
-            hundredths *= -1;
-            str[0] = '-';
-            str++;
-        }
-        sprintf(str, "%d.%02d", hundredths / 100, hundredths % 100);
-    }
-    break;
-
-    case IOT_VALUE_TYPE_STRING:
-        message = (char*)value.s;
-        if (message == NULL) {
-            message = "";
-        }
-        break;
-
-    case IOT_VALUE_TYPE_BINARY:
+    if (valueType == IOT_VALUE_TYPE_BINARY) {
         if (value.bin == NULL) {
+            free(path);
             return false;
         }
         message = (char*)value.bin->data;
         messageLen = (int)value.bin->len;
-        break;
-
-    default:
-        free(path);
-        return false;
+    } else {
+        message = (char*)iotValueToString(valueType, value, payload, sizeof(payload));
+        if (message == NULL) {
+            free(path);
+            return false;
+        }
     }
     if (messageLen == -1) {
         messageLen = strlen((char*)message);
@@ -248,6 +289,77 @@ static bool iotElementSendUpdate(iotElement_t element)
     return result;
 }
 
+const char *iotValueToString(iotValueType_t type, iotValue_t value, char *buffer, size_t bufferLen)
+{
+    switch(type) {
+    case IOT_VALUE_TYPE_BOOL:
+        return (value.b) ? "on":"off";
+
+    case IOT_VALUE_TYPE_LUX:
+    case IOT_VALUE_TYPE_INT:
+        snprintf(buffer, bufferLen, "%d", value.i);
+        return buffer;
+
+    case IOT_VALUE_TYPE_FLOAT:
+        snprintf(buffer, bufferLen, "%f", value.f);
+        return buffer;
+
+    case IOT_VALUE_TYPE_HUNDREDTHS:
+    case IOT_VALUE_TYPE_PERCENT_RH:
+    case IOT_VALUE_TYPE_CELSIUS:
+    case IOT_VALUE_TYPE_KPA: {
+        int hundredths = value.i;
+        const char *sign = "";
+        if (hundredths < 0) {
+            hundredths *= -1;
+            sign = "-";
+        }
+        snprintf(buffer, bufferLen, "%s%d.%02d", sign, hundredths / 100, hundredths % 100);
+        return buffer;
+    }
+
+    case IOT_VALUE_TYPE_STRING:
+        return (value.s == NULL) ? "" : value.s;
+
+    default:
+        return NULL;
+    }
+}
+
+bool iotElementGetPubValue(iotElement_t element, int pubId, iotValueType_t *type, iotValue_t *value)
+{
+    if ((pubId < 0) || (pubId >= element->desc->nrofPubs)) {
+        return false;
+    }
+    *type = element->desc->pubs[pubId].type;
+    *value = element->values[pubId];
+    return true;
+}
+
+int iotElementSubDispatch(iotElement_t element, const char *subName, char *payload, size_t len)
+{
+    int subId;
+
+    if ((subName == NULL) || (subName[0] == 0)) {
+        subName = IOT_DEFAULT_CONTROL_STR;
+    }
+    subId = iotElementFindSub(element, subName);
+    if (subId == -1) {
+        return -1;
+    }
+    return iotElementSubUpdate(element, subId, payload, len);
+}
+
+iotElement_t iotFindElement(const char *name)
+{
+    for (iotElement_t element = iotElementsHead; element != NULL; element = element->next) {
+        if (strcmp(element->name, name) == 0) {
+            return element;
+        }
+    }
+    return NULL;
+}
+
 int iotStrToBool(const char *str, bool *out)
 {
     if ((strcasecmp(str, "on") == 0) || (strcasecmp(str, "true") == 0)) {
@@ -347,7 +459,24 @@ int iotParseString(const char *str, const iotValueType_t type, iotValue_t *out)
     return 0;
 }
 
-static void iotElementSubUpdate(iotElement_t element, int subId, char *payload, size_t len)
+static int iotElementFindSub(iotElement_t element, const char *name)
+{
+    int i;
+    for (i = 0; i < element->desc->nrofSubs; i++) {
+        const char *subName;
+        if (element->desc->subs[i].name[0] == 0) {
+            subName = IOT_DEFAULT_CONTROL_STR;
+        } else {
+            subName = element->desc->subs[i].name;
+        }
+        if (strcmp(name, subName) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int iotElementSubUpdate(iotElement_t element, int subId, char *payload, size_t len)
 {
     iotValue_t value;
     iotBinaryValue_t binValue;
@@ -366,7 +495,7 @@ static void iotElementSubUpdate(iotElement_t element, int subId, char *payload,
     } else {
         if (iotParseString(payload, element->desc->subs[subId].type, &value)) {
             ESP_LOGE(TAG, "Failed to parse value type %d for %s/%s", element->desc->subs[subId].type, element->name, name);
-            return;
+            return -1;
         }
     }
 
@@ -374,6 +503,7 @@ static void iotElementSubUpdate(iotElement_t element, int subId, char *payload,
     details.index = subId;
     details.value = value;
     element->callback(element->userContext, element, IOT_CALLBACK_ON_SUB, &details);
+    return 0;
 }
 
 static bool iotElementSubscribe(iotElement_t element)
@@ -399,6 +529,41 @@ static bool iotElementSubscribe(iotElement_t element)
     return true;
 }
 
+static void iotElementUnsubscribe(iotElement_t element)
+{
+    int i;
+    for (i = 0; i < element->desc->nrofSubs; i++) {
+        if (element->desc->subs[i].name[0] != 0) {
+            char *path = NULL;
+            asprintf(&path, "%s/%s/%s", mqttPathPrefix, element->name, element->desc->subs[i].name);
+            if (path != NULL) {
+                mqttUnsubscribe(path);
+                free(path);
+            }
+        }
+    }
+}
+
+static void iotElementClearRetained(iotElement_t element)
+{
+    int i;
+    for (i = 0; i < element->desc->nrofPubs; i++) {
+        if (element->desc->pubs[i].retained) {
+            char *path = NULL;
+            if (element->desc->pubs[i].name[0] == 0) {
+                asprintf(&path, "%s/%s", mqttPathPrefix, element->name);
+            } else {
+                asprintf(&path, "%s/%s/%s", mqttPathPrefix, element->name, element->desc->pubs[i].name);
+            }
+            if (path != NULL) {
+                /* An empty retained message removes the retained value */
+                iotMqttPublish(path, "", 0, 0, 1);
+                free(path);
+            }
+        }
+    }
+}
+
 void iotMqttProcessMessage(char *topic, char *data, int dataLen)
 {
     bool found = false;
@@ -406,26 +571,19 @@ void iotMqttProcessMessage(char *topic, char *data, int dataLen)
 
     if ((strncmp(topic, mqttPathPrefix, len) == 0) && (topic[len] == '/')) {
         topic += len + 1;
+        iotElementsLock();
         for (iotElement_t element = iotElementsHead; element != NULL; element = element->next) {
             len = strlen(element->name);
             if ((strncmp(topic, element->name, len) == 0) && (topic[len] == '/')) {
                 topic += len + 1;
-                int i;
-                for (i = 0; i < element->desc->nrofSubs; i++) {
-                    const char *name;
-                    if (element->desc->subs[i].name[0] == 0) {
-                        name = IOT_DEFAULT_CONTROL_STR;
-                    } else {
-                        name = element->desc->subs[i].name;
-                    }
-                    if (strcmp(topic, name) == 0) {
-                        iotElementSubUpdate(element, i, data, dataLen);
-                        found = true;
-                        break;
-                    }
+                int i = iotElementFindSub(element, topic);
+                if (i != -1) {
+                    iotElementSubUpdate(element, i, data, dataLen);
+                    found = true;
                 }
             }
         }
+        iotElementsUnlock();
     }
 
     if (!found) {
@@ -433,15 +591,19 @@ void iotMqttProcessMessage(char *topic, char *data, int dataLen)
     }
 }
 
-void iotMqttConnected(void)
+void iotMqttConnected(bool sessionPresent)
 {
-    mqttSubscribe(mqttCommonCtrlSub);
+    if (!sessionPresent) {
+        mqttSubscribe(mqttCommonCtrlSub);
+    }
 
+    iotElementsLock();
     for (iotElement_t element = iotElementsHead; (element != NULL); element = element->next) {
-        if (iotElementSubscribe(element)) {
+        if (sessionPresent || iotElementSubscribe(element)) {
             iotElementSendUpdate(element);
         }
     }
+    iotElementsUnlock();
 }
 
 static void iotWifiConnectionStatus(void *user,  NotificationsMessage_t *message)
@@ -474,6 +636,11 @@ char *iotElementGetName(iotElement_t element)
     return element->name;
 }
 
+uint32_t iotElementGetFlags(iotElement_t element)
+{
+    return element->flags;
+}
+
 const iotElementDescription_t *iotElementGetDescription(iotElement_t element)
 {
     return element->desc;
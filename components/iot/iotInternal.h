@@ -23,7 +23,8 @@ bool mqttIsConnected;
 int mqttInit(void);
 void mqttNetworkConnected(bool connected);
 bool mqttSubscribe(char *topic);
+bool mqttUnsubscribe(char *topic);
 
 void iotMqttProcessMessage(char *topic, char *data, int dataLen);
-void iotMqttConnected(void);
+void iotMqttConnected(bool sessionPresent);
 #endif
\ No newline at end of file
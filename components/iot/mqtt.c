@@ -17,6 +17,7 @@
 #include "iot.h"
 #include "wifi.h"
 #include "notifications.h"
+#include "bootTimeline.h"
 #include "sdkconfig.h"
 #include "iotInternal.h"
 
@@ -40,6 +41,7 @@ static int mqttPort;
 static char mqttUsername[MAX_LENGTH_MQTT_USERNAME];
 static char mqttPassword[MAX_LENGTH_MQTT_PASSWORD];
 static SemaphoreHandle_t sendMutex;
+static esp_mqtt_client_config_t mqttConfig;
 
 static void mqttMessageArrived(char *mqttTopic, int mqttTopicLen, char *data, int dataLen);
 static esp_err_t mqttEventHandler(esp_mqtt_event_handle_t event);
@@ -80,19 +82,17 @@ int mqttInit(void)
         return 0;
     }
 
-    esp_mqtt_client_config_t mqtt_cfg = {
-        .transport = MQTT_TRANSPORT_OVER_TCP,
-        .host = mqttServer,
-        .port = mqttPort,
-        .event_handle = mqttEventHandler,
-        .task_stack = MQTT_TASK_STACK_SIZE,
-    };
+    mqttConfig.transport = MQTT_TRANSPORT_OVER_TCP;
+    mqttConfig.host = mqttServer;
+    mqttConfig.port = mqttPort;
+    mqttConfig.event_handle = mqttEventHandler;
+    mqttConfig.task_stack = MQTT_TASK_STACK_SIZE;
     if (mqttUsername[0] != 0) {
-        mqtt_cfg.username = mqttUsername;
-        mqtt_cfg.password = mqttPassword;
+        mqttConfig.username = mqttUsername;
+        mqttConfig.password = mqttPassword;
     }
 
-    mqttClient = esp_mqtt_client_init(&mqtt_cfg);
+    mqttClient = esp_mqtt_client_init(&mqttConfig);
     mqttIsSetup = true;
     return 0;
 }
@@ -102,6 +102,25 @@ bool iotMqttIsConnected(void)
     return mqttIsConnected;
 }
 
+void iotMqttEnablePersistentSession(void)
+{
+    if (!mqttIsSetup) {
+        return;
+    }
+    mqttConfig.disable_clean_session = true;
+    if (esp_mqtt_set_config(mqttClient, &mqttConfig) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to enable persistent session");
+    }
+}
+
+void iotMqttStop(void)
+{
+    if (mqttIsSetup) {
+        esp_mqtt_client_stop(mqttClient);
+        mqttIsConnected = false;
+    }
+}
+
 int iotMqttPublish(const char *topic, const char *data, int len, int qos, int retain)
 {
     int result;
@@ -123,6 +142,16 @@ bool mqttSubscribe(char *topic)
     return true;
 }
 
+bool mqttUnsubscribe(char *topic)
+{
+    if (esp_mqtt_client_unsubscribe(mqttClient, topic) == -1) {
+        ESP_LOGE(TAG, "UNSUB: Failed to unsubscribe from \"%s\"", topic);
+        return false;
+    }
+    ESP_LOGI(TAG, "UNSUB: MQTT unsubscribe from topic \"%s\"", topic);
+    return true;
+}
+
 static void mqttMessageArrived(char *mqttTopic, int mqttTopicLen, char *data, int dataLen)
 {
     char *topic, *topicStart;
@@ -158,9 +187,11 @@ static esp_err_t mqttEventHandler(esp_mqtt_event_handle_t event)
 
     switch (event->event_id) {
     case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "MQTT Connected");
-        iotMqttConnected();
+        ESP_LOGI(TAG, "MQTT Connected (session present %d)", event->session_present);
+        bootTimelineMark(BOOT_STAGE_MQTT_CONNECTED);
+        iotMqttConnected(event->session_present);
         mqttIsConnected = true;
+        bootTimelineMark(BOOT_STAGE_ONLINE);
         notification.connectionState = Notifications_ConnectionState_Connected;
         notificationsNotify(Notifications_Class_Network, NOTIFICATIONS_ID_MQTT, &notification);
         break;
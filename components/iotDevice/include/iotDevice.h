@@ -1,5 +1,15 @@
 #ifndef _IOTDEVICE_H_
 #define _IOTDEVICE_H_
+#include "cJSON.h"
+
+typedef void (*iotDeviceDiagCallback_t)(cJSON *diag);
+
+/**
+ * Called after a new profile has been stored, returns 0 if the profile was applied or -1 if a restart is required.
+ * Runs on its own task rather than the MQTT task.
+ */
+typedef int (*iotDeviceProfileHandler_t)(void);
+
 /**
  * Initialise the device element with the supplied version and capabilites.
  */
@@ -9,4 +19,14 @@ int iotDeviceInit(const char *version, const char *capabilities);
  * Update the device status string.
  */
 void iotDeviceUpdateStatus(char *status);
+
+/**
+ * Add a callback to be called to add extra information to the diag object each time it is updated.
+ */
+void iotDeviceAddDiagCallback(iotDeviceDiagCallback_t callback);
+
+/**
+ * Set the handler used to apply a new profile without restarting, without a handler setprofile always restarts.
+ */
+void iotDeviceSetProfileHandler(iotDeviceProfileHandler_t handler);
 #endif
\ No newline at end of file
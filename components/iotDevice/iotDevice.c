@@ -27,6 +27,9 @@
 #include "utils.h"
 #include "safestring.h"
 #include "updater.h"
+#include "bootTimeline.h"
+#include "logging.h"
+#include "journal.h"
 #include "iotDevice.h"
 
 static const char *TAG="IOT-DEV";
@@ -44,6 +47,16 @@ static const char *WIFI="wifi";
 static const char *TASK_STATS="tasks";
 static const char *TASK_NAME="name";
 static const char *TASK_STACK="stackMinLeft";
+static const char *BOOT_STAGES="stages";
+static const char *JOURNAL_BOOT="boot";
+static const char *JOURNAL_RESET="reset";
+static const char *JOURNAL_ENTRIES="entries";
+static const char *JOURNAL_MS="ms";
+static const char *JOURNAL_TEXT="text";
+#if CONFIG_BOOT_TIMELINE_BUDGET_MS > 0
+static const char *BOOT_BUDGET="budget";
+static const char *BOOT_OVER_BUDGET="overBudget";
+#endif
 
 #ifdef CONFIG_IDF_TARGET
 #define DEVICE_STR CONFIG_IDF_TARGET
@@ -59,19 +72,34 @@ static const char *TASK_STACK="stackMinLeft";
 #define MEM_AVAILABLE 0
 #endif
 
+#define PROFILE_THREAD_NAME "profile"
+#define PROFILE_THREAD_PRIO 5
+#ifdef CONFIG_IDF_TARGET_ESP8266
+#define PROFILE_THREAD_STACK_WORDS 2048
+#else
+#define PROFILE_THREAD_STACK_WORDS 3072
+#endif
+
 #define DEVICE_PUB_INDEX_INFO        0
 #define DEVICE_PUB_INDEX_PROFILE     1
 #define DEVICE_PUB_INDEX_TOPICS      2
 #define DEVICE_PUB_INDEX_DIAG        3
 #define DEVICE_PUB_INDEX_STATUS      4
+#define DEVICE_PUB_INDEX_BOOT        5
+#define DEVICE_PUB_INDEX_JOURNAL     6
 
 static iotElement_t deviceElement;
 
 #define DIAG_UPDATE_MS (1000 * 30) // 30 Seconds
+#define MAX_DIAG_CALLBACKS 4
 static char *diagValue = NULL;
 static time_t wifiScanTime = 0;
 static uint8_t wifiScanRecordsCount = 0;
 static wifi_ap_record_t *wifiScanRecords = NULL;
+static int nrofDiagCallbacks = 0;
+static iotDeviceDiagCallback_t diagCallbacks[MAX_DIAG_CALLBACKS];
+static iotDeviceProfileHandler_t profileHandler = NULL;
+static TaskHandle_t profileTask = NULL;
 
 static const char *version = NULL;
 static const char *capabilities = NULL;
@@ -81,12 +109,16 @@ static TaskStatus_t *getTaskStats(unsigned long *nrofTasks);
 #endif
 static void iotDeviceUpdateDiag(TimerHandle_t xTimer);
 static void iotDeviceControl(iotValue_t value);
+static void iotDeviceApplyProfile(void);
+static void iotDeviceProfileThread(void *pvParameters);
 static char* iotGetAnnouncedTopics(void);
 static void iotDeviceElementCallback(void *userData, iotElement_t element, iotElementCallbackReason_t reason, iotElementCallbackDetails_t *details);
 static void iotDeviceOnConnect(int pubId, bool release, iotValueType_t *valueType, iotValue_t *value);
 static char* iotDeviceGetDescription(void);
 static char *iotDeviceGetInfo(void);
 static void iotDeviceWifiScan();
+static void iotDeviceBootOnline(void);
+static void iotDevicePublishJournal(void);
 
 static bool iotElementDescriptionToJson(const iotElementDescription_t *desc, cJSON *object) ;
 
@@ -98,7 +130,9 @@ IOT_DESCRIBE_ELEMENT(
         IOT_DESCRIBE_PUB(RETAINED, ON_CONNECT, "profile"),
         IOT_DESCRIBE_PUB(RETAINED, ON_CONNECT, "topics"),
         IOT_DESCRIBE_PUB(RETAINED, STRING, "diag"),
-        IOT_DESCRIBE_PUB(RETAINED, STRING, "status")
+        IOT_DESCRIBE_PUB(RETAINED, STRING, "status"),
+        IOT_DESCRIBE_PUB(RETAINED, STRING, "boot"),
+        IOT_DESCRIBE_PUB(RETAINED, STRING, "journal")
     ),
     IOT_SUB_DESCRIPTIONS(
         IOT_DESCRIBE_SUB(BINARY, IOT_SUB_DEFAULT_NAME)
@@ -114,6 +148,7 @@ int iotDeviceInit(const char *_version, const char *_capabilities)
     iotDeviceUpdateDiag(NULL);
     xTimerStart(xTimerCreate("deviceDiag", DIAG_UPDATE_MS / portTICK_RATE_MS, pdTRUE, NULL, iotDeviceUpdateDiag), 0);
     updaterAddStatusCallback(iotDeviceUpdateStatus);
+    bootTimelineSetOnlineCallback(iotDeviceBootOnline);
     return 0;
 }
 
@@ -124,6 +159,106 @@ void iotDeviceUpdateStatus(char *status)
     iotElementPublish(deviceElement, DEVICE_PUB_INDEX_STATUS, value);
 }
 
+/* Publish the boot timeline once, it is retained so reconnects just resend the same value. */
+static void iotDeviceBootOnline(void)
+{
+    static char *bootValue = NULL;
+    BootTimelineStage_e stage;
+    iotValue_t value;
+    uint32_t ms;
+    cJSON *object, *stages;
+
+    if (bootValue != NULL) {
+        return;
+    }
+    iotDevicePublishJournal();
+
+    object = cJSON_CreateObject();
+    if (object == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for boot timeline");
+        return;
+    }
+    stages = cJSON_AddObjectToObjectCS(object, BOOT_STAGES);
+    if (stages != NULL) {
+        for (stage = BOOT_STAGE_START; stage < BOOT_STAGE_MAX; stage++) {
+            if (bootTimelineGet(stage, &ms)) {
+                cJSON_AddUIntToObjectCS(stages, bootTimelineStageName(stage), ms);
+            }
+        }
+    }
+#if CONFIG_BOOT_TIMELINE_BUDGET_MS > 0
+    cJSON_AddUIntToObjectCS(object, BOOT_BUDGET, CONFIG_BOOT_TIMELINE_BUDGET_MS);
+    if (bootTimelineGet(BOOT_STAGE_ONLINE, &ms)) {
+        cJSON_AddItemToObjectCS(object, BOOT_OVER_BUDGET, cJSON_CreateBool(ms > CONFIG_BOOT_TIMELINE_BUDGET_MS));
+    }
+#endif
+    bootValue = cJSON_PrintUnformatted(object);
+    cJSON_Delete(object);
+    if (bootValue == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for boot timeline");
+        return;
+    }
+    value.s = bootValue;
+    iotElementPublish(deviceElement, DEVICE_PUB_INDEX_BOOT, value);
+}
+
+/*
+ * Publish the journal kept over resets, so the errors and warnings leading up to a crash can be seen once the device
+ * is back online. Only published once per boot, like the boot timeline.
+ */
+static void iotDevicePublishJournal(void)
+{
+    static char *journalValue = NULL;
+    JournalEntry_t entry;
+    iotValue_t value;
+    cJSON *object, *entries, *item;
+    int i;
+
+    object = cJSON_CreateObject();
+    if (object == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for journal");
+        return;
+    }
+    cJSON_AddUIntToObjectCS(object, JOURNAL_BOOT, journalBoot());
+    cJSON_AddStringToObjectCS(object, JOURNAL_RESET, journalResetReason());
+    entries = cJSON_AddArrayToObjectCS(object, JOURNAL_ENTRIES);
+    if (entries != NULL) {
+        for (i = 0; journalGet(i, &entry) == 0; i++) {
+            item = cJSON_CreateObject();
+            if (item == NULL) {
+                break;
+            }
+            cJSON_AddUIntToObjectCS(item, JOURNAL_BOOT, entry.boot);
+            cJSON_AddUIntToObjectCS(item, JOURNAL_MS, entry.ms);
+            cJSON_AddStringToObjectCS(item, JOURNAL_TEXT, entry.text);
+            cJSON_AddItemToArray(entries, item);
+        }
+    }
+    journalValue = cJSON_PrintUnformatted(object);
+    cJSON_Delete(object);
+    if (journalValue == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for journal");
+        return;
+    }
+    value.s = journalValue;
+    iotElementPublish(deviceElement, DEVICE_PUB_INDEX_JOURNAL, value);
+}
+
+void iotDeviceAddDiagCallback(iotDeviceDiagCallback_t callback)
+{
+    if (nrofDiagCallbacks >= MAX_DIAG_CALLBACKS) {
+        ESP_LOGE(TAG, "Maximum number of diag callbacks reached");
+        return;
+    }
+    diagCallbacks[nrofDiagCallbacks] = callback;
+    nrofDiagCallbacks++;
+}
+
+void iotDeviceSetProfileHandler(iotDeviceProfileHandler_t handler)
+{
+    profileHandler = handler;
+}
+
 #ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
 static TaskStatus_t *getTaskStats(unsigned long *nrofTasks)
 {
@@ -240,6 +375,11 @@ static void iotDeviceUpdateDiag(TimerHandle_t xTimer)
         }
     }
 
+    int i;
+    for (i = 0; i < nrofDiagCallbacks; i++) {
+        diagCallbacks[i](object);
+    }
+
     diagValue = cJSON_PrintUnformatted(object);
     uint32_t free_after_format = esp_get_free_heap_size();
     cJSON_Delete(object);
@@ -259,14 +399,28 @@ static void iotDeviceUpdateDiag(TimerHandle_t xTimer)
 #define UPDATE              "update "
 #define VALUE_UPDATE_POLICY "valueupdatepolicy "
 #define WIFI_SCAN           "wifiscan"
+#define LOG_LEVEL           "loglevel "
 static void iotDeviceControl(iotValue_t value)
 {
     if (strcmp(RESTART, (const char *)value.bin->data) == 0) {
         esp_restart();
     } else if (safestrcmp(SETPROFILE, (const char *)value.bin->data, (int)value.bin->len) == 0) {
+        /* setprofile\0<json profile>[\0<binary profile>] */
         char *profile = (char * )(value.bin->data + sizeof(SETPROFILE));
+        size_t remaining = value.bin->len - sizeof(SETPROFILE);
+        size_t profileLen = strnlen(profile, remaining);
+        const uint8_t *binary = (const uint8_t *)profile + profileLen + 1;
+        size_t binaryLen = (profileLen < remaining) ? remaining - profileLen - 1 : 0;
+
+        if ((binaryLen != 0) && !deviceProfileIsBinary(binary, binaryLen)) {
+            ESP_LOGW(TAG, "Ignoring invalid binary profile");
+            binaryLen = 0;
+        }
         if (deviceProfileSetProfile(profile) == 0) {
-            esp_restart();
+            if (deviceProfileSetBinaryProfile(binary, binaryLen) != 0) {
+                deviceProfileSetBinaryProfile(NULL, 0);
+            }
+            iotDeviceApplyProfile();
         }
     } else if (strncmp(UPDATE, (const char *)value.bin->data, sizeof(UPDATE) - 1) == 0) {
         char *version = (char *)value.bin->data + sizeof(UPDATE) - 1 /* remove the \0 */;
@@ -285,6 +439,15 @@ static void iotDeviceControl(iotValue_t value)
         }
     } else if (strncmp(WIFI_SCAN, (const char *)value.bin->data, sizeof(WIFI_SCAN) - 1) == 0) {
         iotDeviceWifiScan();
+    } else if (strncmp(LOG_LEVEL, (const char *)value.bin->data, sizeof(LOG_LEVEL) - 1) == 0) {
+        /* loglevel <tag|*> <none|error|warn|info|debug|verbose> */
+        char tag[32];
+        char level[8];
+        if (sscanf((const char *)value.bin->data + sizeof(LOG_LEVEL) - 1, "%31s %7s", tag, level) == 2) {
+            loggingSetLevel(tag, level);
+        } else {
+            ESP_LOGW(TAG, "Usage: loglevel <tag> <level>");
+        }
     }
 }
 
@@ -542,6 +705,36 @@ static void iotDeviceWifiScanResult(uint8_t nrofAPs, wifi_ap_record_t *records)
     }
 }
 
+/*
+ * Applying a profile waits for the switch and timer tasks, so is done on its own task rather than blocking the MQTT
+ * task. The task is created by the first setprofile and kept, a profile stored while one is being applied is
+ * applied straight after it.
+ */
+static void iotDeviceApplyProfile(void)
+{
+    if (profileHandler == NULL) {
+        esp_restart();
+    }
+    if ((profileTask == NULL) &&
+        (xTaskCreate(iotDeviceProfileThread, PROFILE_THREAD_NAME, PROFILE_THREAD_STACK_WORDS, NULL,
+                     PROFILE_THREAD_PRIO, &profileTask) != pdPASS)) {
+        ESP_LOGE(TAG, "Failed to create profile thread");
+        esp_restart();
+    }
+    xTaskNotifyGive(profileTask);
+}
+
+static void iotDeviceProfileThread(void *pvParameters)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (profileHandler() != 0) {
+            esp_restart();
+        }
+        ESP_LOGI(TAG, "Profile applied without restarting");
+    }
+}
+
 static void iotDeviceWifiScan()
 {
     wifiScan(iotDeviceWifiScanResult);
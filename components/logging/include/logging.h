@@ -1,6 +1,18 @@
 #ifndef _LOGGING_H_
 #define _LOGGING_H_
+#include "cJSON.h"
 
 void loggingInit();
 
-#endif
\ No newline at end of file
+/**
+ * Add the number of datagrams sent and the amount of log output dropped to the diag object.
+ */
+void loggingDiag(cJSON *diag);
+
+/**
+ * Set the log level for tag ("*" for all tags), level is one of none, error, warn, info, debug or verbose.
+ * Returns 0 on success or -1 if the level is unknown or levels can't be changed in this build.
+ */
+int loggingSetLevel(const char *tag, const char *level);
+
+#endif
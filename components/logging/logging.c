@@ -1,14 +1,17 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include "freertos/FreeRTOS.h"
-#include "freertos/timers.h"
-#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 #include "lwip/netdb.h"
 
+#include "sdkconfig.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
 
@@ -16,6 +19,9 @@
 #include "logging.h"
 #include "notifications.h"
 #include "utils.h"
+#include "cJSON_AddOns.h"
+#include "logging_int.h"
+#include "journal.h"
 
 #define MAGIC_SIZE 4
 #define SEQUENCE_OFFSET MAGIC_SIZE
@@ -25,119 +31,515 @@
 #define HEADER_SIZE (MAGIC_SIZE + SEQUENCE_SIZE + MAC_SIZE)
 #define BUFFER_SIZE 1024
 
-#define NROF_BUFFERS 3
+#define RING_SIZE CONFIG_LOGGING_RING_SIZE
+#define RING_MASK (RING_SIZE - 1)
 
-struct Buffer {
-    char data[HEADER_SIZE + BUFFER_SIZE];
+#define FLUSH_TICKS (CONFIG_LOGGING_FLUSH_MS / portTICK_RATE_MS)
+#define DROPPED_NOTE_SIZE 48
+#define LINE_BUFFER_SIZE 128 /* Longer lines are formatted on the heap */
 
-#define BUFFER_READY_TO_SEND 0x80000000
-    uint32_t len;
-};
+#define REPEAT_TICKS (CONFIG_LOGGING_REPEAT_WINDOW_MS / portTICK_RATE_MS)
+#define REPEAT_ENTRIES 8
+#define REPEAT_NOTE_SIZE 48
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+#define JOURNAL_LINE_SIZE (JOURNAL_TEXT_LEN + 16) /* Room for the colour prefix */
+
+#define THREAD_NAME "logging"
+#define THREAD_STACK_WORDS 2048
+#define THREAD_PRIO 1
+
+_Static_assert((RING_SIZE & RING_MASK) == 0, "LOGGING_RING_SIZE must be a power of 2");
+_Static_assert(RING_SIZE >= BUFFER_SIZE, "LOGGING_RING_SIZE must be at least one datagram");
+
+/*
+ * Log output is written into a byte ring by any number of tasks and sent as UDP datagrams by the logging thread.
+ *
+ * The ring positions are free running counters: producers claim space by advancing ringReserved, copy their bytes
+ * in, then add the length to ringWritten. The logging thread only sends when the two are equal, as any reserved
+ * space is then guaranteed to have been written, and advances ringRead once a datagram has been sent. A producer
+ * that can't claim space drops its output and counts it rather than waiting.
+ *
+ * On the ESP32 the counters are updated with compare and swap, the ESP8266 has no atomic instructions so the same
+ * few instructions are run with interrupts disabled instead.
+ */
+#if CONFIG_IDF_TARGET_ESP32
+static portMUX_TYPE repeatMux = portMUX_INITIALIZER_UNLOCKED;
+#define REPEAT_LOCK() portENTER_CRITICAL(&repeatMux)
+#define REPEAT_UNLOCK() portEXIT_CRITICAL(&repeatMux)
+#define RING_LOAD(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define RING_STORE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#define RING_ADD(var, value) __atomic_add_fetch(&(var), (value), __ATOMIC_RELEASE)
+#else
+#define REPEAT_LOCK() portENTER_CRITICAL()
+#define REPEAT_UNLOCK() portEXIT_CRITICAL()
+#define RING_LOAD(var) (var)
+#define RING_STORE(var, value) ((var) = (value))
+#define RING_ADD(var, value) loggingAtomicAdd(&(var), (value))
+#endif
 
 static void loggingDriverInit(void);
-static void loggingSendBuffer(struct Buffer *buffer);
+static int loggingNetworkInit(nvs_handle handle);
+static void loggingLine(const char *line, size_t len);
+static void loggingOutputText(const char *text, size_t len);
+static uint32_t loggingHash(uint32_t hash, const char *data, size_t len);
+static uint32_t loggingTextKey(const char *line, size_t len);
+static bool loggingRepeated(uint32_t key);
+static const char *loggingJournalText(const char *line, size_t len, size_t *textLen);
+#ifdef CONFIG_IDF_TARGET_ESP8266
+static uint32_t loggingAtomicAdd(volatile uint32_t *var, uint32_t value);
+#endif
+static bool loggingRingReserve(uint32_t len, uint32_t *start);
+static bool loggingRingTryWrite(const char *head, uint32_t headLen, const char *data, uint32_t len);
+static void loggingRingWrite(const char *head, uint32_t headLen, const char *data, uint32_t len);
+static void loggingRingCopy(uint32_t position, const char *data, uint32_t len);
+static void loggingWriteText(const char *text, uint32_t len);
+static uint32_t loggingRingPending(void);
+static void loggingThread(void *pvParameters);
+static void loggingSend(int sock, bool partial);
+#ifdef CONFIG_LOGGING_BINARY
+static void loggingJournalBinary(const char *fmt, va_list args);
+static uint32_t loggingRecordsLen(uint32_t pending);
+#endif
 static void loggingWifiNotification(void *user,  NotificationsMessage_t *message);
 
 static const char TAG[]="logging";
-static struct Buffer *buffers;
-static int nrofBuffers = 0;
-static int currentBuffer = 0;
+
+static char *ring;
+static volatile uint32_t ringReserved;
+static volatile uint32_t ringWritten;
+static volatile uint32_t ringRead;
+
+static volatile uint32_t droppedBytes;
+static volatile uint32_t droppedWrites;
+static uint32_t reportedDroppedWrites;
+static uint32_t datagramsSent;
+
+static char *datagram;
 static uint32_t sequence = 0;
 
 static char *loggingHost;
 static uint16_t loggingPort;
-static int loggingSocket = -1;
-static SemaphoreHandle_t loggingMutex;
+static volatile bool loggingConnected = false;
+static TaskHandle_t loggingTask;
+
+struct repeatEntry {
+    uint32_t key;
+    uint32_t count; /* Times dropped since it was output */
+    TickType_t outputTime;
+    bool used;
+};
+static struct repeatEntry repeatEntries[REPEAT_ENTRIES];
 
 
 void loggingInit()
 {
     nvs_handle handle;
-    esp_err_t err;
     uint8_t enabled = 0;
+
+    if (nvs_open("log", NVS_READONLY, &handle) == ESP_OK) {
+        if ((nvs_get_u8(handle, "enable", &enabled) == ESP_OK) && enabled) {
+            loggingNetworkInit(handle);
+        }
+        nvs_close(handle);
+    }
+    /*
+     * Without network logging the hook is still installed to record errors and warnings in the journal, and to
+     * filter repeated lines before they reach the UART (on the ESP8266 only with LOGGING_REPEAT_UART).
+     */
+    loggingDriverInit();
+}
+
+int loggingSetLevel(const char *tag, const char *level)
+{
+    static const char *levels[] = {"none", "error", "warn", "info", "debug", "verbose"};
     int i;
 
-    err = nvs_open("log", NVS_READONLY, &handle);
-    if (err != ESP_OK) {
+    for (i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        if (strcasecmp(level, levels[i]) == 0) {
+#if defined(CONFIG_LOG_SET_LEVEL) || CONFIG_IDF_TARGET_ESP32
+            ESP_LOGI(TAG, "Setting log level for %s to %s", tag, levels[i]);
+            esp_log_level_set(tag, (esp_log_level_t)i);
+            return 0;
+#else
+            ESP_LOGW(TAG, "Log levels can't be changed in this build");
+            return -1;
+#endif
+        }
+    }
+    ESP_LOGW(TAG, "Unknown log level %s", level);
+    return -1;
+}
+
+static int loggingNetworkInit(nvs_handle handle)
+{
+    uint16_t p;
+
+    if (nvs_get_str_alloc(handle, "host", &loggingHost) != ESP_OK) {
+        goto error;
+    }
+    if (nvs_get_u16(handle, "port", &p) == ESP_OK) {
+        loggingPort = (int) p;
+    } else {
+        loggingPort = 5555;
+    }
+
+    ring = malloc(RING_SIZE);
+    datagram = calloc(1, HEADER_SIZE + BUFFER_SIZE);
+    if ((ring == NULL) || (datagram == NULL)) {
+        ESP_LOGE(TAG, "Failed to allocate memory for buffers");
+        goto error;
+    }
+#ifdef CONFIG_LOGGING_BINARY
+    memcpy(datagram, LOGGING_BINARY_MAGIC, MAGIC_SIZE);
+#else
+    strcpy(datagram, "LOG");
+#endif
+    esp_read_mac((uint8_t*)&datagram[MAC_OFFSET], ESP_MAC_WIFI_STA);
+
+    if (xTaskCreate(loggingThread, THREAD_NAME, THREAD_STACK_WORDS, NULL, THREAD_PRIO, &loggingTask) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create thread");
+        goto error;
+    }
+    notificationsRegister(Notifications_Class_Network, NOTIFICATIONS_ID_WIFI_STATION, loggingWifiNotification, NULL);
+    return 0;
+error:
+    if (datagram != NULL) {
+        free(datagram);
+        datagram = NULL;
+    }
+    if (ring != NULL) {
+        free(ring);
+        ring = NULL;
+    }
+    if (loggingHost != NULL) {
+        free(loggingHost);
+        loggingHost = NULL;
+    }
+    return -1;
+}
+
+void loggingDiag(cJSON *diag)
+{
+    cJSON *object;
+
+    if (ring == NULL) {
+        return;
+    }
+    object = cJSON_AddObjectToObjectCS(diag, "logging");
+    if (object == NULL) {
         return;
     }
+    cJSON_AddUIntToObjectCS(object, "sent", datagramsSent);
+    cJSON_AddUIntToObjectCS(object, "pending", RING_LOAD(ringWritten) - RING_LOAD(ringRead));
+    cJSON_AddUIntToObjectCS(object, "droppedBytes", RING_LOAD(droppedBytes));
+    cJSON_AddUIntToObjectCS(object, "droppedWrites", RING_LOAD(droppedWrites));
+}
+
+#ifdef CONFIG_IDF_TARGET_ESP8266
+static uint32_t loggingAtomicAdd(volatile uint32_t *var, uint32_t value)
+{
+    uint32_t result;
+    portENTER_CRITICAL();
+    result = *var + value;
+    *var = result;
+    portEXIT_CRITICAL();
+    return result;
+}
+
+static bool loggingRingReserve(uint32_t len, uint32_t *start)
+{
+    bool reserved = false;
+
+    portENTER_CRITICAL();
+    if (ringReserved + len - ringRead <= RING_SIZE) {
+        *start = ringReserved;
+        ringReserved += len;
+        reserved = true;
+    }
+    portEXIT_CRITICAL();
+    return reserved;
+}
+#endif
 
-    if ((nvs_get_u8(handle, "enable", &enabled) == ESP_OK) && enabled) {
+#if CONFIG_IDF_TARGET_ESP32
+static bool loggingRingReserve(uint32_t len, uint32_t *start)
+{
+    uint32_t reserved = __atomic_load_n(&ringReserved, __ATOMIC_RELAXED);
 
-        if (nvs_get_str_alloc(handle, "host", &loggingHost) != ESP_OK) {
-            goto error;
+    do {
+        if (reserved + len - RING_LOAD(ringRead) > RING_SIZE) {
+            return false;
         }
-        uint16_t p;
-        err = nvs_get_u16(handle, "port", &p);
-        if (err == ESP_OK) {
-            loggingPort = (int) p;
-        } else {
-            loggingPort = 5555;
+    } while (!__atomic_compare_exchange_n(&ringReserved, &reserved, reserved + len, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    *start = reserved;
+    return true;
+}
+#endif
+
+static void loggingRingWrite(const char *head, uint32_t headLen, const char *data, uint32_t len)
+{
+    if (!loggingRingTryWrite(head, headLen, data, len)) {
+        RING_ADD(droppedBytes, headLen + len);
+        RING_ADD(droppedWrites, 1);
+    }
+}
+
+/*
+ * Write head followed by data into the ring as a single entry, head is used for binary record headers and may be NULL.
+ */
+static bool loggingRingTryWrite(const char *head, uint32_t headLen, const char *data, uint32_t len)
+{
+    uint32_t start, written;
+    uint32_t total = headLen + len;
+
+    if (!loggingRingReserve(total, &start)) {
+        return false;
+    }
+    if (headLen) {
+        loggingRingCopy(start, head, headLen);
+    }
+    loggingRingCopy(start + headLen, data, len);
+
+    written = RING_ADD(ringWritten, total);
+    /* Only wake the logging thread when a full datagram has just become available, the rest is sent on a timer */
+    if ((written - RING_LOAD(ringRead) >= BUFFER_SIZE) && (written - total - RING_LOAD(ringRead) < BUFFER_SIZE)) {
+        xTaskNotifyGive(loggingTask);
+    }
+    return true;
+}
+
+static void loggingRingCopy(uint32_t position, const char *data, uint32_t len)
+{
+    uint32_t offset = position & RING_MASK;
+    uint32_t first = RING_SIZE - offset;
+
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&ring[offset], data, first);
+    memcpy(ring, data + first, len - first);
+}
+
+/*
+ * Write formatted text, in binary mode it is wrapped in a text record.
+ */
+static void loggingWriteText(const char *text, uint32_t len)
+{
+#ifdef CONFIG_LOGGING_BINARY
+    char head[LOGGING_RECORD_HEADER_SIZE];
+
+    if (len > BUFFER_SIZE - LOGGING_RECORD_HEADER_SIZE) {
+        len = BUFFER_SIZE - LOGGING_RECORD_HEADER_SIZE;
+    }
+    loggingBinaryHeader(head, LOGGING_RECORD_HEADER_SIZE + len, LOGGING_RECORD_TEXT);
+    loggingRingWrite(head, sizeof(head), text, len);
+#else
+    loggingRingWrite(NULL, 0, text, len);
+#endif
+}
+
+/*
+ * Number of bytes that can be sent, or 0 if another task is still copying into the ring.
+ */
+static uint32_t loggingRingPending(void)
+{
+    uint32_t written = RING_LOAD(ringWritten);
+
+    if (written != RING_LOAD(ringReserved)) {
+        return 0;
+    }
+    return written - ringRead;
+}
+
+/*
+ * Output a complete line of text unless it is a repeat of the last one.
+ */
+static void loggingLine(const char *line, size_t len)
+{
+    const char *text;
+    size_t textLen;
+
+    if (!loggingRepeated(loggingTextKey(line, len))) {
+        text = loggingJournalText(line, len, &textLen);
+        if (text != NULL) {
+            journalAdd(text, textLen);
         }
+        loggingOutputText(line, len);
+    }
+}
+
+/*
+ * Returns the start of an error or warning line without the colour prefix, or NULL for any other line.
+ */
+static const char *loggingJournalText(const char *line, size_t len, size_t *textLen)
+{
+    const char *end = line + len;
 
-        buffers = calloc(NROF_BUFFERS, sizeof(struct Buffer));
-        if (buffers == NULL) {
-            ESP_LOGE(TAG, "Failed to allocate memory for buffers");
-            goto error;
+    if ((len > 0) && (line[0] == '\033')) {
+        line = memchr(line, 'm', len);
+        if (line == NULL) {
+            return NULL;
         }
+        line++;
+    }
+    if ((line + 1 >= end) || ((line[0] != 'E') && (line[0] != 'W')) || (line[1] != ' ')) {
+        return NULL;
+    }
+    *textLen = end - line;
+    return line;
+}
 
-        for (i=0; i < NROF_BUFFERS; i ++) {
-            strcpy(buffers[i].data, "LOG");
-            esp_read_mac((uint8_t*)&buffers[i].data[MAC_OFFSET], ESP_MAC_WIFI_STA);
+/*
+ * Lines logged within LOGGING_REPEAT_WINDOW_MS of the last time the same line was output are counted instead. The
+ * last REPEAT_ENTRIES different lines are remembered, so a loop logging several lines is collapsed as well as a
+ * single line. Once a line's window is over, or it is pushed out by newer lines, its count is output before the
+ * next line. A line that keeps repeating is therefore output once per window followed by a summary.
+ */
+static bool loggingRepeated(uint32_t key)
+{
+#if CONFIG_LOGGING_REPEAT_WINDOW_MS > 0
+    TickType_t now = xTaskGetTickCount();
+    struct repeatEntry *entry = NULL;
+    struct repeatEntry *oldest = &repeatEntries[0];
+    uint32_t repeats = 0;
+    bool repeated = false;
+    int i;
+
+    REPEAT_LOCK();
+    for (i = 0; i < REPEAT_ENTRIES; i++) {
+        struct repeatEntry *e = &repeatEntries[i];
+        if (e->used && (now - e->outputTime >= REPEAT_TICKS)) {
+            repeats += e->count;
+            e->count = 0;
+            e->used = false;
         }
-        nrofBuffers = NROF_BUFFERS;
-        currentBuffer = 0;
-        loggingMutex = xSemaphoreCreateMutex();
-        if (loggingMutex == NULL) {
-            ESP_LOGE(TAG, "Failed to create mutex");
-            goto error;
+        if (e->used && (e->key == key)) {
+            entry = e;
+        }
+        /* Free entries first, otherwise the one output longest ago */
+        if (!e->used) {
+            if (oldest->used) {
+                oldest = e;
+            }
+        } else if (oldest->used && (now - e->outputTime > now - oldest->outputTime)) {
+            oldest = e;
         }
-        loggingDriverInit();
-        notificationsRegister(Notifications_Class_Network, NOTIFICATIONS_ID_WIFI_STATION, loggingWifiNotification, NULL);
     }
-    nvs_close(handle);
-    return;
-error:
-    if (loggingMutex != NULL) {
-        vSemaphoreDelete(loggingMutex);
+    if (entry != NULL) {
+        entry->count++;
+        repeated = true;
+    } else {
+        repeats += oldest->count;
+        oldest->key = key;
+        oldest->count = 0;
+        oldest->outputTime = now;
+        oldest->used = true;
     }
-    if (buffers != NULL) {
-        free(buffers);
+    REPEAT_UNLOCK();
+
+    if (repeats) {
+        char note[REPEAT_NOTE_SIZE];
+        int len = snprintf(note, sizeof(note), "logging: %u repeated lines not shown\n", repeats);
+        if ((len > 0) && (len < (int)sizeof(note))) {
+            loggingOutputText(note, len);
+        }
     }
-    if (loggingHost != NULL) {
-        free(loggingHost);
+    return repeated;
+#else
+    return false;
+#endif
+}
+
+static uint32_t loggingHash(uint32_t hash, const char *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * FNV_PRIME;
     }
-    nvs_close(handle);
-    return;
+    return hash;
+}
+
+/*
+ * Key used to detect repeated lines, ignoring the "(timestamp)" at the start of lines from ESP_LOGx.
+ */
+static uint32_t loggingTextKey(const char *line, size_t len)
+{
+    const char *open = memchr(line, '(', len < 16 ? len : 16);
+    const char *close = NULL;
+
+    if (open != NULL) {
+        close = memchr(open, ')', len - (open - line));
+    }
+    if (close == NULL) {
+        return loggingHash(FNV_OFFSET_BASIS, line, len);
+    }
+    return loggingHash(loggingHash(FNV_OFFSET_BASIS, line, open - line), close, len - (close - line));
 }
 
 #ifdef CONFIG_IDF_TARGET_ESP8266
 static putchar_like_t originalPutChar;
+static char lineBuffer[LINE_BUFFER_SIZE];
+static size_t lineLen;
+static volatile bool lineBusy;
 
+/*
+ * Characters are collected into lines so repeats can be detected, long lines are output in pieces. The task that
+ * completes a line outputs it from lineBuffer, any characters logged by other tasks meanwhile are output as they are.
+ * Without LOGGING_REPEAT_UART characters go straight to the UART and only the network log and journal are filtered.
+ */
 static int loggingPutChar(int ch)
 {
+    char c = ch;
+    size_t len = 0;
+    bool busy;
+
+#ifndef CONFIG_LOGGING_REPEAT_UART
     if (originalPutChar != NULL) {
         originalPutChar(ch);
     }
-    if (xSemaphoreTake(loggingMutex, 10) == pdTRUE) {
-        buffers[currentBuffer].data[HEADER_SIZE + buffers[currentBuffer].len] = ch;
-        buffers[currentBuffer].len ++;
-        if (buffers[currentBuffer].len >= BUFFER_SIZE) {
-            uint32_t networkSequence;
-            loggingSendBuffer(&buffers[currentBuffer]);
-            currentBuffer++;
-            if (currentBuffer >= NROF_BUFFERS) {
-                currentBuffer = 0;
-            }
-            sequence++;
-            networkSequence = htonl(sequence);
-            memcpy(&buffers[currentBuffer].data[SEQUENCE_OFFSET], &networkSequence, sizeof(sequence));
-            buffers[currentBuffer].len = 0;
+#endif
+
+    portENTER_CRITICAL();
+    busy = lineBusy;
+    if (!busy) {
+        lineBuffer[lineLen++] = c;
+        if ((c == '\n') || (lineLen == sizeof(lineBuffer))) {
+            len = lineLen;
+            lineLen = 0;
+            lineBusy = true;
         }
-        xSemaphoreGive(loggingMutex);
+    }
+    portEXIT_CRITICAL();
+
+    if (busy) {
+        loggingOutputText(&c, 1);
+    } else if (len) {
+        loggingLine(lineBuffer, len);
+        lineBusy = false;
     }
     return ch;
 }
+
+static void loggingOutputText(const char *text, size_t len)
+{
+#ifdef CONFIG_LOGGING_REPEAT_UART
+    size_t i;
+
+    if (originalPutChar != NULL) {
+        for (i = 0; i < len; i++) {
+            originalPutChar(text[i]);
+        }
+    }
+#endif
+    /* Without LOGGING_REPEAT_UART the UART has already had the text */
+    if (ring != NULL) {
+        loggingWriteText(text, len);
+    }
+}
+
 static void loggingDriverInit(void)
 {
     originalPutChar = esp_log_set_putchar(loggingPutChar);
@@ -147,38 +549,95 @@ static void loggingDriverInit(void)
 #if CONFIG_IDF_TARGET_ESP32
 static vprintf_like_t originalVprintf;
 
+static int loggingOriginalPrintf(const char *fmt, ...)
+{
+    va_list args;
+    int r;
+
+    va_start(args, fmt);
+    r = originalVprintf(fmt, args);
+    va_end(args);
+    return r;
+}
+
+#ifdef CONFIG_LOGGING_BINARY
+/*
+ * Binary records aren't readable on the device, so errors and warnings are formatted again for the journal.
+ */
+static void loggingJournalBinary(const char *fmt, va_list args)
+{
+    char line[JOURNAL_LINE_SIZE];
+    const char *text;
+    size_t textLen;
+    va_list copy;
+    int r;
+
+    if (loggingJournalText(fmt, strnlen(fmt, JOURNAL_LINE_SIZE), &textLen) == NULL) {
+        return;
+    }
+    va_copy(copy, args);
+    r = vsnprintf(line, sizeof(line), fmt, copy);
+    va_end(copy);
+    if (r > 0) {
+        text = loggingJournalText(line, r < (int)sizeof(line) ? r : sizeof(line) - 1, &textLen);
+        if (text != NULL) {
+            journalAdd(text, textLen);
+        }
+    }
+}
+#endif
+
 static int loggingVprintf(const char *fmt, va_list args)
 {
-    char *output = NULL;
-    int r = vasprintf(&output, fmt, args);
-    if (output != NULL) {
-        if (r) {
-            if (xSemaphoreTake(loggingMutex, 10) == pdTRUE) {
-                int i;
-                for (i=0; i < r; i++) {
-                    buffers[currentBuffer].data[HEADER_SIZE + buffers[currentBuffer].len] = output[i];
-                    buffers[currentBuffer].len ++;
-                    if (buffers[currentBuffer].len >= BUFFER_SIZE) {
-                        uint32_t networkSequence;
-                        loggingSendBuffer(&buffers[currentBuffer]);
-                        currentBuffer++;
-                        if (currentBuffer >= NROF_BUFFERS) {
-                            currentBuffer = 0;
-                        }
-                        sequence++;
-                        networkSequence = htonl(sequence);
-                        memcpy(&buffers[currentBuffer].data[SEQUENCE_OFFSET], &networkSequence, sizeof(sequence));
-                        buffers[currentBuffer].len = 0;
-                    }
-                }
-                xSemaphoreGive(loggingMutex);
+    char line[LINE_BUFFER_SIZE];
+    va_list copy;
+    int r;
+
+#ifdef CONFIG_LOGGING_BINARY
+    if (ring != NULL) {
+        size_t keyOffset;
+        va_copy(copy, args);
+        r = loggingBinaryEncode(line, sizeof(line), fmt, copy, &keyOffset);
+        va_end(copy);
+        if (r > 0) {
+            /* The format address plus the arguments after the timestamp */
+            uint32_t key = loggingHash(loggingHash(FNV_OFFSET_BASIS, &line[2], sizeof(uint32_t)), &line[keyOffset], r - keyOffset);
+            if (!loggingRepeated(key)) {
+                loggingRingWrite(NULL, 0, line, r);
+                loggingJournalBinary(fmt, args);
             }
+            return r;
+        }
+        /* Format string not in flash or arguments too long for a record, send it formatted instead */
+    }
+#endif
+    va_copy(copy, args);
+    r = vsnprintf(line, sizeof(line), fmt, copy);
+    va_end(copy);
+    if (r >= (int)sizeof(line)) {
+        char *output = NULL;
+        if ((vasprintf(&output, fmt, args) > 0) && (output != NULL)) {
+            loggingLine(output, r);
+        } else {
+            RING_ADD(droppedBytes, r);
+            RING_ADD(droppedWrites, 1);
         }
         free(output);
+    } else if (r > 0) {
+        loggingLine(line, r);
     }
     return r;
 }
 
+static void loggingOutputText(const char *text, size_t len)
+{
+    if (ring != NULL) {
+        loggingWriteText(text, len);
+    } else {
+        loggingOriginalPrintf("%.*s", (int)len, text);
+    }
+}
+
 static void loggingDriverInit(void)
 {
     originalVprintf = esp_log_set_vprintf(loggingVprintf);
@@ -186,50 +645,134 @@ static void loggingDriverInit(void)
 
 #endif
 
-static void loggingWifiNotification(void *user,  NotificationsMessage_t *message)
+static void loggingThread(void *pvParameters)
 {
-    switch(message->data.connectionState) {
-    case Notifications_ConnectionState_Connected: {
-        // Get Logging Host address
-        loggingSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
-        if (loggingSocket == -1) {
-            printf("Failed to create logging socket!\n");
-            return;
-        }
-
-        // If successful send pending buffers.
-        if (xSemaphoreTake(loggingMutex, 10) == pdTRUE) {
-            int i;
-            for (i = 0; i < nrofBuffers; i++) {
-                if (buffers[i].len & BUFFER_READY_TO_SEND) {
-                    loggingSendBuffer(&buffers[i]);
-                }
+    int sock = -1;
+    TickType_t lastFlush = xTaskGetTickCount();
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, FLUSH_TICKS);
+
+        if (loggingConnected && (sock == -1)) {
+            sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+            if (sock == -1) {
+                printf("Failed to create logging socket!\n");
             }
-            xSemaphoreGive(loggingMutex);
+        } else if (!loggingConnected && (sock != -1)) {
+            closesocket(sock);
+            sock = -1;
+        }
+        if (sock == -1) {
+            /* Keep buffering until connected, anything that doesn't fit is counted as dropped */
+            continue;
+        }
+        if (xTaskGetTickCount() - lastFlush >= FLUSH_TICKS) {
+            loggingSend(sock, true);
+            lastFlush = xTaskGetTickCount();
+        } else {
+            loggingSend(sock, false);
+        }
+    }
+}
+
+/*
+ * Send everything in the ring as full datagrams, and when partial is set whatever is left over as well.
+ */
+static void loggingSend(int sock, bool partial)
+{
+    struct sockaddr_in destAddr;
+    uint32_t dropped = RING_LOAD(droppedWrites);
+
+    destAddr.sin_addr.s_addr = inet_addr(loggingHost);
+    destAddr.sin_family = AF_INET;
+    destAddr.sin_port = htons(loggingPort);
+
+    while (true) {
+        uint32_t len, offset, first, networkSequence;
+        uint32_t pending = loggingRingPending();
+
+#ifdef CONFIG_LOGGING_BINARY
+        len = loggingRecordsLen(pending);
+#else
+        len = pending > BUFFER_SIZE ? BUFFER_SIZE : pending;
+#endif
+        /* Unless partial is set only send when there is more than will fit in this datagram */
+        if ((len == 0) || (!partial && (len == pending) && (len < BUFFER_SIZE))) {
+            break;
         }
+        offset = ringRead & RING_MASK;
+        first = RING_SIZE - offset;
+        if (first > len) {
+            first = len;
+        }
+        memcpy(&datagram[HEADER_SIZE], &ring[offset], first);
+        memcpy(&datagram[HEADER_SIZE + first], ring, len - first);
 
-        // Start timer
+        networkSequence = htonl(sequence);
+        memcpy(&datagram[SEQUENCE_OFFSET], &networkSequence, sizeof(sequence));
+        if (sendto(sock, datagram, HEADER_SIZE + len, 0, (struct sockaddr *)&destAddr, sizeof(destAddr)) < 0) {
+            /* Most likely out of buffers in the stack, leave the data in the ring and try again later */
+            break;
+        }
+        sequence++;
+        datagramsSent++;
+        RING_STORE(ringRead, ringRead + len);
     }
-    break;
+
+    /*
+     * Report drops in the log itself once there is room again, written through the ring so the note never ends up
+     * in the middle of another line.
+     */
+    if (dropped != reportedDroppedWrites) {
+        char note[DROPPED_NOTE_SIZE];
+        char *head = NULL;
+        uint32_t headLen = 0;
+        int len = snprintf(note, sizeof(note), "logging: %u bytes dropped (%u writes)\n", RING_LOAD(droppedBytes), dropped);
+#ifdef CONFIG_LOGGING_BINARY
+        char record[LOGGING_RECORD_HEADER_SIZE];
+        loggingBinaryHeader(record, sizeof(record) + len, LOGGING_RECORD_TEXT);
+        head = record;
+        headLen = sizeof(record);
+#endif
+        if ((len > 0) && (len < (int)sizeof(note)) && loggingRingTryWrite(head, headLen, note, len)) {
+            reportedDroppedWrites = dropped;
+        }
+    }
+}
+
+#ifdef CONFIG_LOGGING_BINARY
+/*
+ * Length of the whole records at the start of the ring that fit in a datagram, so a lost datagram never leaves the
+ * host with half a record.
+ */
+static uint32_t loggingRecordsLen(uint32_t pending)
+{
+    uint32_t len = 0;
+
+    while (len + LOGGING_RECORD_HEADER_SIZE <= pending) {
+        uint32_t position = ringRead + len;
+        uint32_t recordLen = (uint8_t)ring[position & RING_MASK] | ((uint8_t)ring[(position + 1) & RING_MASK] << 8);
+        if ((recordLen < LOGGING_RECORD_HEADER_SIZE) || (len + recordLen > BUFFER_SIZE) || (len + recordLen > pending)) {
+            break;
+        }
+        len += recordLen;
+    }
+    return len;
+}
+#endif
+
+static void loggingWifiNotification(void *user,  NotificationsMessage_t *message)
+{
+    switch(message->data.connectionState) {
+    case Notifications_ConnectionState_Connected:
+        loggingConnected = true;
+        xTaskNotifyGive(loggingTask);
+        break;
     case Notifications_ConnectionState_Disconnected:
-        closesocket(loggingSocket);
-        loggingSocket = -1;
+        loggingConnected = false;
+        xTaskNotifyGive(loggingTask);
         break;
     default:
         break;
     }
 }
-
-static void loggingSendBuffer(struct Buffer *buffer)
-{
-    if (loggingSocket != -1) {
-        struct sockaddr_in destAddr;
-        destAddr.sin_addr.s_addr = inet_addr(loggingHost);
-        destAddr.sin_family = AF_INET;
-        destAddr.sin_port = htons(loggingPort);
-        sendto(loggingSocket, buffer->data, buffer->len + HEADER_SIZE, 0, (struct sockaddr *)&destAddr, sizeof(destAddr));
-        buffer->len = 0;
-    } else {
-        buffer->len |= BUFFER_READY_TO_SEND;
-    }
-}
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "sdkconfig.h"
+#if CONFIG_IDF_TARGET_ESP32
+#include "soc/soc.h"
+#endif
+
+#include "logging_int.h"
+
+#ifdef SOC_DROM_LOW
+#define IN_FLASH(ptr) (((uintptr_t)(ptr) >= SOC_DROM_LOW) && ((uintptr_t)(ptr) < SOC_DROM_HIGH))
+#else
+#define IN_FLASH(ptr) false
+#endif
+
+static bool loggingBinaryPut(char *out, size_t size, size_t *pos, const void *value, size_t len);
+
+void loggingBinaryHeader(char *out, uint32_t len, uint32_t format)
+{
+    out[0] = len & 0xff;
+    out[1] = (len >> 8) & 0xff;
+    memcpy(&out[2], &format, sizeof(format));
+}
+
+/*
+ * Walks the format string the same way printf does, but copies each argument into the record instead of formatting
+ * it. Only the conversions used with ESP_LOGx are supported, anything else (%n, long double) is sent as text.
+ */
+int loggingBinaryEncode(char *out, size_t size, const char *fmt, va_list args, size_t *keyOffset)
+{
+    size_t pos = LOGGING_RECORD_HEADER_SIZE;
+    bool firstArg = true;
+    const char *p;
+
+    *keyOffset = LOGGING_RECORD_HEADER_SIZE;
+    if (!IN_FLASH(fmt) || (size < LOGGING_RECORD_HEADER_SIZE)) {
+        return -1;
+    }
+
+    for (p = fmt; *p; p++) {
+        const char *start = p;
+        int longs = 0;
+        bool ok = true;
+
+        if (*p != '%') {
+            continue;
+        }
+        p++;
+        while ((*p == '-') || (*p == '+') || (*p == ' ') || (*p == '#') || (*p == '0')) {
+            p++;
+        }
+        /* Width and precision */
+        while (((*p >= '0') && (*p <= '9')) || (*p == '.') || (*p == '*')) {
+            if (*p == '*') {
+                int value = va_arg(args, int);
+                if (!loggingBinaryPut(out, size, &pos, &value, sizeof(value))) {
+                    return -1;
+                }
+            }
+            p++;
+        }
+        /* Length modifiers, only ll and j change the size of an argument */
+        while ((*p == 'h') || (*p == 'l') || (*p == 'z') || (*p == 'j') || (*p == 't')) {
+            if (*p == 'l') {
+                longs++;
+            } else if (*p == 'j') {
+                longs = 2;
+            }
+            p++;
+        }
+
+        switch (*p) {
+        case '%':
+            break;
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        case 'c':
+            if (longs >= 2) {
+                long long value = va_arg(args, long long);
+                ok = loggingBinaryPut(out, size, &pos, &value, sizeof(value));
+            } else {
+                int value = va_arg(args, int);
+                ok = loggingBinaryPut(out, size, &pos, &value, sizeof(value));
+            }
+            break;
+        case 'p': {
+            uint32_t value = (uintptr_t)va_arg(args, void *);
+            ok = loggingBinaryPut(out, size, &pos, &value, sizeof(value));
+        }
+        break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            double value = va_arg(args, double);
+            ok = loggingBinaryPut(out, size, &pos, &value, sizeof(value));
+        }
+        break;
+        case 's': {
+            const char *value = va_arg(args, const char *);
+            uint32_t address = (uintptr_t)value;
+            if ((value != NULL) && !IN_FLASH(value)) {
+                address = LOGGING_STRING_INLINE;
+                ok = loggingBinaryPut(out, size, &pos, &address, sizeof(address)) &&
+                     loggingBinaryPut(out, size, &pos, value, strlen(value) + 1);
+            } else {
+                ok = loggingBinaryPut(out, size, &pos, &address, sizeof(address));
+            }
+        }
+        break;
+        default:
+            return -1;
+        }
+        if (!ok) {
+            return -1;
+        }
+        if (firstArg && (*p != '%')) {
+            /* The timestamp of ESP_LOGx lines is the first argument and is always in brackets */
+            if ((start > fmt) && (start[-1] == '(')) {
+                *keyOffset = pos;
+            }
+            firstArg = false;
+        }
+    }
+    loggingBinaryHeader(out, pos, (uintptr_t)fmt);
+    return pos;
+}
+
+static bool loggingBinaryPut(char *out, size_t size, size_t *pos, const void *value, size_t len)
+{
+    if (*pos + len > size) {
+        return false;
+    }
+    memcpy(&out[*pos], value, len);
+    *pos += len;
+    return true;
+}
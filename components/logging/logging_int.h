@@ -0,0 +1,37 @@
+#ifndef _LOGGING_INT_H_
+#define _LOGGING_INT_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+/*
+ * Binary log records, all values are little endian:
+ *   uint16_t length    Length of the whole record including this header
+ *   uint32_t format    Address of the format string in flash, or LOGGING_RECORD_TEXT
+ * followed by either the already formatted text (LOGGING_RECORD_TEXT) or the arguments in the order they appear in
+ * the format string:
+ *   integers, pointers and '*' widths  4 bytes, 8 bytes for ll and j
+ *   floating point                     8 bytes (double)
+ *   strings                            4 byte address when in flash, 0 for NULL or LOGGING_STRING_INLINE followed
+ *                                      by the NUL terminated string
+ *
+ * tools/logdecode.py must be kept in step with this format.
+ */
+#define LOGGING_BINARY_MAGIC "LOGB"
+#define LOGGING_RECORD_HEADER_SIZE 6
+#define LOGGING_RECORD_TEXT 0
+#define LOGGING_STRING_INLINE 1
+
+/**
+ * Write a record header for a record of len bytes.
+ */
+void loggingBinaryHeader(char *out, uint32_t len, uint32_t format);
+
+/**
+ * Encode a log line as a binary record into out, returning the length of the record or -1 if the format string isn't
+ * in flash, uses an unsupported conversion or the record doesn't fit in size bytes. keyOffset is set to the offset of
+ * the arguments after the "(timestamp)" of an ESP_LOGx line, so repeated lines can be detected.
+ */
+int loggingBinaryEncode(char *out, size_t size, const char *fmt, va_list args, size_t *keyOffset);
+
+#endif
@@ -13,6 +13,7 @@ typedef enum {
     Notifications_Class_Humidity,
     Notifications_Class_Pressure,
     Notifications_Class_Relay,
+    Notifications_Class_Illuminance,
     Notifications_Class_Max
 } Notifications_Class_e;
 
@@ -23,7 +24,8 @@ typedef enum {
 } Notifications_ConnectionState_e;
 
 typedef enum {
-    Notifications_SystemState_InitFinished
+    Notifications_SystemState_InitFinished,
+    Notifications_SystemState_ProfileApplied
 } Notifications_SystemState_e;
 
 typedef uint32_t Notifications_ID_t;
@@ -32,6 +34,7 @@ typedef union {
     uint32_t humidity;  // %RH * 100
     uint32_t pressure;  // hPa * 100
     int32_t temperature; // degrees C * 100
+    uint32_t illuminance; // lux
     bool switchState;
     bool relayState;
     Notifications_ConnectionState_e connectionState;
@@ -68,4 +71,6 @@ void notificationsNotify(Notifications_Class_e clazz, Notifications_ID_t id, Not
 Notifications_ID_t notificationsNewId(const char *name);
 int notificationsRegisterId(Notifications_ID_t id, const char *name);
 Notifications_ID_t notificationsFindId(const char *name);
+/* Remove all names registered for id */
+void notificationsRemoveId(Notifications_ID_t id);
 #endif
\ No newline at end of file
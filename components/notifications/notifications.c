@@ -142,3 +142,21 @@ Notifications_ID_t notificationsFindId(const char *name)
     }
     return NOTIFICATIONS_ID_ERROR;
 }
+
+void notificationsRemoveId(Notifications_ID_t id)
+{
+    NotificationsNamedID_t *entry, *prev = NULL, *next;
+    for (entry = rootEntry; entry; entry = next) {
+        next = entry->next;
+        if (entry->id == id) {
+            if (prev) {
+                prev->next = next;
+            } else {
+                rootEntry = next;
+            }
+            free(entry);
+        } else {
+            prev = entry;
+        }
+    }
+}
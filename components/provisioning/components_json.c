@@ -45,6 +45,10 @@ static const char json[] = "{"
         ",\"level\":{"
             "\"type\":\"gpioLevel\""
         "}"
+        ",\"restore\":{"
+            "\"type\":\"bool\""
+            ",\"optional\":true"
+        "}"
         ",\"name\":{"
             "\"type\":\"string\""
             ",\"optional\":true"
@@ -59,6 +63,30 @@ static const char json[] = "{"
         "\"pin\":{"
             "\"type\":\"gpioPin\""
         "}"
+        ",\"oversample\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"median\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"smoothing\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"minInterval\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"maxInterval\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"changeThreshold\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
         ",\"name\":{"
             "\"type\":\"string\""
             ",\"optional\":true"
@@ -81,6 +109,30 @@ static const char json[] = "{"
             "\"type\":\"i2cAddr\""
             ",\"default\":64"
         "}"
+        ",\"oversample\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"median\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"smoothing\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"minInterval\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"maxInterval\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"changeThreshold\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
         ",\"name\":{"
             "\"type\":\"string\""
             ",\"optional\":true"
@@ -103,6 +155,30 @@ static const char json[] = "{"
             "\"type\":\"i2cAddr\""
             ",\"default\":57"
         "}"
+        ",\"oversample\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"median\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"smoothing\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"minInterval\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"maxInterval\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"changeThreshold\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
         ",\"name\":{"
             "\"type\":\"string\""
             ",\"optional\":true"
@@ -125,6 +201,30 @@ static const char json[] = "{"
             "\"type\":\"i2cAddr\""
             ",\"default\":118"
         "}"
+        ",\"oversample\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"median\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"smoothing\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"minInterval\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"maxInterval\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"changeThreshold\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
         ",\"name\":{"
             "\"type\":\"string\""
             ",\"optional\":true"
@@ -145,6 +245,35 @@ static const char json[] = "{"
             ",\"default\":0.0"
             ",\"optional\":true"
         "}"
+        ",\"resolution\":{"
+            "\"type\":\"uint\""
+            ",\"default\":12"
+            ",\"optional\":true"
+        "}"
+        ",\"oversample\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"median\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"smoothing\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"minInterval\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"maxInterval\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"changeThreshold\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
         ",\"name\":{"
             "\"type\":\"string\""
             ",\"optional\":true"
@@ -291,6 +420,55 @@ static const char json[] = "{"
             ",\"optional\":true"
         "}"
     "}"
+#if defined(CONFIG_DEEP_SLEEP)
+    ",\"deep_sleep\":{"
+        "\"interval\":{"
+            "\"type\":\"uint\""
+        "}"
+        ",\"maxAwake\":{"
+            "\"type\":\"uint\""
+            ",\"optional\":true"
+        "}"
+        ",\"name\":{"
+            "\"type\":\"string\""
+            ",\"optional\":true"
+        "}"
+        ",\"id\":{"
+            "\"type\":\"string\""
+            ",\"optional\":true"
+        "}"
+    "}"
+#endif
+#if defined(CONFIG_RULES)
+    ",\"rule\":{"
+        "\"when\":{"
+            "\"type\":\"string\""
+        "}"
+        ",\"then\":{"
+            "\"type\":\"string\""
+        "}"
+        ",\"otherwise\":{"
+            "\"type\":\"string\""
+            ",\"optional\":true"
+        "}"
+        ",\"refs\":{"
+            "\"type\":\"string\""
+            ",\"optional\":true"
+        "}"
+        ",\"code\":{"
+            "\"type\":\"string\""
+            ",\"optional\":true"
+        "}"
+        ",\"name\":{"
+            "\"type\":\"string\""
+            ",\"optional\":true"
+        "}"
+        ",\"id\":{"
+            "\"type\":\"string\""
+            ",\"optional\":true"
+        "}"
+    "}"
+#endif
 "}";
 
 esp_err_t provisioningComponentsJsonFileHandler(httpd_req_t *req)
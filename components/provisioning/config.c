@@ -1,3 +1,6 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <esp_log.h>
 #include <esp_system.h>
 #include <esp_http_server.h>
@@ -12,12 +15,14 @@
 #include "wifi.h"
 #include "iot.h"
 #include "utils.h"
+#include "jsonStream.h"
 
 #include "cJSON.h"
 #include "cJSON_AddOns.h"
 
 
-#define MAX_CONTENT_LENGTH 1024
+#define RECV_BUFFER_SIZE 128
+#define MAX_TOKEN_LEN 256 /* Longest name or value */
 
 typedef enum FieldType {
     FT_USERNAME = 0,
@@ -47,86 +52,177 @@ struct setting {
 
 const char *TAG="CONFIG";
 
+struct configContext {
+    int depth;
+    uint32_t settingsSeen; /* Bit per setting group */
+    uint32_t variablesSeen; /* Bit per variable in the current group */
+    struct setting *pendingSetting; /* Group named by the last key at the top level */
+    struct setting *setting; /* Group currently being written, handle is open */
+    struct variable *variable; /* Variable named by the last key in the group */
+    nvs_handle handle;
+    const char *errorMsg;
+};
+
 static void reboot(TimerHandle_t xTimer);
 static bool getVariables(nvs_handle handle, struct setting *setting, cJSON *object);
-static char *setVariables(nvs_handle handle, struct setting *setting, cJSON *object);
+static int configEvent(void *user, JsonStreamEvent_e event, const char *value, size_t len);
+static int configOpenSetting(struct configContext *context, struct setting *setting);
+static int configCloseSetting(struct configContext *context);
+static const char *setVariable(nvs_handle handle, struct variable *variable, JsonStreamEvent_e event, const char *value);
 
 esp_err_t provisioningConfigPostHandler(httpd_req_t *req)
 {
-    char *buf = NULL;
-    char *errorMsg = NULL;
-    ESP_LOGI(TAG, "/config handler read content length %d", req->content_len);
-    if (req->content_len > MAX_CONTENT_LENGTH) {
-        errorMsg = "config content length too big";
-        goto error;
-    }
-
-    int i;
-    size_t off = 0;
-    int    ret;
+    struct configContext context;
+    JsonStream_t stream;
+    char token[MAX_TOKEN_LEN];
+    char buf[RECV_BUFFER_SIZE];
+    size_t remaining = req->content_len;
+    int ret;
 
-    buf = malloc(req->content_len + 1);
-    if (!buf) {
-        errorMsg = "failed to allocate buffer";
-        goto error;
-    }
+    ESP_LOGI(TAG, "/config handler read content length %d", req->content_len);
+    memset(&context, 0, sizeof(context));
+    jsonStreamInit(&stream, token, sizeof(token), configEvent, &context);
 
-    while (off < req->content_len) {
+    while (remaining > 0) {
         /* Read data received in the request */
-        ret = httpd_req_recv(req, buf + off, req->content_len - off);
+        ret = httpd_req_recv(req, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
         if (ret <= 0) {
             if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
                 httpd_resp_send_408(req);
             }
-            free (buf);
+            configCloseSetting(&context);
             return ESP_FAIL;
         }
-        off += ret;
-        ESP_LOGI(TAG, "/config handler recv length %d", ret);
+        remaining -= ret;
+        ESP_LOGD(TAG, "/config handler recv length %d", ret);
+        if (jsonStreamFeed(&stream, buf, ret)) {
+            goto error;
+        }
     }
-    buf[req->content_len] = 0;
-
-    cJSON *object = cJSON_Parse(buf);
-    if (object == NULL) {
-        errorMsg = "failed to parse buffer";
+    if (jsonStreamFinish(&stream)) {
         goto error;
     }
-    free(buf);
 
-    for (i=0; i < nrofSettings; i++) {
-        esp_err_t err;
-        nvs_handle handle;
-        cJSON *settingsGroup = cJSON_GetObjectItem(object, settings[i].name);
-        if ((settingsGroup != NULL) && (settingsGroup->type == cJSON_Object)) {
-            err = nvs_open(settings[i].name, NVS_READWRITE, &handle);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to open %s error %d", settings[i].name, err);
-                errorMsg = "Failed to open NVS";
-                goto error;
-            }
-            errorMsg = setVariables(handle, &settings[i], settingsGroup);
-            nvs_close(handle);
-            if (errorMsg) {
-                goto error;
-            }
-        }
-    }
     ESP_LOGI(TAG, "Finished processing settings, will now reboot");
     httpd_send(req, "Saved", 5);
     xTimerStart(xTimerCreate("REBOOT", 10000 / portTICK_RATE_MS, pdTRUE, NULL, reboot), 0);
-
-    cJSON_Delete(object);
     return ESP_FAIL;
 
 error:
-    ESP_LOGE(TAG, "ERROR: %s", errorMsg);
+    configCloseSetting(&context);
+    if (context.errorMsg == NULL) {
+        context.errorMsg = "failed to parse buffer";
+    }
+    ESP_LOGE(TAG, "ERROR: %s", context.errorMsg);
     httpd_resp_set_status(req, HTTPD_400);
-    httpd_resp_send(req, errorMsg, -1);
+    httpd_resp_send(req, context.errorMsg, -1);
+    return ESP_FAIL;
+}
 
-    if (buf) {
-        free(buf);
+/*
+ * Each setting is written to NVS as soon as its value has been parsed, so memory use doesn't depend on the size of
+ * the body. As with cJSON_GetObjectItem names are case insensitive and only the first occurrence of a name is used.
+ */
+static int configEvent(void *user, JsonStreamEvent_e event, const char *value, size_t len)
+{
+    struct configContext *context = user;
+    int i;
+
+    switch (event) {
+    case JSON_STREAM_OBJECT_START:
+    case JSON_STREAM_ARRAY_START:
+        if ((context->depth == 1) && (context->pendingSetting != NULL) && (event == JSON_STREAM_OBJECT_START)) {
+            if (configOpenSetting(context, context->pendingSetting)) {
+                return -1;
+            }
+        } else if ((context->depth == 2) && (context->variable != NULL)) {
+            context->errorMsg = "Variable value is not a string, number or bool";
+            return -1;
+        }
+        context->pendingSetting = NULL;
+        context->depth ++;
+        return 0;
+
+    case JSON_STREAM_OBJECT_END:
+    case JSON_STREAM_ARRAY_END:
+        context->depth --;
+        if (context->depth == 1) {
+            return configCloseSetting(context);
+        }
+        return 0;
+
+    case JSON_STREAM_KEY:
+        if (context->depth == 1) {
+            context->pendingSetting = NULL;
+            for (i = 0; i < nrofSettings; i++) {
+                if (strcasecmp(value, settings[i].name) == 0) {
+                    if ((context->settingsSeen & (1 << i)) == 0) {
+                        context->settingsSeen |= 1 << i;
+                        context->pendingSetting = &settings[i];
+                    }
+                    break;
+                }
+            }
+        } else if ((context->depth == 2) && (context->setting != NULL)) {
+            context->variable = NULL;
+            for (i = 0; i < context->setting->nrofVariables; i++) {
+                if (strcasecmp(value, context->setting->variables[i].name) == 0) {
+                    if ((context->variablesSeen & (1 << i)) == 0) {
+                        context->variablesSeen |= 1 << i;
+                        context->variable = &context->setting->variables[i];
+                    }
+                    break;
+                }
+            }
+        }
+        return 0;
+
+    default:
+        if (context->depth == 1) {
+            context->pendingSetting = NULL;
+        } else if ((context->depth == 2) && (context->variable != NULL)) {
+            context->errorMsg = setVariable(context->handle, context->variable, event, value);
+            context->variable = NULL;
+            if (context->errorMsg != NULL) {
+                return -1;
+            }
+        }
+        return 0;
     }
-    return ESP_FAIL;
+}
+
+static int configOpenSetting(struct configContext *context, struct setting *setting)
+{
+    esp_err_t err = nvs_open(setting->name, NVS_READWRITE, &context->handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open %s error %d", setting->name, err);
+        context->errorMsg = "Failed to open NVS";
+        return -1;
+    }
+    context->setting = setting;
+    context->variable = NULL;
+    context->variablesSeen = 0;
+    return 0;
+}
+
+static int configCloseSetting(struct configContext *context)
+{
+    struct setting *setting = context->setting;
+    esp_err_t err;
+
+    if (setting == NULL) {
+        return 0;
+    }
+    err = nvs_commit(context->handle);
+    nvs_close(context->handle);
+    context->setting = NULL;
+    context->variable = NULL;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to commit %s error %d", setting->name, err);
+        context->errorMsg = "Failed to write NVS";
+        return -1;
+    }
+    return 0;
 }
 
 esp_err_t provisioningConfigGetHandler(httpd_req_t *req)
@@ -202,74 +298,57 @@ static void reboot(TimerHandle_t xTimer)
     esp_restart();
 }
 
-static char *setVariables(nvs_handle handle, struct setting *setting, cJSON *object)
+static const char *setVariable(nvs_handle handle, struct variable *variable, JsonStreamEvent_e event, const char *value)
 {
     esp_err_t err = ESP_OK;
-    char *errorMsg = NULL;
-    int i;
-    for (i=0; i < setting->nrofVariables; i ++) {
-        struct variable *foundVariable = &setting->variables[i];
-        cJSON *value = cJSON_GetObjectItem(object, foundVariable->name);
-        if (value == NULL) {
-            ESP_LOGI(TAG, "No variable %s defined for group %s", foundVariable->name, setting->name);
-            continue;
-        }
-        switch(foundVariable->type) {
-        case FT_STRING:
-        case FT_SSID:
-        case FT_USERNAME:
-        case FT_PASSWORD:
-        case FT_HOSTNAME: {
-            char *valueStr = cJSON_GetStringValue(value);
-            if (valueStr == NULL) {
-                errorMsg = "Failed to extract string variable value";
-                goto error;
-            }
-            ESP_LOGI(TAG,"Setting %s to \"%s\"", foundVariable->name, valueStr);
-            err = nvs_set_str(handle, foundVariable->name, valueStr);
+
+    switch(variable->type) {
+    case FT_STRING:
+    case FT_SSID:
+    case FT_USERNAME:
+    case FT_PASSWORD:
+    case FT_HOSTNAME:
+        if (event != JSON_STREAM_STRING) {
+            return "Failed to extract string variable value";
         }
+        ESP_LOGI(TAG,"Setting %s to \"%s\"", variable->name, value);
+        err = nvs_set_str(handle, variable->name, value);
         break;
-        case FT_PORT: {
-            if (!cJSON_IsNumber(value)) {
-                errorMsg = "Failed to extract int variable value";
-                goto error;
-            }
-            uint16_t valueNumber = (uint16_t) value->valuedouble;
-            ESP_LOGI(TAG,"Setting %s to %u", foundVariable->name, valueNumber);
-            err = nvs_set_u16(handle, foundVariable->name, valueNumber);
+    case FT_PORT: {
+        if (event != JSON_STREAM_NUMBER) {
+            return "Failed to extract int variable value";
         }
-        break;
-        case FT_CHECKBOX: {
-            if (!cJSON_IsBool(value)) {
-                errorMsg = "Failed to extract bool variable value";
-                goto error;
-            }
-            ESP_LOGI(TAG,"Setting %s to %s", foundVariable->name, cJSON_IsTrue(value) ? "true":"false");
-            err = nvs_set_u8(handle, foundVariable->name, cJSON_IsTrue(value));
+        uint16_t valueNumber = (uint16_t) strtod(value, NULL);
+        ESP_LOGI(TAG,"Setting %s to %u", variable->name, valueNumber);
+        err = nvs_set_u16(handle, variable->name, valueNumber);
+    }
+    break;
+    case FT_CHECKBOX:
+        if ((event != JSON_STREAM_TRUE) && (event != JSON_STREAM_FALSE)) {
+            return "Failed to extract bool variable value";
         }
+        ESP_LOGI(TAG,"Setting %s to %s", variable->name, event == JSON_STREAM_TRUE ? "true":"false");
+        err = nvs_set_u8(handle, variable->name, event == JSON_STREAM_TRUE);
         break;
-        case FT_DEVICE_ID:
-            break;
-        case FT_CHOICE: {
-            if (!cJSON_IsNumber(value)) {
-                errorMsg = "Failed to extract int variable value";
-                goto error;
-            }
-            int32_t choiceValue = (int32_t) value->valuedouble;
-            ESP_LOGI(TAG,"Setting %s to %d", foundVariable->name, choiceValue);
-            err = nvs_set_i32(handle, foundVariable->name, choiceValue);
-        }
+    case FT_DEVICE_ID:
         break;
-        default:
-            err = ESP_FAIL;
-            break;
-        }
-        if (err != ESP_OK) {
-            ESP_LOGW(TAG, "setVariable failed for variable %s type %d err %d", foundVariable->name, foundVariable->type, err);
+    case FT_CHOICE: {
+        if (event != JSON_STREAM_NUMBER) {
+            return "Failed to extract int variable value";
         }
+        int32_t choiceValue = (int32_t) strtod(value, NULL);
+        ESP_LOGI(TAG,"Setting %s to %d", variable->name, choiceValue);
+        err = nvs_set_i32(handle, variable->name, choiceValue);
     }
-error:
-    return errorMsg;
+    break;
+    default:
+        err = ESP_FAIL;
+        break;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "setVariable failed for variable %s type %d err %d", variable->name, variable->type, err);
+    }
+    return NULL;
 }
 
 static bool getVariables(nvs_handle handle, struct setting *setting, cJSON *object)
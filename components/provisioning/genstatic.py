@@ -6,11 +6,13 @@ import datetime
 import argparse
 import gzip
 import zlib
+import hashlib
 from bs4 import BeautifulSoup
 import requests
 
 RE_FILENAME_DATA_SECTION=re.compile(r'[./\- ]')
 SIZE_FLAG_COMPRESSED = 0x80000000
+ETAG_LEN = 16
 cache_dir = None
 
 def compress(data):
@@ -68,6 +70,16 @@ class StaticFile:
             self.data = load(self.path)
         return self.data
 
+    @property
+    def etag(self):
+        # Hash of the uncompressed content, so it only changes when the content does
+        return hashlib.sha256(self.load()).hexdigest()[:ETAG_LEN]
+
+    @property
+    def immutable(self):
+        # Everything but the html pages is referenced with a versioned url, see version_references()
+        return not self.filename.endswith('.html')
+
     def generate_data_section(self):
         can_compress = True
         if self.filename.endswith('.css'):
@@ -88,6 +100,8 @@ class StaticFile:
         data_section = f"""static const struct static_file_data {self.data_section_name} = {{
     .size= {size} {compression},
     .content_type= {content_type},
+    .etag= "{self.etag}",
+    .immutable= {'true' if self.immutable else 'false'},
     .data= {{
         """
 
@@ -161,10 +175,25 @@ def process_html_file(html_file, files):
     script = soup.new_tag('script')
     script.append(js_data)
     body.append(script)
+    version_references(html_file, soup, files)
     html_file.data = str(soup).encode()
     return files_linked, files_embedded
 
 
+def version_references(html_file, soup, files):
+    """Add the content hash to the url of each linked file so they can be cached indefinitely."""
+    for tag, attr in (('link', 'href'), ('script', 'src'), ('img', 'src')):
+        for element in soup.find_all(tag):
+            url = element.get(attr)
+            if url is None or '://' in url or '?' in url:
+                continue
+            filename = os.path.normpath(os.path.join(os.path.dirname(html_file.filename), url))
+            for f in files:
+                if f.filename == filename:
+                    element[attr] = f"{url}?v={f.etag[:8]}"
+                    break
+
+
 def process_files(files):
     processed_files = []
     files_linked = set()
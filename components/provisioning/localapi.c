@@ -0,0 +1,452 @@
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_http_server.h>
+#include <nvs_flash.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "sdkconfig.h"
+#include "provisioning_int.h"
+#include "iot.h"
+#include "utils.h"
+#include "cJSON.h"
+
+/*
+ * Local control API, lets a controller on the same network read element state and send controls without going via
+ * the MQTT server.
+ *
+ * GET  /api/state                  JSON object mapping each pub topic ("element" or "element/pub") to its value.
+ * POST /api/ctrl?topic=element/sub Body is the control payload, exactly as it would be sent over MQTT.
+ * GET  /api/ws                     WebSocket, send "element/sub payload" text frames to control elements, every
+ *                                  change to a pub is pushed as a "element/pub value" text frame.
+ *
+ * Requests must include the key set in the localapi settings in an X-Api-Key header. Browsers can't set headers on
+ * WebSocket requests, so /api/ws also accepts it as a key query parameter. Only there, as URLs end up in logs and
+ * browser history. Only announced elements are accessible, device control (restart, profile, update) is only
+ * available over MQTT.
+ */
+
+#define API_KEY_HEADER "x-api-key"
+#define WS_URI "/api/ws"
+#define MAX_KEY_LEN 65
+#define MAX_QUERY_LEN 160
+#define MAX_TOPIC_LEN 96
+#define MAX_PAYLOAD_LEN 128
+#define MAX_MESSAGE_LEN (MAX_TOPIC_LEN + 1 + MAX_PAYLOAD_LEN)
+
+#ifndef CONFIG_LOCAL_API_MAX_CLIENTS
+#define CONFIG_LOCAL_API_MAX_CLIENTS 2
+#endif
+
+static const char TAG[] = "localapi";
+
+static char *apiKey = NULL;
+static httpd_handle_t apiServer = NULL;
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+/*
+ * Socket descriptors of connected WebSocket clients, -1 if the slot is free. Changed by the server task and read by
+ * whichever task publishes, so only accessed with wsClientsMutex held.
+ */
+static SemaphoreHandle_t wsClientsMutex = NULL;
+static int wsClients[CONFIG_LOCAL_API_MAX_CLIENTS];
+static int nrofWsClients = 0;
+#endif
+
+static esp_err_t localApiStateHandler(httpd_req_t *req);
+static esp_err_t localApiCtrlHandler(httpd_req_t *req);
+static bool localApiCheckKey(httpd_req_t *req, bool allowQuery);
+static bool localApiKeyEqual(const char *key);
+static int localApiDispatch(char *topic, char *payload, size_t len);
+static bool localApiTopic(iotElement_t element, int pubId, char *buffer, size_t len);
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+static esp_err_t localApiWsHandler(httpd_req_t *req);
+static void localApiWsRemoveClosed(void);
+static void localApiPubListener(iotElement_t element, int pubId, iotValue_t value);
+static void localApiWsSend(void *arg);
+#endif
+
+static const httpd_uri_t handlers[] = {{
+        .method = HTTP_GET,
+        .uri = "/api/state",
+        .handler = localApiStateHandler,
+        .user_ctx = NULL
+    }, {
+        .method = HTTP_POST,
+        .uri = "/api/ctrl",
+        .handler = localApiCtrlHandler,
+        .user_ctx = NULL
+    },
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    {
+        .method = HTTP_GET,
+        .uri = WS_URI,
+        .handler = localApiWsHandler,
+        .user_ctx = NULL,
+        .is_websocket = true
+    }
+#endif
+};
+
+void provisioningLocalApiStart(httpd_handle_t server)
+{
+    nvs_handle handle;
+    int i;
+
+    if (nvs_open("localapi", NVS_READONLY, &handle) == ESP_OK) {
+        if (nvs_get_str_alloc(handle, "key", &apiKey) != ESP_OK) {
+            apiKey = NULL;
+        }
+        nvs_close(handle);
+    }
+    if ((apiKey == NULL) || (apiKey[0] == 0)) {
+        ESP_LOGI(TAG, "No key set, local API disabled");
+        return;
+    }
+    apiServer = server;
+    for (i = 0; i < sizeof(handlers)/sizeof(httpd_uri_t); i++) {
+        httpd_register_uri_handler(server, &handlers[i]);
+    }
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    wsClientsMutex = xSemaphoreCreateMutex();
+    if (wsClientsMutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create WebSocket clients mutex");
+        return;
+    }
+    for (i = 0; i < CONFIG_LOCAL_API_MAX_CLIENTS; i++) {
+        wsClients[i] = -1;
+    }
+    iotSetPubListener(localApiPubListener);
+#endif
+}
+
+bool provisioningLocalApiUriMatch(const char *reference, const char *uri, size_t len)
+{
+    if ((strlen(reference) != len) || (strncmp(reference, uri, len) != 0)) {
+        return false;
+    }
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    /*
+     * The server completes the WebSocket handshake before calling the handler, so a full server is turned away here
+     * (as not found) rather than accepting the client and then closing it.
+     */
+    if ((apiServer != NULL) && (wsClientsMutex != NULL) && (strcmp(reference, WS_URI) == 0)) {
+        bool full;
+        localApiWsRemoveClosed();
+        xSemaphoreTake(wsClientsMutex, portMAX_DELAY);
+        full = nrofWsClients >= CONFIG_LOCAL_API_MAX_CLIENTS;
+        xSemaphoreGive(wsClientsMutex);
+        if (full) {
+            ESP_LOGW(TAG, "Too many WebSocket clients");
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+static esp_err_t localApiStateHandler(httpd_req_t *req)
+{
+    iotElementIterator_t iterator = IOT_ELEMENT_ITERATOR_START;
+    iotElement_t element;
+    cJSON *object;
+    char *state;
+
+    if (!localApiCheckKey(req, false)) {
+        return ESP_FAIL;
+    }
+    object = cJSON_CreateObject();
+    if (object == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    iotElementsLock();
+    while (iotElementIterate(&iterator, true, &element)) {
+        const iotElementDescription_t *desc = iotElementGetDescription(element);
+        int pubId;
+        for (pubId = 0; pubId < desc->nrofPubs; pubId++) {
+            char topic[MAX_TOPIC_LEN];
+            char buffer[IOT_VALUE_STR_LEN];
+            iotValueType_t type;
+            iotValue_t value;
+            const char *str;
+
+            if (!iotElementGetPubValue(element, pubId, &type, &value) || !localApiTopic(element, pubId, topic, sizeof(topic))) {
+                continue;
+            }
+            str = iotValueToString(type, value, buffer, sizeof(buffer));
+            if (str != NULL) {
+                cJSON_AddStringToObject(object, topic, str);
+            }
+        }
+    }
+    iotElementsUnlock();
+    state = cJSON_PrintUnformatted(object);
+    cJSON_Delete(object);
+    if (state == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    provisioningSetContentType(req, CT_JSON);
+    httpd_resp_send(req, state, strlen(state));
+    free(state);
+    return ESP_OK;
+}
+
+static esp_err_t localApiCtrlHandler(httpd_req_t *req)
+{
+    char query[MAX_QUERY_LEN];
+    char topic[MAX_TOPIC_LEN];
+    char payload[MAX_PAYLOAD_LEN];
+    size_t off = 0;
+    int ret;
+
+    if (!localApiCheckKey(req, false)) {
+        return ESP_FAIL;
+    }
+    if ((httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) ||
+            (httpd_query_key_value(query, "topic", topic, sizeof(topic)) != ESP_OK)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "topic missing");
+        return ESP_FAIL;
+    }
+    if (req->content_len >= sizeof(payload)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "payload too long");
+        return ESP_FAIL;
+    }
+    while (off < req->content_len) {
+        ret = httpd_req_recv(req, payload + off, req->content_len - off);
+        if (ret <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                httpd_resp_send_408(req);
+            }
+            return ESP_FAIL;
+        }
+        off += ret;
+    }
+    payload[off] = 0;
+
+    if (localApiDispatch(topic, payload, off)) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_status(req, "204 No Content");
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+}
+
+/* allowQuery also accepts the key as a key query parameter, only for the WebSocket handshake, see the top of the file */
+static bool localApiCheckKey(httpd_req_t *req, bool allowQuery)
+{
+    char key[MAX_KEY_LEN];
+    char query[MAX_QUERY_LEN];
+    size_t pathLen;
+
+    if (httpd_req_get_hdr_value_str(req, API_KEY_HEADER, key, sizeof(key)) == ESP_OK) {
+        if (localApiKeyEqual(key)) {
+            return true;
+        }
+    } else if (allowQuery && (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) &&
+               (httpd_query_key_value(query, "key", key, sizeof(key)) == ESP_OK)) {
+        if (localApiKeyEqual(key)) {
+            return true;
+        }
+    }
+    /* Without the query, which may hold the rejected key */
+    pathLen = strcspn(req->uri, "?");
+    ESP_LOGW(TAG, "Request for %.*s with missing or invalid key", (int)pathLen, req->uri);
+    httpd_resp_set_status(req, "403 Forbidden");
+    httpd_resp_send(req, NULL, 0);
+    return false;
+}
+
+/* Compare every character so the time taken doesn't reveal how much of the key matched */
+static bool localApiKeyEqual(const char *key)
+{
+    size_t len = strlen(apiKey);
+    uint8_t diff = 0;
+    size_t i;
+
+    if (strlen(key) != len) {
+        return false;
+    }
+    for (i = 0; i < len; i++) {
+        diff |= key[i] ^ apiKey[i];
+    }
+    return diff == 0;
+}
+
+/*
+ * topic is "element/sub" or just "element" for the default control sub, matched the same way as MQTT topics.
+ * Runs in the server task, so the element list is held to keep the MQTT task from removing the element while its
+ * callback runs, as it does when a profile change recreates relays and switches.
+ */
+static int localApiDispatch(char *topic, char *payload, size_t len)
+{
+    iotElementIterator_t iterator = IOT_ELEMENT_ITERATOR_START;
+    iotElement_t element;
+    int result = -1;
+
+    iotElementsLock();
+    while (iotElementIterate(&iterator, true, &element)) {
+        const char *name = iotElementGetName(element);
+        size_t nameLen = strlen(name);
+        if (strncmp(topic, name, nameLen) != 0) {
+            continue;
+        }
+        if (topic[nameLen] == 0) {
+            result = iotElementSubDispatch(element, NULL, payload, len);
+            break;
+        }
+        if ((topic[nameLen] == '/') && (iotElementSubDispatch(element, &topic[nameLen + 1], payload, len) == 0)) {
+            result = 0;
+            break;
+        }
+    }
+    iotElementsUnlock();
+    return result;
+}
+
+static bool localApiTopic(iotElement_t element, int pubId, char *buffer, size_t len)
+{
+    const char *pubName = iotElementGetPubName(element, pubId);
+    int written;
+
+    if ((pubName == NULL) || (pubName[0] == 0)) {
+        written = snprintf(buffer, len, "%s", iotElementGetName(element));
+    } else {
+        written = snprintf(buffer, len, "%s/%s", iotElementGetName(element), pubName);
+    }
+    return (written > 0) && (written < len);
+}
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+static esp_err_t localApiWsHandler(httpd_req_t *req)
+{
+    httpd_ws_frame_t frame;
+    char message[MAX_MESSAGE_LEN + 1];
+    char *payload;
+    int i;
+
+    if (req->method == HTTP_GET) {
+        /* Handshake, provisioningLocalApiUriMatch has already checked there is a free slot */
+        int fd = httpd_req_to_sockfd(req);
+        if (!localApiCheckKey(req, true)) {
+            return ESP_FAIL;
+        }
+        xSemaphoreTake(wsClientsMutex, portMAX_DELAY);
+        for (i = 0; i < CONFIG_LOCAL_API_MAX_CLIENTS; i++) {
+            if (wsClients[i] == -1) {
+                wsClients[i] = fd;
+                nrofWsClients++;
+                break;
+            }
+        }
+        xSemaphoreGive(wsClientsMutex);
+        if (i == CONFIG_LOCAL_API_MAX_CLIENTS) {
+            ESP_LOGW(TAG, "Too many WebSocket clients");
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "WebSocket client %d connected", fd);
+        return ESP_OK;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    if (httpd_ws_recv_frame(req, &frame, 0) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (frame.type != HTTPD_WS_TYPE_TEXT) {
+        return ESP_OK;
+    }
+    if (frame.len > MAX_MESSAGE_LEN) {
+        ESP_LOGW(TAG, "WebSocket message too long (%d)", frame.len);
+        return ESP_FAIL;
+    }
+    frame.payload = (uint8_t *)message;
+    if (httpd_ws_recv_frame(req, &frame, frame.len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    message[frame.len] = 0;
+
+    payload = strchr(message, ' ');
+    if (payload == NULL) {
+        ESP_LOGW(TAG, "WebSocket message missing payload");
+        return ESP_OK;
+    }
+    *payload = 0;
+    payload++;
+    if (localApiDispatch(message, payload, strlen(payload))) {
+        ESP_LOGW(TAG, "WebSocket message for unknown topic %s", message);
+    }
+    return ESP_OK;
+}
+
+/* Called from the publishing task, formats the message and leaves sending it to the server task */
+static void localApiPubListener(iotElement_t element, int pubId, iotValue_t value)
+{
+    const iotElementDescription_t *desc = iotElementGetDescription(element);
+    char topic[MAX_TOPIC_LEN];
+    char buffer[IOT_VALUE_STR_LEN];
+    const char *str;
+    char *message;
+    int clients;
+
+    xSemaphoreTake(wsClientsMutex, portMAX_DELAY);
+    clients = nrofWsClients;
+    xSemaphoreGive(wsClientsMutex);
+    if ((clients == 0) || ((iotElementGetFlags(element) & IOT_ELEMENT_FLAGS_DONT_ANNOUNCE) != 0) ||
+            (desc->pubs[pubId].type == IOT_VALUE_TYPE_ON_CONNECT)) {
+        return;
+    }
+    str = iotValueToString(desc->pubs[pubId].type, value, buffer, sizeof(buffer));
+    if ((str == NULL) || !localApiTopic(element, pubId, topic, sizeof(topic))) {
+        return;
+    }
+    if (asprintf(&message, "%s %s", topic, str) == -1) {
+        return;
+    }
+    if (httpd_queue_work(apiServer, localApiWsSend, message) != ESP_OK) {
+        free(message);
+    }
+}
+
+/* Runs in the server task, which is the only task that closes sockets, so the clients can't go away while sending */
+static void localApiWsSend(void *arg)
+{
+    httpd_ws_frame_t frame;
+    int clients[CONFIG_LOCAL_API_MAX_CLIENTS];
+    int i;
+
+    localApiWsRemoveClosed();
+    xSemaphoreTake(wsClientsMutex, portMAX_DELAY);
+    memcpy(clients, wsClients, sizeof(clients));
+    xSemaphoreGive(wsClientsMutex);
+
+    memset(&frame, 0, sizeof(frame));
+    frame.type = HTTPD_WS_TYPE_TEXT;
+    frame.payload = arg;
+    frame.len = strlen(arg);
+    for (i = 0; i < CONFIG_LOCAL_API_MAX_CLIENTS; i++) {
+        if (clients[i] != -1) {
+            httpd_ws_send_frame_async(apiServer, clients[i], &frame);
+        }
+    }
+    free(arg);
+}
+
+/* Free the slots of clients that have gone away, only called from the server task */
+static void localApiWsRemoveClosed(void)
+{
+    int i;
+
+    xSemaphoreTake(wsClientsMutex, portMAX_DELAY);
+    for (i = 0; i < CONFIG_LOCAL_API_MAX_CLIENTS; i++) {
+        if ((wsClients[i] != -1) && (httpd_ws_get_fd_info(apiServer, wsClients[i]) != HTTPD_WS_CLIENT_WEBSOCKET)) {
+            ESP_LOGI(TAG, "WebSocket client %d disconnected", wsClients[i]);
+            wsClients[i] = -1;
+            nrofWsClients--;
+        }
+    }
+    xSemaphoreGive(wsClientsMutex);
+}
+#endif
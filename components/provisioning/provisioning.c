@@ -1,3 +1,6 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <esp_log.h>
 #include <esp_http_server.h>
 
@@ -12,10 +15,23 @@
 
 #define DICT_SIZE 1024
 #define DECOMPRESS_BUFFER_SIZE 1024
+#define MAX_IF_NONE_MATCH_LEN 128
+#define MAX_ETAG_LEN 24 /* Quotes, hash, "-gz" suffix and terminator */
+#define MAX_URI_HANDLERS 16
 
 static const char *TAG="PROVISION";
 static const char *ACCEPT_ENCODING = "accept-encoding";
 static const char *CONTENT_ENCODING = "content-encoding";
+static const char *IF_NONE_MATCH = "if-none-match";
+static const char *ETAG = "etag";
+static const char *CACHE_CONTROL = "cache-control";
+static const char *VARY = "vary";
+static const char *CACHE_IMMUTABLE = "public, max-age=31536000, immutable";
+static const char *CACHE_REVALIDATE = "no-cache";
+
+/* Only used from the http server task, allocated on first use and kept for subsequent requests */
+static unsigned char *decompressDict = NULL;
+static unsigned char *decompressBuffer = NULL;
 
 static const char *content_types[CT_MAX] = {
     NULL,
@@ -48,6 +64,7 @@ static const httpd_uri_t handlers[] = {{
 };
 
 static bool isCompressionAcceptable(httpd_req_t *req);
+static bool isNotModified(httpd_req_t *req, const char *etag);
 static esp_err_t sendDecompressed(httpd_req_t *req, const struct static_file_data *resp);
 
 int provisioningInit(void)
@@ -62,6 +79,11 @@ int provisioningStart(void)
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 
+    config.max_uri_handlers = MAX_URI_HANDLERS;
+#ifdef CONFIG_LOCAL_API
+    config.uri_match_fn = provisioningLocalApiUriMatch;
+#endif
+
     ESP_LOGI(TAG, "Starting server on port: %d", config.server_port);
     if (httpd_start(&server, &config) != ESP_OK) {
         return 1;
@@ -73,6 +95,9 @@ int provisioningStart(void)
     for (i = 0; i < sizeof(handlers)/sizeof(httpd_uri_t); i++) {
         httpd_register_uri_handler(server, &handlers[i]);
     }
+#ifdef CONFIG_LOCAL_API
+    provisioningLocalApiStart(server);
+#endif
 
     return 0;
 }
@@ -88,10 +113,29 @@ void provisioningSetContentType(httpd_req_t *req, enum ContentType content_type)
 esp_err_t provisioningStaticFileHandler(httpd_req_t *req)
 {
     const struct static_file_data* resp = (const struct static_file_data*) req->user_ctx;
+    bool compressed = (resp->size & SIZE_FLAG_COMPRESSED) != 0;
+    char etag[MAX_ETAG_LEN];
+
+    // Check if compression via gzip is acceptable?
+    if (compressed && !isCompressionAcceptable(req)) {
+        compressed = false;
+    }
+    /* Each encoding is a different representation so needs its own strong ETag */
+    snprintf(etag, sizeof(etag), "\"%s%s\"", resp->etag, compressed ? "-gz" : "");
+    httpd_resp_set_hdr(req, ETAG, etag);
+    httpd_resp_set_hdr(req, CACHE_CONTROL, resp->immutable ? CACHE_IMMUTABLE : CACHE_REVALIDATE);
+    if (resp->size & SIZE_FLAG_COMPRESSED) {
+        httpd_resp_set_hdr(req, VARY, ACCEPT_ENCODING);
+    }
+    if (isNotModified(req, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+
     provisioningSetContentType(req, resp->content_type);
     if (resp->size & SIZE_FLAG_COMPRESSED) {
-        // Check if compression via gzip is acceptable?
-        if (!isCompressionAcceptable(req)) {
+        if (!compressed) {
             return sendDecompressed(req, resp);
         }
         httpd_resp_set_hdr(req, CONTENT_ENCODING, "gzip");
@@ -117,50 +161,86 @@ static bool isCompressionAcceptable(httpd_req_t *req)
     return result;
 }
 
+/*
+ * etag is the quoted tag of the representation being sent. If-None-Match is a comma separated list of tags, it uses
+ * the weak comparison so a W/ prefix is ignored, but each tag has to match the whole of etag so a tag for the other
+ * encoding doesn't.
+ */
+static bool isNotModified(httpd_req_t *req, const char *etag)
+{
+    char value[MAX_IF_NONE_MATCH_LEN];
+    size_t len = httpd_req_get_hdr_value_len(req, IF_NONE_MATCH);
+    size_t etagLen = strlen(etag);
+    char *tag = value;
+
+    if ((len == 0) || (len >= sizeof(value))) {
+        return false;
+    }
+    if (httpd_req_get_hdr_value_str(req, IF_NONE_MATCH, value, sizeof(value)) != ESP_OK) {
+        return false;
+    }
+    while (*tag != 0) {
+        size_t tagLen;
+        while ((*tag == ' ') || (*tag == '\t') || (*tag == ',')) {
+            tag++;
+        }
+        if (strncmp(tag, "W/", 2) == 0) {
+            tag += 2;
+        }
+        tagLen = strcspn(tag, ", \t");
+        if ((tagLen == 1) && (tag[0] == '*')) {
+            return true;
+        }
+        if ((tagLen == etagLen) && (strncmp(tag, etag, etagLen) == 0)) {
+            return true;
+        }
+        tag += tagLen;
+    }
+    return false;
+}
+
 static esp_err_t sendDecompressed(httpd_req_t *req, const struct static_file_data *resp)
 {
-    int res;
+    int r;
     struct uzlib_uncomp d;
-    unsigned char *buffer;
-    unsigned char *dict;
 
-    dict = malloc(DICT_SIZE);
-    if (dict == NULL) {
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+    if (decompressDict == NULL) {
+        decompressDict = malloc(DICT_SIZE);
+        if (decompressDict == NULL) {
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
     }
-    uzlib_uncompress_init(&d, dict, DICT_SIZE);
+    if (decompressBuffer == NULL) {
+        decompressBuffer = malloc(DECOMPRESS_BUFFER_SIZE);
+        if (decompressBuffer == NULL) {
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+    }
+    uzlib_uncompress_init(&d, decompressDict, DICT_SIZE);
     d.source = (unsigned char*) resp->data;
     d.source_limit = (unsigned char*)resp->data + SF_GET_SIZE(resp->size) - 4;
-    res = uzlib_gzip_parse_header(&d);
-    if (res != TINF_OK) {
+    if (uzlib_gzip_parse_header(&d) != TINF_OK) {
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
 
-    buffer = malloc(DECOMPRESS_BUFFER_SIZE);
-    if (buffer == NULL) {
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
-    }
-    ESP_LOGI(TAG, "Decompression buffer allocated.");
-    d.dest = d.dest_start = buffer;
-    d.dest_limit = buffer + DECOMPRESS_BUFFER_SIZE;
-    int r = uzlib_uncompress(&d);
-    ESP_LOGI(TAG, "uncompress result %d", r);
+    d.dest = d.dest_start = decompressBuffer;
+    d.dest_limit = decompressBuffer + DECOMPRESS_BUFFER_SIZE;
+    r = uzlib_uncompress(&d);
     while (r == TINF_OK) {
-        ESP_LOGI(TAG, "Decompressed chunk, dest %p (limit %p) source %p (limit %p)", d.dest, d.dest_limit, d.source, d.source_limit);
-        httpd_resp_send_chunk(req, (char*)buffer, d.dest - buffer);
-        ESP_LOGI(TAG, "Sent decompressed chunk");
-        d.dest = buffer;
+        ESP_LOGD(TAG, "Decompressed chunk, dest %p (limit %p) source %p (limit %p)", d.dest, d.dest_limit, d.source, d.source_limit);
+        if (httpd_resp_send_chunk(req, (char*)decompressBuffer, d.dest - decompressBuffer) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        d.dest = decompressBuffer;
         r = uzlib_uncompress(&d);
-        ESP_LOGI(TAG, "uncompress result %d", r);
     }
-    if (d.dest != buffer) {
-        httpd_resp_send_chunk(req, (char*)buffer, d.dest - buffer);
+    ESP_LOGD(TAG, "uncompress result %d", r);
+    if (d.dest != decompressBuffer) {
+        httpd_resp_send_chunk(req, (char*)decompressBuffer, d.dest - decompressBuffer);
     }
     httpd_resp_send_chunk(req, NULL, 0);
-    free(buffer);
-    free(dict);
     return ESP_OK;
-}
\ No newline at end of file
+}
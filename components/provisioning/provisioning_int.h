@@ -1,6 +1,7 @@
 #ifndef _PROVISIONING_INT_H_
 #define _PROVISIONING_INT_H_
 #include <stdint.h>
+#include <stdbool.h>
 #include <esp_http_server.h>
 
 enum ContentType {
@@ -16,6 +17,8 @@ enum ContentType {
 struct static_file_data {
     uint32_t size;
     const int content_type;
+    const char *etag; /* Hash of the uncompressed content */
+    const bool immutable; /* Referenced with a versioned url so can be cached indefinitely */
     const char data[];
 };
 
@@ -26,6 +29,9 @@ esp_err_t provisioningComponentsJsonFileHandler(httpd_req_t *req);
 esp_err_t provisioningWifiScanGetHandler(httpd_req_t *req);
 
 void provisioningRegisterStaticFileHandlers(httpd_handle_t server);
+void provisioningLocalApiStart(httpd_handle_t server);
+/* URI matcher for the server, exact matches that turn away WebSocket clients once the local API is full */
+bool provisioningLocalApiUriMatch(const char *reference, const char *uri, size_t len);
 void provisioningSetContentType(httpd_req_t *req, enum ContentType content_type);
 
 
@@ -5,6 +5,7 @@
 
 #include "iot.h"
 #include "notifications.h"
+#include "timerWheel.h"
 
 typedef struct Relay Relay_t;
 
@@ -31,11 +32,10 @@ struct Relay {
 typedef struct RelayTimeout {
     bool targetValue;
     uint32_t timeoutSeconds;
-    TimerHandle_t timer;
-    uint32_t secondsLeft;
+    TimerWheelEntry_t timer;
     Relay_t *relay;
     iotElement_t element;
-    char *stateStr;
+    char stateStr[56]; // {"active":false,"left":4294967295,"timeout":4294967295}
 } RelayTimeout_t;
 
 typedef struct RelayLockout {
@@ -49,11 +49,27 @@ void relayNewIOTElement(Relay_t *relay, char *nameFmt);
 void relaySetState(Relay_t *relay, bool on);
 bool relayIsOn(Relay_t *relay);
 const char* relayGetName(Relay_t *relay);
+/* Remove the relay's iot element and id, the relay is left in its current state */
+void relayDeinit(Relay_t *relay);
+
+/*
+ * Put a GPIO relay back to the state it was last in and keep track of its state from now on, see restore.c.
+ * Disabling keeps the recorded state so it is restored if the relay is enabled again.
+ */
+void relayEnableRestore(Relay_t *relay);
+void relayDisableRestore(Relay_t *relay);
 
 void relayRegister(Relay_t *relay, const char *id);
+void relayUnregister(Relay_t *relay);
 Relay_t* relayFind(const char *id);
 
 void relayLockoutInit(uint8_t id, char *relayId, char *lockoutId, RelayLockout_t *lockout);
+void relayLockoutDeinit(RelayLockout_t *lockout);
 
 void relayTimeoutInit(uint8_t id, char *relay, bool targetValue, uint32_t seconds, RelayTimeout_t *timeout);
+/*
+ * Stop and remove the timeout, on success the countdown callback will not run again so timeout can be freed.
+ * Returns -1 if the timer task did not respond in time, in which case timeout must not be freed.
+ */
+int relayTimeoutDeinit(RelayTimeout_t *timeout);
 #endif
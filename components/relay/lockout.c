@@ -25,6 +25,7 @@ void relayLockoutInit(uint8_t id, char *relayId, char *lockoutId, RelayLockout_t
 {
     Relay_t *state = &lockout->state;
     state->element = NULL;
+    state->id = NOTIFICATIONS_ID_ERROR;
     state->intf = &lockoutIntf;
     state->fields.id = id;
     state->fields.on = true; // So that we can set it to false in relaySetState!
@@ -35,6 +36,7 @@ void relayLockoutInit(uint8_t id, char *relayId, char *lockoutId, RelayLockout_t
     substituteRelay->intf = &substituteIntf;
     substituteRelay->data = 0u;
     substituteRelay->element = NULL;
+    substituteRelay->id = NOTIFICATIONS_ID_ERROR;
 
     lockout->relay = relayFind(relayId);
     if (lockout->relay == NULL) {
@@ -45,6 +47,13 @@ void relayLockoutInit(uint8_t id, char *relayId, char *lockoutId, RelayLockout_t
     }
 }
 
+void relayLockoutDeinit(RelayLockout_t *lockout)
+{
+    relayDeinit(&lockout->substituteRelay);
+    relayDeinit(&lockout->state);
+    lockout->relay = NULL;
+}
+
 static void lockoutSetState(Relay_t *relay, bool on)
 {
     relay->fields.on = on;
@@ -1,6 +1,7 @@
 #include <stdbool.h>
 #include "gpiox.h"
 #include "relay.h"
+#include "relayInternal.h"
 #include "sdkconfig.h"
 #include "esp_log.h"
 #include "iot.h"
@@ -49,6 +50,15 @@ void relayNewIOTElement(Relay_t *relay, char *nameFmt)
     relay->element = iotNewElement(&elementDescription, 0, relayElementCallback, relay, nameFmt, relay->fields.id);
 }
 
+void relayDeinit(Relay_t *relay)
+{
+    relayUnregister(relay);
+    if (relay->element) {
+        iotDeleteElement(relay->element);
+        relay->element = NULL;
+    }
+}
+
 void relaySetState(Relay_t *relay, bool on)
 {
     if (on == relayIsOn(relay)) {
@@ -103,6 +113,7 @@ static void gpioRelaySetState(Relay_t *relay, bool on)
     ESP_LOGI(TAG, "Relay %d: Is on? %s (pin value %d)", relay->fields.pin, on ? "On":"Off", l);
     gpioxSetPins(&pins, &values);
     relay->fields.on = on;
+    relayRestoreStateChanged(relay->fields.pin, on);
 }
 
 
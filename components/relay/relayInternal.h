@@ -0,0 +1,8 @@
+#ifndef _RELAYINTERNAL_H_
+#define _RELAYINTERNAL_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Called by GPIO relays whenever their state is set, records the state if restore is enabled for the pin */
+void relayRestoreStateChanged(uint8_t pin, bool on);
+#endif
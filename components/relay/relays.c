@@ -31,6 +31,24 @@ void relayRegister(Relay_t *relay, const char *id)
     rootEntry = entry;
 }
 
+void relayUnregister(Relay_t *relay)
+{
+    struct RelayMapEntry **current = &rootEntry, *entry;
+    while (*current != NULL) {
+        entry = *current;
+        if (entry->relay == relay) {
+            *current = entry->next;
+            free(entry);
+        } else {
+            current = &entry->next;
+        }
+    }
+    if (relay->id != NOTIFICATIONS_ID_ERROR) {
+        notificationsRemoveId(relay->id);
+        relay->id = NOTIFICATIONS_ID_ERROR;
+    }
+}
+
 Relay_t *relayFind(const char *id)
 {
     struct RelayMapEntry *entry;
@@ -0,0 +1,177 @@
+#include <stdbool.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "gpiox.h"
+#include "relay.h"
+#include "relayInternal.h"
+#include "timerWheel.h"
+
+#define MAGIC 0x72656c79
+
+#define RESTORE_NAMESPACE "relays"
+#define RESTORE_KEY "state"
+
+#ifndef __NOINIT_ATTR
+#define __NOINIT_ATTR _SECTION_ATTR_IMPL(".noinit", __COUNTER__)
+#endif
+
+#if CONFIG_IDF_TARGET_ESP32
+static portMUX_TYPE restoreMux = portMUX_INITIALIZER_UNLOCKED;
+#define RESTORE_LOCK() portENTER_CRITICAL(&restoreMux)
+#define RESTORE_UNLOCK() portEXIT_CRITICAL(&restoreMux)
+#else
+#define RESTORE_LOCK() portENTER_CRITICAL()
+#define RESTORE_UNLOCK() portEXIT_CRITICAL()
+#endif
+
+typedef struct RelayStates {
+    GPIOX_Pins_t known; /* Pins with a recorded state */
+    GPIOX_Pins_t on;
+} RelayStates_t;
+
+/*
+ * Changes are recorded straight away in RAM that isn't cleared at startup, so they survive a software, panic or
+ * watchdog reset without touching the flash. They are written to NVS, for power cycles, once
+ * CONFIG_RELAY_RESTORE_SAVE_DELAY has passed since the first unsaved change, so however often the relays are switched
+ * there is at most one write per delay and none if they end up as they were.
+ */
+__NOINIT_ATTR static struct RelayRestoreCurrent {
+    uint32_t magic;
+    uint32_t check;
+    RelayStates_t states;
+} current;
+
+static const char TAG[] = "relay_restore";
+
+static RelayStates_t saved; /* As written to NVS */
+static GPIOX_Pins_t restorePins;
+static TimerWheelEntry_t saveTimer;
+static bool initialised = false;
+
+static void relayRestoreInit(void);
+static uint32_t relayRestoreCheck(RelayStates_t *states);
+static void relayRestoreSave(void *user, uint32_t secondsLeft);
+
+void relayEnableRestore(Relay_t *relay)
+{
+    uint8_t pin = relay->fields.pin;
+    bool known, on;
+
+    relayRestoreInit();
+    RESTORE_LOCK();
+    known = GPIOX_PINS_IS_SET(current.states.known, pin);
+    on = GPIOX_PINS_IS_SET(current.states.on, pin);
+    GPIOX_PINS_SET(restorePins, pin);
+    RESTORE_UNLOCK();
+    if (known) {
+        ESP_LOGI(TAG, "Relay %d: Restoring %s", pin, on ? "on" : "off");
+        relaySetState(relay, on);
+    } else {
+        relayRestoreStateChanged(pin, relayIsOn(relay));
+    }
+}
+
+void relayDisableRestore(Relay_t *relay)
+{
+    RESTORE_LOCK();
+    GPIOX_PINS_CLEAR(restorePins, relay->fields.pin);
+    RESTORE_UNLOCK();
+}
+
+void relayRestoreStateChanged(uint8_t pin, bool on)
+{
+    bool changed;
+
+    RESTORE_LOCK();
+    if (!GPIOX_PINS_IS_SET(restorePins, pin)) {
+        RESTORE_UNLOCK();
+        return;
+    }
+    changed = !GPIOX_PINS_IS_SET(current.states.known, pin) || (GPIOX_PINS_IS_SET(current.states.on, pin) != on);
+    GPIOX_PINS_SET(current.states.known, pin);
+    if (on) {
+        GPIOX_PINS_SET(current.states.on, pin);
+    } else {
+        GPIOX_PINS_CLEAR(current.states.on, pin);
+    }
+    current.check = relayRestoreCheck(&current.states);
+    RESTORE_UNLOCK();
+
+    /* Not restarted by later changes, so a relay that never stops changing is still saved */
+    if (changed && !timerWheelIsActive(&saveTimer)) {
+        timerWheelStart(&saveTimer, CONFIG_RELAY_RESTORE_SAVE_DELAY, 0);
+    }
+}
+
+static void relayRestoreInit(void)
+{
+    nvs_handle handle;
+    size_t len = sizeof(saved);
+
+    if (initialised) {
+        return;
+    }
+    initialised = true;
+    timerWheelEntryInit(&saveTimer, relayRestoreSave, NULL);
+
+    if (nvs_open(RESTORE_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        if ((nvs_get_blob(handle, RESTORE_KEY, &saved, &len) != ESP_OK) || (len != sizeof(saved))) {
+            memset(&saved, 0, sizeof(saved));
+        }
+        nvs_close(handle);
+    }
+    /* After a power cycle, or an update that moved the RAM, only the saved states are known */
+    if ((current.magic != MAGIC) || (current.check != relayRestoreCheck(&current.states))) {
+        current.states = saved;
+        current.check = relayRestoreCheck(&current.states);
+        current.magic = MAGIC;
+    } else if (memcmp(&current.states, &saved, sizeof(saved)) != 0) {
+        /* Changed shortly before the reset */
+        timerWheelStart(&saveTimer, CONFIG_RELAY_RESTORE_SAVE_DELAY, 0);
+    }
+}
+
+static uint32_t relayRestoreCheck(RelayStates_t *states)
+{
+    uint32_t check = ~MAGIC;
+    int i;
+
+    for (i = 0; i < GPIOX_PINS_SIZE; i++) {
+        check = ((check << 5) | (check >> 27)) ^ states->known.pins[i];
+        check = ((check << 5) | (check >> 27)) ^ states->on.pins[i];
+    }
+    return check;
+}
+
+/* Runs in the timer task, which is held up for the few ms the write takes */
+static void relayRestoreSave(void *user, uint32_t secondsLeft)
+{
+    RelayStates_t states;
+    nvs_handle handle;
+    esp_err_t err;
+
+    RESTORE_LOCK();
+    states = current.states;
+    RESTORE_UNLOCK();
+    if (memcmp(&states, &saved, sizeof(states)) == 0) {
+        return;
+    }
+    err = nvs_open(RESTORE_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, RESTORE_KEY, &states, sizeof(states));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save relay states (%d)", err);
+        return;
+    }
+    saved = states;
+    ESP_LOGI(TAG, "Relay states saved");
+}
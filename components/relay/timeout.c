@@ -1,20 +1,24 @@
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
 #include "sdkconfig.h"
 #include "esp_log.h"
 #include "iot.h"
 #include "relay.h"
 #include "notifications.h"
+#include "timerWheel.h"
 
-#define SECS_TO_TICKS(secs) ((secs * 1000) / portTICK_RATE_MS)
+#define DEINIT_TIMEOUT_TICKS (500 / portTICK_RATE_MS)
 
 static const char TAG[] = "relay_timeout";
 
 static void relayTimeoutCheckRelay(RelayTimeout_t *timeout);
 static void relayTimeoutElementCallback(void *userData, iotElement_t element, iotElementCallbackReason_t reason, iotElementCallbackDetails_t *details);
 static void relayTimeoutNotification(void *user,  NotificationsMessage_t *message);
-static void relayTimeoutSecondTimer(TimerHandle_t xTimer);
-static void relayTimeoutUpdateState(RelayTimeout_t *timeout, bool timerRunning);
+static void relayTimeoutCountdown(void *user, uint32_t secondsLeft);
+static void relayTimeoutUpdateState(RelayTimeout_t *timeout, bool timerRunning, uint32_t secondsLeft);
 
 IOT_DESCRIBE_ELEMENT(
     elementDescription,
@@ -31,41 +35,58 @@ void relayTimeoutInit(uint8_t id, char *relay, bool targetValue, uint32_t second
 {
     timeout->targetValue = targetValue;
     timeout->timeoutSeconds = seconds;
-    timeout->secondsLeft = seconds;
-    timeout->stateStr = NULL;
+    timeout->stateStr[0] = 0;
     timeout->relay = relayFind(relay);
 
     if (timeout->relay != NULL) {
         ESP_LOGI(TAG, "Timeout created for relay %s timeout %d value %s", relay, seconds, targetValue ?"on":"off");
         timeout->element = iotNewElement(&elementDescription, IOT_ELEMENT_FLAGS_DONT_ANNOUNCE, relayTimeoutElementCallback, timeout, "relayTimeout%d", id);
-        timeout->timer = xTimerCreate(iotElementGetName(timeout->element), SECS_TO_TICKS(1), pdTRUE, timeout, relayTimeoutSecondTimer);
+        timerWheelEntryInit(&timeout->timer, relayTimeoutCountdown, timeout);
         notificationsRegister(Notifications_Class_Relay, timeout->relay->id, relayTimeoutNotification, timeout);
         relayTimeoutCheckRelay(timeout);
-        if (timeout->stateStr == NULL) {
-            relayTimeoutUpdateState(timeout, false);
+        if (timeout->stateStr[0] == 0) {
+            relayTimeoutUpdateState(timeout, false, seconds);
         }
     } else {
         ESP_LOGI(TAG, "Failed to find relay %s", relay);
     }
 }
 
+int relayTimeoutDeinit(RelayTimeout_t *timeout)
+{
+    if (timeout->relay == NULL) {
+        return 0;
+    }
+    /* Unregistered first so a relay change can't start the countdown again once it has been stopped */
+    notificationsUnregister(Notifications_Class_Relay, timeout->relay->id, relayTimeoutNotification, timeout);
+    if (timerWheelStopSync(&timeout->timer, DEINIT_TIMEOUT_TICKS)) {
+        notificationsRegister(Notifications_Class_Relay, timeout->relay->id, relayTimeoutNotification, timeout);
+        return -1;
+    }
+    iotDeleteElement(timeout->element);
+    timeout->element = NULL;
+    timeout->relay = NULL;
+    return 0;
+}
+
 static void relayTimeoutCheckRelay(RelayTimeout_t *timeout)
 {
-    bool origState = xTimerIsTimerActive(timeout->timer) != pdFALSE;
-    bool newState = origState;
+    bool origState = timerWheelIsActive(&timeout->timer);
+    uint32_t secondsLeft = timeout->timeoutSeconds;
+    bool newState;
 
     if(relayIsOn(timeout->relay) == timeout->targetValue) {
-        xTimerStop(timeout->timer, 0);
+        secondsLeft = timerWheelSecondsLeft(&timeout->timer);
+        timerWheelStop(&timeout->timer);
         newState = false;
     } else {
-        timeout->secondsLeft = timeout->timeoutSeconds;
-        xTimerStart(timeout->timer, 0);
+        timerWheelStart(&timeout->timer, timeout->timeoutSeconds, CONFIG_TIMER_WHEEL_PROGRESS_SECS);
         newState = true;
     }
 
     if (origState != newState) {
         // update IOT state
-        relayTimeoutUpdateState(timeout, newState);
+        relayTimeoutUpdateState(timeout, newState, secondsLeft);
     }
 }
 
@@ -74,9 +95,12 @@ static void relayTimeoutElementCallback(void *userData, iotElement_t element, io
     if (reason == IOT_CALLBACK_ON_SUB) {
         RelayTimeout_t *timeout = userData;
         if (strcasecmp("reset", details->value.s)==0) {
-            timeout->secondsLeft = timeout->timeoutSeconds;
+            bool running = timerWheelIsActive(&timeout->timer);
+            if (running) {
+                timerWheelStart(&timeout->timer, timeout->timeoutSeconds, CONFIG_TIMER_WHEEL_PROGRESS_SECS);
+            }
             // update IOT state
-            relayTimeoutUpdateState(timeout, xTimerIsTimerActive(timeout->timer) != pdFALSE);
+            relayTimeoutUpdateState(timeout, running, timeout->timeoutSeconds);
         }
     }
 }
@@ -89,34 +113,23 @@ static void relayTimeoutNotification(void *user,  NotificationsMessage_t *messag
     }
 }
 
-static void relayTimeoutSecondTimer(TimerHandle_t xTimer)
+/* Called by the timer wheel with progress updates and when the timeout expires */
+static void relayTimeoutCountdown(void *user, uint32_t secondsLeft)
 {
-    RelayTimeout_t *timeout = pvTimerGetTimerID(xTimer);
-    bool state = xTimerIsTimerActive(timeout->timer) != pdFALSE;
+    RelayTimeout_t *timeout = user;
 
-    if (timeout->secondsLeft > 0) {
-        timeout->secondsLeft --;
-    }
-    if (timeout->secondsLeft == 0) {
-        xTimerStop(timeout->timer, 0);
-        state = false;
+    if (secondsLeft == 0) {
         relaySetState(timeout->relay, timeout->targetValue);
     }
     // update IOT state
-    relayTimeoutUpdateState(timeout, state);
+    relayTimeoutUpdateState(timeout, secondsLeft != 0, secondsLeft);
 }
 
-static void relayTimeoutUpdateState(RelayTimeout_t *timeout, bool timerRunning)
+static void relayTimeoutUpdateState(RelayTimeout_t *timeout, bool timerRunning, uint32_t secondsLeft)
 {
-    char *newState = NULL;
-    asprintf(&newState, "{\"active\":%s,\"left\":%d,\"timeout\":%d}", timerRunning ? "true":"false", timeout->secondsLeft, timeout->timeoutSeconds);
-    if (newState != NULL) {
-        iotValue_t value;
-        value.s = newState;
-        iotElementPublish(timeout->element, 0, value);
-        if (timeout->stateStr != NULL) {
-            free(timeout->stateStr);
-        }
-        timeout->stateStr = newState;
-    }
-}
\ No newline at end of file
+    iotValue_t value;
+    snprintf(timeout->stateStr, sizeof(timeout->stateStr), "{\"active\":%s,\"left\":%u,\"timeout\":%u}",
+             timerRunning ? "true":"false", secondsLeft, timeout->timeoutSeconds);
+    value.s = timeout->stateStr;
+    iotElementPublish(timeout->element, 0, value);
+}
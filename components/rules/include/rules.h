@@ -0,0 +1,17 @@
+#ifndef _RULES_H_
+#define _RULES_H_
+#include <stdint.h>
+
+/*
+ * Automation rules run on the device, see tools/rulecompiler.py for how they are written and compiled.
+ */
+
+int rulesInit(void);
+
+/**
+ * Load a rule compiled by tools/rulecompiler.py, refs being the comma separated ids used by code. The ids are looked
+ * up straight away so the relays, switches and sensors must already have been added. name may be NULL.
+ * Returns -1 if the code is not valid or an id can't be found.
+ */
+int rulesAdd(uint32_t number, const char *name, const char *refs, const char *code);
+#endif
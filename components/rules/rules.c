@@ -0,0 +1,535 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "notifications.h"
+#include "relay.h"
+#include "timerWheel.h"
+#include "rules.h"
+
+/*
+ * Rules are compiled to straight line code for a small stack machine, there are no jumps so running a rule takes at
+ * most one step per byte of code. The code is checked when it is loaded so the interpreter doesn't check as it runs.
+ * Each rule registers for the values its condition uses and is run in the task that sent the notification.
+ */
+#define RULE_VERSION 1
+#define RULE_HEADER_LEN 3
+#define RULE_MAX_CODE_LEN 127
+#define RULE_MAX_STACK 8
+/* Rules can trigger each other through the relays they set, this stops them doing so forever */
+#define RULE_MAX_NESTING 4
+
+#define OP_PUSH_REF   0x01
+#define OP_PUSH_INT8  0x02
+#define OP_PUSH_INT32 0x03
+#define OP_EQ         0x10
+#define OP_NE         0x11
+#define OP_LT         0x12
+#define OP_LE         0x13
+#define OP_GT         0x14
+#define OP_GE         0x15
+#define OP_AND        0x18
+#define OP_OR         0x19
+#define OP_NOT        0x1a
+#define OP_SET        0x20
+#define OP_SET_FOR    0x21
+
+#define STATE_OFF    0
+#define STATE_ON     1
+#define STATE_TOGGLE 2
+
+typedef enum {
+    RULE_KIND_SWITCH = 0,
+    RULE_KIND_RELAY,
+    RULE_KIND_TEMPERATURE,
+    RULE_KIND_HUMIDITY,
+    RULE_KIND_PRESSURE,
+    RULE_KIND_ILLUMINANCE,
+    RULE_KIND_MAX
+} RuleKind_e;
+
+typedef enum {
+    RULE_SECTION_WHEN = 0,
+    RULE_SECTION_THEN,
+    RULE_SECTION_OTHERWISE,
+    RULE_SECTION_MAX
+} RuleSection_e;
+
+typedef struct Rule Rule_t;
+
+typedef struct RuleRef {
+    Rule_t *rule;
+    Relay_t *relay; /* Only for relays */
+    Notifications_ID_t id;
+    int32_t value;
+    uint8_t kind;
+    bool known;
+    bool watched; /* Used by the condition */
+} RuleRef_t;
+
+typedef struct RuleTimer {
+    TimerWheelEntry_t entry;
+    Relay_t *relay;
+    bool revertState;
+} RuleTimer_t;
+
+struct Rule {
+    uint32_t number;
+    const char *name;
+    const uint8_t *sections[RULE_SECTION_MAX];
+    uint8_t sectionLens[RULE_SECTION_MAX];
+    uint8_t nrofRefs;
+    uint8_t nrofTimers;
+    int8_t state; /* -1 until the condition has been evaluated */
+    RuleRef_t *refs;
+    RuleTimer_t *timers;
+    uint8_t code[RULE_MAX_CODE_LEN];
+};
+
+static int ruleDecode(Rule_t *rule, const char *code);
+static int ruleCheckSection(Rule_t *rule, RuleSection_e section);
+static int ruleFindRefs(Rule_t *rule, const char *refs);
+static void ruleNotification(void *user, NotificationsMessage_t *message);
+static void ruleEvaluate(Rule_t *rule);
+static bool ruleCondition(Rule_t *rule);
+static void ruleActions(Rule_t *rule, RuleSection_e section);
+static void ruleTimerExpired(void *user, uint32_t secondsLeft);
+static int32_t ruleRead32(const uint8_t *data);
+
+static const char TAG[] = "rules";
+
+static const Notifications_Class_e kindClasses[RULE_KIND_MAX] = {
+    [RULE_KIND_SWITCH] = Notifications_Class_Switch,
+    [RULE_KIND_RELAY] = Notifications_Class_Relay,
+    [RULE_KIND_TEMPERATURE] = Notifications_Class_Temperature,
+    [RULE_KIND_HUMIDITY] = Notifications_Class_Humidity,
+    [RULE_KIND_PRESSURE] = Notifications_Class_Pressure,
+    [RULE_KIND_ILLUMINANCE] = Notifications_Class_Illuminance,
+};
+
+/* Recursive as setting a relay notifies the rules that use it from the same task */
+static SemaphoreHandle_t rulesMutex;
+static int nesting;
+
+int rulesInit(void)
+{
+    if (rulesMutex != NULL) {
+        return 0;
+    }
+    rulesMutex = xSemaphoreCreateRecursiveMutex();
+    if (rulesMutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+        return -1;
+    }
+    return 0;
+}
+
+int rulesAdd(uint32_t number, const char *name, const char *refs, const char *code)
+{
+    Rule_t *rule;
+    int i;
+
+    if ((refs == NULL) || (code == NULL)) {
+        ESP_LOGE(TAG, "Rule %u: Not compiled, use tools/updateprofile.py", number);
+        return -1;
+    }
+    rule = calloc(1, sizeof(Rule_t));
+    if (rule == NULL) {
+        ESP_LOGE(TAG, "Rule %u: Failed to allocate rule", number);
+        return -1;
+    }
+    rule->number = number;
+    rule->name = name;
+    rule->state = -1;
+    if (ruleDecode(rule, code) || ruleFindRefs(rule, refs)) {
+        free(rule->refs);
+        free(rule);
+        return -1;
+    }
+    if (rule->nrofTimers > 0) {
+        rule->timers = calloc(rule->nrofTimers, sizeof(RuleTimer_t));
+        if (rule->timers == NULL) {
+            ESP_LOGE(TAG, "Rule %u: Failed to allocate timers", number);
+            free(rule->refs);
+            free(rule);
+            return -1;
+        }
+        for (i = 0; i < rule->nrofTimers; i++) {
+            timerWheelEntryInit(&rule->timers[i].entry, ruleTimerExpired, &rule->timers[i]);
+        }
+    }
+    ESP_LOGI(TAG, "Rule %u: %s loaded (%d ids, %d timers)", number, name ? name : "", rule->nrofRefs, rule->nrofTimers);
+
+    xSemaphoreTakeRecursive(rulesMutex, portMAX_DELAY);
+    for (i = 0; i < rule->nrofRefs; i++) {
+        RuleRef_t *ref = &rule->refs[i];
+        if (ref->watched) {
+            notificationsRegister(kindClasses[ref->kind], ref->id, ruleNotification, ref);
+        }
+    }
+    /* Relays already have a state, so rules that only use them can run straight away */
+    ruleEvaluate(rule);
+    xSemaphoreGiveRecursive(rulesMutex);
+    return 0;
+}
+
+static int ruleHexDigit(char c)
+{
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static int ruleDecode(Rule_t *rule, const char *code)
+{
+    size_t len = strlen(code) / 2;
+    size_t offset;
+    int i, high, low;
+
+    if ((strlen(code) % 2 != 0) || (len > RULE_MAX_CODE_LEN)) {
+        ESP_LOGE(TAG, "Rule %u: Invalid code length", rule->number);
+        return -1;
+    }
+    for (i = 0; i < len; i++) {
+        high = ruleHexDigit(code[i * 2]);
+        low = ruleHexDigit(code[i * 2 + 1]);
+        if ((high < 0) || (low < 0)) {
+            ESP_LOGE(TAG, "Rule %u: Invalid code", rule->number);
+            return -1;
+        }
+        rule->code[i] = (high << 4) | low;
+    }
+
+    if ((len < RULE_HEADER_LEN) || (rule->code[0] != RULE_VERSION)) {
+        ESP_LOGE(TAG, "Rule %u: Unsupported version, recompile with tools/updateprofile.py", rule->number);
+        return -1;
+    }
+    rule->nrofRefs = rule->code[1];
+    rule->nrofTimers = rule->code[2];
+    offset = RULE_HEADER_LEN + rule->nrofRefs;
+    if (offset > len) {
+        ESP_LOGE(TAG, "Rule %u: Code truncated", rule->number);
+        return -1;
+    }
+    if (rule->nrofRefs > 0) {
+        rule->refs = calloc(rule->nrofRefs, sizeof(RuleRef_t));
+        if (rule->refs == NULL) {
+            ESP_LOGE(TAG, "Rule %u: Failed to allocate ids", rule->number);
+            return -1;
+        }
+    }
+    for (i = 0; i < rule->nrofRefs; i++) {
+        rule->refs[i].rule = rule;
+        rule->refs[i].kind = rule->code[RULE_HEADER_LEN + i];
+        if (rule->refs[i].kind >= RULE_KIND_MAX) {
+            ESP_LOGE(TAG, "Rule %u: Unknown kind of id %d", rule->number, rule->refs[i].kind);
+            return -1;
+        }
+    }
+    for (i = 0; i < RULE_SECTION_MAX; i++) {
+        if ((offset >= len) || (offset + 1 + rule->code[offset] > len)) {
+            ESP_LOGE(TAG, "Rule %u: Code truncated", rule->number);
+            return -1;
+        }
+        rule->sectionLens[i] = rule->code[offset];
+        rule->sections[i] = &rule->code[offset + 1];
+        offset += 1 + rule->sectionLens[i];
+        if (ruleCheckSection(rule, i)) {
+            return -1;
+        }
+    }
+    if (offset != len) {
+        ESP_LOGE(TAG, "Rule %u: Data after code", rule->number);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Check every instruction has its operands, refers to ids and timers that exist and keeps within the stack, the
+ * condition must leave exactly one value and actions must be relays.
+ */
+static int ruleCheckSection(Rule_t *rule, RuleSection_e section)
+{
+    const uint8_t *code = rule->sections[section];
+    uint8_t len = rule->sectionLens[section];
+    uint8_t pc = 0, ref, op;
+    int depth = 0;
+
+    while (pc < len) {
+        op = code[pc++];
+        if (section == RULE_SECTION_WHEN) {
+            switch (op) {
+            case OP_PUSH_REF:
+                if ((pc >= len) || (code[pc] >= rule->nrofRefs)) {
+                    goto invalid;
+                }
+                rule->refs[code[pc]].watched = true;
+                pc++;
+                depth++;
+                break;
+            case OP_PUSH_INT8:
+                pc += 1;
+                depth++;
+                break;
+            case OP_PUSH_INT32:
+                pc += 4;
+                depth++;
+                break;
+            case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
+            case OP_AND: case OP_OR:
+                depth--;
+                break;
+            case OP_NOT:
+                break;
+            default:
+                goto invalid;
+            }
+            if ((pc > len) || (depth < 1) || (depth > RULE_MAX_STACK)) {
+                goto invalid;
+            }
+        } else {
+            switch (op) {
+            case OP_SET:
+                if ((pc + 2 > len) || (code[pc + 1] > STATE_TOGGLE)) {
+                    goto invalid;
+                }
+                ref = code[pc];
+                pc += 2;
+                break;
+            case OP_SET_FOR:
+                if ((pc + 7 > len) || (code[pc + 1] > STATE_TOGGLE) || (code[pc + 2] >= rule->nrofTimers)) {
+                    goto invalid;
+                }
+                ref = code[pc];
+                pc += 7;
+                break;
+            default:
+                goto invalid;
+            }
+            if ((ref >= rule->nrofRefs) || (rule->refs[ref].kind != RULE_KIND_RELAY)) {
+                goto invalid;
+            }
+        }
+    }
+    if ((section == RULE_SECTION_WHEN) && (depth != 1)) {
+        goto invalid;
+    }
+    return 0;
+
+invalid:
+    ESP_LOGE(TAG, "Rule %u: Invalid code in section %d at %d", rule->number, section, pc);
+    return -1;
+}
+
+static int ruleFindRefs(Rule_t *rule, const char *refs)
+{
+    char name[64];
+    size_t len;
+    int i;
+
+    for (i = 0; i < rule->nrofRefs; i++) {
+        RuleRef_t *ref = &rule->refs[i];
+        len = strcspn(refs, ",");
+        if (len >= sizeof(name)) {
+            ESP_LOGE(TAG, "Rule %u: Id too long", rule->number);
+            return -1;
+        }
+        memcpy(name, refs, len);
+        name[len] = 0;
+        refs += len;
+        if (*refs == ',') {
+            refs++;
+        }
+
+        if (ref->kind == RULE_KIND_RELAY) {
+            ref->relay = relayFind(name);
+            if (ref->relay == NULL) {
+                ESP_LOGE(TAG, "Rule %u: Unknown relay %s", rule->number, name);
+                return -1;
+            }
+            ref->id = ref->relay->id;
+            ref->value = relayIsOn(ref->relay);
+            ref->known = true;
+        } else {
+            ref->id = notificationsFindId(name);
+            if (ref->id == NOTIFICATIONS_ID_ERROR) {
+                ESP_LOGE(TAG, "Rule %u: Unknown id %s", rule->number, name);
+                return -1;
+            }
+        }
+    }
+    if (*refs != 0) {
+        ESP_LOGE(TAG, "Rule %u: Ids don't match code", rule->number);
+        return -1;
+    }
+    return 0;
+}
+
+static void ruleNotification(void *user, NotificationsMessage_t *message)
+{
+    RuleRef_t *ref = user;
+    int32_t value;
+
+    switch (ref->kind) {
+    case RULE_KIND_SWITCH:
+        value = message->data.switchState;
+        break;
+    case RULE_KIND_RELAY:
+        value = message->data.relayState;
+        break;
+    case RULE_KIND_TEMPERATURE:
+        value = message->data.temperature;
+        break;
+    case RULE_KIND_HUMIDITY:
+        value = message->data.humidity;
+        break;
+    case RULE_KIND_PRESSURE:
+        value = message->data.pressure;
+        break;
+    default:
+        value = message->data.illuminance;
+        break;
+    }
+
+    xSemaphoreTakeRecursive(rulesMutex, portMAX_DELAY);
+    if (!ref->known || (ref->value != value)) {
+        ref->value = value;
+        ref->known = true;
+        ruleEvaluate(ref->rule);
+    }
+    xSemaphoreGiveRecursive(rulesMutex);
+}
+
+/* Must be called with rulesMutex held */
+static void ruleEvaluate(Rule_t *rule)
+{
+    bool result;
+    int i;
+
+    for (i = 0; i < rule->nrofRefs; i++) {
+        if (rule->refs[i].watched && !rule->refs[i].known) {
+            return;
+        }
+    }
+    if (nesting >= RULE_MAX_NESTING) {
+        ESP_LOGW(TAG, "Rule %u: Not evaluated, rules are triggering each other", rule->number);
+        return;
+    }
+    nesting++;
+    result = ruleCondition(rule);
+    /* Actions are only run when the condition changes */
+    if (rule->state != result) {
+        rule->state = result;
+        ESP_LOGI(TAG, "Rule %u: %s", rule->number, result ? "true" : "false");
+        ruleActions(rule, result ? RULE_SECTION_THEN : RULE_SECTION_OTHERWISE);
+    }
+    nesting--;
+}
+
+static bool ruleCondition(Rule_t *rule)
+{
+    const uint8_t *code = rule->sections[RULE_SECTION_WHEN];
+    uint8_t len = rule->sectionLens[RULE_SECTION_WHEN];
+    int32_t stack[RULE_MAX_STACK];
+    int32_t a, b;
+    uint8_t pc = 0, op;
+    int sp = 0;
+
+    while (pc < len) {
+        op = code[pc++];
+        switch (op) {
+        case OP_PUSH_REF:
+            stack[sp++] = rule->refs[code[pc++]].value;
+            continue;
+        case OP_PUSH_INT8:
+            stack[sp++] = (int8_t)code[pc++];
+            continue;
+        case OP_PUSH_INT32:
+            stack[sp++] = ruleRead32(&code[pc]);
+            pc += 4;
+            continue;
+        case OP_NOT:
+            stack[sp - 1] = !stack[sp - 1];
+            continue;
+        }
+        b = stack[--sp];
+        a = stack[sp - 1];
+        switch (op) {
+        case OP_EQ:
+            a = a == b;
+            break;
+        case OP_NE:
+            a = a != b;
+            break;
+        case OP_LT:
+            a = a < b;
+            break;
+        case OP_LE:
+            a = a <= b;
+            break;
+        case OP_GT:
+            a = a > b;
+            break;
+        case OP_GE:
+            a = a >= b;
+            break;
+        case OP_AND:
+            a = a && b;
+            break;
+        case OP_OR:
+            a = a || b;
+            break;
+        }
+        stack[sp - 1] = a;
+    }
+    return stack[0] != 0;
+}
+
+static void ruleActions(Rule_t *rule, RuleSection_e section)
+{
+    const uint8_t *code = rule->sections[section];
+    uint8_t len = rule->sectionLens[section];
+    uint8_t pc = 0, op, state;
+    Relay_t *relay;
+    bool on;
+
+    while (pc < len) {
+        op = code[pc];
+        relay = rule->refs[code[pc + 1]].relay;
+        state = code[pc + 2];
+        on = (state == STATE_TOGGLE) ? !relayIsOn(relay) : (state == STATE_ON);
+        relaySetState(relay, on);
+        if (op == OP_SET_FOR) {
+            RuleTimer_t *timer = &rule->timers[code[pc + 3]];
+            timer->relay = relay;
+            timer->revertState = !on;
+            timerWheelStart(&timer->entry, ruleRead32(&code[pc + 4]), 0);
+            pc += 8;
+        } else {
+            pc += 3;
+        }
+    }
+}
+
+static void ruleTimerExpired(void *user, uint32_t secondsLeft)
+{
+    RuleTimer_t *timer = user;
+
+    xSemaphoreTakeRecursive(rulesMutex, portMAX_DELAY);
+    relaySetState(timer->relay, timer->revertState);
+    xSemaphoreGiveRecursive(rulesMutex);
+}
+
+static int32_t ruleRead32(const uint8_t *data)
+{
+    return (int32_t)((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+}
@@ -3,6 +3,30 @@
 #include "sdkconfig.h"
 #include "notifications.h"
 #include "deviceprofile.h"
+#include "cJSON.h"
 
 void sensorsInit(DeviceProfile_DeviceConfig_t *config);
+
+/**
+ * Request that the sensor(s) with the given id sample at their minimum interval.
+ * Requests are counted, each fast == true request should be matched by a fast == false.
+ */
+void sensorsRequestFastSampling(Notifications_ID_t id, bool fast);
+
+/**
+ * Take a reading from every sensor as soon as possible rather than waiting for their intervals.
+ * Sensors that oversample keep being read back to back until they have a value to publish, as filter state does not
+ * survive deep sleep.
+ */
+void sensorsSampleNow(void);
+
+/**
+ * Returns true once every sensor has published a value since boot, or failed to be read.
+ */
+bool sensorsAllPublished(void);
+
+/**
+ * Add the health of all sensors to the diag object and refresh each sensor's status pub.
+ */
+void sensorsDiag(cJSON *diag);
 #endif
\ No newline at end of file
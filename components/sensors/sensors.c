@@ -1,10 +1,14 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/timers.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
+#include "cJSON_AddOns.h"
 #include "iot.h"
 #include "notifications.h"
 #include "deviceprofile.h"
@@ -23,9 +27,13 @@ struct SensorDef {
 };
 
 static void sensorsTimerHandler(TimerHandle_t xTimer);
+static void sensorsPublishStatus(Sensor_t *sensor);
 
 static char const TAG[]="sensors";
 
+/* Set by sensorsSampleNow, see sensorsBurstPending */
+static bool sampleBurst = false;
+
 struct SensorDef sensorDefs[] = {
 #ifdef CONFIG_DHT22
     {
@@ -84,6 +92,7 @@ static uint32_t sensorsTotal = 0;
 static uint32_t sensorsCount = 0;
 
 static struct Sensor *sensors = NULL;
+static struct Sensor *sensorsList = NULL;
 
 int sensorsAddSensor(struct Sensor **sensor)
 {
@@ -99,32 +108,277 @@ int sensorsAddSensor(struct Sensor **sensor)
     }
     newSensor = &sensors[sensorsCount];
     newSensor->id = NOTIFICATIONS_ID_ERROR;
+    sensorsRegisterSensor(newSensor);
     *sensor = newSensor;
     sensorsCount ++;
     return 0;
 }
 
+void sensorsRegisterSensor(Sensor_t *sensor)
+{
+    sensor->next = sensorsList;
+    sensorsList = sensor;
+}
+
 void sensorsCreateSecondsTimer(Sensor_t *sensor, const char *name, uint32_t seconds, SensorTimerCallback_t callback)
 {
     sensor->callback = callback;
-    xTimerStart(xTimerCreate(name, SECS_TO_TICKS(seconds), pdTRUE, sensor, sensorsTimerHandler), 0);
+    if (sensor->minInterval == 0) {
+        sensorsSetInterval(sensor, seconds, 0, 0);
+    }
+    sensor->timer = xTimerCreate(name, SECS_TO_TICKS(sensor->interval), pdTRUE, sensor, sensorsTimerHandler);
+    xTimerStart(sensor->timer, 0);
 }
 
 static void sensorsTimerHandler(TimerHandle_t xTimer)
 {
     Sensor_t *sensor = pvTimerGetTimerID(xTimer);
+    TickType_t period;
     sensor->callback(sensor);
+    sensorsUpdateInterval(sensor);
+    if (sensorsBurstPending(sensor)) {
+        period = MSECS_TO_TICKS(SENSORS_BURST_MS);
+    } else {
+        period = SECS_TO_TICKS(sensor->interval);
+    }
+    if (xTimerGetPeriod(xTimer) != period) {
+        xTimerChangePeriod(xTimer, period, 0);
+    }
+}
+
+void sensorsSetInterval(Sensor_t *sensor, uint32_t minInterval, uint32_t maxInterval, uint32_t changeThreshold)
+{
+    if (minInterval == 0) {
+        minInterval = SENSORS_DEFAULT_INTERVAL_SECS;
+    }
+    if (minInterval > UINT16_MAX) {
+        minInterval = UINT16_MAX;
+    }
+    if (maxInterval > UINT16_MAX) {
+        maxInterval = UINT16_MAX;
+    }
+    if (maxInterval < minInterval) {
+        maxInterval = minInterval;
+    }
+    sensor->minInterval = minInterval;
+    sensor->maxInterval = maxInterval;
+    sensor->interval = minInterval;
+    sensor->changeThreshold = changeThreshold ? changeThreshold : SENSORS_DEFAULT_CHANGE_THRESHOLD;
+}
+
+void sensorsTrackChange(Sensor_t *sensor, int index, int32_t value)
+{
+    int32_t delta;
+    if (index >= SENSORS_MAX_VALUES) {
+        return;
+    }
+    if ((sensor->referenceValid & (1 << index)) == 0) {
+        sensor->referenceValid |= 1 << index;
+        sensor->reference[index] = value;
+        sensor->changed = true;
+        return;
+    }
+    delta = value - sensor->reference[index];
+    if ((delta >= (int32_t)sensor->changeThreshold) || (-delta >= (int32_t)sensor->changeThreshold)) {
+        sensor->reference[index] = value;
+        sensor->changed = true;
+    }
+}
+
+void sensorsUpdateInterval(Sensor_t *sensor)
+{
+    if (sensor->changed || sensor->fastRequests) {
+        sensor->interval = sensor->minInterval;
+    } else if (sensor->interval < sensor->maxInterval) {
+        uint32_t interval = sensor->interval * 2;
+        sensor->interval = interval > sensor->maxInterval ? sensor->maxInterval : interval;
+        ESP_LOGD(TAG, "Id %d: Stable, backing off to %us", sensor->id, sensor->interval);
+    }
+    sensor->changed = false;
+}
+
+void sensorsReadStart(Sensor_t *sensor)
+{
+    sensor->readStart = esp_timer_get_time();
+}
+
+void sensorsReadFinished(Sensor_t *sensor, bool success)
+{
+    struct SensorHealth *health = &sensor->health;
+    uint32_t duration = (uint32_t)(esp_timer_get_time() - sensor->readStart);
+    bool wasFailing = health->consecutiveFailures != 0;
+
+    health->reads ++;
+    health->totalReadUs += duration;
+    if ((health->reads == 1) || (duration < health->minReadUs)) {
+        health->minReadUs = duration;
+    }
+    if (duration > health->maxReadUs) {
+        health->maxReadUs = duration;
+    }
+    if (success) {
+        health->consecutiveFailures = 0;
+        health->lastSuccess = xTaskGetTickCount();
+    } else {
+        health->failures ++;
+        health->consecutiveFailures ++;
+    }
+    /* Let listeners know straight away when a sensor starts or stops failing */
+    if (wasFailing != (health->consecutiveFailures != 0)) {
+        sensorsPublishStatus(sensor);
+    }
+}
+
+static int32_t sensorsLastSuccessAge(Sensor_t *sensor)
+{
+    if (sensor->health.reads == sensor->health.failures) {
+        return -1;
+    }
+    return ((xTaskGetTickCount() - sensor->health.lastSuccess) * portTICK_RATE_MS) / 1000;
+}
+
+static uint32_t sensorsAverageReadUs(Sensor_t *sensor)
+{
+    if (sensor->health.reads == 0) {
+        return 0;
+    }
+    return (uint32_t)(sensor->health.totalReadUs / sensor->health.reads);
+}
+
+static void sensorsPublishStatus(Sensor_t *sensor)
+{
+    const iotElementDescription_t *desc;
+    struct SensorHealth *health = &sensor->health;
+    iotValue_t value;
+    char *status = NULL;
+
+    if (sensor->element == NULL) {
+        return;
+    }
+    /* The status pub is always the last pub of a sensor element */
+    desc = iotElementGetDescription(sensor->element);
+    asprintf(&status, "{\"reads\":%u,\"failures\":%u,\"consecutiveFailures\":%u,\"lastSuccess\":%d,"
+             "\"readUs\":{\"min\":%u,\"avg\":%u,\"max\":%u}}",
+             health->reads, health->failures, health->consecutiveFailures, sensorsLastSuccessAge(sensor),
+             health->minReadUs, sensorsAverageReadUs(sensor), health->maxReadUs);
+    if (status == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate status string");
+        return;
+    }
+    value.s = status;
+    iotElementPublish(sensor->element, desc->nrofPubs - 1, value);
+    if (sensor->status != NULL) {
+        free(sensor->status);
+    }
+    sensor->status = status;
+}
+
+void sensorsDiag(cJSON *diag)
+{
+    Sensor_t *sensor;
+    cJSON *array;
+
+    if (sensorsList == NULL) {
+        return;
+    }
+    array = cJSON_AddArrayToObjectCS(diag, "sensors");
+    if (array == NULL) {
+        return;
+    }
+    for (sensor = sensorsList; sensor != NULL; sensor = sensor->next) {
+        struct SensorHealth *health = &sensor->health;
+        cJSON *object = cJSON_CreateObject();
+        if (object == NULL) {
+            break;
+        }
+        cJSON_AddItemToArray(array, object);
+        cJSON_AddStringReferenceToObjectCS(object, "name", iotElementGetName(sensor->element));
+        cJSON_AddUIntToObjectCS(object, "reads", health->reads);
+        cJSON_AddUIntToObjectCS(object, "failures", health->failures);
+        cJSON_AddUIntToObjectCS(object, "consecutiveFailures", health->consecutiveFailures);
+        cJSON_AddIntToObjectCS(object, "lastSuccess", sensorsLastSuccessAge(sensor));
+        cJSON_AddUIntToObjectCS(object, "minReadUs", health->minReadUs);
+        cJSON_AddUIntToObjectCS(object, "avgReadUs", sensorsAverageReadUs(sensor));
+        cJSON_AddUIntToObjectCS(object, "maxReadUs", health->maxReadUs);
+        cJSON_AddUIntToObjectCS(object, "interval", sensor->interval);
+
+        sensorsPublishStatus(sensor);
+    }
+}
+
+void sensorsRequestFastSampling(Notifications_ID_t id, bool fast)
+{
+    Sensor_t *sensor;
+    for (sensor = sensorsList; sensor != NULL; sensor = sensor->next) {
+        if (sensor->id != id) {
+            continue;
+        }
+        if (!fast) {
+            if (sensor->fastRequests) {
+                sensor->fastRequests --;
+            }
+            continue;
+        }
+        sensor->fastRequests ++;
+        if (sensor->interval != sensor->minInterval) {
+            sensor->interval = sensor->minInterval;
+            /* Take a reading now, the timer callback will restore the period. */
+            if (sensor->timer != NULL) {
+                xTimerChangePeriod(sensor->timer, 1, 0);
+            }
+        }
+    }
+}
+
+void sensorsSampleNow(void)
+{
+    Sensor_t *sensor;
+    sampleBurst = true;
+#ifdef CONFIG_DS18x20
+    /* Pins share a scheduler timer that only starts conversions when they are due */
+    sensorsDS18x20SampleNow();
+#endif
+    for (sensor = sensorsList; sensor != NULL; sensor = sensor->next) {
+        if (sensor->timer != NULL) {
+            xTimerChangePeriod(sensor->timer, 1, 0);
+        }
+    }
+}
+
+bool sensorsBurstPending(Sensor_t *sensor)
+{
+    /* A failing sensor is left to its normal interval, it doesn't hold up sleeping either */
+    return sampleBurst && !sensor->published && (sensor->health.consecutiveFailures == 0);
+}
+
+bool sensorsAllPublished(void)
+{
+    Sensor_t *sensor;
+    for (sensor = sensorsList; sensor != NULL; sensor = sensor->next) {
+        /* A failing sensor should not keep the device awake */
+        if (!sensor->published && (sensor->health.consecutiveFailures == 0)) {
+            return false;
+        }
+    }
+    return true;
 }
 
 void sensorsUpdateForHundredth(Sensor_t *sensor, int index, Notifications_Class_e clazz, int hundredths)
 {
     NotificationsData_t data;
     iotValue_t value;
+    int32_t filtered = hundredths;
 
+    sensorsTrackChange(sensor, index, hundredths);
+    if (!sensorsFilter(sensor, index, &filtered)) {
+        return;
+    }
+    hundredths = filtered;
     data.temperature = hundredths;
     ESP_LOGI(TAG, "sensorsUpdateForHundredth: Class %d Id %d: Index: %d Value %d", clazz, sensor->id, index, hundredths);
     value.i = hundredths;
     iotElementPublish(sensor->element, index, value);
+    sensor->published = true;
     if (sensor->id != NOTIFICATIONS_ID_ERROR) {
         notificationsNotify(clazz, sensor->id, &data);
     }
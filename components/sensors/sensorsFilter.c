@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "iot.h"
+#include "notifications.h"
+#include "deviceprofile.h"
+#include "sensors.h"
+#include "sensorsInternal.h"
+
+/* EMA state is kept with 8 fractional bits */
+#define EMA_FRACTION_BITS 8
+#define MAX_OVERSAMPLE    255
+#define MAX_SMOOTHING     8
+
+struct SensorFilter {
+    int32_t window[SENSORS_FILTER_MAX_MEDIAN];
+    uint8_t windowCount;
+    uint8_t windowNext;
+    uint8_t summed;
+    int32_t sum;
+    int32_t ema;
+    bool emaValid;
+};
+
+static char const TAG[]="sensorsFilter";
+
+static int32_t sensorsFilterMedian(struct SensorFilter *filter, uint8_t size, int32_t value);
+
+int sensorsInitFilter(Sensor_t *sensor, int nrofValues, uint32_t oversample, uint32_t median, uint32_t smoothing)
+{
+    sensor->filters = NULL;
+    if (oversample > MAX_OVERSAMPLE) {
+        ESP_LOGW(TAG, "Oversample %u too large, using %u", oversample, MAX_OVERSAMPLE);
+        oversample = MAX_OVERSAMPLE;
+    }
+    if (median > SENSORS_FILTER_MAX_MEDIAN) {
+        ESP_LOGW(TAG, "Median window %u too large, using %u", median, SENSORS_FILTER_MAX_MEDIAN);
+        median = SENSORS_FILTER_MAX_MEDIAN;
+    }
+    if (smoothing > MAX_SMOOTHING) {
+        ESP_LOGW(TAG, "Smoothing %u too large, using %u", smoothing, MAX_SMOOTHING);
+        smoothing = MAX_SMOOTHING;
+    }
+    sensor->oversample = oversample;
+    sensor->median = median;
+    sensor->smoothing = smoothing;
+
+    if ((oversample <= 1) && (median <= 1) && (smoothing == 0)) {
+        return 0;
+    }
+
+    sensor->filters = calloc(nrofValues, sizeof(struct SensorFilter));
+    if (sensor->filters == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate filters, readings will be unfiltered");
+        return -1;
+    }
+    sensor->nrofFilters = nrofValues;
+    return 0;
+}
+
+bool sensorsFilter(Sensor_t *sensor, int index, int32_t *value)
+{
+    struct SensorFilter *filter;
+    int32_t sample = *value;
+
+    if ((sensor->filters == NULL) || (index >= sensor->nrofFilters)) {
+        return true;
+    }
+    filter = &sensor->filters[index];
+
+    /* Outlier rejection */
+    if (sensor->median > 1) {
+        sample = sensorsFilterMedian(filter, sensor->median, sample);
+    }
+
+    /* Oversampling, only emit once enough samples have been averaged. */
+    if (sensor->oversample > 1) {
+        filter->sum += sample;
+        filter->summed++;
+        if (filter->summed < sensor->oversample) {
+            return false;
+        }
+        sample = filter->sum / filter->summed;
+        filter->sum = 0;
+        filter->summed = 0;
+    }
+
+    /* Exponential moving average with alpha = 1 / 2^smoothing */
+    if (sensor->smoothing) {
+        int32_t fixed = sample * (1 << EMA_FRACTION_BITS);
+        if (filter->emaValid) {
+            filter->ema += (fixed - filter->ema) / (1 << sensor->smoothing);
+        } else {
+            filter->ema = fixed;
+            filter->emaValid = true;
+        }
+        sample = (filter->ema + (1 << (EMA_FRACTION_BITS - 1))) >> EMA_FRACTION_BITS;
+    }
+
+    *value = sample;
+    return true;
+}
+
+static int32_t sensorsFilterMedian(struct SensorFilter *filter, uint8_t size, int32_t value)
+{
+    int32_t sorted[SENSORS_FILTER_MAX_MEDIAN];
+    int i, j;
+
+    filter->window[filter->windowNext] = value;
+    filter->windowNext = (filter->windowNext + 1) % size;
+    if (filter->windowCount < size) {
+        filter->windowCount++;
+    }
+
+    for (i = 0; i < filter->windowCount; i++) {
+        int32_t v = filter->window[i];
+        for (j = i; (j > 0) && (sorted[j - 1] > v); j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = v;
+    }
+    return sorted[filter->windowCount / 2];
+}
@@ -1,14 +1,36 @@
 #ifndef __SENSORS_INTERNAL_H__
 #define __SENSORS_INTERNAL_H__
 #include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
 #include "iot.h"
 #include "notifications.h"
 
 #define MSECS_TO_TICKS(msecs) ((msecs) / portTICK_RATE_MS)
 #define SECS_TO_TICKS(secs) MSECS_TO_TICKS(secs * 1000)
 
+#define SENSORS_FILTER_MAX_MEDIAN 7
+
+/* Maximum number of values (pubs) tracked for change detection per sensor */
+#define SENSORS_MAX_VALUES 3
+#define SENSORS_DEFAULT_INTERVAL_SECS 5
+#define SENSORS_DEFAULT_CHANGE_THRESHOLD 50
+/* Time between back to back readings while filling the filters, the DHT22 needs 2 seconds between reads */
+#define SENSORS_BURST_MS 2000
+
+struct SensorHealth {
+    uint32_t reads;
+    uint32_t failures;
+    uint32_t consecutiveFailures;
+    TickType_t lastSuccess;
+    uint32_t minReadUs;
+    uint32_t maxReadUs;
+    uint64_t totalReadUs;
+};
+
 typedef struct Sensor Sensor_t;
 typedef void (*SensorTimerCallback_t )(struct Sensor *sensor);
+struct SensorFilter;
 
 struct Sensor {
     Notifications_ID_t id;
@@ -18,15 +40,87 @@ struct Sensor {
         void *dev;
     } details;
     SensorTimerCallback_t callback;
+    uint8_t oversample;
+    uint8_t median;
+    uint8_t smoothing;
+    uint8_t nrofFilters;
+    struct SensorFilter *filters;
+    struct Sensor *next;
+    TimerHandle_t timer;
+    uint16_t minInterval;
+    uint16_t maxInterval;
+    uint16_t interval;
+    uint8_t fastRequests;
+    bool changed;
+    uint8_t referenceValid;
+    uint32_t changeThreshold;
+    int32_t reference[SENSORS_MAX_VALUES];
+    bool published;
+    int64_t readStart;
+    struct SensorHealth health;
+    char *status;
 };
 
 
 
 
 int sensorsAddSensor(struct Sensor **sensor);
+
+/**
+ * Add a sensor not allocated by sensorsAddSensor to the list of known sensors.
+ */
+void sensorsRegisterSensor(Sensor_t *sensor);
+
+/**
+ * Create a periodic timer for the sensor, seconds is only used if sensorsSetInterval has not been called.
+ */
 void sensorsCreateSecondsTimer(Sensor_t *sensor, const char *name, uint32_t seconds, SensorTimerCallback_t callback);
+
+/**
+ * Set the adaptive sampling parameters for a sensor, 0 selects the default for each parameter.
+ * While readings change by less than changeThreshold the interval doubles up to maxInterval.
+ */
+void sensorsSetInterval(Sensor_t *sensor, uint32_t minInterval, uint32_t maxInterval, uint32_t changeThreshold);
+
+/**
+ * Mark the start of a read of the sensor hardware.
+ */
+void sensorsReadStart(Sensor_t *sensor);
+
+/**
+ * Mark the end of a read of the sensor hardware, updating the health counters.
+ */
+void sensorsReadFinished(Sensor_t *sensor, bool success);
+
+/**
+ * Record a raw reading for change detection.
+ */
+void sensorsTrackChange(Sensor_t *sensor, int index, int32_t value);
+
+/**
+ * Work out the next sampling interval once all values for a sampling cycle have been read.
+ */
+void sensorsUpdateInterval(Sensor_t *sensor);
+
+/**
+ * Returns true if sensorsSampleNow has been called and the sensor's filters have not produced a value to publish
+ * yet, in which case the sensor should be read again straight away rather than waiting for its interval.
+ */
+bool sensorsBurstPending(Sensor_t *sensor);
 void sensorsUpdateForHundredth(Sensor_t *sensor,int index, Notifications_Class_e clazz, int hundredths);
 
+/**
+ * Setup the filter chain (median-of-N -> oversampling -> EMA) for a sensor with nrofValues readings.
+ * A median or oversample of 0/1 and a smoothing of 0 disable that stage.
+ */
+int sensorsInitFilter(Sensor_t *sensor, int nrofValues, uint32_t oversample, uint32_t median, uint32_t smoothing);
+
+/**
+ * Pass a raw reading through the sensor's filter chain, returns true if the
+ * (updated) value should be published.
+ */
+bool sensorsFilter(Sensor_t *sensor, int index, int32_t *value);
+
 #ifdef CONFIG_DHT22
 int sensorsDHT22Init(int nrofSensors);
 int sensorsDHT22Add(DeviceProfile_Dht22Config_t *config);
@@ -45,6 +139,10 @@ int sensorsSI7021Add(DeviceProfile_Si7021Config_t *config);
 #ifdef CONFIG_DS18x20
 int sensorsDS18x20Init(int nrofSensors);
 int sensorsDS18x20Add(DeviceProfile_Ds18x20Config_t *config);
+/**
+ * Make every pin due a conversion, so the next run of the scheduler measures them all.
+ */
+void sensorsDS18x20SampleNow(void);
 #endif
 
 #ifdef CONFIG_TSL2561
@@ -24,7 +24,8 @@ IOT_DESCRIBE_ELEMENT_NO_SUBS(
     lightElementDescription,
     IOT_ELEMENT_TYPE_SENSOR_LIGHT,
     IOT_PUB_DESCRIPTIONS(
-        IOT_DESCRIBE_PUB(RETAINED, LUX, IOT_PUB_USE_ELEMENT)
+        IOT_DESCRIBE_PUB(RETAINED, LUX, IOT_PUB_USE_ELEMENT),
+        IOT_DESCRIBE_PUB(RETAINED, STRING, "status")
     )
 );
 
@@ -78,6 +79,8 @@ int sensorsTSL2561Add(DeviceProfile_Tsl2561Config_t *config)
     value.i = 0;
     iotElementPublish(sensor->element, 0, value);
     sensor->details.dev = tsl;
+    sensorsInitFilter(sensor, 1, config->oversample, config->median, config->smoothing);
+    sensorsSetInterval(sensor, config->minInterval, config->maxInterval, config->changeThreshold);
     sensorsCreateSecondsTimer(sensor, "tsl2561", 5, tsl2561MeasureTimer);
 
     return 0;
@@ -87,15 +90,30 @@ static void tsl2561MeasureTimer(Sensor_t *sensor)
 {
     struct TSL2561 *tsl = sensor->details.dev;
     uint32_t lux;
+    int32_t filtered;
     iotValue_t value;
     esp_err_t err;
+    sensorsReadStart(sensor);
     err = tsl2561_read_lux(&tsl->dev, &lux);
+    sensorsReadFinished(sensor, err == ESP_OK);
     ESP_LOGI(TAG, "tsl2561MeasureTimer: Lux %d", lux);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "tsl2561MeasureTimer: Failed to read lux %d", err);
         return;
     }
-    value.i = lux;
+    filtered = lux;
+    /* changeThreshold is in hundredths like the other sensors, so track lux in hundredths too */
+    sensorsTrackChange(sensor, 0, filtered * 100);
+    if (!sensorsFilter(sensor, 0, &filtered)) {
+        return;
+    }
+    value.i = filtered;
     iotElementPublish(sensor->element, 0, value);
+    sensor->published = true;
+    if (sensor->id != NOTIFICATIONS_ID_ERROR) {
+        NotificationsData_t data;
+        data.illuminance = filtered;
+        notificationsNotify(Notifications_Class_Illuminance, sensor->id, &data);
+    }
 }
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/timers.h"
 #include "esp_log.h"
 #include "sdkconfig.h"
@@ -31,19 +32,31 @@ struct SI7021 {
     i2c_dev_t dev;
 };
 
+#define DS18x20_MIN_RESOLUTION 9
+#define DS18x20_MAX_RESOLUTION 12
+#define DS18x20_POLL_TICKS (MSECS_TO_TICKS(20) ? MSECS_TO_TICKS(20) : 1)
+#define DS18x20_READ_POWER_SUPPLY 0xb4
+#ifndef DS1822_FAMILY_ID
+#define DS1822_FAMILY_ID 0x22
+#endif
+
 struct DS18x20Sensor {
-    Notifications_ID_t id;
-    iotElement_t element;
+    Sensor_t sensor;
     ds18x20_addr_t addr;
+    uint8_t resolution;
 };
 
 struct DS18x20Pin {
     int8_t pin;
+    bool parasitic;
+    bool converting;
     int nrofSensors;
     float temperatureCorrection;
     struct DS18x20Sensor *sensors;
-    TimerHandle_t measureTimer;
-    TimerHandle_t readTimer;
+    uint32_t conversionMs;
+    bool measured;
+    TickType_t deadline;
+    TickType_t lastMeasure;
 };
 
 #ifdef CONFIG_DHT22
@@ -59,8 +72,9 @@ static void si7021MeasureTimer(Sensor_t *sensor);
 #endif
 
 #ifdef CONFIG_DS18x20
-static void ds18x20MeasureTimer(TimerHandle_t xTimer);
-static void ds18x20ReadTimer(TimerHandle_t xTimer);
+static bool ds18x20ParasiticPower(gpio_num_t pin);
+static uint8_t ds18x20SetResolution(gpio_num_t pin, ds18x20_addr_t addr, uint8_t resolution);
+static void ds18x20SchedulerTimer(TimerHandle_t xTimer);
 #endif
 
 static char const TAG[]="sensorsTHP";
@@ -73,7 +87,8 @@ IOT_DESCRIBE_ELEMENT_NO_SUBS(
     IOT_ELEMENT_TYPE_SENSOR_HUMIDITY,
     IOT_PUB_DESCRIPTIONS(
         IOT_DESCRIBE_PUB(RETAINED, PERCENT_RH, IOT_PUB_USE_ELEMENT),
-        IOT_DESCRIBE_PUB(RETAINED, CELSIUS, "temperature")
+        IOT_DESCRIBE_PUB(RETAINED, CELSIUS, "temperature"),
+        IOT_DESCRIBE_PUB(RETAINED, STRING, "status")
     )
 );
 #endif
@@ -85,7 +100,8 @@ IOT_DESCRIBE_ELEMENT_NO_SUBS(
     IOT_PUB_DESCRIPTIONS(
         IOT_DESCRIBE_PUB(RETAINED, PERCENT_RH, IOT_PUB_USE_ELEMENT),
         IOT_DESCRIBE_PUB(RETAINED, CELSIUS, "temperature"),
-        IOT_DESCRIBE_PUB(RETAINED, KPA, "pressure")
+        IOT_DESCRIBE_PUB(RETAINED, KPA, "pressure"),
+        IOT_DESCRIBE_PUB(RETAINED, STRING, "status")
     )
 );
 
@@ -94,7 +110,8 @@ IOT_DESCRIBE_ELEMENT_NO_SUBS(
     IOT_ELEMENT_TYPE_SENSOR_TEMPERATURE,
     IOT_PUB_DESCRIPTIONS(
         IOT_DESCRIBE_PUB(RETAINED, CELSIUS, IOT_PUB_USE_ELEMENT),
-        IOT_DESCRIBE_PUB(RETAINED, KPA, "pressure")
+        IOT_DESCRIBE_PUB(RETAINED, KPA, "pressure"),
+        IOT_DESCRIBE_PUB(RETAINED, STRING, "status")
     )
 );
 #endif
@@ -104,7 +121,8 @@ IOT_DESCRIBE_ELEMENT_NO_SUBS(
     temperatureElementDescription, // Temperature
     IOT_ELEMENT_TYPE_SENSOR_TEMPERATURE,
     IOT_PUB_DESCRIPTIONS(
-        IOT_DESCRIBE_PUB(RETAINED, CELSIUS, IOT_PUB_USE_ELEMENT)
+        IOT_DESCRIBE_PUB(RETAINED, CELSIUS, IOT_PUB_USE_ELEMENT),
+        IOT_DESCRIBE_PUB(RETAINED, STRING, "status")
     )
 );
 #endif
@@ -119,6 +137,11 @@ static struct SI7021 *si7021Devices;
 
 #ifdef CONFIG_DS18x20
 static struct DS18x20Pin *ds18x20Pins;
+static int nrofDS18x20Pins = 0;
+static TimerHandle_t ds18x20Timer;
+
+/* Conversion time in milliseconds for 9, 10, 11 and 12 bit resolution */
+static const uint16_t ds18x20ConversionMs[] = { 94, 188, 375, 750 };
 #endif
 
 
@@ -154,6 +177,8 @@ int sensorsDHT22Add(DeviceProfile_Dht22Config_t *config)
         iotElementSetHumanDescription(dht->element, config->name);
     }
     dht->details.pin = config->pin;
+    sensorsInitFilter(dht, 2, config->oversample, config->median, config->smoothing);
+    sensorsSetInterval(dht, config->minInterval, config->maxInterval, config->changeThreshold);
 
     value.i = 0;
     iotElementPublish(dht->element, HUMIDITY_PUB_INDEX_HUMIDITY, value);
@@ -166,8 +191,12 @@ int sensorsDHT22Add(DeviceProfile_Dht22Config_t *config)
 static void dht22MeasureTimer(Sensor_t *sensor)
 {
     int16_t temperature, humidity;
+    esp_err_t err;
 
-    if (dht_read_data(DHT_TYPE_AM2301, sensor->details.pin, &humidity, &temperature) != ESP_OK) {
+    sensorsReadStart(sensor);
+    err = dht_read_data(DHT_TYPE_AM2301, sensor->details.pin, &humidity, &temperature);
+    sensorsReadFinished(sensor, err == ESP_OK);
+    if (err != ESP_OK) {
         ESP_LOGE(TAG, "dht22MeasureTimer: Failed reading sensor pin %d", sensor->details.pin);
         return;
     }
@@ -239,6 +268,8 @@ int sensorsBME280Add(DeviceProfile_Bme280Config_t *config)
     if (config->name) {
         iotElementSetHumanDescription(bme->element, config->name);
     }
+    sensorsInitFilter(bme, bme280p ? 3 : 2, config->oversample, config->median, config->smoothing);
+    sensorsSetInterval(bme, config->minInterval, config->maxInterval, config->changeThreshold);
 
     sensorsCreateSecondsTimer(bme, "bme280", 5, bme280MeasureTimer);
     return 0;
@@ -252,7 +283,9 @@ static void bme280MeasureTimer(Sensor_t *sensor)
     uint32_t humidity, pressure;
     esp_err_t err;
 
+    sensorsReadStart(sensor);
     err = bmp280_read_fixed(&bme->dev, &temperature, &pressure, &humidity);
+    sensorsReadFinished(sensor, err == ESP_OK);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "bme280MeasureTimer: Failed reading sensor %d", err);
         return;
@@ -322,6 +355,8 @@ int sensorsSI7021Add(DeviceProfile_Si7021Config_t *config)
     iotElementPublish(sensor->element, HUMIDITY_PUB_INDEX_HUMIDITY, value);
     iotElementPublish(sensor->element, HUMIDITY_PUB_INDEX_TEMPERATURE, value);
     sensor->details.dev = dev;
+    sensorsInitFilter(sensor, 2, config->oversample, config->median, config->smoothing);
+    sensorsSetInterval(sensor, config->minInterval, config->maxInterval, config->changeThreshold);
     sensorsCreateSecondsTimer(sensor, "si7021", 5, si7021MeasureTimer);
     return 0;
 }
@@ -332,15 +367,17 @@ static void si7021MeasureTimer(Sensor_t *sensor)
     esp_err_t err;
     float temperature, humidity;
 
+    sensorsReadStart(sensor);
     err = si7021_measure_temperature(&dev->dev, &temperature);
     if (err != ESP_OK) {
+        sensorsReadFinished(sensor, false);
         ESP_LOGE(TAG, "si7021MeasureTimer: Failed to read temperature %d", err);
         return;
     }
 
-    sensorsUpdateForHundredth(sensor, HUMIDITY_PUB_INDEX_TEMPERATURE, Notifications_Class_Temperature, (int32_t) (temperature * 100.0));
-
     err = si7021_measure_humidity(&dev->dev, &humidity);
+    sensorsReadFinished(sensor, err == ESP_OK);
+    sensorsUpdateForHundredth(sensor, HUMIDITY_PUB_INDEX_TEMPERATURE, Notifications_Class_Temperature, (int32_t) (temperature * 100.0));
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "si7021MeasureTimer: Failed to read humidity %d", err);
         return;
@@ -356,7 +393,12 @@ int sensorsDS18x20Init(int nrofSensors)
     if (ds18x20Pins == NULL) {
         return -1;
     }
-
+    ds18x20Timer = xTimerCreate("ds18x20", SECS_TO_TICKS(SENSORS_DEFAULT_INTERVAL_SECS), pdFALSE, NULL, ds18x20SchedulerTimer);
+    if (ds18x20Timer == NULL) {
+        free(ds18x20Pins);
+        ds18x20Pins = NULL;
+        return -1;
+    }
     return 0;
 }
 
@@ -368,8 +410,18 @@ int sensorsDS18x20Add(DeviceProfile_Ds18x20Config_t *config)
     struct DS18x20Pin *pinStruct;
     size_t nrofDevices = 0, i;
     gpio_config_t pinConfig;
+    uint8_t resolution;
     esp_err_t err;
 
+    if (ds18x20Pins == NULL) {
+        return -1;
+    }
+
+    resolution = config->resolution ? config->resolution : DS18x20_MAX_RESOLUTION;
+    if ((resolution < DS18x20_MIN_RESOLUTION) || (resolution > DS18x20_MAX_RESOLUTION)) {
+        ESP_LOGW(TAG, "addDS18x20: Resolution %u not supported, using %u bits", config->resolution, DS18x20_MAX_RESOLUTION);
+        resolution = DS18x20_MAX_RESOLUTION;
+    }
 
     pinConfig.pin_bit_mask = 1<<config->pin;
     pinConfig.pull_down_en = GPIO_PULLDOWN_DISABLE;
@@ -391,7 +443,7 @@ int sensorsDS18x20Add(DeviceProfile_Ds18x20Config_t *config)
     } else {
         ESP_LOGI(TAG, "addDS18x20: Found %d devices", nrofDevices);
     }
-    pinStruct = ds18x20Pins;
+    pinStruct = &ds18x20Pins[nrofDS18x20Pins];
     pinStruct->temperatureCorrection = config->temperatureCorrection;
     pinStruct->sensors = calloc(nrofDevices, sizeof(struct DS18x20Sensor));
     if (pinStruct->sensors == NULL) {
@@ -400,49 +452,194 @@ int sensorsDS18x20Add(DeviceProfile_Ds18x20Config_t *config)
     }
     pinStruct->pin = config->pin;
     pinStruct->nrofSensors = nrofDevices;
-    ds18x20Pins++;
+    pinStruct->parasitic = ds18x20ParasiticPower(config->pin);
+    pinStruct->conversionMs = 0;
+    nrofDS18x20Pins++;
     for (i = 0; i < nrofDevices; i++) {
-        pinStruct->sensors[i].addr = deviceAddrs[i];
-        pinStruct->sensors[i].id = NOTIFICATIONS_ID_ERROR;
+        struct DS18x20Sensor *sensor = &pinStruct->sensors[i];
+        uint32_t conversionMs;
+        sensor->addr = deviceAddrs[i];
+        sensor->sensor.id = NOTIFICATIONS_ID_ERROR;
+        sensor->resolution = ds18x20SetResolution(config->pin, deviceAddrs[i], resolution);
         if ((i == 0) && (config->id)) {
-            pinStruct->sensors[i].id = notificationsNewId(config->id);
+            sensor->sensor.id = notificationsNewId(config->id);
+        }
+        sensor->sensor.element = iotNewElement(&temperatureElementDescription, 0, NULL, NULL, "temperature%08x%08x", (uint32_t)(deviceAddrs[i]>> 32), (uint32_t)(deviceAddrs[i]));
+        sensorsInitFilter(&sensor->sensor, 1, config->oversample, config->median, config->smoothing);
+        sensorsSetInterval(&sensor->sensor, config->minInterval, config->maxInterval, config->changeThreshold);
+        sensor->sensor.timer = ds18x20Timer;
+        sensorsRegisterSensor(&sensor->sensor);
+        conversionMs = ds18x20ConversionMs[sensor->resolution - DS18x20_MIN_RESOLUTION];
+        if (conversionMs > pinStruct->conversionMs) {
+            pinStruct->conversionMs = conversionMs;
         }
-        pinStruct->sensors[i].element = iotNewElement(&temperatureElementDescription, 0, NULL, NULL, "temperature%08x%08x", (uint32_t)(deviceAddrs[i]>> 32), (uint32_t)(deviceAddrs[i]));
     }
-    pinStruct->measureTimer = xTimerCreate("ds18x20M", SECS_TO_TICKS(5), pdFALSE, pinStruct, ds18x20MeasureTimer);
-    pinStruct->readTimer = xTimerCreate("ds18x20R", MSECS_TO_TICKS(750), pdFALSE, pinStruct, ds18x20ReadTimer);
-    xTimerStart(pinStruct->measureTimer, 0);
+    ESP_LOGI(TAG, "addDS18x20: Pin %u %s powered, conversion takes %ums", config->pin,
+             pinStruct->parasitic ? "parasitic" : "externally", pinStruct->conversionMs);
+
+    /* Start the first conversion cycle on all pins at the same time. */
+    pinStruct->measured = false;
+    xTimerChangePeriod(ds18x20Timer, 1, 0);
     return 0;
 }
 
-static void ds18x20MeasureTimer(TimerHandle_t xTimer)
+static bool ds18x20ParasiticPower(gpio_num_t pin)
+{
+    int bit;
+    if (!onewire_reset(pin)) {
+        return true;
+    }
+    onewire_skip_rom(pin);
+    onewire_write(pin, DS18x20_READ_POWER_SUPPLY);
+    /* Parasitically powered devices pull the bus low during the read slot */
+    bit = onewire_read_bit(pin);
+    return bit != 1;
+}
+
+static uint8_t ds18x20SetResolution(gpio_num_t pin, ds18x20_addr_t addr, uint8_t resolution)
+{
+    uint8_t scratchpad[9];
+    uint8_t family = addr & 0xff;
+
+    if ((family != DS18B20_FAMILY_ID) && (family != DS1822_FAMILY_ID)) {
+        /* DS18S20 has a fixed resolution and always takes the full conversion time. */
+        return DS18x20_MAX_RESOLUTION;
+    }
+    if (ds18x20_read_scratchpad(pin, addr, scratchpad) != ESP_OK) {
+        ESP_LOGW(TAG, "addDS18x20: Failed to read scratchpad, assuming %u bits", DS18x20_MAX_RESOLUTION);
+        return DS18x20_MAX_RESOLUTION;
+    }
+    if (((scratchpad[4] >> 5) & 3) == resolution - DS18x20_MIN_RESOLUTION) {
+        return resolution;
+    }
+    /* Keep the alarm registers (TH/TL), only change the configuration register.
+       The change isn't copied to EEPROM as it is reapplied on every boot. */
+    scratchpad[4] = ((resolution - DS18x20_MIN_RESOLUTION) << 5) | 0x1f;
+    if (ds18x20_write_scratchpad(pin, addr, &scratchpad[2]) != ESP_OK) {
+        ESP_LOGW(TAG, "addDS18x20: Failed to set resolution, assuming %u bits", DS18x20_MAX_RESOLUTION);
+        return DS18x20_MAX_RESOLUTION;
+    }
+    return resolution;
+}
+
+void sensorsDS18x20SampleNow(void)
 {
-    struct DS18x20Pin *pinStruct = pvTimerGetTimerID(xTimer);
-    if (ds18x20_measure(pinStruct->pin, DS18X20_ANY, true) != ESP_OK) {
-        ESP_LOGE(TAG, "ds18x20MeasureTimer: Failed to send measure");
-        xTimerStart(pinStruct->measureTimer, 0);
+    int i;
+    for (i = 0; i < nrofDS18x20Pins; i++) {
+        /* A conversion already running is still read, then another is started straight away */
+        ds18x20Pins[i].measured = false;
+    }
+}
+
+static TickType_t ds18x20NextMeasure(struct DS18x20Pin *pinStruct, TickType_t now)
+{
+    uint32_t interval = UINT16_MAX;
+    int i;
+    if (!pinStruct->measured) {
+        return now;
+    }
+    /* The pin is sampled at the rate needed by its fastest sensor */
+    for (i = 0; i < pinStruct->nrofSensors; i++) {
+        if (pinStruct->sensors[i].sensor.interval < interval) {
+            interval = pinStruct->sensors[i].sensor.interval;
+        }
+    }
+    return pinStruct->lastMeasure + SECS_TO_TICKS(interval);
+}
+
+static void ds18x20StartConversion(struct DS18x20Pin *pinStruct, TickType_t now)
+{
+    pinStruct->lastMeasure = now;
+    pinStruct->measured = true;
+    if (ds18x20_measure(pinStruct->pin, DS18X20_ANY, false) != ESP_OK) {
+        ESP_LOGE(TAG, "ds18x20SchedulerTimer: Failed to send measure on pin %u", pinStruct->pin);
         return;
     }
-    xTimerStart(pinStruct->readTimer, 0);
+    if (!pinStruct->parasitic) {
+        /* Release the strong pull up so the devices can signal when they are done */
+        onewire_depower(pinStruct->pin);
+    }
+    pinStruct->deadline = now + MSECS_TO_TICKS(pinStruct->conversionMs) + 1;
+    pinStruct->converting = true;
+}
+
+static bool ds18x20ConversionDone(struct DS18x20Pin *pinStruct, TickType_t now)
+{
+    if ((int32_t)(now - pinStruct->deadline) >= 0) {
+        return true;
+    }
+    /* Externally powered devices hold the bus low until the conversion is complete */
+    return !pinStruct->parasitic && (onewire_read_bit(pinStruct->pin) == 1);
 }
 
-static void ds18x20ReadTimer(TimerHandle_t xTimer)
+static void ds18x20ReadPin(struct DS18x20Pin *pinStruct)
 {
-    struct DS18x20Pin *pinStruct = pvTimerGetTimerID(xTimer);
     int i;
     onewire_depower(pinStruct->pin);
 
     for (i = 0; i < pinStruct->nrofSensors; i++) {
+        struct DS18x20Sensor *ds18x20 = &pinStruct->sensors[i];
         float temp;
-        if (ds18x20_read_temperature(pinStruct->pin, pinStruct->sensors[i].addr, &temp) == ESP_OK) {
-            int itemp = (int)((temp + pinStruct->temperatureCorrection) * 100.0);
-            struct Sensor sensor;
-            sensor.id = pinStruct->sensors[i].id;
-            sensor.element = pinStruct->sensors[i].element;
-            sensorsUpdateForHundredth(&sensor, TEMPERATURE_PUB_INDEX_TEMPERATURE, Notifications_Class_Temperature, itemp);
+        esp_err_t err;
+        sensorsReadStart(&ds18x20->sensor);
+        err = ds18x20_read_temperature(pinStruct->pin, ds18x20->addr, &temp);
+        sensorsReadFinished(&ds18x20->sensor, err == ESP_OK);
+        if (err == ESP_OK) {
+            int itemp;
+            if (ds18x20->resolution < DS18x20_MAX_RESOLUTION) {
+                /* Low bits are undefined at lower resolutions, so discard them. */
+                int32_t raw = (int32_t)(temp * 16.0);
+                raw &= ~((1 << (DS18x20_MAX_RESOLUTION - ds18x20->resolution)) - 1);
+                temp = raw / 16.0;
+            }
+            itemp = (int)((temp + pinStruct->temperatureCorrection) * 100.0);
+            sensorsUpdateForHundredth(&ds18x20->sensor, TEMPERATURE_PUB_INDEX_TEMPERATURE, Notifications_Class_Temperature, itemp);
+        } else {
+            ESP_LOGE(TAG, "ds18x20SchedulerTimer: Failed to read sensor %08x%08x", (uint32_t)(ds18x20->addr >> 32), (uint32_t)ds18x20->addr);
+        }
+        sensorsUpdateInterval(&ds18x20->sensor);
+        if (sensorsBurstPending(&ds18x20->sensor)) {
+            /* The conversion time already spaces out the readings, so start the next one straight away */
+            pinStruct->measured = false;
+        }
+    }
+}
+
+static void ds18x20SchedulerTimer(TimerHandle_t xTimer)
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t next = now + SECS_TO_TICKS(UINT16_MAX);
+    int i;
+
+    /* Finish conversions first so that pins due a new cycle can start straight away. */
+    for (i = 0; i < nrofDS18x20Pins; i++) {
+        struct DS18x20Pin *pinStruct = &ds18x20Pins[i];
+        if (pinStruct->converting && ds18x20ConversionDone(pinStruct, now)) {
+            pinStruct->converting = false;
+            ds18x20ReadPin(pinStruct);
+        }
+    }
+
+    /* All pins that are due are started together so their conversions overlap. */
+    for (i = 0; i < nrofDS18x20Pins; i++) {
+        struct DS18x20Pin *pinStruct = &ds18x20Pins[i];
+        TickType_t wake;
+        if (!pinStruct->converting && ((int32_t)(now - ds18x20NextMeasure(pinStruct, now)) >= 0)) {
+            ds18x20StartConversion(pinStruct, now);
+        }
+        if (pinStruct->converting) {
+            wake = pinStruct->parasitic ? pinStruct->deadline : now + DS18x20_POLL_TICKS;
+        } else {
+            wake = ds18x20NextMeasure(pinStruct, now);
+        }
+        if ((int32_t)(wake - next) < 0) {
+            next = wake;
         }
     }
 
-    xTimerStart(pinStruct->measureTimer, 0);
+    if ((int32_t)(next - now) <= 0) {
+        next = now + 1;
+    }
+    xTimerChangePeriod(xTimer, next - now, 0);
 }
-#endif
\ No newline at end of file
+#endif
@@ -1,8 +1,21 @@
 #ifndef _SWITCH_H_
 #define _SWITCH_H_
+#include <stdint.h>
 #include "notifications.h"
 
 int switchInit(void);
+/*
+ * Once switchStart has been called switches can only be added or removed while holding the lock.
+ */
 Notifications_ID_t switchAdd(int pin, uint8_t noiseFilter);
+void switchRemove(int pin);
+
+/*
+ * Stop the switch thread processing (and sending notifications) until switchUnlock is called.
+ * The thread may be blocked publishing a change, so a timeout is needed to avoid deadlocking the caller.
+ * Returns 0 if locked, -1 on timeout.
+ */
+int switchLock(uint32_t timeoutMs);
+void switchUnlock(void);
 void switchStart(void);
 #endif
@@ -2,6 +2,7 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 
 #include "sdkconfig.h"
@@ -12,6 +13,7 @@
 static const char *TAG="switch";
 static void processSwitchHistories(GPIOX_Pins_t *history, int end);
 static void printPinHistory(GPIOX_Pins_t *history, int end, int pin);
+static void switchSetupNewPins(void);
 
 #define SWITCH_THREAD_NAME "switches"
 #define SWITCH_THREAD_PRIO 8
@@ -21,13 +23,22 @@ static void printPinHistory(GPIOX_Pins_t *history, int end, int pin);
 #define SWITCH_THREAD_STACK_WORDS 3*1024
 #endif
 #define MAX_HISTORY 10
-static GPIOX_Pins_t switchPins, switchValues;
+static GPIOX_Pins_t switchPins, switchValues, newPins;
 static GPIOX_Pins_t history[MAX_HISTORY];
 static uint8_t noiseFilterValues[GPIOX_PINS_MAX];
+/* Held by the switch thread while processing, so switches can be added and removed after it has started */
+static SemaphoreHandle_t switchMutex;
+static TaskHandle_t switchThreadHandle = NULL;
+static bool newPinsPending = false;
 
 int switchInit()
 {
     GPIOX_PINS_CLEAR_ALL(switchPins);
+    GPIOX_PINS_CLEAR_ALL(newPins);
+    switchMutex = xSemaphoreCreateMutex();
+    if (switchMutex == NULL) {
+        return -1;
+    }
     return 0;
 }
 
@@ -37,14 +48,71 @@ Notifications_ID_t switchAdd(int pin, uint8_t noiseFilter)
         ESP_LOGE(TAG, "switchAdd: Invalid Pin number %d", pin);
         return -1;
     }
-    GPIOX_PINS_SET(switchPins, pin);
     if (noiseFilter > MAX_HISTORY) {
         noiseFilter = MAX_HISTORY;
     }
     noiseFilterValues[pin] = noiseFilter;
+    if (switchThreadHandle == NULL) {
+        GPIOX_PINS_SET(switchPins, pin);
+    } else {
+        /* The switch thread will configure the pin and read its initial state */
+        GPIOX_PINS_SET(newPins, pin);
+        newPinsPending = true;
+    }
     return NOTIFICATIONS_MAKE_ID(GPIOSWITCH, pin);
 }
 
+void switchRemove(int pin)
+{
+    if ((pin < 0) || (pin >= GPIOX_PINS_MAX)) {
+        return;
+    }
+    GPIOX_PINS_CLEAR(switchPins, pin);
+    GPIOX_PINS_CLEAR(newPins, pin);
+}
+
+int switchLock(uint32_t timeoutMs)
+{
+    if (xSemaphoreTake(switchMutex, timeoutMs / portTICK_RATE_MS) != pdTRUE) {
+        ESP_LOGW(TAG, "Timed out waiting for the switch thread");
+        return -1;
+    }
+    return 0;
+}
+
+void switchUnlock(void)
+{
+    xSemaphoreGive(switchMutex);
+}
+
+static void switchSetupNewPins(void)
+{
+    GPIOX_Pins_t values;
+    int pin, i;
+
+    gpioxSetup(&newPins, GPIOX_MODE_IN_PULLUP);
+    gpioxGetPins(&newPins, &values);
+    for (pin = 0; pin < GPIOX_PINS_MAX; pin++) {
+        if (GPIOX_PINS_IS_SET(newPins, pin)) {
+            bool set = GPIOX_PINS_IS_SET(values, pin);
+            for (i = 0; i < MAX_HISTORY; i++) {
+                if (set) {
+                    GPIOX_PINS_SET(history[i], pin);
+                } else {
+                    GPIOX_PINS_CLEAR(history[i], pin);
+                }
+            }
+            if (set) {
+                GPIOX_PINS_SET(switchValues, pin);
+            } else {
+                GPIOX_PINS_CLEAR(switchValues, pin);
+            }
+            GPIOX_PINS_SET(switchPins, pin);
+            GPIOX_PINS_CLEAR(newPins, pin);
+        }
+    }
+}
+
 static void switchThread(void* pvParameters)
 {
     int historyIdx;
@@ -65,8 +133,14 @@ static void switchThread(void* pvParameters)
         if (historyIdx >= MAX_HISTORY) {
             historyIdx = 0;
         }
+        xSemaphoreTake(switchMutex, portMAX_DELAY);
+        if (newPinsPending) {
+            switchSetupNewPins();
+            newPinsPending = false;
+        }
         gpioxGetPins(&switchPins, &history[historyIdx]);
         processSwitchHistories(history, historyIdx);
+        xSemaphoreGive(switchMutex);
     }
 }
 
@@ -132,6 +206,9 @@ static void printPinHistory(GPIOX_Pins_t *history, int end, int pin)
 void switchStart()
 {
     int i;
+    if (switchThreadHandle != NULL) {
+        return;
+    }
     for (i=0; i < GPIOX_PINS_MAX; i++) {
         if (GPIOX_PINS_IS_SET(switchPins, i)) {
             xTaskCreate(switchThread,
@@ -139,7 +216,7 @@ void switchStart()
                         SWITCH_THREAD_STACK_WORDS,
                         NULL,
                         SWITCH_THREAD_PRIO,
-                        NULL);
+                        &switchThreadHandle);
             return;
         }
     }
@@ -6,6 +6,7 @@
 #include "iot.h"
 #include "notifications.h"
 #include "relay.h"
+#include "timerWheel.h"
 
 typedef void (*ThermostatCallForHeatStateSet_t)(void *, bool);
 typedef bool (*ThermostatCallForHeatStateGet_t)(void *);
@@ -19,9 +20,9 @@ typedef struct Thermostat {
     iotElement_t element;
     char modeState[44]; // {"mode":"manual","secondsLeft":1234567890}
 
-    uint32_t manualModeSecsLeft;
+    uint32_t manualModeSecsLeft; // As last published
     bool manualMode;
-    TimerHandle_t manualModeTimer;
+    TimerWheelEntry_t manualModeTimer;
     int lastTemperature;
 } Thermostat_t;
 
@@ -7,8 +7,6 @@
 #include "cJSON_AddOns.h"
 #include "homeassistant.h"
 
-#define SECS_TO_TICKS(secs) ((secs * 1000) / portTICK_RATE_MS)
-
 #define TARGET_CMD "target "
 #define TARGET_CMD_LEN (sizeof(TARGET_CMD) - 1)
 
@@ -20,7 +18,7 @@
 static void thermostatElementCallback(void *userData, iotElement_t element, iotElementCallbackReason_t reason,
                                       iotElementCallbackDetails_t *details);
 static void thermostatCtrl(Thermostat_t *fan, iotValue_t value);
-static void thermostatManualModeSecsTimeout(TimerHandle_t xTimer);
+static void thermostatManualModeCountdown(void *user, uint32_t secondsLeft);
 static void thermostatManualModeDisable(Thermostat_t *thermostat);
 static void thermostatReevaluateState(Thermostat_t *thermostat);
 static void thermostatUpdateTemperature(Thermostat_t *thermostat, NotificationsMessage_t *message);
@@ -75,7 +73,7 @@ void thermostatInit(Thermostat_t *thermostat, Relay_t *relay,
     iotElementPublish(thermostat->element, PUB_ID_TEMPERATURE, value);
     thermostatUpdateMode(thermostat);
 
-    thermostat->manualModeTimer = xTimerCreate("tMM", SECS_TO_TICKS(1), pdTRUE, thermostat, thermostatManualModeSecsTimeout);
+    timerWheelEntryInit(&thermostat->manualModeTimer, thermostatManualModeCountdown, thermostat);
     notificationsRegister(Notifications_Class_Temperature, temperatureSensor, (NotificationsCallback_t)thermostatUpdateTemperature, thermostat);
 #ifdef CONFIG_HOMEASSISTANT
     notificationsRegister(Notifications_Class_Network, NOTIFICATIONS_ID_MQTT, onMqttStatusUpdated, thermostat);
@@ -178,7 +176,7 @@ static void thermostatCtrl(Thermostat_t *thermostat, iotValue_t value)
     } else if (strncmp(MANUAL_CMD, value.s, MANUAL_CMD_LEN) == 0) {
         uint32_t secs;
         if (sscanf(value.s + MANUAL_CMD_LEN, "%u", &secs) == 1) {
-            xTimerReset(thermostat->manualModeTimer, 0);
+            timerWheelStart(&thermostat->manualModeTimer, secs, CONFIG_TIMER_WHEEL_PROGRESS_SECS);
             thermostat->manualMode = true;
             thermostat->manualModeSecsLeft = secs;
             thermostatUpdateMode(thermostat);
@@ -190,21 +188,24 @@ static void thermostatCtrl(Thermostat_t *thermostat, iotValue_t value)
     }
 }
 
-static void thermostatManualModeSecsTimeout(TimerHandle_t xTimer)
+static void thermostatManualModeCountdown(void *user, uint32_t secondsLeft)
 {
-    Thermostat_t *thermostat = pvTimerGetTimerID(xTimer);
-    thermostat->manualModeSecsLeft --;
-    thermostatUpdateMode(thermostat);
+    Thermostat_t *thermostat = user;
 
-    ESP_LOGI(TAG, "%s: Manual mode seconds left %d", iotElementGetName(thermostat->element), thermostat->manualModeSecsLeft);
-    if (thermostat->manualModeSecsLeft == 0) {
+    ESP_LOGI(TAG, "%s: Manual mode seconds left %d", iotElementGetName(thermostat->element), secondsLeft);
+    if (secondsLeft == 0) {
         thermostatManualModeDisable(thermostat);
+    } else {
+        thermostat->manualModeSecsLeft = secondsLeft;
+        thermostatUpdateMode(thermostat);
     }
 }
 
 static void thermostatManualModeDisable(Thermostat_t *thermostat)
 {
+    timerWheelStop(&thermostat->manualModeTimer);
     thermostat->manualMode = false;
+    thermostat->manualModeSecsLeft = 0;
     thermostatUpdateMode(thermostat);
     thermostatReevaluateState(thermostat);
 }
@@ -1,19 +1,24 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <netdb.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "mbedtls/md5.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_ota_ops.h"
+#include "nvs_flash.h"
 
 #include "updaterInternal.h"
 #include "http_parser.h"
+#include "uzlib.h"
 #include "sdkconfig.h"
 
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
@@ -22,26 +27,198 @@ static const char TAG[]="Updater";
 
 #define MAX_HASH_LENGTH 16
 
+/*
+ * The last byte of the signature gives the format of the data following the header. binLen and digest always describe
+ * the data as downloaded, a compressed image is checked again by the zlib checksum once inflated.
+ */
+#define OTA_SIG "OTA"
+#define OTA_SIG_LEN 3
+#define OTA_FORMAT_RAW 0
+#define OTA_FORMAT_ZLIB 'Z'
+#define OTA_FORMAT_DELTA 'D'
+
 static struct Header {
     char sig[4];
-    size_t binLen;
+    uint32_t binLen;
     char digest[MAX_HASH_LENGTH];
 } updateHeader;
 
 static size_t updateHeaderBytes = 0;
 static size_t updateBinBytes = 0;
 static esp_ota_handle_t updateHandle = 0;
-
-#define MAX_RECV_BUFFER_LENGTH 1500
-static char recvBuffer[MAX_RECV_BUFFER_LENGTH];
+static const esp_partition_t *updatePartition;
 
 static mbedtls_md5_context updateDigest;
 
+/*
+ * The download is split into two stages so the network isn't stalled while flash is being erased and written. The
+ * updater thread receives the body directly into one block while the writer thread writes the other to flash, full
+ * blocks are passed to the writer on fullQueue and handed back on freeQueue once written.
+ */
+#define NROF_BLOCKS 2
+#define BLOCK_SIZE CONFIG_UPDATER_BLOCK_SIZE
+
+#define WRITER_THREAD_NAME "otawriter"
+#define WRITER_THREAD_PRIO 6
+#ifdef CONFIG_IDF_TARGET_ESP8266
+#define WRITER_THREAD_STACK_WORDS 1024
+#elif CONFIG_IDF_TARGET_ESP32
+#define WRITER_THREAD_STACK_WORDS 3072
+#endif
+
+#define PROGRESS_TICKS (CONFIG_UPDATER_PROGRESS_MS / portTICK_RATE_MS)
+
+/* Compressed images are inflated by the writer thread into INFLATE_BUFFER_SIZE pieces */
+#define INFLATE_BUFFER_SIZE 1024
+#define ZLIB_WINDOW_BITS(cmf) (((cmf) >> 4) + 8)
+
+/*
+ * A delta image is a zlib stream holding a PatchHeader followed by commands, each made up of a PatchControl, addLen
+ * bytes that are added to the running image starting at the current source offset and copyLen bytes that are copied
+ * as they are. The source offset then moves on by seek. See tools/otadelta.py.
+ */
+#define PATCH_SOURCE_SIZE 256
+
+struct PatchHeader {
+    uint32_t sourceLen;
+    char sourceDigest[MAX_HASH_LENGTH];
+    uint32_t targetLen;
+    char targetDigest[MAX_HASH_LENGTH];
+};
+
+struct PatchControl {
+    uint32_t addLen;
+    uint32_t copyLen;
+    int32_t seek;
+};
+
+typedef enum PatchState {
+    PATCH_HEADER,
+    PATCH_CONTROL,
+    PATCH_ADD,
+    PATCH_COPY
+} PatchState_e;
+
+/*
+ * A dropped connection doesn't restart the download, the next request asks for the rest of the file with a Range
+ * header. Retries back off from RETRY_DELAY_MS up to MAX_RETRY_DELAY_MS and the count is reset whenever a request
+ * makes progress.
+ */
+#define RECV_TIMEOUT_MS 10000
+#define RETRY_DELAY_MS 1000
+#define MAX_RETRY_DELAY_MS 30000
+
+#define HEADER_FIELD_SIZE 16
+#define HEADER_VALUE_SIZE 48
+
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+#define RESUME_NAMESPACE "updater"
+#define RESUME_PATH "path"
+#define RESUME_PARTITION "partition"
+#define RESUME_HEADER "header"
+#define RESUME_WRITTEN "written"
+#define RESUME_SAVE_BYTES (CONFIG_UPDATER_RESUME_SAVE_KB * 1024)
+#define SECTOR_SIZE 4096
+#define SECTOR_ROUND_UP(x) (((x) + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1))
+#endif
+
+typedef struct Block {
+    char *data;
+    size_t len; /* 0 tells the writer to stop */
+} Block_t;
+
+typedef enum DownloadResult {
+    DOWNLOAD_OK,
+    DOWNLOAD_RETRY,
+    DOWNLOAD_FAILED
+} DownloadResult_e;
+
+struct Response {
+    bool done;
+    bool failed; /* Retrying won't help */
+    size_t bodyOffset; /* Offset in the OTA file of the next body byte */
+    bool haveRange;
+    unsigned int rangeStart;
+    unsigned int rangeTotal;
+    bool inValue;
+    size_t fieldLen;
+    size_t valueLen;
+    char field[HEADER_FIELD_SIZE];
+    char value[HEADER_VALUE_SIZE];
+};
+
+static char *blocks;
+static char *fillBlock;
+static size_t fillLen;
+static QueueHandle_t freeQueue;
+static QueueHandle_t fullQueue;
+static SemaphoreHandle_t writerDone;
+static const char * volatile writeError; /* Set by the writer thread when the update can't continue */
+static char imageFormat;
+static bool writeToPartition; /* Resumed after a restart, so esp_ota_begin() would erase what is already written */
+static bool otaStarted; /* esp_ota_begin() has been called for this download */
+
+static size_t writtenBytes; /* Downloaded bytes processed by the writer */
+static size_t imageBytes; /* Bytes written to flash */
+static bool inflateDone;
+
+static struct Patch {
+    PatchState_e state;
+    size_t collected; /* Bytes of the header or control received so far */
+    union {
+        struct PatchHeader header;
+        struct PatchControl control;
+    };
+    uint32_t targetLen;
+    char targetDigest[MAX_HASH_LENGTH];
+    uint32_t sourceLen;
+    uint32_t sourceOffset;
+    uint32_t remaining; /* Bytes left to add or copy */
+    const esp_partition_t *source;
+    mbedtls_md5_context digest;
+    unsigned char sourceData[PATCH_SOURCE_SIZE];
+} patch;
+static unsigned int progressPercent;
+static TickType_t progressTime;
+
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+static const char *resumePath;
+static size_t resumeSaved;
+#endif
+
+static size_t downloadOffset(void);
+static bool downloadComplete(void);
+static DownloadResult_e downloadRange(int sock, char *host, int port, char *path, bool *keepAlive);
+static void processHeader(struct Response *response);
+static int queueFillBlock(void);
+static void writerThread(void *pvParameters);
+static bool writerTake(Block_t *block);
+static void writerGive(Block_t *block);
+static void writeImage(const char *data, size_t len);
+static int otaStart(void);
+static bool inflateImage(Block_t *block);
+static int inflateRead(struct uzlib_uncomp *uncomp);
+static void inflateOutput(unsigned char *data, size_t len);
+static void patchOutput(unsigned char *data, size_t len);
+static void patchCommand(void);
+static void patchCheckSource(void);
+static void patchWrite(const unsigned char *data, size_t len);
+static void patchFinish(void);
+static void reportProgress(void);
+static int pipelineStart(void);
+static void pipelineStop(void);
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+static bool resumeLoad(const char *path);
+static void resumeSave(size_t written);
+static void resumeClear(void);
+#endif
+
 static int connectToServer(char *host, int port)
 {
     struct sockaddr_in sAddr;
     int mySocket = -1;
     struct hostent* entry;
+    struct timeval timeout = { .tv_sec = RECV_TIMEOUT_MS / 1000, .tv_usec = (RECV_TIMEOUT_MS % 1000) * 1000 };
 
     entry = gethostbyname(host);
     if (entry != NULL) {
@@ -51,6 +228,7 @@ static int connectToServer(char *host, int port)
 
         mySocket = socket(AF_INET, SOCK_STREAM, 0);
         if (mySocket >= 0) {
+            setsockopt(mySocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
             if (connect(mySocket, (struct sockaddr*)&sAddr, sizeof(sAddr)) == 0) {
                 return mySocket;
             } else {
@@ -61,17 +239,23 @@ static int connectToServer(char *host, int port)
     return -1;
 }
 
-static int sendGet(int sock, char *host, int port, char *path)
+static int sendGet(int sock, char *host, int port, char *path, size_t offset)
 {
     char *req;
+    char range[32] = "";
     int l;
     int r = 0;
     const char *GET_FORMAT =
-        "GET %s HTTP/1.0\r\n"
+        "GET %s HTTP/1.1\r\n"
         "Host: %s:%d\r\n"
-        "User-Agent: hiot/1.0 " CONFIG_IDF_TARGET "\r\n\r\n";
+        "User-Agent: hiot/1.0 " CONFIG_IDF_TARGET "\r\n"
+        "Connection: keep-alive\r\n"
+        "%s\r\n";
 
-    l = asprintf(&req,  GET_FORMAT, path, host, port);
+    if (offset > 0) {
+        snprintf(range, sizeof(range), "Range: bytes=%u-\r\n", (unsigned int)offset);
+    }
+    l = asprintf(&req,  GET_FORMAT, path, host, port, range);
     if (l == -1) {
         return -1;
     }
@@ -82,83 +266,746 @@ static int sendGet(int sock, char *host, int port, char *path)
     return r;
 }
 
-static int httpSendGet(char *host, int port, char *path)
+static int onMessageComplete(http_parser* parser)
 {
-    int sock = connectToServer(host, port);
-    if (sock == -1) {
-        return -1;
+    struct Response *response = parser->data;
+    response->done = true;
+    return 0;
+}
+
+static int onStatus(http_parser* parser, const char *at, size_t length)
+{
+    struct Response *response = parser->data;
+
+    if ((parser->status_code == 200) || (parser->status_code == 206)) {
+        return 0;
     }
-    if (sendGet(sock, host, port, path) == -1) {
-        close(sock);
-        sock = -1;
+    ESP_LOGW(TAG, "Download failed %d", parser->status_code);
+    /* Server errors and timeouts may be temporary, anything else (ie 404) won't be fixed by asking again */
+    if ((parser->status_code < 500) && (parser->status_code != 408) && (parser->status_code != 429)) {
+        updaterUpdateStatusf("Download failed with error code %d", parser->status_code);
+        response->failed = true;
     }
-    return sock;
+    return -1;
 }
 
-static int onMessageComplete(http_parser* parser)
+static int onHeaderField(http_parser* parser, const char *at, size_t length)
 {
-    bool *done = (bool *)parser->data;
-    *done = true;
+    struct Response *response = parser->data;
+    size_t toCopy;
+
+    /* Names and values can arrive in pieces, a new name means the last value is complete */
+    if (response->inValue) {
+        processHeader(response);
+    }
+    toCopy = MIN(length, HEADER_FIELD_SIZE - 1 - response->fieldLen);
+    memcpy(response->field + response->fieldLen, at, toCopy);
+    response->fieldLen += toCopy;
     return 0;
 }
 
-static int onStatus(http_parser* parser, const char *at, size_t length)
+static int onHeaderValue(http_parser* parser, const char *at, size_t length)
 {
-    if (parser->status_code != 200) {
-        ESP_LOGW(TAG, "Download failed %d", parser->status_code);
-        updaterUpdateStatusf("Download failed with error code %d", parser->status_code);
+    struct Response *response = parser->data;
+    size_t toCopy = MIN(length, HEADER_VALUE_SIZE - 1 - response->valueLen);
+
+    memcpy(response->value + response->valueLen, at, toCopy);
+    response->valueLen += toCopy;
+    response->inValue = true;
+    return 0;
+}
+
+static void processHeader(struct Response *response)
+{
+    response->field[response->fieldLen] = 0;
+    response->value[response->valueLen] = 0;
+    if (strcasecmp(response->field, "Content-Range") == 0) {
+        response->haveRange = sscanf(response->value, "bytes %u-%*u/%u", &response->rangeStart, &response->rangeTotal) == 2;
+    }
+    response->inValue = false;
+    response->fieldLen = 0;
+    response->valueLen = 0;
+}
+
+static int onHeadersComplete(http_parser* parser)
+{
+    struct Response *response = parser->data;
+
+    if (response->inValue) {
+        processHeader(response);
+    }
+    if (parser->status_code != 206) {
+        /* The server ignored the range, the bytes already received are skipped in onBody */
+        response->bodyOffset = 0;
+        return 0;
+    }
+    if (!response->haveRange || (response->rangeStart > downloadOffset())) {
+        updaterUpdateStatus("Failed: Invalid range response");
+        response->failed = true;
         return -1;
     }
+    if ((updateHeaderBytes == sizeof(struct Header)) &&
+            (response->rangeTotal != sizeof(struct Header) + updateHeader.binLen)) {
+        updaterUpdateStatus("Failed: OTA file changed");
+        response->failed = true;
+        return -1;
+    }
+    response->bodyOffset = response->rangeStart;
     return 0;
 }
 
 static int onBody(http_parser* parser, const char *at, size_t length)
 {
-    int r = 0;
+    struct Response *response = parser->data;
+    size_t offset = downloadOffset();
+    size_t skip;
+
+    if (response->bodyOffset < offset) {
+        skip = MIN(offset - response->bodyOffset, length);
+        if ((response->bodyOffset < updateHeaderBytes) &&
+                (memcmp(((char *)&updateHeader) + response->bodyOffset, at,
+                        MIN(skip, updateHeaderBytes - response->bodyOffset)) != 0)) {
+            updaterUpdateStatus("Failed: OTA file changed");
+            response->failed = true;
+            return -1;
+        }
+        response->bodyOffset += skip;
+        at += skip;
+        length -= skip;
+    }
+    response->bodyOffset += length;
+
     if (updateHeaderBytes < sizeof(struct Header)) {
         int toCopy = MIN(sizeof(struct Header) - updateHeaderBytes, length);
-        memcpy(&updateHeader, at, toCopy);
+        memcpy(((char *)&updateHeader) + updateHeaderBytes, at, toCopy);
         updateHeaderBytes += toCopy;
         at += toCopy;
         length -= toCopy;
-        updaterUpdateStatusf("Downloading Header: %d/%d", updateHeaderBytes, sizeof(struct Header));
         if (updateHeaderBytes == sizeof(struct Header)) {
-            if (memcmp(updateHeader.sig, "OTA\0", 4) != 0) {
+            imageFormat = updateHeader.sig[OTA_SIG_LEN];
+            if ((memcmp(updateHeader.sig, OTA_SIG, OTA_SIG_LEN) != 0) ||
+                    ((imageFormat != OTA_FORMAT_RAW) && (imageFormat != OTA_FORMAT_ZLIB) &&
+                     (imageFormat != OTA_FORMAT_DELTA))) {
                 updaterUpdateStatus("Failed: Invalid OTA signature");
+                response->failed = true;
                 return -1;
             }
+            updaterUpdateStatusf("Downloading Bin: %d bytes", updateHeader.binLen);
         }
     }
 
-    if(updateHeaderBytes == sizeof(struct Header)) {
-        if (esp_ota_write(updateHandle, at, length) != ESP_OK) {
-            return -1;
-        }
-        mbedtls_md5_update_ret(&updateDigest, (unsigned char *)at, length);
+    if ((updateHeaderBytes == sizeof(struct Header)) && (length > 0)) {
         updateBinBytes += length;
-        updaterUpdateStatusf("Downloading Bin: %d/%d", updateBinBytes, updateHeader.binLen);
         if (updateBinBytes > updateHeader.binLen) {
             ESP_LOGE(TAG, "Have now download more bytes than expected (%d > %d)", updateBinBytes, updateHeader.binLen);
+            response->failed = true;
             return -1;
         }
+        /* The body was received into the fill block after the bytes already in it, so it only moves to close the gap
+         * left by the HTTP and OTA headers. */
+        if (at != fillBlock + fillLen) {
+            memmove(fillBlock + fillLen, at, length);
+        }
+        fillLen += length;
     }
+    return 0;
+}
 
-    return r;
+/*
+ * Number of bytes of the OTA file received so far, including the header.
+ */
+static size_t downloadOffset(void)
+{
+    return updateHeaderBytes + updateBinBytes;
 }
 
-void updaterDownloadAndUpdate(char *host, int port, char *path)
+static bool downloadComplete(void)
 {
-    int sock;
-    int err = -1;
+    return (updateHeaderBytes == sizeof(struct Header)) && (updateBinBytes == updateHeader.binLen);
+}
+
+/*
+ * Request the rest of the file on sock and receive until the response ends.
+ */
+static DownloadResult_e downloadRange(int sock, char *host, int port, char *path, bool *keepAlive)
+{
+    struct Response response;
     http_parser parser;
     http_parser_settings parserSettings;
-    size_t len;
-    bool done = false;
-    const esp_partition_t *updatePartition;
+    int len;
+
+    if (sendGet(sock, host, port, path, downloadOffset()) == -1) {
+        return DOWNLOAD_RETRY;
+    }
+
+    memset(&response, 0, sizeof(response));
+    http_parser_init(&parser, HTTP_RESPONSE);
+    parser.data = &response;
+    http_parser_settings_init(&parserSettings);
+    parserSettings.on_status = onStatus;
+    parserSettings.on_header_field = onHeaderField;
+    parserSettings.on_header_value = onHeaderValue;
+    parserSettings.on_headers_complete = onHeadersComplete;
+    parserSettings.on_body = onBody;
+    parserSettings.on_message_complete = onMessageComplete;
+
+    while (!response.done) {
+        len = recv(sock, fillBlock + fillLen, BLOCK_SIZE - fillLen, 0);
+        if (len < 0) {
+            ESP_LOGW(TAG, "Connection error at %d bytes", downloadOffset());
+            return DOWNLOAD_RETRY;
+        }
+        /* A length of 0 tells the parser the connection has closed */
+        http_parser_execute(&parser, &parserSettings, fillBlock + fillLen, len);
+        if (parser.http_errno != HPE_OK) {
+            return response.failed ? DOWNLOAD_FAILED : DOWNLOAD_RETRY;
+        }
+        if ((len == 0) && !response.done) {
+            ESP_LOGW(TAG, "Connection closed at %d bytes", downloadOffset());
+            return DOWNLOAD_RETRY;
+        }
+        if ((fillLen == BLOCK_SIZE) && queueFillBlock()) {
+            return DOWNLOAD_FAILED;
+        }
+    }
+    *keepAlive = http_should_keep_alive(&parser);
+    return DOWNLOAD_OK;
+}
+
+/*
+ * Hash the fill block and pass it to the writer, then wait for a free block to receive into.
+ */
+static int queueFillBlock(void)
+{
+    Block_t block;
+
+    if (fillLen == 0) {
+        return 0;
+    }
+    mbedtls_md5_update_ret(&updateDigest, (unsigned char *)fillBlock, fillLen);
+    block.data = fillBlock;
+    block.len = fillLen;
+    xQueueSend(fullQueue, &block, portMAX_DELAY);
+    xQueueReceive(freeQueue, &fillBlock, portMAX_DELAY);
+    fillLen = 0;
+    return writeError ? -1 : 0;
+}
+
+static void writerThread(void *pvParameters)
+{
+    Block_t block;
+
+    while (writerTake(&block)) {
+        /* After a failure blocks are still handed back so the receiver never waits forever */
+        if (!writeError) {
+            if (inflateDone) {
+                writeError = "Failed: Data after compressed image";
+            } else if ((imageFormat == OTA_FORMAT_ZLIB) || (imageFormat == OTA_FORMAT_DELTA)) {
+                /* Takes further blocks itself, returns false if it took the request to stop */
+                if (!inflateImage(&block)) {
+                    break;
+                }
+            } else {
+                writeImage(block.data, block.len);
+            }
+        }
+        writerGive(&block);
+    }
+    xSemaphoreGive(writerDone);
+    vTaskDelete(NULL);
+}
+
+/*
+ * Wait for the next full block, returns false when told to stop.
+ */
+static bool writerTake(Block_t *block)
+{
+    xQueueReceive(fullQueue, block, portMAX_DELAY);
+    return block->len != 0;
+}
+
+static void writerGive(Block_t *block)
+{
+    xQueueSend(freeQueue, &block->data, portMAX_DELAY);
+    writtenBytes += block->len;
+    reportProgress();
+}
+
+static void writeImage(const char *data, size_t len)
+{
+    esp_err_t err;
+
+    if (!writeToPartition && !otaStarted && otaStart()) {
+        writeError = "Failed: esp_ota_begin";
+        return;
+    }
+    if (writeToPartition) {
+        err = esp_partition_write(updatePartition, imageBytes, data, len);
+    } else {
+        err = esp_ota_write(updateHandle, data, len);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Flash write failed at %d, err=0x%x", imageBytes, err);
+        writeError = "Failed: Flash write";
+        return;
+    }
+    imageBytes += len;
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+    /* A compressed download can't be restarted part way through, the inflate state would be lost */
+    if ((imageFormat == OTA_FORMAT_RAW) && (imageBytes - resumeSaved >= RESUME_SAVE_BYTES)) {
+        resumeSave(imageBytes);
+    }
+#endif
+}
+
+/*
+ * Start writing the update partition. Left until there is something to write, as it erases the partition and the
+ * saved progress, so a download that fails straight away (such as a delta that doesn't exist) leaves an interrupted
+ * download to be resumed later.
+ */
+static int otaStart(void)
+{
+    esp_err_t err;
+
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+    resumeClear();
+#endif
+    err = esp_ota_begin(updatePartition, OTA_SIZE_UNKNOWN, &updateHandle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed, error=%d", err);
+        return -1;
+    }
+    otaStarted = true;
+    return 0;
+}
+
+static Block_t *inflateBlock;
+static bool inflateEnded;
+
+/*
+ * Inflate the zlib stream starting in block into flash. The window is allocated to match the stream, up to
+ * UPDATER_WINDOW_BITS, and uzlib pulls in further blocks through inflateRead() as it needs them.
+ * Returns false if the request to stop was taken while waiting for more data.
+ */
+static bool inflateImage(Block_t *block)
+{
+    struct uzlib_uncomp d;
+    unsigned int windowBits = ZLIB_WINDOW_BITS((unsigned char)block->data[0]);
+    unsigned char *window = NULL;
+    unsigned char *buffer = NULL;
+    int r;
+
+    if (windowBits > CONFIG_UPDATER_WINDOW_BITS) {
+        ESP_LOGE(TAG, "Compression window %u bits, maximum %u", windowBits, CONFIG_UPDATER_WINDOW_BITS);
+        writeError = "Failed: Compression window too large";
+        return true;
+    }
+    window = malloc(1 << windowBits);
+    buffer = malloc(INFLATE_BUFFER_SIZE);
+    if ((window == NULL) || (buffer == NULL)) {
+        writeError = "Failed: Out of memory";
+        goto exit;
+    }
+
+    inflateBlock = block;
+    inflateEnded = false;
+    memset(&d, 0, sizeof(d));
+    uzlib_init();
+    uzlib_uncompress_init(&d, window, 1 << windowBits);
+    d.source = (unsigned char *)block->data;
+    d.source_limit = (unsigned char *)block->data + block->len;
+    d.source_read_cb = inflateRead;
+    if (uzlib_zlib_parse_header(&d) < 0) {
+        writeError = "Failed: Invalid compressed image";
+        goto exit;
+    }
+    do {
+        d.dest_start = d.dest = buffer;
+        d.dest_limit = buffer + INFLATE_BUFFER_SIZE;
+        r = uzlib_uncompress_chksum(&d);
+        if (r < 0) {
+            ESP_LOGE(TAG, "Inflate failed %d after %d bytes", r, imageBytes);
+            writeError = inflateEnded ? "Failed: Compressed image truncated" : "Failed: Invalid compressed image";
+            break;
+        }
+        inflateOutput(buffer, d.dest - buffer);
+    } while ((r == TINF_OK) && !writeError);
+    inflateDone = (r == TINF_DONE) && !writeError;
+    if (inflateDone && (imageFormat == OTA_FORMAT_DELTA)) {
+        patchFinish();
+    }
+
+exit:
+    free(window);
+    free(buffer);
+    return !inflateEnded;
+}
+
+static int inflateRead(struct uzlib_uncomp *uncomp)
+{
+    if (inflateEnded) {
+        return -1;
+    }
+    writerGive(inflateBlock);
+    if (!writerTake(inflateBlock)) {
+        inflateEnded = true;
+        return -1;
+    }
+    uncomp->source = (unsigned char *)inflateBlock->data + 1;
+    uncomp->source_limit = (unsigned char *)inflateBlock->data + inflateBlock->len;
+    return (unsigned char)inflateBlock->data[0];
+}
+
+static void inflateOutput(unsigned char *data, size_t len)
+{
+    if (imageFormat == OTA_FORMAT_DELTA) {
+        patchOutput(data, len);
+    } else {
+        writeImage((char *)data, len);
+    }
+}
+
+/*
+ * Rebuild the new image from the inflated patch, the added bytes are summed in place with the running image.
+ */
+static void patchOutput(unsigned char *data, size_t len)
+{
+    size_t size;
+    size_t n;
+    size_t i;
+
+    while ((len > 0) && !writeError) {
+        switch (patch.state) {
+        case PATCH_HEADER:
+        case PATCH_CONTROL:
+            size = (patch.state == PATCH_HEADER) ? sizeof(patch.header) : sizeof(patch.control);
+            n = MIN(size - patch.collected, len);
+            memcpy((char *)&patch.header + patch.collected, data, n);
+            patch.collected += n;
+            if (patch.collected == size) {
+                patch.collected = 0;
+                if (patch.state == PATCH_HEADER) {
+                    patchCheckSource();
+                    patch.state = PATCH_CONTROL;
+                } else {
+                    patchCommand();
+                }
+            }
+            break;
+
+        case PATCH_ADD:
+            n = MIN(MIN(patch.remaining, len), PATCH_SOURCE_SIZE);
+            if (esp_partition_read(patch.source, patch.sourceOffset, patch.sourceData, n) != ESP_OK) {
+                writeError = "Failed: Reading running image";
+                return;
+            }
+            for (i = 0; i < n; i++) {
+                data[i] += patch.sourceData[i];
+            }
+            patchWrite(data, n);
+            patch.sourceOffset += n;
+            patch.remaining -= n;
+            if (patch.remaining == 0) {
+                patch.remaining = patch.control.copyLen;
+                patch.state = PATCH_COPY;
+            }
+            break;
+
+        case PATCH_COPY:
+            n = MIN(patch.remaining, len);
+            patchWrite(data, n);
+            patch.remaining -= n;
+            break;
+        }
+        data += n;
+        len -= n;
+        if ((patch.state == PATCH_COPY) && (patch.remaining == 0)) {
+            patch.sourceOffset += patch.control.seek;
+            patch.state = PATCH_CONTROL;
+        }
+    }
+}
+
+static void patchCommand(void)
+{
+    uint32_t targetLeft = patch.targetLen - imageBytes;
+
+    if ((patch.control.addLen > targetLeft) || (patch.control.copyLen > targetLeft - patch.control.addLen) ||
+            (patch.sourceOffset > patch.sourceLen) || (patch.control.addLen > patch.sourceLen - patch.sourceOffset)) {
+        ESP_LOGE(TAG, "Invalid delta command add %u copy %u at %u", patch.control.addLen, patch.control.copyLen,
+                 patch.sourceOffset);
+        writeError = "Failed: Invalid delta image";
+        return;
+    }
+    patch.remaining = patch.control.addLen;
+    patch.state = PATCH_ADD;
+    if (patch.remaining == 0) {
+        patch.remaining = patch.control.copyLen;
+        patch.state = PATCH_COPY;
+    }
+}
+
+/*
+ * A delta only makes sense applied to the image it was made from, so check the digest of the running image before
+ * anything is written.
+ */
+static void patchCheckSource(void)
+{
+    mbedtls_md5_context md5;
+    unsigned char digest[MAX_HASH_LENGTH];
+    uint32_t offset;
+    size_t n;
+    esp_err_t err = ESP_OK;
+
+    patch.source = esp_ota_get_running_partition();
+    patch.sourceLen = patch.header.sourceLen;
+    patch.sourceOffset = 0;
+    patch.targetLen = patch.header.targetLen;
+    memcpy(patch.targetDigest, patch.header.targetDigest, MAX_HASH_LENGTH);
+    if (patch.sourceLen > patch.source->size) {
+        writeError = "Failed: Delta is for a different image";
+        return;
+    }
+
+    mbedtls_md5_init(&md5);
+    mbedtls_md5_starts_ret(&md5);
+    for (offset = 0; (offset < patch.sourceLen) && (err == ESP_OK); offset += n) {
+        n = MIN(patch.sourceLen - offset, PATCH_SOURCE_SIZE);
+        err = esp_partition_read(patch.source, offset, patch.sourceData, n);
+        mbedtls_md5_update_ret(&md5, patch.sourceData, n);
+    }
+    mbedtls_md5_finish_ret(&md5, digest);
+    mbedtls_md5_free(&md5);
+    if (err != ESP_OK) {
+        writeError = "Failed: Reading running image";
+    } else if (memcmp(digest, patch.header.sourceDigest, MAX_HASH_LENGTH) != 0) {
+        ESP_LOGE(TAG, "Running image doesn't match delta source (%u bytes)", patch.sourceLen);
+        writeError = "Failed: Delta is for a different image";
+    } else {
+        ESP_LOGI(TAG, "Applying delta to running image, %u bytes to %u bytes", patch.sourceLen, patch.targetLen);
+        mbedtls_md5_init(&patch.digest);
+        mbedtls_md5_starts_ret(&patch.digest);
+    }
+}
+
+static void patchWrite(const unsigned char *data, size_t len)
+{
+    mbedtls_md5_update_ret(&patch.digest, data, len);
+    writeImage((const char *)data, len);
+}
+
+static void patchFinish(void)
+{
+    unsigned char digest[MAX_HASH_LENGTH];
+
+    if ((patch.state != PATCH_CONTROL) || (patch.collected != 0) || (imageBytes != patch.targetLen)) {
+        writeError = "Failed: Delta image incomplete";
+        return;
+    }
+    mbedtls_md5_finish_ret(&patch.digest, digest);
+    mbedtls_md5_free(&patch.digest);
+    if (memcmp(digest, patch.targetDigest, MAX_HASH_LENGTH) != 0) {
+        writeError = "Failed: Delta image digest mismatch";
+    }
+}
+
+/*
+ * Status is published over MQTT, so only report when the download has moved on by UPDATER_PROGRESS_PERCENT or
+ * UPDATER_PROGRESS_MS has passed since the last report.
+ */
+static void reportProgress(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    unsigned int percent = updateHeader.binLen ? (uint64_t)writtenBytes * 100 / updateHeader.binLen : 0;
+
+    if ((percent >= progressPercent + CONFIG_UPDATER_PROGRESS_PERCENT) || (now - progressTime >= PROGRESS_TICKS) ||
+            (writtenBytes == updateHeader.binLen)) {
+        progressPercent = percent;
+        progressTime = now;
+        updaterUpdateStatusf("Downloading Bin: %d/%d (%u%%)", writtenBytes, updateHeader.binLen, percent);
+    }
+}
+
+static int pipelineStart(void)
+{
+    int i;
+
+    fillLen = 0;
+    writtenBytes = 0;
+    imageBytes = 0;
+    writeError = NULL;
+    imageFormat = OTA_FORMAT_RAW;
+    inflateDone = false;
+    patch.state = PATCH_HEADER;
+    patch.collected = 0;
+    progressPercent = 0;
+    progressTime = xTaskGetTickCount();
+
+    blocks = malloc(NROF_BLOCKS * BLOCK_SIZE);
+    freeQueue = xQueueCreate(NROF_BLOCKS, sizeof(char *));
+    fullQueue = xQueueCreate(NROF_BLOCKS + 1, sizeof(Block_t));
+    writerDone = xSemaphoreCreateBinary();
+    if ((blocks == NULL) || (freeQueue == NULL) || (fullQueue == NULL) || (writerDone == NULL)) {
+        goto error;
+    }
+    fillBlock = blocks;
+    for (i = 1; i < NROF_BLOCKS; i++) {
+        char *block = blocks + (i * BLOCK_SIZE);
+        xQueueSend(freeQueue, &block, 0);
+    }
+    if (xTaskCreate(writerThread, WRITER_THREAD_NAME, WRITER_THREAD_STACK_WORDS, NULL, WRITER_THREAD_PRIO, NULL) != pdPASS) {
+        goto error;
+    }
+    return 0;
+
+error:
+    ESP_LOGE(TAG, "Failed to allocate download buffers");
+    free(blocks);
+    blocks = NULL;
+    if (freeQueue != NULL) {
+        vQueueDelete(freeQueue);
+        freeQueue = NULL;
+    }
+    if (fullQueue != NULL) {
+        vQueueDelete(fullQueue);
+        fullQueue = NULL;
+    }
+    if (writerDone != NULL) {
+        vSemaphoreDelete(writerDone);
+        writerDone = NULL;
+    }
+    return -1;
+}
+
+/*
+ * Tell the writer to stop once it has written any blocks already queued, and wait for it.
+ */
+static void pipelineStop(void)
+{
+    Block_t block = { .data = NULL, .len = 0 };
+
+    xQueueSend(fullQueue, &block, portMAX_DELAY);
+    xSemaphoreTake(writerDone, portMAX_DELAY);
+    vSemaphoreDelete(writerDone);
+    vQueueDelete(fullQueue);
+    vQueueDelete(freeQueue);
+    free(blocks);
+    writerDone = NULL;
+    fullQueue = NULL;
+    freeQueue = NULL;
+    blocks = NULL;
+}
+
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+/*
+ * Progress is saved to NVS every UPDATER_RESUME_SAVE_KB, rounded down to a flash sector. After a restart the digest
+ * is recalculated from what is already in flash, so only the position and the OTA header need to be kept.
+ */
+static bool resumeLoad(const char *path)
+{
+    nvs_handle handle;
+    char savedPath[UPDATER_PATH_SIZE];
+    size_t len = sizeof(savedPath);
+    uint32_t partition = 0;
+    uint32_t written = 0;
+    size_t offset;
+    bool valid = false;
+
+    if (nvs_open(RESUME_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    if ((nvs_get_str(handle, RESUME_PATH, savedPath, &len) == ESP_OK) && (strcmp(savedPath, path) == 0) &&
+            (nvs_get_u32(handle, RESUME_PARTITION, &partition) == ESP_OK) && (partition == updatePartition->address) &&
+            (nvs_get_u32(handle, RESUME_WRITTEN, &written) == ESP_OK)) {
+        len = sizeof(updateHeader);
+        valid = (nvs_get_blob(handle, RESUME_HEADER, &updateHeader, &len) == ESP_OK) && (len == sizeof(updateHeader));
+    }
+    nvs_close(handle);
+    if (!valid || (updateHeader.sig[OTA_SIG_LEN] != OTA_FORMAT_RAW) || (written > updateHeader.binLen) ||
+            (SECTOR_ROUND_UP(updateHeader.binLen) > updatePartition->size)) {
+        return false;
+    }
+
+    for (offset = 0; offset < written; offset += len) {
+        len = MIN(BLOCK_SIZE, written - offset);
+        if (esp_partition_read(updatePartition, offset, fillBlock, len) != ESP_OK) {
+            return false;
+        }
+        mbedtls_md5_update_ret(&updateDigest, (unsigned char *)fillBlock, len);
+    }
+    if (esp_partition_erase_range(updatePartition, written, SECTOR_ROUND_UP(updateHeader.binLen) - written) != ESP_OK) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Resuming download at %u of %u bytes", written, updateHeader.binLen);
+    updateHeaderBytes = sizeof(updateHeader);
+    updateBinBytes = written;
+    writtenBytes = written;
+    imageBytes = written;
+    resumeSaved = written;
+    return true;
+}
+
+static void resumeSave(size_t written)
+{
+    nvs_handle handle;
+
+    written &= ~(SECTOR_SIZE - 1);
+    if (nvs_open(RESUME_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (resumeSaved == 0) {
+        nvs_set_str(handle, RESUME_PATH, resumePath);
+        nvs_set_u32(handle, RESUME_PARTITION, updatePartition->address);
+        nvs_set_blob(handle, RESUME_HEADER, &updateHeader, sizeof(updateHeader));
+    }
+    nvs_set_u32(handle, RESUME_WRITTEN, written);
+    nvs_commit(handle);
+    nvs_close(handle);
+    resumeSaved = written;
+}
+
+static void resumeClear(void)
+{
+    nvs_handle handle;
+
+    if (nvs_open(RESUME_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        nvs_erase_all(handle);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+    resumeSaved = 0;
+}
+
+bool updaterResumePath(char *path, size_t len)
+{
+    nvs_handle handle;
+    bool found = false;
+
+    if (nvs_open(RESUME_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        found = nvs_get_str(handle, RESUME_PATH, path, &len) == ESP_OK;
+        nvs_close(handle);
+    }
+    return found;
+}
+#endif
+
+void updaterDownloadAndUpdate(char *host, int port, char *path)
+{
+    int sock = -1;
+    int err = -1;
+    DownloadResult_e result = DOWNLOAD_FAILED;
+    bool keepAlive = false;
+    size_t lastOffset;
+    int retries = 0;
+    int retryDelay = RETRY_DELAY_MS;
     unsigned char digest[16];
+    TickType_t startTime;
+    int elapsedMs;
 
     updateHeaderBytes = 0;
     updateBinBytes = 0;
+    writeToPartition = false;
+    otaStarted = false;
     mbedtls_md5_init(&updateDigest);
     mbedtls_md5_starts_ret(&updateDigest);
 
@@ -166,68 +1013,136 @@ void updaterDownloadAndUpdate(char *host, int port, char *path)
     ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%x",
              updatePartition->subtype, updatePartition->address);
 
-    err = esp_ota_begin(updatePartition, OTA_SIZE_UNKNOWN, &updateHandle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_begin failed, error=%d", err);
-        updaterUpdateStatus("esp_ota_begin failed");
+    if (pipelineStart()) {
+        updaterUpdateStatus("Failed: Out of memory");
         return;
     }
 
-    ESP_LOGI(TAG, "Downloading from %s:%d%s", host, port, path);
-    sock = httpSendGet(host, port, path);
-    if (sock == -1) {
-        updaterUpdateStatus("Failed to connect to update host");
-        esp_ota_end(updateHandle);
-        return;
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+    resumePath = path;
+    resumeSaved = 0;
+    writeToPartition = resumeLoad(path);
+    if (!writeToPartition) {
+        mbedtls_md5_starts_ret(&updateDigest);
+        updateHeaderBytes = 0;
+        updateBinBytes = 0;
+        writtenBytes = 0;
+        imageBytes = 0;
     }
-    ESP_LOGI(TAG, "Connected to update host");
-
-    http_parser_init(&parser, HTTP_RESPONSE);
-    parser.data = &done;
-    http_parser_settings_init(&parserSettings);
-    parserSettings.on_body = onBody;
-    parserSettings.on_status = onStatus;
-    parserSettings.on_message_complete = onMessageComplete;
+#endif
 
-    while (!done) {
-        len = recv(sock, recvBuffer, MAX_RECV_BUFFER_LENGTH, 0);
-        if (len == -1) {
-            goto exit;
+    ESP_LOGI(TAG, "Downloading from %s:%d%s", host, port, path);
+    startTime = xTaskGetTickCount();
+    while (!downloadComplete()) {
+        lastOffset = downloadOffset();
+        if (sock == -1) {
+            sock = connectToServer(host, port);
         }
-        http_parser_execute(&parser, &parserSettings, recvBuffer, len);
-        if (parser.http_errno != HPE_OK) {
-            goto exit;
+        if (sock == -1) {
+            result = DOWNLOAD_RETRY;
+        } else {
+            result = downloadRange(sock, host, port, path, &keepAlive);
+            /* A response that ends without making progress would otherwise be requested forever */
+            if ((result == DOWNLOAD_OK) && (downloadOffset() == lastOffset)) {
+                result = DOWNLOAD_RETRY;
+            }
+        }
+        if ((result == DOWNLOAD_FAILED) || writeError) {
+            break;
+        }
+        if ((result == DOWNLOAD_RETRY) || !keepAlive) {
+            if (sock != -1) {
+                close(sock);
+                sock = -1;
+            }
+        }
+        if (result == DOWNLOAD_RETRY) {
+            if (downloadOffset() != lastOffset) {
+                retries = 0;
+                retryDelay = RETRY_DELAY_MS;
+            }
+            retries++;
+            if (retries > CONFIG_UPDATER_RETRIES) {
+                updaterUpdateStatus("Failed: Too many retries");
+                break;
+            }
+            updaterUpdateStatusf("Download interrupted at %d bytes, retry %d", downloadOffset(), retries);
+            vTaskDelay(retryDelay / portTICK_RATE_MS);
+            retryDelay = MIN(retryDelay * 2, MAX_RETRY_DELAY_MS);
         }
     }
-    close(sock);
+    if (sock != -1) {
+        close(sock);
+    }
 
-    err = esp_ota_end(updateHandle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_end failed! err=0x%x", err);
-        updaterUpdateStatus("Failed: esp_ota_end");
+    if (!writeError && (result != DOWNLOAD_FAILED)) {
+        queueFillBlock();
+    }
+    pipelineStop();
+    if (!writeError && downloadComplete() && (imageFormat == OTA_FORMAT_ZLIB) && !inflateDone) {
+        writeError = "Failed: Compressed image truncated";
+    }
+    if (writeError) {
+        updaterUpdateStatus((char *)writeError);
+        goto failed;
+    }
+    if (!downloadComplete()) {
+        if (result == DOWNLOAD_FAILED) {
+            goto failed;
+        }
+        /* Gave up retrying, anything saved is kept so the download can carry on later */
+        if (otaStarted) {
+            esp_ota_end(updateHandle);
+        }
         return;
     }
+    elapsedMs = (xTaskGetTickCount() - startTime) * portTICK_RATE_MS;
+    ESP_LOGI(TAG, "Downloaded %d bytes in %d ms (%d KB/s)", updateBinBytes, elapsedMs,
+             elapsedMs ? (int)((uint64_t)updateBinBytes * 1000 / 1024 / elapsedMs) : 0);
+
+    if (otaStarted) {
+        err = esp_ota_end(updateHandle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "esp_ota_end failed! err=0x%x", err);
+            updaterUpdateStatus("Failed: esp_ota_end");
+            goto cleared;
+        }
+    }
 
     mbedtls_md5_finish_ret(&updateDigest, digest);
     if (memcmp(digest, updateHeader.digest, 16) != 0) {
-        ESP_LOGE(TAG, "esp_ota_end failed! err=0x%x", err);
+        ESP_LOGE(TAG, "Digests don't match");
         updaterUpdateStatus("Failed: digests don't match");
-        return;
+        goto cleared;
     }
 
+    /* Also verifies the image, which esp_ota_end() didn't do if the download was resumed after a restart */
     err = esp_ota_set_boot_partition(updatePartition);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_set_boot_partition failed! err=0x%x", err);
         updaterUpdateStatus("Failed: esp_ota_set_boot_partition");
-        return;
+        goto cleared;
     }
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+    resumeClear();
+#endif
 
-    updaterUpdateStatus("Update successful, restarting in 1 second");
+    updaterUpdateStatusf("Update successful in %d ms, restarting in 1 second", elapsedMs);
     vTaskDelay(1000 / portTICK_RATE_MS);
     ESP_LOGI(TAG, "Prepare to restart system!");
     esp_restart();
+    return;
 
-exit:
-    esp_ota_end(updateHandle);
-    close(sock);
+failed:
+    if (otaStarted) {
+        esp_ota_end(updateHandle);
+    }
+cleared:
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+    /* Progress saved by another download is still valid if this one never wrote anything */
+    if (otaStarted || writeToPartition) {
+        resumeClear();
+    }
+#endif
+    return;
 }
@@ -13,12 +13,20 @@
 #include "esp_ota_ops.h"
 
 #include "updater.h"
+#include "wifi.h"
 
 #include "sdkconfig.h"
 #include "updaterInternal.h"
 
 #define MAX_VERSION_LEN 31
 
+#ifdef CONFIG_UPDATER_COMPRESSED
+#define UPDATER_EXTENSION ".otz"
+#else
+#define UPDATER_EXTENSION ".ota"
+#endif
+#define UPDATER_DELTA_EXTENSION ".otd"
+
 #define UPDATER_THREAD_NAME "updater"
 #define UPDATER_THREAD_PRIO 7
 #ifdef CONFIG_IDF_TARGET_ESP8266
@@ -39,11 +47,12 @@ static EventGroupHandle_t updateEventGroup;
 
 static char newVersion[MAX_VERSION_LEN + 1];
 
-char updaterStatusBuffer[UPDATER_STATUS_BUFFER_SIZE];
-static char updatePath[256];
+static char updatePath[UPDATER_PATH_SIZE];
 
 extern char appVersion[]; /* this is defined in version.c which is autogenerated */
 
+static void updaterSetPath(const char *suffix);
+
 static void updaterThread(void *pvParameter)
 {
     ESP_LOGI(TAG, "Starting OTA : flash %s", CONFIG_ESPTOOLPY_FLASHSIZE);
@@ -59,31 +68,55 @@ static void updaterThread(void *pvParameter)
     ESP_LOGI(TAG, "Running partition type %d subtype %d (offset 0x%08x)",
              running->type, running->subtype, running->address);
 
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+    if (updaterResumePath(updatePath, sizeof(updatePath))) {
+        while (!wifiIsConnected()) {
+            vTaskDelay(1000 / portTICK_RATE_MS);
+        }
+        updaterUpdateStatus("Resuming update");
+        updaterDownloadAndUpdate(CONFIG_UPDATER_HOST, CONFIG_UPDATER_PORT, updatePath);
+    }
+#endif
     updaterUpdateStatus("Waiting for update");
     while(true) {
         xEventGroupWaitBits(updateEventGroup, UPDATE_BIT, false, true, portMAX_DELAY);
         xEventGroupClearBits(updateEventGroup, UPDATE_BIT);
         updaterUpdateStatusf("Updating to %s", newVersion);
 
-#ifdef CONFIG_ESPTOOLPY_FLASHSIZE_1MB
+#ifdef CONFIG_UPDATER_DELTA
         {
-            const esp_partition_t *updatePartition;
-            int partitionId;
-            updatePartition = esp_ota_get_next_update_partition(NULL);
-            partitionId = (updatePartition->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_0) + 1;
-            if ((partitionId <= 0) || (partitionId > 16)) {
-                partitionId = 1;
-            }
-            snprintf(updatePath, sizeof(updatePath), CONFIG_UPDATER_PATH_PREFIX "/homething." CONFIG_IDF_TARGET ".app%d.%s.ota", partitionId, newVersion);
+            /* Only returns if the delta couldn't be applied, ie there isn't one from this version */
+            char suffix[MAX_VERSION_LEN + sizeof(".from." UPDATER_DELTA_EXTENSION)];
+            snprintf(suffix, sizeof(suffix), ".from.%s" UPDATER_DELTA_EXTENSION, appVersion);
+            updaterSetPath(suffix);
+            updaterDownloadAndUpdate(CONFIG_UPDATER_HOST, CONFIG_UPDATER_PORT, updatePath);
+            updaterUpdateStatus("Delta update failed, downloading full image");
         }
-#else
-        snprintf(updatePath, sizeof(updatePath), CONFIG_UPDATER_PATH_PREFIX "/homething." CONFIG_IDF_TARGET ".%s.ota", newVersion);
 #endif
-
+        updaterSetPath(UPDATER_EXTENSION);
         updaterDownloadAndUpdate(CONFIG_UPDATER_HOST, CONFIG_UPDATER_PORT, updatePath);
     }
 }
 
+/*
+ * Set updatePath to the image for newVersion, on 1MB devices each version is built for both app partitions.
+ */
+static void updaterSetPath(const char *suffix)
+{
+#ifdef CONFIG_ESPTOOLPY_FLASHSIZE_1MB
+    const esp_partition_t *updatePartition;
+    int partitionId;
+    updatePartition = esp_ota_get_next_update_partition(NULL);
+    partitionId = (updatePartition->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_0) + 1;
+    if ((partitionId <= 0) || (partitionId > 16)) {
+        partitionId = 1;
+    }
+    snprintf(updatePath, sizeof(updatePath), CONFIG_UPDATER_PATH_PREFIX "/homething." CONFIG_IDF_TARGET ".app%d.%s%s", partitionId, newVersion, suffix);
+#else
+    snprintf(updatePath, sizeof(updatePath), CONFIG_UPDATER_PATH_PREFIX "/homething." CONFIG_IDF_TARGET ".%s%s", newVersion, suffix);
+#endif
+}
+
 void updaterInit()
 {
     ESP_LOGI(TAG, "Updater initialised, Version: %s", appVersion);
@@ -107,7 +140,10 @@ void updaterUpdateStatus(char *status)
 void updaterUpdate(const char *updateVersion)
 {
     ESP_LOGI(TAG, "Updating to version %s", updateVersion);
-    if (strlen(updateVersion) <= MAX_VERSION_LEN) {
+    if (updateEventGroup == NULL) {
+        /* Not started while deep sleeping */
+        updaterUpdateStatus("Failed : Updater not running");
+    } else if (strlen(updateVersion) <= MAX_VERSION_LEN) {
         strcpy(newVersion, updateVersion);
         xEventGroupSetBits(updateEventGroup, UPDATE_BIT);
     } else {
@@ -1,11 +1,27 @@
 #ifndef _UPDATERINTERNAL_H_
 #define _UPDATERINTERNAL_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #define UPDATER_STATUS_BUFFER_SIZE 64
+#define UPDATER_PATH_SIZE 256
 
-#define updaterUpdateStatusf(fmt...) snprintf(updaterStatusBuffer, UPDATER_STATUS_BUFFER_SIZE, fmt); updaterUpdateStatus(updaterStatusBuffer)
-extern char updaterStatusBuffer[];
+/* Formatted on the caller's stack as both the updater and OTA writer threads report status */
+#define updaterUpdateStatusf(fmt...) do { \
+        char _statusBuffer[UPDATER_STATUS_BUFFER_SIZE]; \
+        snprintf(_statusBuffer, UPDATER_STATUS_BUFFER_SIZE, fmt); \
+        updaterUpdateStatus(_statusBuffer); \
+    } while (0)
 
 void updaterUpdateStatus(char *);
 void updaterDownloadAndUpdate(char *host, int port, char *path);
+
+#ifdef CONFIG_UPDATER_RESUME_AFTER_RESTART
+/**
+ * Copy the path of an update that was interrupted by a restart into path.
+ * Returns true if there is an update to resume.
+ */
+bool updaterResumePath(char *path, size_t len);
+#endif
 #endif
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "bootTimeline.h"
+
+static const char TAG[] = "boot";
+
+static const char *stageNames[BOOT_STAGE_MAX] = {
+    [BOOT_STAGE_START] = "start",
+    [BOOT_STAGE_NVS] = "nvs",
+    [BOOT_STAGE_BOOTPROT] = "bootprot",
+    [BOOT_STAGE_WIFI_INIT] = "wifiInit",
+    [BOOT_STAGE_IOT_INIT] = "iotInit",
+    [BOOT_STAGE_PROFILE] = "profile",
+    [BOOT_STAGE_INIT_DONE] = "initDone",
+    [BOOT_STAGE_ASSOCIATED] = "associated",
+    [BOOT_STAGE_GOT_IP] = "gotIP",
+    [BOOT_STAGE_MQTT_CONNECTED] = "mqtt",
+    [BOOT_STAGE_ONLINE] = "online",
+};
+
+/* 0 means not reached, times are stored + 1 so a stage reached in the first millisecond is still recorded */
+static uint32_t stageTimes[BOOT_STAGE_MAX];
+static BootTimelineCallback_t onlineCallback = NULL;
+
+void bootTimelineMark(BootTimelineStage_e stage)
+{
+    uint32_t ms;
+
+    if ((stage >= BOOT_STAGE_MAX) || (stageTimes[stage] != 0)) {
+        return;
+    }
+    ms = (uint32_t)(esp_timer_get_time() / 1000);
+    stageTimes[stage] = ms + 1;
+    ESP_LOGI(TAG, "%s at %ums", stageNames[stage], ms);
+
+    if (stage == BOOT_STAGE_ONLINE) {
+#if CONFIG_BOOT_TIMELINE_BUDGET_MS > 0
+        if (ms > CONFIG_BOOT_TIMELINE_BUDGET_MS) {
+            ESP_LOGW(TAG, "Boot to online took %ums, budget is %ums", ms, CONFIG_BOOT_TIMELINE_BUDGET_MS);
+        }
+#endif
+        if (onlineCallback != NULL) {
+            onlineCallback();
+        }
+    }
+}
+
+bool bootTimelineGet(BootTimelineStage_e stage, uint32_t *ms)
+{
+    if ((stage >= BOOT_STAGE_MAX) || (stageTimes[stage] == 0)) {
+        return false;
+    }
+    *ms = stageTimes[stage] - 1;
+    return true;
+}
+
+const char *bootTimelineStageName(BootTimelineStage_e stage)
+{
+    if (stage >= BOOT_STAGE_MAX) {
+        return NULL;
+    }
+    return stageNames[stage];
+}
+
+void bootTimelineSetOnlineCallback(BootTimelineCallback_t callback)
+{
+    onlineCallback = callback;
+}
@@ -0,0 +1,45 @@
+#ifndef _BOOTTIMELINE_H_
+#define _BOOTTIMELINE_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Stages of the boot, in the order they are normally reached. */
+typedef enum {
+    BOOT_STAGE_START,          /* app_main entered */
+    BOOT_STAGE_NVS,            /* NVS flash initialised */
+    BOOT_STAGE_BOOTPROT,       /* Boot protection checked */
+    BOOT_STAGE_WIFI_INIT,      /* Wifi driver initialised */
+    BOOT_STAGE_IOT_INIT,       /* MQTT client created */
+    BOOT_STAGE_PROFILE,        /* Profile loaded and components initialised */
+    BOOT_STAGE_INIT_DONE,      /* app_main finished starting everything */
+    BOOT_STAGE_ASSOCIATED,     /* Associated with the access point */
+    BOOT_STAGE_GOT_IP,         /* IP address assigned */
+    BOOT_STAGE_MQTT_CONNECTED, /* CONNACK received from the MQTT server */
+    BOOT_STAGE_ONLINE,         /* Subscriptions made and full state published */
+    BOOT_STAGE_MAX
+} BootTimelineStage_e;
+
+typedef void (*BootTimelineCallback_t)(void);
+
+/**
+ * Record the time since reset at which stage was reached.
+ * Only the first time a stage is reached is recorded, so reconnects don't overwrite the boot times.
+ */
+void bootTimelineMark(BootTimelineStage_e stage);
+
+/**
+ * Get the time in milliseconds since reset that stage was reached.
+ * Returns false if the stage has not been reached.
+ */
+bool bootTimelineGet(BootTimelineStage_e stage, uint32_t *ms);
+
+/**
+ * Name of the stage, suitable for use as a JSON key.
+ */
+const char *bootTimelineStageName(BootTimelineStage_e stage);
+
+/**
+ * Set a function to be called once, from the task marking it, when BOOT_STAGE_ONLINE is reached.
+ */
+void bootTimelineSetOnlineCallback(BootTimelineCallback_t callback);
+#endif
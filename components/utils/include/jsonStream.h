@@ -0,0 +1,74 @@
+#ifndef _JSONSTREAM_H_
+#define _JSONSTREAM_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Same as cJSON's CJSON_NESTING_LIMIT so both parsers accept the same documents */
+#define JSON_STREAM_MAX_DEPTH 1000
+
+typedef enum {
+    JSON_STREAM_OBJECT_START,
+    JSON_STREAM_OBJECT_END,
+    JSON_STREAM_ARRAY_START,
+    JSON_STREAM_ARRAY_END,
+    JSON_STREAM_KEY,
+    JSON_STREAM_STRING,
+    JSON_STREAM_NUMBER,
+    JSON_STREAM_TRUE,
+    JSON_STREAM_FALSE,
+    JSON_STREAM_NULL,
+    JSON_STREAM_KEY_PART,   /* Start of a key or string longer than the buffer, see jsonStreamSplitStrings */
+    JSON_STREAM_STRING_PART
+} JsonStreamEvent_e;
+
+/**
+ * Called for each JSON event, for KEY, STRING, NUMBER and the PART events value is the \0 terminated (unescaped)
+ * text, otherwise NULL.
+ * Return 0 to continue parsing, any other value stops the parse and is returned from jsonStreamFeed.
+ */
+typedef int (*JsonStreamCallback_t)(void *user, JsonStreamEvent_e event, const char *value, size_t len);
+
+typedef struct JsonStream {
+    JsonStreamCallback_t callback;
+    void *user;
+    char *token;
+    size_t tokenSize;
+    size_t tokenLen;
+    const char *literal;
+    uint8_t arrays[(JSON_STREAM_MAX_DEPTH / 8) + 1]; /* Bit per depth, set if the container at that depth is an array */
+    uint16_t unicode;
+    uint16_t highSurrogate;
+    uint16_t depth;
+    uint8_t unicodeDigits;
+    uint8_t literalPos;
+    uint8_t state;
+    bool inKey;
+    bool splitStrings;
+} JsonStream_t;
+
+/**
+ * Initialise a push parser, buffer is used to hold keys, strings and numbers so limits the longest token.
+ * Memory use is fixed, nesting is limited to JSON_STREAM_MAX_DEPTH.
+ */
+void jsonStreamInit(JsonStream_t *stream, char *buffer, size_t bufferSize, JsonStreamCallback_t callback, void *user);
+
+/**
+ * Pass keys and strings that don't fit in the buffer as a series of KEY_PART/STRING_PART events, each a full buffer,
+ * followed by the usual KEY/STRING event with the rest. Without this they fail the parse. Numbers must always fit.
+ */
+void jsonStreamSplitStrings(JsonStream_t *stream, bool split);
+
+/**
+ * Parse the next chunk of the document, chunks may split tokens at any point.
+ * Anything after the end of the top level value is ignored.
+ * Returns 0 on success, -1 on a syntax error or over long token, or the non-zero value returned by the callback.
+ */
+int jsonStreamFeed(JsonStream_t *stream, const char *data, size_t len);
+
+/**
+ * Signal the end of the document.
+ * Returns 0 if a complete top level value was parsed, non-zero otherwise.
+ */
+int jsonStreamFinish(JsonStream_t *stream);
+#endif
@@ -0,0 +1,55 @@
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
+/*
+ * Second resolution countdowns sharing a single FreeRTOS timer, which only runs while a countdown is active.
+ * Entries are embedded in the owner's struct so starting and stopping them doesn't allocate.
+ */
+
+/*
+ * Called from the timer task with the number of seconds left, every progress seconds if progress was given and once
+ * with secondsLeft 0 when the countdown expires. The entry is no longer active when secondsLeft is 0.
+ */
+typedef void (*TimerWheelCallback_t)(void *user, uint32_t secondsLeft);
+
+typedef struct TimerWheelEntry {
+    struct TimerWheelEntry *next;
+    struct TimerWheelEntry **pprev; /* NULL when the entry isn't in the wheel */
+    uint32_t due;      /* Wheel time the callback is next called */
+    uint32_t expires;  /* Wheel time the countdown ends */
+    uint32_t progress;
+    TimerWheelCallback_t callback;
+    void *user;
+} TimerWheelEntry_t;
+
+void timerWheelInit(void);
+
+/**
+ * Set up entry, must be called before any of the other functions are used with it.
+ */
+void timerWheelEntryInit(TimerWheelEntry_t *entry, TimerWheelCallback_t callback, void *user);
+
+/**
+ * Start, or restart, the countdown. The callback is called after seconds, less up to a second as the wheel has a
+ * single tick, and every progress seconds before that unless progress is 0.
+ */
+void timerWheelStart(TimerWheelEntry_t *entry, uint32_t seconds, uint32_t progress);
+
+void timerWheelStop(TimerWheelEntry_t *entry);
+
+/**
+ * Stop the countdown and wait until the callback is not running, after which entry can be freed.
+ * Returns -1 if the timer task did not respond within wait ticks, in which case entry must not be freed.
+ */
+int timerWheelStopSync(TimerWheelEntry_t *entry, TickType_t wait);
+
+bool timerWheelIsActive(TimerWheelEntry_t *entry);
+
+/**
+ * Seconds until the countdown ends, 0 if it isn't active.
+ */
+uint32_t timerWheelSecondsLeft(TimerWheelEntry_t *entry);
+#endif
@@ -0,0 +1,366 @@
+#include <stdlib.h>
+#include <string.h>
+#include "jsonStream.h"
+
+enum {
+    STATE_VALUE,
+    STATE_VALUE_OR_END,
+    STATE_AFTER_VALUE,
+    STATE_KEY_OR_END,
+    STATE_KEY,
+    STATE_COLON,
+    STATE_STRING,
+    STATE_ESCAPE,
+    STATE_UNICODE,
+    STATE_NUMBER,
+    STATE_LITERAL,
+    STATE_DONE
+};
+
+#define IS_WHITESPACE(c) (((c) == ' ') || ((c) == '\t') || ((c) == '\n') || ((c) == '\r'))
+#define IN_ARRAY(stream) (((stream)->arrays[(stream)->depth / 8] & (1 << ((stream)->depth % 8))) != 0)
+
+static int jsonStreamChar(JsonStream_t *stream, char c, bool *consumed);
+static int jsonStreamEmit(JsonStream_t *stream, JsonStreamEvent_e event);
+static int jsonStreamAppend(JsonStream_t *stream, char c);
+static int jsonStreamAppendUnicode(JsonStream_t *stream);
+static int jsonStreamOpen(JsonStream_t *stream, bool array);
+static int jsonStreamClose(JsonStream_t *stream);
+static int jsonStreamEndNumber(JsonStream_t *stream);
+static void jsonStreamValueDone(JsonStream_t *stream);
+
+void jsonStreamInit(JsonStream_t *stream, char *buffer, size_t bufferSize, JsonStreamCallback_t callback, void *user)
+{
+    memset(stream, 0, sizeof(JsonStream_t));
+    stream->callback = callback;
+    stream->user = user;
+    stream->token = buffer;
+    stream->tokenSize = bufferSize;
+    stream->state = STATE_VALUE;
+}
+
+void jsonStreamSplitStrings(JsonStream_t *stream, bool split)
+{
+    stream->splitStrings = split;
+}
+
+int jsonStreamFeed(JsonStream_t *stream, const char *data, size_t len)
+{
+    size_t i = 0;
+    int result;
+
+    while ((i < len) && (stream->state != STATE_DONE)) {
+        bool consumed = true;
+        result = jsonStreamChar(stream, data[i], &consumed);
+        if (result) {
+            return result;
+        }
+        if (consumed) {
+            i++;
+        }
+    }
+    return 0;
+}
+
+int jsonStreamFinish(JsonStream_t *stream)
+{
+    if ((stream->state == STATE_NUMBER) && (stream->depth == 0)) {
+        return jsonStreamEndNumber(stream);
+    }
+    return stream->state == STATE_DONE ? 0 : -1;
+}
+
+static int jsonStreamChar(JsonStream_t *stream, char c, bool *consumed)
+{
+    switch (stream->state) {
+    case STATE_VALUE_OR_END:
+        if (c == ']') {
+            return jsonStreamClose(stream);
+        }
+    /* Fall through */
+    case STATE_VALUE:
+        if (IS_WHITESPACE(c)) {
+            return 0;
+        }
+        stream->tokenLen = 0;
+        switch (c) {
+        case '{':
+            return jsonStreamOpen(stream, false);
+        case '[':
+            return jsonStreamOpen(stream, true);
+        case '"':
+            stream->inKey = false;
+            stream->state = STATE_STRING;
+            return 0;
+        case 't':
+            stream->literal = "true";
+            break;
+        case 'f':
+            stream->literal = "false";
+            break;
+        case 'n':
+            stream->literal = "null";
+            break;
+        default:
+            if ((c == '-') || ((c >= '0') && (c <= '9'))) {
+                stream->state = STATE_NUMBER;
+                return jsonStreamAppend(stream, c);
+            }
+            return -1;
+        }
+        stream->literalPos = 1;
+        stream->state = STATE_LITERAL;
+        return 0;
+
+    case STATE_AFTER_VALUE:
+        if (IS_WHITESPACE(c)) {
+            return 0;
+        }
+        if (c == ',') {
+            stream->state = IN_ARRAY(stream) ? STATE_VALUE : STATE_KEY;
+            return 0;
+        }
+        if ((c == (IN_ARRAY(stream) ? ']' : '}'))) {
+            return jsonStreamClose(stream);
+        }
+        return -1;
+
+    case STATE_KEY_OR_END:
+        if (c == '}') {
+            return jsonStreamClose(stream);
+        }
+    /* Fall through */
+    case STATE_KEY:
+        if (IS_WHITESPACE(c)) {
+            return 0;
+        }
+        if (c != '"') {
+            return -1;
+        }
+        stream->tokenLen = 0;
+        stream->inKey = true;
+        stream->state = STATE_STRING;
+        return 0;
+
+    case STATE_COLON:
+        if (IS_WHITESPACE(c)) {
+            return 0;
+        }
+        if (c != ':') {
+            return -1;
+        }
+        stream->state = STATE_VALUE;
+        return 0;
+
+    case STATE_STRING:
+        if (stream->highSurrogate && (c != '\\')) {
+            return -1;
+        }
+        if (c == '\\') {
+            stream->state = STATE_ESCAPE;
+            return 0;
+        }
+        if (c == '"') {
+            int result;
+            if (stream->inKey) {
+                stream->state = STATE_COLON;
+                return jsonStreamEmit(stream, JSON_STREAM_KEY);
+            }
+            result = jsonStreamEmit(stream, JSON_STREAM_STRING);
+            jsonStreamValueDone(stream);
+            return result;
+        }
+        return jsonStreamAppend(stream, c);
+
+    case STATE_ESCAPE:
+        if (stream->highSurrogate && (c != 'u')) {
+            return -1;
+        }
+        stream->state = STATE_STRING;
+        switch (c) {
+        case 'b':
+            return jsonStreamAppend(stream, '\b');
+        case 'f':
+            return jsonStreamAppend(stream, '\f');
+        case 'n':
+            return jsonStreamAppend(stream, '\n');
+        case 'r':
+            return jsonStreamAppend(stream, '\r');
+        case 't':
+            return jsonStreamAppend(stream, '\t');
+        case '"':
+        case '\\':
+        case '/':
+            return jsonStreamAppend(stream, c);
+        case 'u':
+            stream->unicode = 0;
+            stream->unicodeDigits = 0;
+            stream->state = STATE_UNICODE;
+            return 0;
+        default:
+            return -1;
+        }
+
+    case STATE_UNICODE:
+        stream->unicode <<= 4;
+        if ((c >= '0') && (c <= '9')) {
+            stream->unicode |= c - '0';
+        } else if ((c >= 'a') && (c <= 'f')) {
+            stream->unicode |= c - 'a' + 10;
+        } else if ((c >= 'A') && (c <= 'F')) {
+            stream->unicode |= c - 'A' + 10;
+        } else {
+            return -1;
+        }
+        stream->unicodeDigits ++;
+        if (stream->unicodeDigits < 4) {
+            return 0;
+        }
+        stream->state = STATE_STRING;
+        return jsonStreamAppendUnicode(stream);
+
+    case STATE_NUMBER:
+        if (((c >= '0') && (c <= '9')) || (c == '+') || (c == '-') || (c == '.') || (c == 'e') || (c == 'E')) {
+            return jsonStreamAppend(stream, c);
+        }
+        /* The character after the number still needs to be processed */
+        *consumed = false;
+        return jsonStreamEndNumber(stream);
+
+    case STATE_LITERAL:
+        if (c != stream->literal[stream->literalPos]) {
+            return -1;
+        }
+        stream->literalPos ++;
+        if (stream->literal[stream->literalPos] == 0) {
+            int result;
+            switch (stream->literal[0]) {
+            case 't':
+                result = jsonStreamEmit(stream, JSON_STREAM_TRUE);
+                break;
+            case 'f':
+                result = jsonStreamEmit(stream, JSON_STREAM_FALSE);
+                break;
+            default:
+                result = jsonStreamEmit(stream, JSON_STREAM_NULL);
+                break;
+            }
+            jsonStreamValueDone(stream);
+            return result;
+        }
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+static int jsonStreamEmit(JsonStream_t *stream, JsonStreamEvent_e event)
+{
+    const char *value = NULL;
+    if ((event == JSON_STREAM_KEY) || (event == JSON_STREAM_STRING) || (event == JSON_STREAM_NUMBER) ||
+        (event == JSON_STREAM_KEY_PART) || (event == JSON_STREAM_STRING_PART)) {
+        stream->token[stream->tokenLen] = 0;
+        value = stream->token;
+    }
+    return stream->callback(stream->user, event, value, stream->tokenLen);
+}
+
+static int jsonStreamAppend(JsonStream_t *stream, char c)
+{
+    /* Always leave room for the terminator */
+    if (stream->tokenLen + 1 >= stream->tokenSize) {
+        int result;
+        /* Escapes set the state back to STATE_STRING before appending */
+        if (!stream->splitStrings || (stream->state != STATE_STRING)) {
+            return -1;
+        }
+        result = jsonStreamEmit(stream, stream->inKey ? JSON_STREAM_KEY_PART : JSON_STREAM_STRING_PART);
+        stream->tokenLen = 0;
+        if (result) {
+            return result;
+        }
+    }
+    stream->token[stream->tokenLen++] = c;
+    return 0;
+}
+
+static int jsonStreamAppendUnicode(JsonStream_t *stream)
+{
+    uint32_t codepoint = stream->unicode;
+    int result = 0;
+
+    if ((codepoint >= 0xdc00) && (codepoint <= 0xdfff)) {
+        if (stream->highSurrogate == 0) {
+            return -1;
+        }
+        codepoint = 0x10000 + (((stream->highSurrogate & 0x3ff) << 10) | (codepoint & 0x3ff));
+        stream->highSurrogate = 0;
+    } else if (stream->highSurrogate) {
+        return -1;
+    } else if ((codepoint >= 0xd800) && (codepoint <= 0xdbff)) {
+        stream->highSurrogate = codepoint;
+        return 0;
+    }
+
+    if (codepoint < 0x80) {
+        result |= jsonStreamAppend(stream, codepoint);
+    } else if (codepoint < 0x800) {
+        result |= jsonStreamAppend(stream, 0xc0 | (codepoint >> 6));
+        result |= jsonStreamAppend(stream, 0x80 | (codepoint & 0x3f));
+    } else if (codepoint < 0x10000) {
+        result |= jsonStreamAppend(stream, 0xe0 | (codepoint >> 12));
+        result |= jsonStreamAppend(stream, 0x80 | ((codepoint >> 6) & 0x3f));
+        result |= jsonStreamAppend(stream, 0x80 | (codepoint & 0x3f));
+    } else {
+        result |= jsonStreamAppend(stream, 0xf0 | (codepoint >> 18));
+        result |= jsonStreamAppend(stream, 0x80 | ((codepoint >> 12) & 0x3f));
+        result |= jsonStreamAppend(stream, 0x80 | ((codepoint >> 6) & 0x3f));
+        result |= jsonStreamAppend(stream, 0x80 | (codepoint & 0x3f));
+    }
+    return result;
+}
+
+static int jsonStreamOpen(JsonStream_t *stream, bool array)
+{
+    if (stream->depth >= JSON_STREAM_MAX_DEPTH) {
+        return -1;
+    }
+    stream->depth ++;
+    if (array) {
+        stream->arrays[stream->depth / 8] |= 1 << (stream->depth % 8);
+        stream->state = STATE_VALUE_OR_END;
+        return jsonStreamEmit(stream, JSON_STREAM_ARRAY_START);
+    }
+    stream->arrays[stream->depth / 8] &= ~(1 << (stream->depth % 8));
+    stream->state = STATE_KEY_OR_END;
+    return jsonStreamEmit(stream, JSON_STREAM_OBJECT_START);
+}
+
+static int jsonStreamClose(JsonStream_t *stream)
+{
+    JsonStreamEvent_e event = IN_ARRAY(stream) ? JSON_STREAM_ARRAY_END : JSON_STREAM_OBJECT_END;
+    stream->depth --;
+    jsonStreamValueDone(stream);
+    return jsonStreamEmit(stream, event);
+}
+
+static int jsonStreamEndNumber(JsonStream_t *stream)
+{
+    char *end;
+    int result;
+
+    stream->token[stream->tokenLen] = 0;
+    strtod(stream->token, &end);
+    if (*end != 0) {
+        return -1;
+    }
+    result = jsonStreamEmit(stream, JSON_STREAM_NUMBER);
+    jsonStreamValueDone(stream);
+    return result;
+}
+
+static void jsonStreamValueDone(JsonStream_t *stream)
+{
+    stream->state = (stream->depth == 0) ? STATE_DONE : STATE_AFTER_VALUE;
+}
@@ -0,0 +1,218 @@
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "timerWheel.h"
+
+/*
+ * Hierarchical wheel, level 0 has a slot per second and each level above covers a whole turn of the level below in
+ * each slot. When a level wraps the next slot of the level above is cascaded down, so entries are only moved a few
+ * times however long they are. Countdowns longer than WHEEL_RANGE are parked in the top level and cascaded around it
+ * until they are in range.
+ */
+#define SLOT_BITS 5
+#define NROF_SLOTS (1 << SLOT_BITS)
+#define SLOT_MASK (NROF_SLOTS - 1)
+#define NROF_LEVELS 4
+#define LEVEL_SPAN(level) (1u << ((level) * SLOT_BITS))
+#define WHEEL_RANGE LEVEL_SPAN(NROF_LEVELS)
+#define SLOT_INDEX(time, level) (((time) >> ((level) * SLOT_BITS)) & SLOT_MASK)
+
+#define TICK_MS 1000
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+static const char TAG[] = "timerwheel";
+
+static TimerWheelEntry_t *slots[NROF_LEVELS][NROF_SLOTS];
+static uint32_t wheelNow;
+static unsigned int activeCount;
+static SemaphoreHandle_t wheelMutex;
+static TimerHandle_t tickTimer;
+
+static void timerWheelTick(TimerHandle_t xTimer);
+static void timerWheelCascade(int level);
+static void timerWheelLink(TimerWheelEntry_t *entry);
+static void timerWheelUnlink(TimerWheelEntry_t *entry);
+static void timerWheelBarrier(void *semaphore, uint32_t unused);
+
+void timerWheelInit(void)
+{
+    wheelMutex = xSemaphoreCreateMutex();
+    tickTimer = xTimerCreate("wheel", TICK_MS / portTICK_RATE_MS, pdTRUE, NULL, timerWheelTick);
+    if ((wheelMutex == NULL) || (tickTimer == NULL)) {
+        ESP_LOGE(TAG, "Failed to create timer wheel");
+    }
+}
+
+void timerWheelEntryInit(TimerWheelEntry_t *entry, TimerWheelCallback_t callback, void *user)
+{
+    entry->next = NULL;
+    entry->pprev = NULL;
+    entry->callback = callback;
+    entry->user = user;
+}
+
+void timerWheelStart(TimerWheelEntry_t *entry, uint32_t seconds, uint32_t progress)
+{
+    if (seconds == 0) {
+        seconds = 1;
+    }
+    xSemaphoreTake(wheelMutex, portMAX_DELAY);
+    if (entry->pprev != NULL) {
+        timerWheelUnlink(entry);
+    }
+    entry->expires = wheelNow + seconds;
+    entry->progress = progress;
+    entry->due = wheelNow + (progress ? MIN(progress, seconds) : seconds);
+    timerWheelLink(entry);
+    if (activeCount == 1) {
+        xTimerStart(tickTimer, 0);
+    }
+    xSemaphoreGive(wheelMutex);
+}
+
+void timerWheelStop(TimerWheelEntry_t *entry)
+{
+    xSemaphoreTake(wheelMutex, portMAX_DELAY);
+    if (entry->pprev != NULL) {
+        timerWheelUnlink(entry);
+    }
+    xSemaphoreGive(wheelMutex);
+}
+
+int timerWheelStopSync(TimerWheelEntry_t *entry, TickType_t wait)
+{
+    SemaphoreHandle_t done;
+    bool finished = false;
+
+    timerWheelStop(entry);
+    /*
+     * Callbacks run in the timer task, so once the barrier has run there is no callback still using the entry. The
+     * timer task may be blocked publishing, hence the timeouts.
+     */
+    done = xSemaphoreCreateBinary();
+    if (done == NULL) {
+        return -1;
+    }
+    if (xTimerPendFunctionCall(timerWheelBarrier, done, 0, wait) == pdPASS) {
+        finished = xSemaphoreTake(done, wait) == pdTRUE;
+    }
+    if (!finished) {
+        /* The barrier may still run, so the semaphore has to be leaked */
+        ESP_LOGW(TAG, "Timed out waiting for timer task");
+        return -1;
+    }
+    vSemaphoreDelete(done);
+    /* A callback that was running may have restarted the countdown */
+    timerWheelStop(entry);
+    return 0;
+}
+
+bool timerWheelIsActive(TimerWheelEntry_t *entry)
+{
+    bool active;
+
+    xSemaphoreTake(wheelMutex, portMAX_DELAY);
+    active = entry->pprev != NULL;
+    xSemaphoreGive(wheelMutex);
+    return active;
+}
+
+uint32_t timerWheelSecondsLeft(TimerWheelEntry_t *entry)
+{
+    uint32_t left = 0;
+
+    xSemaphoreTake(wheelMutex, portMAX_DELAY);
+    if (entry->pprev != NULL) {
+        left = entry->expires - wheelNow;
+    }
+    xSemaphoreGive(wheelMutex);
+    return left;
+}
+
+static void timerWheelTick(TimerHandle_t xTimer)
+{
+    TimerWheelEntry_t **slot;
+    TimerWheelEntry_t *entry;
+    TimerWheelCallback_t callback;
+    void *user;
+    uint32_t left;
+    int level;
+
+    xSemaphoreTake(wheelMutex, portMAX_DELAY);
+    wheelNow++;
+    for (level = 1; (level < NROF_LEVELS) && ((wheelNow & (LEVEL_SPAN(level) - 1)) == 0); level++) {
+        timerWheelCascade(level);
+    }
+    slot = &slots[0][SLOT_INDEX(wheelNow, 0)];
+    while ((entry = *slot) != NULL) {
+        timerWheelUnlink(entry);
+        left = entry->expires - wheelNow;
+        if (left > 0) {
+            entry->due = wheelNow + (entry->progress ? MIN(entry->progress, left) : left);
+            timerWheelLink(entry);
+        }
+        callback = entry->callback;
+        user = entry->user;
+        /* Released so the callback can start and stop entries, including this one */
+        xSemaphoreGive(wheelMutex);
+        callback(user, left);
+        xSemaphoreTake(wheelMutex, portMAX_DELAY);
+    }
+    if (activeCount == 0) {
+        xTimerStop(tickTimer, 0);
+    }
+    xSemaphoreGive(wheelMutex);
+}
+
+static void timerWheelCascade(int level)
+{
+    TimerWheelEntry_t **slot = &slots[level][SLOT_INDEX(wheelNow, level)];
+    TimerWheelEntry_t *entry;
+
+    while ((entry = *slot) != NULL) {
+        timerWheelUnlink(entry);
+        timerWheelLink(entry);
+    }
+}
+
+static void timerWheelLink(TimerWheelEntry_t *entry)
+{
+    TimerWheelEntry_t **slot;
+    uint32_t due = entry->due;
+    int level;
+
+    if (due - wheelNow >= WHEEL_RANGE) {
+        due = wheelNow + WHEEL_RANGE - 1;
+    }
+    for (level = 0; level < NROF_LEVELS - 1; level++) {
+        if (due - wheelNow < LEVEL_SPAN(level + 1)) {
+            break;
+        }
+    }
+    slot = &slots[level][SLOT_INDEX(due, level)];
+    entry->next = *slot;
+    if (entry->next != NULL) {
+        entry->next->pprev = &entry->next;
+    }
+    entry->pprev = slot;
+    *slot = entry;
+    activeCount++;
+}
+
+static void timerWheelUnlink(TimerWheelEntry_t *entry)
+{
+    *entry->pprev = entry->next;
+    if (entry->next != NULL) {
+        entry->next->pprev = entry->pprev;
+    }
+    entry->next = NULL;
+    entry->pprev = NULL;
+    activeCount--;
+}
+
+static void timerWheelBarrier(void *semaphore, uint32_t unused)
+{
+    xSemaphoreGive((SemaphoreHandle_t)semaphore);
+}
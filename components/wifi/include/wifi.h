@@ -43,4 +43,11 @@ uint32_t wifiGetConnectionCount();
  * Returns a string that does not need to be freed.
  */
 const char* wifiGetConnectionSSID();
+
+/**
+ * Reconnect using the access point, channel and IP lease saved in RTC memory before the last deep sleep,
+ * skipping the scan and DHCP. Falls back to a normal connection if the saved details no longer work.
+ * Must be called before wifiStart().
+ */
+void wifiEnableFastResume(void);
 #endif
\ No newline at end of file
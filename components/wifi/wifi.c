@@ -8,6 +8,7 @@
 #include "freertos/event_groups.h"
 #include "freertos/timers.h"
 
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
@@ -25,6 +26,7 @@
 #include "sdkconfig.h"
 #include "notifications.h"
 #include "utils.h"
+#include "bootTimeline.h"
 
 #define UNIQ_NAME_PREFIX  "homething-"
 #define MAC_STR "%02x%02x%02x%02x%02x%02x"
@@ -36,6 +38,9 @@
 #define MAX_LENGTH_WIFI_NAME 32
 #define MAX_LENGTH_WIFI_PASSWORD 64
 
+#define RESUME_MAGIC 0x77726573
+#define RESUME_MAX_USES 32 /* Number of fast resumes before the IP lease is refreshed using DHCP */
+
 #if defined(CONFIG_IDF_TARGET_ESP8266) && !defined(ESP_EVENT_BASE_H_)
 typedef void* esp_event_base_t;
 typedef system_event_sta_got_ip_t ip_event_got_ip_t;
@@ -51,6 +56,24 @@ static bool connected = false;
 static uint32_t connectionCount = 0;
 static time_t disconnectedSeconds = 0;
 static wifiScanCallback_t scanCallback = NULL;
+static bool fastResume = false;
+static bool resuming = false;
+
+/*
+ * Kept in RTC memory rather than .noinit like the journal, as it is only used after waking from deep sleep and the
+ * ESP32 powers down main RAM while asleep.
+ */
+RTC_DATA_ATTR static struct WifiResume {
+    uint32_t magic;
+    uint32_t ssidHash;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t uses;
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns;
+} wifiResume;
 
 #if CONFIG_IDF_TARGET_ESP32
 static esp_netif_t *stationNetif = NULL, *apNetif = NULL;
@@ -60,6 +83,10 @@ static void wifiDriverInit(void);
 static void wifiStartStation(void);
 static void wifiSetupStation(void);
 static void wifiSetupAP(bool andStation);
+static uint32_t wifiSsidHash(void);
+static void wifiResumeSave(ip_event_got_ip_t *event);
+static void wifiResumeSetIP(void);
+static void wifiResumeRestartDHCP(void);
 
 static void getUniqName(char *name);
 
@@ -103,6 +130,11 @@ const char* wifiGetConnectionSSID()
     return wifiSsid;
 }
 
+void wifiEnableFastResume(void)
+{
+    fastResume = true;
+}
+
 int wifiScan(wifiScanCallback_t callback)
 {
     scanCallback = callback;
@@ -179,22 +211,35 @@ static void wifiEventStationStart(void* arg, esp_event_base_t event_base, int32_
         ESP_LOGE(TAG, "esp_netif_set_hostname(stationNetif, \"%s\") == %d", hostname, err);
     }
 #endif
+    if (resuming) {
+        wifiResumeSetIP();
+    }
     notification.connectionState = Notifications_ConnectionState_Connecting;
     notificationsNotify(Notifications_Class_Network, NOTIFICATIONS_ID_WIFI_STATION, &notification);
 
     wifiStartStation();
 }
 
+static void wifiEventStationConnected(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+    bootTimelineMark(BOOT_STAGE_ASSOCIATED);
+}
+
 static void wifiEventStationGotIP(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
     NotificationsData_t notification;
     ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
 
+    bootTimelineMark(BOOT_STAGE_GOT_IP);
+
     sprintf(ipAddr, IPSTR, IP2STR(&event->ip_info.ip));
     ESP_LOGI(TAG, "Connected to SSID, IP=%s", ipAddr);
     connected = true;
     connectionCount++;
     disconnectedSeconds = 0;
+    if (fastResume) {
+        wifiResumeSave(event);
+    }
     notification.connectionState = Notifications_ConnectionState_Connected;
     notificationsNotify(Notifications_Class_Network, NOTIFICATIONS_ID_WIFI_STATION, &notification);
 }
@@ -206,6 +251,13 @@ static void wifiEventStationDisconnected(void* arg, esp_event_base_t event_base,
 
     gettimeofday(&tv, NULL);
     sprintf(ipAddr, IPSTR, 0, 0, 0, 0);
+    if (resuming && !connected) {
+        ESP_LOGI(TAG, "Fast resume failed, falling back to scan and DHCP");
+        wifiResume.magic = 0;
+        resuming = false;
+        wifiSetupStation();
+        wifiResumeRestartDHCP();
+    }
     wifiStartStation();
     if (connected) {
         connected = false;
@@ -292,6 +344,9 @@ static esp_err_t wifiEventHandler(void *ctx, system_event_t *event)
     case SYSTEM_EVENT_STA_START:
         wifiEventStationStart(NULL, NULL, SYSTEM_EVENT_STA_START, &event->event_info);
         break;
+    case SYSTEM_EVENT_STA_CONNECTED:
+        wifiEventStationConnected(NULL, NULL, SYSTEM_EVENT_STA_CONNECTED, &event->event_info);
+        break;
     case SYSTEM_EVENT_STA_GOT_IP:
         wifiEventStationGotIP(NULL, NULL, SYSTEM_EVENT_STA_GOT_IP, &event->event_info);
         break;
@@ -339,6 +394,11 @@ static void wifiDriverInit(void)
                     wifiEventStationStart,
                     NULL,
                     NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
+                    WIFI_EVENT_STA_CONNECTED,
+                    wifiEventStationConnected,
+                    NULL,
+                    NULL));
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                     WIFI_EVENT_STA_DISCONNECTED,
                     wifiEventStationDisconnected,
@@ -397,6 +457,15 @@ static void wifiSetupStation(void)
 
     strcpy((char *)wifi_config.sta.ssid, wifiSsid);
     strcpy((char *)wifi_config.sta.password, wifiPassword);
+    resuming = fastResume && (wifiResume.magic == RESUME_MAGIC) && (wifiResume.ssidHash == wifiSsidHash());
+    if (resuming) {
+        ESP_LOGI(TAG, "Resuming connection to %02x:%02x:%02x:%02x:%02x:%02x on channel %u",
+                 wifiResume.bssid[0], wifiResume.bssid[1], wifiResume.bssid[2],
+                 wifiResume.bssid[3], wifiResume.bssid[4], wifiResume.bssid[5], wifiResume.channel);
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, wifiResume.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = wifiResume.channel;
+    }
     ESP_LOGI(TAG, "Setting WiFi station SSID %s...", wifi_config.sta.ssid);
     ESP_ERROR_CHECK( esp_wifi_set_ps(WIFI_PS_NONE) );
     ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
@@ -431,3 +500,95 @@ static void getUniqName(char *name)
     esp_read_mac(mac, ESP_MAC_WIFI_STA);
     sprintf(name, UNIQ_NAME_PREFIX MAC_STR, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 }
+
+static uint32_t wifiSsidHash(void)
+{
+    /* FNV-1a over SSID and password so a change to either invalidates the saved details */
+    uint32_t hash = 0x811c9dc5;
+    const char *str;
+    for (str = wifiSsid; *str; str++) {
+        hash = (hash ^ (uint8_t)*str) * 0x01000193;
+    }
+    for (str = wifiPassword; *str; str++) {
+        hash = (hash ^ (uint8_t)*str) * 0x01000193;
+    }
+    return hash;
+}
+
+static void wifiResumeSave(ip_event_got_ip_t *event)
+{
+    wifi_ap_record_t apInfo;
+
+    if (resuming) {
+        wifiResume.uses ++;
+        if (wifiResume.uses >= RESUME_MAX_USES) {
+            /* Next time use DHCP to make sure the lease is still ours */
+            wifiResume.magic = 0;
+        }
+        return;
+    }
+    if (esp_wifi_sta_get_ap_info(&apInfo) != ESP_OK) {
+        wifiResume.magic = 0;
+        return;
+    }
+    memcpy(wifiResume.bssid, apInfo.bssid, sizeof(wifiResume.bssid));
+    wifiResume.channel = apInfo.primary;
+    wifiResume.ip = event->ip_info.ip.addr;
+    wifiResume.netmask = event->ip_info.netmask.addr;
+    wifiResume.gw = event->ip_info.gw.addr;
+#ifdef CONFIG_IDF_TARGET_ESP8266
+    tcpip_adapter_dns_info_t dnsInfo;
+    if (tcpip_adapter_get_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &dnsInfo) == ESP_OK) {
+        wifiResume.dns = ip4_addr_get_u32(ip_2_ip4(&dnsInfo.ip));
+    } else {
+        wifiResume.dns = wifiResume.gw;
+    }
+#elif CONFIG_IDF_TARGET_ESP32
+    esp_netif_dns_info_t dnsInfo;
+    if (esp_netif_get_dns_info(stationNetif, ESP_NETIF_DNS_MAIN, &dnsInfo) == ESP_OK) {
+        wifiResume.dns = dnsInfo.ip.u_addr.ip4.addr;
+    } else {
+        wifiResume.dns = wifiResume.gw;
+    }
+#endif
+    wifiResume.uses = 0;
+    wifiResume.ssidHash = wifiSsidHash();
+    wifiResume.magic = RESUME_MAGIC;
+}
+
+static void wifiResumeSetIP(void)
+{
+#ifdef CONFIG_IDF_TARGET_ESP8266
+    tcpip_adapter_ip_info_t ipInfo;
+    tcpip_adapter_dns_info_t dnsInfo;
+
+    tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+    ipInfo.ip.addr = wifiResume.ip;
+    ipInfo.netmask.addr = wifiResume.netmask;
+    ipInfo.gw.addr = wifiResume.gw;
+    tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &ipInfo);
+    ip_addr_set_ip4_u32(&dnsInfo.ip, wifiResume.dns);
+    tcpip_adapter_set_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &dnsInfo);
+#elif CONFIG_IDF_TARGET_ESP32
+    esp_netif_ip_info_t ipInfo;
+    esp_netif_dns_info_t dnsInfo;
+
+    esp_netif_dhcpc_stop(stationNetif);
+    ipInfo.ip.addr = wifiResume.ip;
+    ipInfo.netmask.addr = wifiResume.netmask;
+    ipInfo.gw.addr = wifiResume.gw;
+    esp_netif_set_ip_info(stationNetif, &ipInfo);
+    dnsInfo.ip.type = ESP_IPADDR_TYPE_V4;
+    dnsInfo.ip.u_addr.ip4.addr = wifiResume.dns;
+    esp_netif_set_dns_info(stationNetif, ESP_NETIF_DNS_MAIN, &dnsInfo);
+#endif
+}
+
+static void wifiResumeRestartDHCP(void)
+{
+#ifdef CONFIG_IDF_TARGET_ESP8266
+    tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+#elif CONFIG_IDF_TARGET_ESP32
+    esp_netif_dhcpc_start(stationNetif);
+#endif
+}
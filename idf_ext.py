@@ -8,6 +8,7 @@ import click
 import subprocess
 import configparser
 import fnmatch
+import zlib
 
 build_action = None
 
@@ -34,24 +35,43 @@ def get_version(args):
     return 'unknown'
         
 
-def generate_ota_file(in_file, out_file):
-    with open(in_file, 'rb') as inf:  
-        with open(out_file, 'wb') as outf:
-            outf.write(b'OTA\0')
-            outf.write(b'\0' * 20)
-            m = hashlib.md5()
-            in_len = 0
-            while True:
-                data = inf.read(1024)
-                if not data:
-                    break
-                in_len += len(data)
-                m.update(data)
-                outf.write(data)
-            
-            outf.seek(4)
-            outf.write(struct.pack('<l', in_len))
-            outf.write(m.digest())
+OTA_SIG = b'OTA'
+OTA_FORMAT_RAW = b'\0'
+OTA_FORMAT_ZLIB = b'Z'
+DEFAULT_WINDOW_BITS = 12
+
+
+def generate_ota_file(in_file, out_file, window_bits=None):
+    """
+    Write in_file to out_file with the OTA header. If window_bits is given the image is compressed as a zlib stream
+    using a window no bigger than the device allows (UPDATER_WINDOW_BITS), the length and digest in the header are
+    then those of the compressed data.
+    """
+    with open(in_file, 'rb') as inf:
+        data = inf.read()
+    if window_bits is None:
+        fmt = OTA_FORMAT_RAW
+    else:
+        fmt = OTA_FORMAT_ZLIB
+        compressor = zlib.compressobj(9, zlib.DEFLATED, window_bits)
+        data = compressor.compress(data) + compressor.flush()
+    with open(out_file, 'wb') as outf:
+        outf.write(OTA_SIG + fmt)
+        outf.write(struct.pack('<l', len(data)))
+        outf.write(hashlib.md5(data).digest())
+        outf.write(data)
+    return len(data)
+
+
+def generate_ota_files(in_file, out_file, config):
+    """Write the uncompressed out_file and a compressed copy alongside it with the .otz extension"""
+    generate_ota_file(in_file, out_file)
+    compressed_file = os.path.splitext(out_file)[0] + '.otz'
+    window_bits = config.get('UPDATER_WINDOW_BITS', DEFAULT_WINDOW_BITS)
+    compressed_len = generate_ota_file(in_file, compressed_file, window_bits)
+    print(f'{os.path.basename(compressed_file)}: {compressed_len} bytes, '
+          f'{compressed_len * 100 // os.path.getsize(in_file)}% of the image')
+    return [out_file, compressed_file]
 
 
 def print_dict(d, indent=0):
@@ -117,15 +137,14 @@ CONFIG_PARTITION_TABLE_CUSTOM_FILENAME="{new_parttable}"''')
         args.build_dir = ota_part1_build_dir
         build_action('app', ctx, args)
 
-        ota_files = [os.path.join(build_dir, f'{ota_prefix}.app1{ota_suffix}'),
-                    os.path.join(build_dir, f'{ota_prefix}.app2{ota_suffix}')]
-        
-        generate_ota_file(os.path.join(build_dir, '%s.bin' % project_name), ota_files[0])
+        ota_files = generate_ota_files(os.path.join(build_dir, '%s.bin' % project_name),
+                                       os.path.join(build_dir, f'{ota_prefix}.app1{ota_suffix}'), config)
 
-        generate_ota_file(os.path.join(ota_part1_build_dir, '%s.bin' % project_name), ota_files[1])    
+        ota_files += generate_ota_files(os.path.join(ota_part1_build_dir, '%s.bin' % project_name),
+                                        os.path.join(build_dir, f'{ota_prefix}.app2{ota_suffix}'), config)
     else:
-        ota_files = [os.path.join(build_dir,  f'{ota_prefix}{ota_suffix}')]
-        generate_ota_file(os.path.join(build_dir, '%s.bin' % project_name), ota_files[0])
+        ota_files = generate_ota_files(os.path.join(build_dir, '%s.bin' % project_name),
+                                       os.path.join(build_dir,  f'{ota_prefix}{ota_suffix}'), config)
     
     print(f"Generated {len(ota_files)} ota file{'s' if len(ota_files) > 1 else ''}")
     for ota_file in ota_files:
@@ -217,26 +236,14 @@ def format_code(action, ctx, args):
     subprocess.check_call(['astyle'] + options + ['main/*.c,*.h'])
 
 def logs(action, ctx, args):
-    import socket
-    import struct
-
-    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-    sock.bind(('0.0.0.0', 5555))
-    header_struct = struct.Struct("!4sL6s")
-
-    last_sequence = -1
-    while True:
-        data, addr = sock.recvfrom(1200)
-        sig, sequence, mac = header_struct.unpack_from(data)
-        if sig == b'LOG\x00':
-            if sequence != last_sequence + 1:
-                print(f'Missing {sequence - (last_sequence + 1)} logging packets!')
-
-            prefix = ''
-            for b in mac:
-                prefix += '%02x' % b
-            print(prefix + ': '+  data[14:].decode(), end='')
-            last_sequence = sequence
+    logdecode_args = ['python', 'tools/logdecode.py', 'listen']
+    # Without a build there's no string table, text logs are still shown
+    if os.path.exists(os.path.join(args['build_dir'], 'project_description.json')):
+        project_desc = load_project_description(args)
+        strings = os.path.join(args['build_dir'], '%s.logstrings.json' % project_desc['project_name'])
+        if os.path.exists(strings):
+            logdecode_args += ['--strings', strings]
+    subprocess.check_call(logdecode_args)
 
 def gencomponents(actions, ctx, args):
     subprocess.check_call(['python', "tools/gencomponents.py"])
@@ -1,6 +1,8 @@
 #include "deviceprofile.h"
 #include "humidityfan.h"
+#include "sensors.h"
 #include "thermostat.h"
+#include "rules.h"
 
 static void controllersInitFinished(void *user, NotificationsMessage_t *message);
 
@@ -18,42 +20,50 @@ static DeviceProfile_HumidistatConfig_t *humidistatConfig = NULL;
 static uint32_t humidistatCount = 0;
 #endif
 
+#ifdef CONFIG_RULES
+static void rulesLoad();
+
+static DeviceProfile_RuleConfig_t *ruleConfig = NULL;
+static uint32_t ruleCount = 0;
+#endif
+
 
 void initControllers(DeviceProfile_DeviceConfig_t *config)
 {
     notificationsRegister(Notifications_Class_System, NOTIFICATIONS_ID_ALL, controllersInitFinished, NULL);
+    /* The config is kept for the lifetime of the device (see profile.c) so only references are kept */
 #ifdef CONFIG_THERMOSTAT
     thermostatConfig = config->thermostatConfig;
     thermostatCount = config->thermostatCount;
-    /* Take over ownership of the config structures */
-    config->thermostatConfig = NULL;
-    config->thermostatCount = 0;
 #endif
 #ifdef CONFIG_HUMIDISTAT
     humidistatConfig = config->humidistatConfig;
     humidistatCount = config->humidistatCount;
-    /* Take over ownership of the config structures */
-    config->humidistatConfig = NULL;
-    config->humidistatCount = 0;
+#endif
+#ifdef CONFIG_RULES
+    ruleConfig = config->ruleConfig;
+    ruleCount = config->ruleCount;
 #endif
 }
 
 static void controllersInitFinished(void *user, NotificationsMessage_t *message)
 {
+    if (message->data.systemState != Notifications_SystemState_InitFinished) {
+        return;
+    }
 #ifdef CONFIG_THERMOSTAT
     if (thermostatCount > 0) {
         thermostatsInit();
-        free(thermostatConfig);
-        thermostatConfig = NULL;
-        thermostatCount = 0;
     }
 #endif
 #ifdef CONFIG_HUMIDISTAT
     if (humidistatCount > 0) {
         humidistatsInit();
-        free(humidistatConfig);
-        humidistatConfig = NULL;
-        humidistatCount = 0;
+    }
+#endif
+#ifdef CONFIG_RULES
+    if (ruleCount > 0) {
+        rulesLoad();
     }
 #endif
 }
@@ -88,6 +98,7 @@ static void humidistatsInit()
     if (humidistats == NULL) {
         return;
     }
+    humidityFanSetSamplingRequest(sensorsRequestFastSampling);
     for (i = 0; i < humidistatCount; i++) {
         Relay_t *relay = relayFind(humidistatConfig[i].relay);
         Notifications_ID_t sensor = notificationsFindId(humidistatConfig[i].sensor);
@@ -99,4 +110,17 @@ static void humidistatsInit()
         }
     }
 }
+#endif
+
+#ifdef CONFIG_RULES
+static void rulesLoad()
+{
+    uint32_t i;
+    if (rulesInit()) {
+        return;
+    }
+    for (i = 0; i < ruleCount; i++) {
+        rulesAdd(i, ruleConfig[i].name, ruleConfig[i].refs, ruleConfig[i].code);
+    }
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "led_effects.h"
+
+#define BYTES_PER_LED 3
+#define NROF_BUFFERS 4
+#define MIN_PERIOD_MS 100
+#define MIX_ONE 256
+
+/* Chases have a tail a quarter of the strip long */
+#define CHASE_TAIL(length) (((length) >= 4) ? ((length) / 4) : 1)
+
+const char *ledEffectNames[LedEffect_Max] = {
+    [LedEffect_Solid] = "solid",
+    [LedEffect_Gradient] = "gradient",
+    [LedEffect_Chase] = "chase",
+    [LedEffect_Fade] = "fade",
+};
+
+/* Output level for each linear level, gamma 2.2 */
+static const uint8_t gammaTable[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+static void ledEffectsRenderSettings(LedEffects_t *effects, uint32_t nowMs, uint8_t *out);
+static void ledEffectsFill(uint8_t *out, uint32_t count, const uint8_t *rgb);
+static inline uint8_t ledEffectsMix(uint8_t a, uint8_t b, uint32_t weight);
+
+int ledEffectsInit(LedEffects_t *effects, uint32_t length)
+{
+    uint32_t size = length * BYTES_PER_LED;
+    uint8_t *buffers;
+
+    memset(effects, 0, sizeof(*effects));
+    buffers = calloc(NROF_BUFFERS, size);
+    if (buffers == NULL) {
+        return -1;
+    }
+    effects->length = length;
+    effects->frames[0] = buffers;
+    effects->frames[1] = buffers + size;
+    effects->linear = buffers + (size * 2);
+    effects->from = buffers + (size * 3);
+    effects->settings.periodMs = MIN_PERIOD_MS;
+    return 0;
+}
+
+void ledEffectsFree(LedEffects_t *effects)
+{
+    free(effects->frames[0]);
+    memset(effects, 0, sizeof(*effects));
+}
+
+void ledEffectsSet(LedEffects_t *effects, const LedEffectSettings_t *settings, uint32_t nowMs, uint32_t transitionMs)
+{
+    uint32_t scale;
+    int i;
+
+    effects->settings = *settings;
+    if (effects->settings.periodMs < MIN_PERIOD_MS) {
+        effects->settings.periodMs = MIN_PERIOD_MS;
+    }
+    if (effects->settings.brightness > 100) {
+        effects->settings.brightness = 100;
+    }
+    /* Brightness is applied as part of rendering so it fades and transitions like the colours */
+    scale = (effects->settings.brightness * 255) / 100;
+    for (i = 0; i < 256; i++) {
+        effects->levels[i] = (uint8_t)(((i * scale) + 127) / 255);
+    }
+
+    /*
+     * Fading out a snapshot rather than rendering the old settings as well keeps transitions the same cost as any
+     * other frame, and means a change part way through a transition carries on from what is actually shown. A change
+     * without a transition, such as the period, leaves a running transition fading to the new settings.
+     */
+    if (transitionMs != 0) {
+        effects->transitioning = true;
+        memcpy(effects->from, effects->linear, effects->length * BYTES_PER_LED);
+        effects->transitionStart = nowMs;
+        effects->transitionMs = transitionMs;
+    }
+}
+
+const uint8_t *ledEffectsRender(LedEffects_t *effects, uint32_t nowMs)
+{
+    uint32_t size = effects->length * BYTES_PER_LED;
+    uint8_t *linear = effects->linear;
+    uint8_t *frame = effects->frames[effects->front ^ 1];
+    uint32_t elapsed, weight, i;
+
+    ledEffectsRenderSettings(effects, nowMs, linear);
+    if (effects->transitioning) {
+        elapsed = nowMs - effects->transitionStart;
+        if (elapsed >= effects->transitionMs) {
+            effects->transitioning = false;
+        } else {
+            weight = (elapsed * MIX_ONE) / effects->transitionMs;
+            for (i = 0; i < size; i++) {
+                linear[i] = ledEffectsMix(effects->from[i], linear[i], weight);
+            }
+        }
+    }
+
+    for (i = 0; i < size; i++) {
+        frame[i] = gammaTable[linear[i]];
+    }
+    if (effects->sent && (memcmp(frame, effects->frames[effects->front], size) == 0)) {
+        return NULL;
+    }
+    effects->sent = true;
+    effects->front ^= 1;
+    return frame;
+}
+
+bool ledEffectsAnimating(LedEffects_t *effects)
+{
+    LedEffectSettings_t *settings = &effects->settings;
+
+    if (effects->transitioning) {
+        return true;
+    }
+    if ((settings->brightness == 0) || (memcmp(&settings->color, &settings->color2, sizeof(LedColor_t)) == 0)) {
+        return false;
+    }
+    return (settings->effect == LedEffect_Chase) || (settings->effect == LedEffect_Fade);
+}
+
+LedEffect_e ledEffectFromName(const char *name)
+{
+    LedEffect_e effect;
+
+    for (effect = 0; effect < LedEffect_Max; effect++) {
+        if (strcmp(ledEffectNames[effect], name) == 0) {
+            break;
+        }
+    }
+    return effect;
+}
+
+static void ledEffectsRenderSettings(LedEffects_t *effects, uint32_t nowMs, uint8_t *out)
+{
+    LedEffectSettings_t *settings = &effects->settings;
+    uint32_t length = effects->length;
+    uint32_t period = settings->periodMs;
+    uint32_t phase = nowMs % period;
+    uint32_t i, weight, tail, head, distance;
+    uint8_t from[BYTES_PER_LED] = {
+        effects->levels[settings->color.red], effects->levels[settings->color.green], effects->levels[settings->color.blue]
+    };
+    uint8_t to[BYTES_PER_LED] = {
+        effects->levels[settings->color2.red], effects->levels[settings->color2.green], effects->levels[settings->color2.blue]
+    };
+    uint8_t rgb[BYTES_PER_LED];
+
+    if (length == 0) {
+        return;
+    }
+    switch (settings->effect) {
+    case LedEffect_Gradient:
+        for (i = 0; i < length; i++, out += BYTES_PER_LED) {
+            weight = (length > 1) ? ((i * MIX_ONE) / (length - 1)) : 0;
+            out[0] = ledEffectsMix(from[0], to[0], weight);
+            out[1] = ledEffectsMix(from[1], to[1], weight);
+            out[2] = ledEffectsMix(from[2], to[2], weight);
+        }
+        break;
+
+    case LedEffect_Chase:
+        tail = CHASE_TAIL(length);
+        head = (uint32_t)(((uint64_t)phase * length) / period);
+        /* Walk back from the head so the distance doesn't need a divide per LED */
+        ledEffectsFill(out, length, to);
+        for (distance = 0; distance < tail; distance++) {
+            i = (head >= distance) ? (head - distance) : (head + length - distance);
+            weight = MIX_ONE - ((distance * MIX_ONE) / tail);
+            out[(i * BYTES_PER_LED) + 0] = ledEffectsMix(to[0], from[0], weight);
+            out[(i * BYTES_PER_LED) + 1] = ledEffectsMix(to[1], from[1], weight);
+            out[(i * BYTES_PER_LED) + 2] = ledEffectsMix(to[2], from[2], weight);
+        }
+        break;
+
+    case LedEffect_Fade:
+        /* Triangle wave, color at the start of the period and color2 half way through */
+        weight = (uint32_t)(((uint64_t)phase * MIX_ONE * 2) / period);
+        if (weight > MIX_ONE) {
+            weight = (MIX_ONE * 2) - weight;
+        }
+        rgb[0] = ledEffectsMix(from[0], to[0], weight);
+        rgb[1] = ledEffectsMix(from[1], to[1], weight);
+        rgb[2] = ledEffectsMix(from[2], to[2], weight);
+        ledEffectsFill(out, length, rgb);
+        break;
+
+    default:
+        ledEffectsFill(out, length, from);
+        break;
+    }
+}
+
+static void ledEffectsFill(uint8_t *out, uint32_t count, const uint8_t *rgb)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++, out += BYTES_PER_LED) {
+        out[0] = rgb[0];
+        out[1] = rgb[1];
+        out[2] = rgb[2];
+    }
+}
+
+/* weight is 0 for all a to MIX_ONE for all b */
+static inline uint8_t ledEffectsMix(uint8_t a, uint8_t b, uint32_t weight)
+{
+    return (uint8_t)(((a * (MIX_ONE - weight)) + (b * weight)) >> 8);
+}
@@ -0,0 +1,78 @@
+#ifndef _LED_EFFECTS_H_
+#define _LED_EFFECTS_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Renders LED strip frames from a set of settings, with no hardware or RTOS dependencies so it can be built on the
+ * host (see tools/ledbench.c). Frames are 3 bytes per LED, red, green then blue, already gamma corrected.
+ */
+
+typedef enum LedEffect {
+    LedEffect_Solid,
+    LedEffect_Gradient, /* color at the start of the strip to color2 at the end */
+    LedEffect_Chase,    /* Band of color with a fading tail moving along a color2 background */
+    LedEffect_Fade,     /* Whole strip fading between color and color2 */
+    LedEffect_Max
+} LedEffect_e;
+
+typedef struct LedColor {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+} LedColor_t;
+
+typedef struct LedEffectSettings {
+    LedEffect_e effect;
+    LedColor_t color;
+    LedColor_t color2;
+    uint8_t brightness; /* 0 - 100, 0 when the strip is off */
+    uint32_t periodMs;  /* Time for a chase to cross the strip or a fade to go there and back */
+} LedEffectSettings_t;
+
+typedef struct LedEffects {
+    uint32_t length;
+    uint8_t *frames[2]; /* Last frame returned and the one being rendered */
+    uint8_t front;
+    uint8_t *linear;    /* Last frame before gamma correction */
+    uint8_t *from;      /* What was shown when the settings changed, faded out while transitioning */
+    LedEffectSettings_t settings;
+    uint8_t levels[256]; /* Brightness table for settings */
+    uint32_t transitionStart;
+    uint32_t transitionMs;
+    bool transitioning;
+    bool sent;          /* A frame has been returned, the first is always returned as the strip's state is unknown */
+} LedEffects_t;
+
+extern const char *ledEffectNames[LedEffect_Max];
+
+/**
+ * Allocate the frames for a strip of length LEDs, initially off. Returns -1 if the memory couldn't be allocated.
+ */
+int ledEffectsInit(LedEffects_t *effects, uint32_t length);
+
+void ledEffectsFree(LedEffects_t *effects);
+
+/**
+ * Change the settings, cross fading from what is currently shown over transitionMs. With 0 the new settings are
+ * shown straight away, or if a transition is running it carries on to the new settings.
+ */
+void ledEffectsSet(LedEffects_t *effects, const LedEffectSettings_t *settings, uint32_t nowMs, uint32_t transitionMs);
+
+/**
+ * Render the frame for nowMs. Returns the frame if it is the first or differs from the last one returned, otherwise
+ * NULL.
+ * The frame stays valid until the next call.
+ */
+const uint8_t *ledEffectsRender(LedEffects_t *effects, uint32_t nowMs);
+
+/**
+ * Whether the frames change over time, if not nothing needs rendering until the settings change.
+ */
+bool ledEffectsAnimating(LedEffects_t *effects);
+
+/**
+ * Find an effect by name, returns LedEffect_Max if there isn't one.
+ */
+LedEffect_e ledEffectFromName(const char *name);
+#endif
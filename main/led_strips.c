@@ -1,12 +1,19 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 #include "iot.h"
 #include "led_strip_spi.h"
 #include "deviceprofile.h"
 #include "notifications.h"
 #include "safestring.h"
+#include "led_effects.h"
 
 static const char TAG[] = "led_strip_spi";
 
@@ -14,21 +21,41 @@ static const char TAG[] = "led_strip_spi";
 #define PUB_IDX_STATE      1
 #define PUB_IDX_RGB        2
 #define PUB_IDX_BRIGHTNESS 3
+#define PUB_IDX_EFFECT     4
+
+#define THREAD_NAME "ledstrip"
+#define THREAD_STACK_WORDS 2048
+#define THREAD_PRIO 2
+
+#define FRAME_MS (1000 / CONFIG_LED_STRIP_FPS)
+#define FRAME_TICKS ((FRAME_MS / portTICK_RATE_MS) ? (FRAME_MS / portTICK_RATE_MS) : 1)
+
+#define DEFAULT_PERIOD_MS 2000
+#define MAX_TRANSITION_MS 60000
+#define MAX_EFFECT_NAME_LEN 16
 
 struct LEDStrip {
     led_strip_spi_t strip;
     iotElement_t element;
-    rgb_t color;
+    SemaphoreHandle_t mutex; /* Protects effects, which is rendered by the strip thread */
+    TaskHandle_t task;
+    LedEffects_t effects;
+    LedEffectSettings_t settings; /* Brightness is only applied when state is on */
     char colorStr[12]; /* XXX,XXX,XXX\0 */
     uint8_t brightness;
+    uint32_t transitionMs;
     bool state;
 } *ledStrip = NULL;
 
 static void addLEDStripSPI(DeviceProfile_LedStripSpiConfig_t *config);
 static void ledStripSPIElementCallback(void *userData, iotElement_t element, iotElementCallbackReason_t reason, iotElementCallbackDetails_t *details);
 static void ledStripSPIControl(iotValue_t value);
-static void ledStripSPIUpdate(void);
+static void ledStripSPIUpdate(uint32_t transitionMs);
 static void ledStripSPIUpdateColor(void);
+static void ledStripSPIUpdateEffect(void);
+static void ledStripSPIThread(void *pvParameters);
+static void ledStripSPIFlush(const uint8_t *frame);
+static uint32_t ledStripSPINowMs(void);
 
 IOT_DESCRIBE_ELEMENT(
     elementDescription,
@@ -37,7 +64,8 @@ IOT_DESCRIBE_ELEMENT(
         IOT_DESCRIBE_PUB(RETAINED, INT, "ledcount"),
         IOT_DESCRIBE_PUB(RETAINED, BOOL, "state"),
         IOT_DESCRIBE_PUB(RETAINED, STRING, "rgb"),
-        IOT_DESCRIBE_PUB(RETAINED, INT, "brightness")
+        IOT_DESCRIBE_PUB(RETAINED, INT, "brightness"),
+        IOT_DESCRIBE_PUB(RETAINED, STRING, "effect")
     ),
     IOT_SUB_DESCRIPTIONS(
         IOT_DESCRIBE_SUB(STRING, IOT_SUB_DEFAULT_NAME)
@@ -78,15 +106,34 @@ static void addLEDStripSPI(DeviceProfile_LedStripSpiConfig_t *config)
     ledStrip = calloc(1, sizeof(struct LEDStrip));
     if (ledStrip == NULL) {
         ESP_LOGE(TAG, "Failed to allocate memory for led strip");
+        return;
     }
 
     ESP_LOGI(TAG, "Initializing LED strip");
     err = led_strip_spi_init(&strip);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to init led strip, %08x", err);
-        free(ledStrip);
+        goto error;
     }
     ledStrip->strip = strip;
+    ledStrip->settings.effect = LedEffect_Solid;
+    ledStrip->settings.periodMs = DEFAULT_PERIOD_MS;
+    ledStrip->transitionMs = CONFIG_LED_STRIP_TRANSITION_MS;
+
+    if (ledEffectsInit(&ledStrip->effects, strip.length) == -1) {
+        ESP_LOGE(TAG, "Failed to allocate frames for %d LEDs", strip.length);
+        goto error;
+    }
+    ledStrip->mutex = xSemaphoreCreateMutex();
+    if (ledStrip->mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+        goto error;
+    }
+    if (xTaskCreate(ledStripSPIThread, THREAD_NAME, THREAD_STACK_WORDS, NULL, THREAD_PRIO, &ledStrip->task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create thread");
+        goto error;
+    }
+
     ledStrip->element = iotNewElement(&elementDescription, 0, ledStripSPIElementCallback, ledStrip, "ledStrip");
     if (config->name) {
         iotElementSetHumanDescription(ledStrip->element, config->name);
@@ -98,34 +145,67 @@ static void addLEDStripSPI(DeviceProfile_LedStripSpiConfig_t *config)
     value.b = ledStrip->state;
     iotElementPublish(ledStrip->element, PUB_IDX_STATE, value);
 
-    ledStripSPIUpdate();
+    ledStripSPIUpdate(0);
 
     value.i = ledStrip->brightness;
     iotElementPublish(ledStrip->element, PUB_IDX_BRIGHTNESS, value);
     ledStripSPIUpdateColor();
-}
+    ledStripSPIUpdateEffect();
+    return;
 
+error:
+    if (ledStrip->mutex != NULL) {
+        vSemaphoreDelete(ledStrip->mutex);
+    }
+    ledEffectsFree(&ledStrip->effects);
+    free(ledStrip);
+    ledStrip = NULL;
+}
 
-void ledStripSPIControl(iotValue_t value)
+/*
+ * Runs in the MQTT task, so only changes the settings and leaves rendering and the SPI transfer to the strip thread.
+ */
+static void ledStripSPIControl(iotValue_t value)
 {
-    uint32_t red, green, blue, brightness;
+    uint32_t red, green, blue, brightness, ms;
     bool currentState = ledStrip->state;
+    char name[MAX_EFFECT_NAME_LEN];
+    LedEffect_e effect;
     iotValue_t updateValue;
 
-    if (sscanf(value.s, "color %u,%u,%u", &red, &green, &blue) == 3) {
-        ledStrip->color.red = red;
-        ledStrip->color.green = green;
-        ledStrip->color.blue = blue;
-        ledStripSPIUpdate();
+    if (sscanf(value.s, "color2 %u,%u,%u", &red, &green, &blue) == 3) {
+        ledStrip->settings.color2.red = red;
+        ledStrip->settings.color2.green = green;
+        ledStrip->settings.color2.blue = blue;
+        ledStripSPIUpdate(ledStrip->transitionMs);
+    } else if (sscanf(value.s, "color %u,%u,%u", &red, &green, &blue) == 3) {
+        ledStrip->settings.color.red = red;
+        ledStrip->settings.color.green = green;
+        ledStrip->settings.color.blue = blue;
+        ledStripSPIUpdate(ledStrip->transitionMs);
         ledStripSPIUpdateColor();
     } else if (sscanf(value.s, "brightness %u", &brightness) == 1) {
         if (brightness > 100) {
             brightness = 100;
         }
         ledStrip->brightness = (uint8_t)brightness;
-        ledStripSPIUpdate();
+        ledStripSPIUpdate(ledStrip->transitionMs);
         updateValue.i = ledStrip->brightness;
         iotElementPublish(ledStrip->element, PUB_IDX_BRIGHTNESS, updateValue);
+    } else if (sscanf(value.s, "effect %15s", name) == 1) {
+        effect = ledEffectFromName(name);
+        if (effect == LedEffect_Max) {
+            ESP_LOGW(TAG, "Unknown effect \"%s\"", name);
+            return;
+        }
+        ledStrip->settings.effect = effect;
+        ledStripSPIUpdate(ledStrip->transitionMs);
+        ledStripSPIUpdateEffect();
+    } else if (sscanf(value.s, "period %u", &ms) == 1) {
+        ledStrip->settings.periodMs = ms;
+        ledStripSPIUpdate(0);
+    } else if (sscanf(value.s, "transition %u", &ms) == 1) {
+        ledStrip->transitionMs = (ms > MAX_TRANSITION_MS) ? MAX_TRANSITION_MS : ms;
     } else if (strcmp("on", value.s) == 0) {
         if (!ledStrip->state) {
             ledStrip->state = true;
@@ -137,38 +217,96 @@ void ledStripSPIControl(iotValue_t value)
     }
 
     if (currentState != ledStrip->state) {
-        ledStripSPIUpdate();
+        ledStripSPIUpdate(ledStrip->transitionMs);
         updateValue.b = ledStrip->state;
         iotElementPublish(ledStrip->element, PUB_IDX_STATE, updateValue);
     }
 }
 
-void ledStripSPIUpdate(void)
+static void ledStripSPIUpdate(uint32_t transitionMs)
 {
-    esp_err_t err;
+    LedEffectSettings_t settings = ledStrip->settings;
 
-    uint8_t brightness = ledStrip->state ? ledStrip->brightness: 0;
+    settings.brightness = ledStrip->state ? ledStrip->brightness : 0;
+    xSemaphoreTake(ledStrip->mutex, portMAX_DELAY);
+    ledEffectsSet(&ledStrip->effects, &settings, ledStripSPINowMs(), transitionMs);
+    xSemaphoreGive(ledStrip->mutex);
+    xTaskNotifyGive(ledStrip->task);
+}
 
-    err = led_strip_spi_fill_brightness(&ledStrip->strip, 0, ledStrip->strip.length, ledStrip->color, brightness);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set all leds to %d, %d, %d, %d => %08x",
-                 ledStrip->color.red, ledStrip->color.green, ledStrip->color.blue, brightness, err);
-        return;
+static void ledStripSPIUpdateColor(void)
+{
+    iotValue_t value;
+    LedColor_t *color = &ledStrip->settings.color;
+
+    sprintf(ledStrip->colorStr, "%d,%d,%d", color->red, color->green, color->blue);
+    value.s = ledStrip->colorStr;
+    iotElementPublish(ledStrip->element, PUB_IDX_RGB, value);
+}
+
+static void ledStripSPIUpdateEffect(void)
+{
+    iotValue_t value;
+
+    value.s = ledEffectNames[ledStrip->settings.effect];
+    iotElementPublish(ledStrip->element, PUB_IDX_EFFECT, value);
+}
+
+/*
+ * Sleeps until the settings change, then renders a frame every FRAME_TICKS for as long as the effect or a transition
+ * is animating. Frames that are the same as the last one aren't sent to the strip.
+ */
+static void ledStripSPIThread(void *pvParameters)
+{
+    const uint8_t *frame;
+    TickType_t lastWake;
+    bool animating;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        lastWake = xTaskGetTickCount();
+        do {
+            xSemaphoreTake(ledStrip->mutex, portMAX_DELAY);
+            frame = ledEffectsRender(&ledStrip->effects, ledStripSPINowMs());
+            animating = ledEffectsAnimating(&ledStrip->effects);
+            xSemaphoreGive(ledStrip->mutex);
+
+            /* Only this thread renders, so the frame can't change while it is sent */
+            if (frame != NULL) {
+                ledStripSPIFlush(frame);
+            }
+            if (animating) {
+                vTaskDelayUntil(&lastWake, FRAME_TICKS);
+            }
+        } while (animating);
+    }
+}
+
+static void ledStripSPIFlush(const uint8_t *frame)
+{
+    esp_err_t err;
+    rgb_t color;
+    int i;
+
+    for (i = 0; i < ledStrip->strip.length; i++, frame += 3) {
+        color.red = frame[0];
+        color.green = frame[1];
+        color.blue = frame[2];
+        err = led_strip_spi_set_pixel(&ledStrip->strip, i, color);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to set led %d => %08x", i, err);
+            return;
+        }
     }
     err = led_strip_spi_flush(&ledStrip->strip);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to flush all leds to %d, %d, %d, %d => %08x",
-                 ledStrip->color.red, ledStrip->color.green, ledStrip->color.blue, ledStrip->brightness, err);
-        return;
+        ESP_LOGE(TAG, "Failed to flush leds => %08x", err);
     }
 }
 
-void ledStripSPIUpdateColor(void)
+static uint32_t ledStripSPINowMs(void)
 {
-    iotValue_t value;
-    sprintf(ledStrip->colorStr, "%d,%d,%d", ledStrip->color.red, ledStrip->color.green, ledStrip->color.blue);
-    value.s = ledStrip->colorStr;
-    iotElementPublish(ledStrip->element, PUB_IDX_RGB, value);
+    return (uint32_t)(esp_timer_get_time() / 1000);
 }
 
 static void ledStripSPIElementCallback(void *userData, iotElement_t element, iotElementCallbackReason_t reason, iotElementCallbackDetails_t *details)
@@ -176,4 +314,4 @@ static void ledStripSPIElementCallback(void *userData, iotElement_t element, iot
     if (reason == IOT_CALLBACK_ON_SUB) {
         ledStripSPIControl(details->value);
     }
-}
\ No newline at end of file
+}
@@ -18,28 +18,43 @@
 #include "controllers.h"
 #include "bootprot.h"
 #include "gpiox.h"
+#include "deepsleep.h"
+#include "switch.h"
+#include "bootTimeline.h"
+
+#define SWITCH_LOCK_TIMEOUT_MS 500
 
 static const char TAG[] = "profile";
 
+/*
+ * Components that can be changed by profileApply without restarting. Sensors and controllers have no teardown path,
+ * so changes to them, and to anything else not listed, restart the device (see README.md, Profiles).
+ */
+static const char * const liveComponents[] = {
+    "relay",
+    "relay_lockout",
+    "relay_timeout",
+    "switch",
+    NULL
+};
+
+/* Components keep references into the config so it is kept for the lifetime of the device */
+static DeviceProfile_DeviceConfig_t config;
+static bool profileProcessed = false;
+
+static bool controllersUseRelays(void);
+
 void processProfile(void)
 {
-    const char *profile = NULL;
-    DeviceProfile_DeviceConfig_t config;
-
     if (bootprotTriggered()) {
         ESP_LOGI(TAG, "Not loading Profile, boot protection triggered!");
     } else {
         ESP_LOGI(TAG, "Processing Profile");
-        if (deviceProfileGetProfile(&profile)) {
+        if (deviceProfileLoad(&config)) {
             ESP_LOGE(TAG, "Failed to load profile!");
             return;
         }
 
-        if (deviceProfileDeserialize(profile, &config)) {
-            ESP_LOGE(TAG, "Failed to deserialise profile!");
-            return;
-        }
-
         if (config.gpioxCount > 0) {
             DeviceProfile_GpioxConfig_t *gpioxConfig = config.gpioxConfig;
             gpioxInit(gpioxConfig->number, gpioxConfig->sda, gpioxConfig->scl);
@@ -60,9 +75,126 @@ void processProfile(void)
 #endif
 
         initControllers(&config);
+
+#ifdef CONFIG_DEEP_SLEEP
+        if (config.deepSleepCount > 0) {
+            deepSleepInit(config.deepSleepConfig);
+        }
+#endif
+        profileProcessed = true;
     }
+    bootTimelineMark(BOOT_STAGE_PROFILE);
     ESP_LOGI(TAG, "Signalling Profile finished processing");
     NotificationsData_t notification;
     notification.systemState = Notifications_SystemState_InitFinished;
     notificationsNotify(Notifications_Class_System, NOTIFICATIONS_ID_ALL, &notification);
 }
+
+int profileApply(void)
+{
+    DeviceProfile_DeviceConfig_t newConfig;
+    const char *changed;
+    bool relaysChanged, timeoutsChanged, switchesChanged;
+    int result = 0;
+
+    if (!profileProcessed) {
+        return -1;
+    }
+    if (deviceProfileLoad(&newConfig)) {
+        ESP_LOGE(TAG, "Failed to load new profile");
+        return -1;
+    }
+    changed = deviceProfileFindChange(&config, &newConfig, liveComponents);
+    if (changed != NULL) {
+        ESP_LOGI(TAG, "%s changed, restart required", changed);
+        deviceProfileFree(&newConfig);
+        return -1;
+    }
+
+    relaysChanged = !deviceProfileComponentEqual(&config, &newConfig, "relay") ||
+                    !deviceProfileComponentEqual(&config, &newConfig, "relay_lockout");
+    /* Timeouts and switches hold pointers to the relays so are recreated with them */
+    timeoutsChanged = relaysChanged || !deviceProfileComponentEqual(&config, &newConfig, "relay_timeout");
+    switchesChanged = relaysChanged || !deviceProfileComponentEqual(&config, &newConfig, "switch");
+
+    if (relaysChanged && controllersUseRelays()) {
+        ESP_LOGI(TAG, "Relays used by controllers changed, restart required");
+        deviceProfileFree(&newConfig);
+        return -1;
+    }
+#ifdef CONFIG_RULES
+    /* Rules look up the switches they refer to when they are added, so would be left with the old ids */
+    if (switchesChanged && (config.ruleCount > 0)) {
+        ESP_LOGI(TAG, "Switches used by rules changed, restart required");
+        deviceProfileFree(&newConfig);
+        return -1;
+    }
+#endif
+    if (!timeoutsChanged && !switchesChanged) {
+        ESP_LOGI(TAG, "Profile unchanged");
+        deviceProfileFree(&newConfig);
+        /* Still publish the new profile so whoever sent it sees it was taken */
+        iotResendAll();
+        return 0;
+    }
+
+    if (switchesChanged) {
+        if (switchLock(SWITCH_LOCK_TIMEOUT_MS)) {
+            deviceProfileFree(&newConfig);
+            return -1;
+        }
+        deinitSwitches();
+    }
+    if (timeoutsChanged && deinitRelays(!relaysChanged)) {
+        /* Part way through removing, only a restart gets back to a known state */
+        result = -1;
+    } else {
+        if (relaysChanged) {
+            deviceProfileMoveComponent(&config, &newConfig, "relay");
+            deviceProfileMoveComponent(&config, &newConfig, "relay_lockout");
+        }
+        if (timeoutsChanged) {
+            deviceProfileMoveComponent(&config, &newConfig, "relay_timeout");
+            reinitRelays(&config, !relaysChanged);
+        }
+        if (switchesChanged) {
+            deviceProfileMoveComponent(&config, &newConfig, "switch");
+            initSwitches(config.switchConfig, config.switchCount);
+        }
+    }
+    if (switchesChanged) {
+        switchUnlock();
+    }
+    deviceProfileFree(&newConfig);
+    if (result != 0) {
+        return result;
+    }
+
+    switchStart();
+    ESP_LOGI(TAG, "Profile applied (relays %d timeouts %d switches %d)", relaysChanged, timeoutsChanged, switchesChanged);
+    NotificationsData_t notification;
+    notification.systemState = Notifications_SystemState_ProfileApplied;
+    notificationsNotify(Notifications_Class_System, NOTIFICATIONS_ID_ALL, &notification);
+    iotResendAll();
+    return 0;
+}
+
+static bool controllersUseRelays(void)
+{
+#ifdef CONFIG_THERMOSTAT
+    if (config.thermostatCount > 0) {
+        return true;
+    }
+#endif
+#ifdef CONFIG_HUMIDISTAT
+    if (config.humidistatCount > 0) {
+        return true;
+    }
+#endif
+#ifdef CONFIG_RULES
+    if (config.ruleCount > 0) {
+        return true;
+    }
+#endif
+    return false;
+}
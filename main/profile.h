@@ -1,4 +1,12 @@
 #ifndef _PROFILE_H_
 #define _PROFILE_H_
 void processProfile(void);
+
+/**
+ * Apply the stored profile to the running device, only changes to relays, relay lockouts/timeouts and switches
+ * can be applied, changes to sensors, controllers and everything else need a restart.
+ * Waits on the switch and timer tasks so must not be called from either of them.
+ * Returns 0 if applied, -1 if the device needs to be restarted to use the new profile.
+ */
+int profileApply(void);
 #endif
\ No newline at end of file
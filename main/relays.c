@@ -13,8 +13,11 @@
 static const char TAG[] = "relays";
 
 static Relay_t *relays;
+static uint32_t relaysCount;
 static RelayLockout_t *lockouts;
+static uint32_t lockoutsCount;
 static RelayTimeout_t *timeouts;
+static uint32_t timeoutsCount;
 
 static int addGPIORelay(uint32_t id, DeviceProfile_RelayConfig_t *config)
 {
@@ -27,6 +30,9 @@ static int addGPIORelay(uint32_t id, DeviceProfile_RelayConfig_t *config)
     if (config->id) {
         relayRegister(relay, config->id);
     }
+    if (config->restore) {
+        relayEnableRestore(relay);
+    }
     return 0;
 }
 
@@ -41,6 +47,7 @@ static int initGPIORelays(DeviceProfile_RelayConfig_t *relayConfig, uint32_t rel
         ESP_LOGE(TAG, "Failed to allocate memory for relays");
         return -1;
     }
+    relaysCount = relayCount;
     for (i = 0; i < relayCount; i ++) {
         addGPIORelay(i, &relayConfig[i]);
     }
@@ -60,6 +67,7 @@ static int initRelayLockout(DeviceProfile_RelayLockoutConfig_t *config, uint32_t
         return -1;
     }
 
+    lockoutsCount = lockoutCount;
     for (i = 0; i < lockoutCount; i ++) {
         relayLockoutInit(i, config[i].relay, config[i].id, &lockouts[i]);
     }
@@ -79,6 +87,7 @@ static int initRelayTimeout(DeviceProfile_RelayTimeoutConfig_t *config, uint32_t
         return -1;
     }
 
+    timeoutsCount = timeoutCount;
     for (i = 0; i < timeoutCount; i ++) {
         relayTimeoutInit(i, config[i].relay, config[i].value, config[i].timeout, &timeouts[i]);
     }
@@ -126,4 +135,49 @@ int initRelays(DeviceProfile_DeviceConfig_t *config)
     initRelayTimeout(config->relayTimeoutConfig, config->relayTimeoutCount);
 
     return 0;
-}
\ No newline at end of file
+}
+
+int deinitRelays(bool timeoutsOnly)
+{
+    uint32_t i;
+
+    for (i = 0; i < timeoutsCount; i ++) {
+        if (relayTimeoutDeinit(&timeouts[i])) {
+            return -1;
+        }
+    }
+    free(timeouts);
+    timeouts = NULL;
+    timeoutsCount = 0;
+    if (timeoutsOnly) {
+        return 0;
+    }
+
+    for (i = 0; i < lockoutsCount; i ++) {
+        relayLockoutDeinit(&lockouts[i]);
+    }
+    free(lockouts);
+    lockouts = NULL;
+    lockoutsCount = 0;
+
+    for (i = 0; i < relaysCount; i ++) {
+        /* Don't leave a removed relay switched on, but restore its state if it is added back */
+        relayDisableRestore(&relays[i]);
+        relaySetState(&relays[i], false);
+        relayDeinit(&relays[i]);
+    }
+    free(relays);
+    relays = NULL;
+    relaysCount = 0;
+    return 0;
+}
+
+int reinitRelays(DeviceProfile_DeviceConfig_t *config, bool timeoutsOnly)
+{
+    if (!timeoutsOnly) {
+        initGPIORelays(config->relayConfig, config->relayCount);
+        initRelayLockout(config->relayLockoutConfig, config->relayLockoutCount);
+    }
+    initRelayTimeout(config->relayTimeoutConfig, config->relayTimeoutCount);
+    return 0;
+}
@@ -3,4 +3,15 @@
 #include "deviceprofile.h"
 
 int initRelays(DeviceProfile_DeviceConfig_t *config);
+
+/**
+ * Remove the relay timeouts and, unless timeoutsOnly is set, the GPIO relays and lockouts.
+ * Returns -1 if they could not be safely removed, in which case the device should be restarted.
+ */
+int deinitRelays(bool timeoutsOnly);
+
+/**
+ * Recreate the relays removed by deinitRelays from config.
+ */
+int reinitRelays(DeviceProfile_DeviceConfig_t *config, bool timeoutsOnly);
 #endif
\ No newline at end of file
@@ -22,6 +22,7 @@ struct SwitchTypeInfo {
 
 static struct Switch {
     Notifications_ID_t id;
+    int pin;
     const struct SwitchTypeInfo *typeInfo;
     iotElement_t element;
     const char *relayId;
@@ -125,6 +126,7 @@ void addSwitch(struct Switch *switchInstance, DeviceProfile_SwitchConfig_t *conf
 
     id = switchAdd(config->pin, (uint8_t)config->noiseFilter);
     switchInstance->id = id;
+    switchInstance->pin = config->pin;
     switchInstance->typeInfo = typeInfo;
     switchInstance->relayId = config->relay;
     switchInstance->element = iotNewElement(&elementDescription, 0, NULL, NULL, typeInfo->deviceName, devId);
@@ -133,6 +135,26 @@ void addSwitch(struct Switch *switchInstance, DeviceProfile_SwitchConfig_t *conf
     }
 }
 
+void deinitSwitches(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < switchCount; i ++) {
+        if (switches[i].element == NULL) {
+            /* Skipped due to an invalid type */
+            continue;
+        }
+        switchRemove(switches[i].pin);
+        notificationsRemoveId(switches[i].id);
+        iotDeleteElement(switches[i].element);
+    }
+    notificationsUnregister(Notifications_Class_Switch, NOTIFICATIONS_ID_ALL, switchUpdated, NULL);
+    notificationsUnregister(Notifications_Class_System, NOTIFICATIONS_ID_ALL, switchInitFinished, NULL);
+    free(switches);
+    switches = NULL;
+    switchCount = 0;
+}
+
 static void switchInitFinished(void *user, NotificationsMessage_t *message)
 {
     uint32_t i;
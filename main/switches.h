@@ -3,4 +3,9 @@
 #include "deviceprofile.h"
 
 int initSwitches(DeviceProfile_SwitchConfig_t *switchConfigs, int norfSwitches);
+
+/**
+ * Remove all the switches, must be called with the switch thread locked (see switchLock).
+ */
+void deinitSwitches(void);
 #endif
\ No newline at end of file
@@ -28,6 +28,11 @@
 #include "profile.h"
 #include "homeassistant.h"
 #include "bootprot.h"
+#include "sensors.h"
+#include "deepsleep.h"
+#include "bootTimeline.h"
+#include "journal.h"
+#include "timerWheel.h"
 
 static const char TAG[] = "main";
 extern char appVersion[]; /* this is defined in version.c which is autogenerated */
@@ -59,6 +64,12 @@ static char capabilities[] = "flash" CONFIG_ESPTOOLPY_FLASHSIZE ",configV2"
 #endif
 #ifdef CONFIG_LED_STRIP
                              ",led_strip"
+#endif
+#ifdef CONFIG_DEEP_SLEEP
+                             ",deepsleep"
+#endif
+#ifdef CONFIG_LOCAL_API
+                             ",localapi"
 #endif
                              ;
 /* Device capabilities string creation - finish */
@@ -68,17 +79,23 @@ static char capabilities[] = "flash" CONFIG_ESPTOOLPY_FLASHSIZE ",configV2"
 void app_main(void)
 {
     struct timeval tv = {.tv_sec = 0, .tv_usec=0};
+    bool sleeping = false;
     settimeofday(&tv, NULL);
+    bootTimelineMark(BOOT_STAGE_START);
 
     ESP_ERROR_CHECK( nvs_flash_init() );
+    bootTimelineMark(BOOT_STAGE_NVS);
 #if defined(CONFIG_BME280) || defined(CONFIG_SI7021) || defined(CONFIG_GPIOX_EXPANDERS)
     ESP_ERROR_CHECK( i2cdev_init() );
 #endif
     cJSON_InitHooks(NULL);
 
     bootprotInit();
+    journalInit();
+    bootTimelineMark(BOOT_STAGE_BOOTPROT);
 
     notificationsInit();
+    timerWheelInit();
 
 #ifdef CONFIG_NOTIFICATION_LED
     notificationLedInit();
@@ -91,13 +108,24 @@ void app_main(void)
     loggingInit();
 
     CHECK_ERROR(wifiInit());
+    bootTimelineMark(BOOT_STAGE_WIFI_INIT);
     CHECK_ERROR(iotInit());
+    bootTimelineMark(BOOT_STAGE_IOT_INIT);
     CHECK_ERROR(provisioningInit());
     CHECK_ERROR(switchInit());
-    updaterInit();
     CHECK_ERROR(iotDeviceInit(appVersion, capabilities));
+    iotDeviceAddDiagCallback(sensorsDiag);
+    iotDeviceAddDiagCallback(loggingDiag);
 
     processProfile();
+    iotDeviceSetProfileHandler(profileApply);
+#ifdef CONFIG_DEEP_SLEEP
+    sleeping = deepSleepIsEnabled();
+#endif
+    /* A sleeping device is only awake for a few seconds, updates are done while it stays awake to recover */
+    if (!sleeping) {
+        updaterInit();
+    }
 
 #ifdef CONFIG_HOMEASSISTANT
     homeAssistantDiscoveryInit();
@@ -105,6 +133,11 @@ void app_main(void)
 
     switchStart();
     wifiStart();
+    bootTimelineMark(BOOT_STAGE_INIT_DONE);
 
+    if (sleeping) {
+        /* Going back to sleep as soon as the readings are published, no need for the provisioning server */
+        return;
+    }
     CHECK_ERROR(provisioningStart());
 }
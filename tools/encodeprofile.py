@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+"""
+Write a profile in the JSON and binary forms updateprofile.py sends to a device, using the component definitions in
+components.yml rather than fetching them from a device. Used to make inputs for tools/profilebench.c.
+
+Run from the top of the repository:
+    tools/encodeprofile.py <profile yaml> <output prefix>
+writes <output prefix>.json and <output prefix>.bin.
+"""
+import argparse
+import json
+import sys
+import yaml
+import gencomponents
+import rulecompiler
+import updateprofile
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('profile', help='Profile yaml, as passed to updateprofile.py')
+    parser.add_argument('output', help='Prefix for the .json and .bin files')
+    parser.add_argument('--components', default='components.yml', help='Component definitions')
+    args = parser.parse_args()
+
+    with open(args.components) as fp:
+        components_dict = yaml.safe_load(fp)
+    components = {name: gencomponents.load_component(name, details) for name, details in components_dict.items()}
+
+    profile_dict = updateprofile.load_profile(args.profile)
+    messages = updateprofile.Messages()
+    if 'rule' in components:
+        rulecompiler.compile_rules(messages, profile_dict)
+    updateprofile.validate_profile(messages, components, profile_dict)
+    messages.print()
+    if messages.errors:
+        sys.exit(1)
+
+    profile = json.dumps({'version': updateprofile.VERSION, 'components': profile_dict})
+    binary_profile = gencomponents.encode_profile(components, profile_dict)
+    with open(args.output + '.json', 'w') as fp:
+        fp.write(profile)
+    with open(args.output + '.bin', 'wb') as fp:
+        fp.write(binary_profile)
+    print(f"JSON {len(profile)} bytes, binary {len(binary_profile)} bytes")
+
+
+if __name__ == '__main__':
+    main()
@@ -1,4 +1,6 @@
 import yaml
+import struct
+from functools import cached_property
 from collections import defaultdict
 from jinja2 import Environment, FileSystemLoader, select_autoescape
 env = Environment(
@@ -32,6 +34,21 @@ class Argument:
     def default(self):
         return self.options['default']
 
+    @property
+    def field_type(self) -> str:
+        return "FIELD_TYPE_" + self.type.upper()
+
+    @cached_property
+    def choice_hash(self):
+        return PerfectHash(self.options['choices'])
+
+    @property
+    def schema(self) -> str:
+        schema = f"{self.name}:{self.type}"
+        if self.type == 'choice':
+            schema += "=" + "|".join(self.options['choices'])
+        return schema
+
     def __str__(self) -> str:
         return self.name
 
@@ -40,8 +57,11 @@ class Component:
         self.name = name
         self.arguments = arguments
         self.condition = condition
-        self.arguments.append(Argument(name, "name", "string", {"optional": True}))
-        self.arguments.append(Argument(name, "id", "string", {"optional": True}))
+        # Definitions loaded from a device already include the common arguments
+        if self.get_arg("name") is None:
+            self.arguments.append(Argument(name, "name", "string", {"optional": True}))
+        if self.get_arg("id") is None:
+            self.arguments.append(Argument(name, "id", "string", {"optional": True}))
     
     def get_arg(self, name):
         for arg in self.arguments:
@@ -51,6 +71,21 @@ class Component:
     @property
     def mandatory_args(self):
         return {arg for arg in self.arguments if not arg.is_optional}
+
+    @property
+    def mandatory_mask(self) -> int:
+        """Bit per argument index, set if the argument must be present."""
+        if len(self.arguments) > 32:
+            raise ValueError(f"{self.name} has more than 32 arguments")
+        mask = 0
+        for index, arg in enumerate(self.arguments):
+            if not arg.is_optional:
+                mask |= 1 << index
+        return mask
+
+    @cached_property
+    def key_hash(self):
+        return PerfectHash([arg.name for arg in self.arguments])
     
     @property
     def normalised_name(self) -> str:
@@ -60,6 +95,12 @@ class Component:
             name += part[0].upper() + part[1:]
         return name
 
+    @property
+    def schema_hash(self) -> int:
+        """Identifies the component and the layout of its fields in binary profiles."""
+        schema = self.name + "(" + ",".join(arg.schema for arg in self.arguments) + ")"
+        return fnv1a(schema.encode())
+
     @property
     def normalised_field_name(self) -> str:
         parts = self.name.split('_')
@@ -71,6 +112,105 @@ class Component:
     def __str__(self) -> str:
         return self.name
 
+def fnv1a(data: bytes) -> int:
+    value = 0x811c9dc5
+    for byte in data:
+        value = ((value ^ byte) * 0x01000193) & 0xffffffff
+    return value
+
+
+def key_hash(key: str, seed: int) -> int:
+    """Must match hashKey() in deserialize.c, keys are case folded as profile keys are case insensitive."""
+    value = 0x811c9dc5 ^ seed
+    for byte in key.encode().lower():
+        value = ((value ^ byte) * 0x01000193) & 0xffffffff
+    return value ^ (value >> 16)
+
+
+class PerfectHash:
+    """Collision free mapping of a set of keys to slots, each slot holds index + 1 of its key or 0 if unused."""
+    MAX_SEED = 0x10000
+
+    def __init__(self, keys) -> None:
+        folded = [key.lower() for key in keys]
+        if len(set(folded)) != len(folded):
+            raise ValueError(f"Keys are not unique ignoring case: {keys}")
+        size = 1
+        while size < len(keys):
+            size *= 2
+        while True:
+            for seed in range(self.MAX_SEED):
+                slots = self._try_seed(keys, seed, size)
+                if slots is not None:
+                    self.seed = seed
+                    self.mask = size - 1
+                    self.slots = slots
+                    return
+            size *= 2
+
+    @staticmethod
+    def _try_seed(keys, seed, size):
+        slots = [0] * size
+        for index, key in enumerate(keys):
+            slot = key_hash(key, seed) & (size - 1)
+            if slots[slot]:
+                return None
+            slots[slot] = index + 1
+        return slots
+
+
+BINARY_MAGIC = b"HTPB"
+BINARY_VERSION = 1
+
+def encode_value(arg, value) -> bytes:
+    if arg.type in ("uint",):
+        return struct.pack("<I", value)
+    if arg.type == "int":
+        return struct.pack("<i", value)
+    if arg.type == "float":
+        return struct.pack("<f", value)
+    if arg.type in ("gpioPin", "gpioLevel", "i2cAddr"):
+        return struct.pack("<B", value)
+    if arg.type == "bool":
+        return struct.pack("<B", 1 if value else 0)
+    if arg.type == "choice":
+        return struct.pack("<B", arg.options['choices'].index(value))
+    if arg.type in ("string", "id"):
+        encoded = str(value).encode()
+        if len(encoded) > 255:
+            raise ValueError(f"{arg.component}.{arg.name} is too long for a binary profile")
+        return struct.pack("<B", len(encoded)) + encoded
+    raise ValueError(f"Unknown type {arg.type}")
+
+
+def encode_profile(components, profile_dict) -> bytes:
+    """Encode a validated profile as a binary profile for the device described by components (name -> Component).
+    Layout (little endian):
+        header:    "HTPB" u8 version, u8 nrofComponents, u16 totalLength
+        component: u32 schemaHash, u8 count, u16 length, then count instances
+        instance:  u8 nrofFields, then (u8 fieldIndex, value) for each field present
+    """
+    records = b""
+    nrof_components = 0
+    for name, instances in profile_dict.items():
+        if name not in components or not instances:
+            continue
+        component = components[name]
+        payload = b""
+        for details in instances:
+            fields = b""
+            for arg_name, value in details.items():
+                arg = component.get_arg(arg_name)
+                if arg is None:
+                    continue
+                fields += struct.pack("<B", component.arguments.index(arg)) + encode_value(arg, value)
+            payload += struct.pack("<B", len([a for a in details if component.get_arg(a)])) + fields
+        records += struct.pack("<IBH", component.schema_hash, len(instances), len(payload)) + payload
+        nrof_components += 1
+    header_len = len(BINARY_MAGIC) + 4
+    return BINARY_MAGIC + struct.pack("<BBH", BINARY_VERSION, nrof_components, header_len + len(records)) + records
+
+
 def process_option(component, argument, details):
     arg_type_options = {}
     if isinstance(details, dict):
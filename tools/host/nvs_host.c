@@ -0,0 +1,41 @@
+#include "nvs_flash.h"
+#include "utils.h"
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle)
+{
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+void nvs_close(nvs_handle handle)
+{
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length)
+{
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length)
+{
+    return ESP_FAIL;
+}
+
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value)
+{
+    return ESP_FAIL;
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key)
+{
+    return ESP_FAIL;
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    return ESP_FAIL;
+}
+
+esp_err_t nvs_get_str_alloc(nvs_handle handle, const char* key, char** out_value)
+{
+    return ESP_ERR_NVS_NOT_FOUND;
+}
@@ -0,0 +1,20 @@
+#ifndef _HOST_SDKCONFIG_H_
+#define _HOST_SDKCONFIG_H_
+/*
+ * Configuration for device code built into the host tools, every profile component is enabled and the cJSON tree
+ * parser is built so it can be compared with the streaming parser.
+ */
+#define CONFIG_DEVICEPROFILE_CJSON_PARSER 1
+
+#define CONFIG_DHT22 1
+#define CONFIG_SI7021 1
+#define CONFIG_TSL2561 1
+#define CONFIG_BME280 1
+#define CONFIG_DS18x20 1
+#define CONFIG_DRAYTONSCR 1
+#define CONFIG_HUMIDISTAT 1
+#define CONFIG_THERMOSTAT 1
+#define CONFIG_GPIOX_EXPANDERS 1
+#define CONFIG_DEEP_SLEEP 1
+#define CONFIG_RULES 1
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Host benchmark for the LED strip effects in main/led_effects.c, reports the time to render a frame of each effect,
+ * and of a transition, for a range of strip lengths.
+ *
+ *   cc -O2 -Imain -o ledbench tools/ledbench.c main/led_effects.c && ./ledbench [frames]
+ *
+ * Times are for the host, so are only useful for comparing changes to the effects and how they scale with length.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "led_effects.h"
+
+#define FRAME_MS 20
+#define DEFAULT_FRAMES 5000
+
+static const uint32_t lengths[] = {30, 60, 144, 300, 600, 1200};
+#define NROF_LENGTHS (sizeof(lengths) / sizeof(lengths[0]))
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Returns the mean ns per frame, changed is set to the number of frames that would have been sent to the strip */
+static uint64_t bench(uint32_t length, LedEffect_e effect, uint32_t transitionMs, int frames, int *changed)
+{
+    LedEffects_t effects;
+    LedEffectSettings_t settings = {
+        .effect = effect,
+        .color = {255, 128, 0},
+        .color2 = {0, 32, 255},
+        .brightness = 80,
+        .periodMs = 2000,
+    };
+    uint32_t ms = 0;
+    uint64_t start, total = 0;
+    int i;
+
+    if (ledEffectsInit(&effects, length) == -1) {
+        fprintf(stderr, "Failed to allocate %u LEDs\n", length);
+        exit(1);
+    }
+    ledEffectsSet(&effects, &settings, ms, 0);
+    ledEffectsRender(&effects, ms);
+    *changed = 0;
+    for (i = 0; i < frames; i++) {
+        /* Restart the transition whenever it finishes so every frame is a transition frame */
+        if ((transitionMs != 0) && !effects.transitioning) {
+            settings.color.red ^= 0xff;
+            ledEffectsSet(&effects, &settings, ms, transitionMs);
+        }
+        ms += FRAME_MS;
+        start = nowNs();
+        if (ledEffectsRender(&effects, ms) != NULL) {
+            (*changed)++;
+        }
+        total += nowNs() - start;
+    }
+    ledEffectsFree(&effects);
+    return total / frames;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = (argc > 1) ? atoi(argv[1]) : DEFAULT_FRAMES;
+    LedEffect_e effect;
+    uint64_t ns;
+    unsigned int l;
+    int changed;
+
+    if (frames <= 0) {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 1;
+    }
+    printf("%-12s %6s %10s %10s %8s\n", "effect", "leds", "ns/frame", "ns/led", "changed");
+    for (effect = 0; effect <= LedEffect_Max; effect++) {
+        for (l = 0; l < NROF_LENGTHS; l++) {
+            /* LedEffect_Max stands for a solid colour transition */
+            if (effect == LedEffect_Max) {
+                ns = bench(lengths[l], LedEffect_Solid, 400, frames, &changed);
+            } else {
+                ns = bench(lengths[l], effect, 0, frames, &changed);
+            }
+            printf("%-12s %6u %10llu %10llu %7d%%\n", (effect == LedEffect_Max) ? "transition" : ledEffectNames[effect],
+                   lengths[l], (unsigned long long)ns, (unsigned long long)(ns / lengths[l]), (changed * 100) / frames);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,210 @@
+"""
+Receive logs sent by the logging component and print them.
+
+Text datagrams (LOG\\0) are printed as they are, binary datagrams (LOGB) are formatted using the string table extracted
+from the ELF at build time. See components/logging/logging_int.h for the record format.
+
+    logdecode.py extract build/homething.elf -o build/homething.logstrings.json
+    logdecode.py listen --strings build/homething.logstrings.json
+"""
+import argparse
+import bisect
+import json
+import re
+import socket
+import struct
+import sys
+
+HEADER = struct.Struct('!4sL6s')
+RECORD_HEADER = struct.Struct('<HL')
+RECORD_TEXT = 0
+STRING_INLINE = 1
+
+# Flash mapped read only data on the ESP32
+DROM_LOW = 0x3F400000
+DROM_HIGH = 0x3F800000
+
+SHT_PROGBITS = 1
+SHF_ALLOC = 2
+
+# Printable latin-1 plus the whitespace and colour escapes found in log formats
+PRINTABLE_RUN = re.compile(rb'[\x20-\x7e\xa0-\xff\t\n\r\x1b]+')
+FORMAT_RE = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|z|j|t)?([diouxXcspfFeEgGaA%])')
+
+
+def extract(elf_file):
+    """Return a dict of address to string for every string in the flash rodata sections of elf_file"""
+    with open(elf_file, 'rb') as f:
+        elf = f.read()
+    if elf[:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1:
+        raise RuntimeError(f'{elf_file} is not a little endian 32bit ELF file')
+    shoff, = struct.unpack_from('<L', elf, 0x20)
+    shentsize, shnum = struct.unpack_from('<HH', elf, 0x2e)
+
+    strings = {}
+    for i in range(shnum):
+        _, sh_type, flags, addr, offset, size = struct.unpack_from('<LLLLLL', elf, shoff + i * shentsize)
+        if sh_type != SHT_PROGBITS or not (flags & SHF_ALLOC) or not (DROM_LOW <= addr < DROM_HIGH):
+            continue
+        data = elf[offset:offset + size]
+        # Strings can sit next to other data with no \0 between them, so take every printable run rather than only
+        # whole \0 terminated chunks
+        for m in PRINTABLE_RUN.finditer(data):
+            strings[addr + m.start()] = m.group().decode('latin-1')
+    return strings
+
+
+class StringTable:
+    def __init__(self, strings):
+        self.addresses = sorted(strings)
+        self.strings = strings
+
+    @classmethod
+    def load(cls, filename):
+        with open(filename) as f:
+            table = json.load(f)
+        return cls({int(k, 16): v for k, v in table['strings'].items()})
+
+    def lookup(self, address):
+        """Strings can share a tail, so the address may point into the middle of one in the table"""
+        i = bisect.bisect_right(self.addresses, address) - 1
+        if i >= 0:
+            start = self.addresses[i]
+            text = self.strings[start]
+            if address - start < len(text):
+                return text[address - start:]
+        return None
+
+
+def format_record(strings, fmt, args):
+    """Format a C printf string using the raw arguments from a binary record"""
+    pos = 0
+
+    def take(fmt_str):
+        nonlocal pos
+        value, = struct.unpack_from(fmt_str, args, pos)
+        pos += struct.calcsize(fmt_str)
+        return value
+
+    def take_string():
+        nonlocal pos
+        address = take('<L')
+        if address == 0:
+            return '(null)'
+        if address == STRING_INLINE:
+            end = args.index(b'\0', pos)
+            value = args[pos:end].decode('utf-8', 'replace')
+            pos = end + 1
+            return value
+        value = strings.lookup(address)
+        return value if value is not None else f'<unknown string 0x{address:08x}>'
+
+    def convert(m):
+        flags, width, precision, length, conversion = m.groups()
+        if conversion == '%':
+            return '%'
+        if width == '*':
+            width = str(take('<l'))
+        if precision == '*':
+            precision = str(take('<l'))
+        spec = '%' + flags + (width or '') + ('.' + precision if precision is not None else '')
+        wide = length in ('ll', 'j')
+        if conversion in 'di':
+            return (spec + 'd') % take('<q' if wide else '<l')
+        if conversion in 'uoxX':
+            return (spec + ('d' if conversion == 'u' else conversion)) % take('<Q' if wide else '<L')
+        if conversion == 'c':
+            return (spec + 'c') % (take('<l') & 0xff)
+        if conversion == 'p':
+            return (spec + 's') % ('0x%x' % take('<L'))
+        if conversion == 's':
+            return (spec + 's') % take_string()
+        return (spec + conversion.replace('F', 'f').replace('a', 'e').replace('A', 'E')) % take('<d')
+
+    return FORMAT_RE.sub(convert, fmt)
+
+
+def decode_records(strings, payload):
+    """Yield the text of each record in a binary datagram payload"""
+    pos = 0
+    while pos + RECORD_HEADER.size <= len(payload):
+        length, address = RECORD_HEADER.unpack_from(payload, pos)
+        if length < RECORD_HEADER.size or pos + length > len(payload):
+            yield '<corrupt record>\n'
+            return
+        body = payload[pos + RECORD_HEADER.size:pos + length]
+        pos += length
+        if address == RECORD_TEXT:
+            yield body.decode('utf-8', 'replace')
+            continue
+        fmt = strings.lookup(address) if strings is not None else None
+        if fmt is None:
+            yield f'<unknown format 0x{address:08x}, is the string table from the same build?>\n'
+            continue
+        try:
+            yield format_record(strings, fmt, body)
+        except (struct.error, ValueError, TypeError):
+            yield f'<failed to decode record for "{fmt.strip()}">\n'
+
+
+def listen(port, strings):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('0.0.0.0', port))
+    last_sequences = {}
+    warned = False
+
+    while True:
+        data, addr = sock.recvfrom(1200)
+        if len(data) < HEADER.size:
+            continue
+        sig, sequence, mac = HEADER.unpack_from(data)
+        if sig not in (b'LOG\x00', b'LOGB'):
+            continue
+        prefix = mac.hex()
+        last_sequence = last_sequences.get(mac)
+        if last_sequence is not None and sequence != last_sequence + 1:
+            if sequence <= last_sequence:
+                print(f'{prefix}: Device restarted')
+            else:
+                print(f'{prefix}: Missing {sequence - (last_sequence + 1)} logging packets!')
+        last_sequences[mac] = sequence
+
+        payload = data[HEADER.size:]
+        if sig == b'LOG\x00':
+            print(prefix + ': ' + payload.decode('utf-8', 'replace'), end='')
+            continue
+        if strings is None and not warned:
+            print('Received binary logs but no string table was given, use --strings', file=sys.stderr)
+            warned = True
+        for text in decode_records(strings, payload):
+            print(prefix + ': ' + text, end='')
+        sys.stdout.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Receive and decode homething logs')
+    subparsers = parser.add_subparsers(dest='command', required=True)
+
+    extract_parser = subparsers.add_parser('extract', help='Extract the string table from an ELF file')
+    extract_parser.add_argument('elf')
+    extract_parser.add_argument('-o', '--output', required=True)
+
+    listen_parser = subparsers.add_parser('listen', help='Receive and print logs')
+    listen_parser.add_argument('-p', '--port', type=int, default=5555)
+    listen_parser.add_argument('-s', '--strings', help='String table used to decode binary logs')
+
+    args = parser.parse_args()
+    if args.command == 'extract':
+        strings = extract(args.elf)
+        with open(args.output, 'w') as f:
+            json.dump({'strings': {f'{k:08x}': v for k, v in sorted(strings.items())}}, f)
+    else:
+        strings = StringTable.load(args.strings) if args.strings else None
+        try:
+            listen(args.port, strings)
+        except KeyboardInterrupt:
+            pass
+
+
+if __name__ == '__main__':
+    main()
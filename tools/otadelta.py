@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""
+Generate a delta OTA file that updates a device running one build to another.
+
+The device rebuilds the new image from the image it is running, so the delta has to be made from exactly the .bin
+that is running on the device. Most releases only move code around, so like bsdiff the delta is made up of regions
+where the new image is "nearly" the same as somewhere in the old image, stored as the bytewise difference (mostly
+zeros), and literal data for anything new. The whole thing is then compressed with zlib.
+
+    otadelta.py homething-1.2.bin homething-1.3.bin -o homething.esp32.1.3.from.1.2.otd
+
+The file starts with the usual OTA header with the format set to 'D', the zlib stream contains:
+
+    uint32 source length, source MD5, uint32 target length, target MD5
+    repeated: uint32 add length, uint32 copy length, int32 seek
+              add length bytes added to the source image at the current source offset
+              copy length bytes copied to the new image
+              the source offset moves on by seek
+
+See components/updater/download.c for the device side.
+"""
+import argparse
+import hashlib
+import os
+import struct
+import sys
+import zlib
+
+OTA_SIG = b'OTAD'
+PATCH_HEADER = struct.Struct('<L16sL16s')
+PATCH_CONTROL = struct.Struct('<LLl')
+DEFAULT_WINDOW_BITS = 12
+
+KEY_LEN = 8  # Bytes hashed to find candidate matches
+INDEX_STEP = 4  # Only every INDEX_STEP'th position in the old image is indexed to keep memory down
+MAX_CANDIDATES = 16
+MIN_MATCH = 16
+MAX_COMPARE = 1024
+SLACK = 32  # How far the score of an approximate match can drop before giving up on it
+CHUNK = 64
+
+
+def build_index(old):
+    index = {}
+    for i in range(0, len(old) - KEY_LEN + 1, INDEX_STEP):
+        key = old[i:i + KEY_LEN]
+        positions = index.get(key)
+        if positions is None:
+            index[key] = [i]
+        elif len(positions) < MAX_CANDIDATES:
+            positions.append(i)
+    return index
+
+
+def match_len(old, o, new, n, limit):
+    """Length of the exact match between old[o:] and new[n:], up to limit"""
+    limit = min(limit, len(old) - o, len(new) - n)
+    length = 0
+    while length + CHUNK <= limit and old[o + length:o + length + CHUNK] == new[n + length:n + length + CHUNK]:
+        length += CHUNK
+    while length < limit and old[o + length] == new[n + length]:
+        length += 1
+    return length
+
+
+def extend_match(old, o, new, n):
+    """Length of the approximate match at old[o:] and new[n:] where matching bytes outweigh those that differ"""
+    limit = min(len(old) - o, len(new) - n)
+    score = best_score = best_len = 0
+    k = 0
+    while k < limit:
+        if k + CHUNK <= limit and old[o + k:o + k + CHUNK] == new[n + k:n + k + CHUNK]:
+            k += CHUNK
+            score += CHUNK
+        else:
+            score += 1 if old[o + k] == new[n + k] else -1
+            k += 1
+        if score > best_score:
+            best_score = score
+            best_len = k
+        elif score < best_score - SLACK:
+            break
+    return best_len
+
+
+def find_regions(old, new):
+    """Return a list of (new offset, old offset, length) for the parts of new that are similar to old"""
+    index = build_index(old)
+    regions = []
+    last_end = 0
+    last_old_end = 0
+    i = 0
+    while i <= len(new) - KEY_LEN:
+        candidates = list(index.get(new[i:i + KEY_LEN], ()))
+        # Carrying on where the last region finished catches small changes the approximate match gave up on
+        following = last_old_end + (i - last_end)
+        if following < len(old):
+            candidates.append(following)
+        best_old = None
+        best_len = 0
+        for o in candidates:
+            length = match_len(old, o, new, i, MAX_COMPARE)
+            if length > best_len:
+                best_old = o
+                best_len = length
+        if best_len < MIN_MATCH:
+            i += 1
+            continue
+        # The index is sparse, so the match may start a few bytes earlier
+        o = best_old
+        while i > last_end and o > 0 and new[i - 1] == old[o - 1]:
+            i -= 1
+            o -= 1
+        length = extend_match(old, o, new, i)
+        regions.append((i, o, length))
+        i += length
+        last_end = i
+        last_old_end = o + length
+    return regions
+
+
+def make_patch(old, new):
+    """Return the uncompressed patch stream that turns old into new"""
+    out = [PATCH_HEADER.pack(len(old), hashlib.md5(old).digest(), len(new), hashlib.md5(new).digest())]
+    regions = find_regions(old, new)
+    first_new = regions[0][0] if regions else len(new)
+    first_old = regions[0][1] if regions else 0
+    out.append(PATCH_CONTROL.pack(0, first_new, first_old))
+    out.append(new[:first_new])
+    for r, (n, o, length) in enumerate(regions):
+        if r + 1 < len(regions):
+            next_new, next_old, _ = regions[r + 1]
+        else:
+            next_new, next_old = len(new), o + length
+        out.append(PATCH_CONTROL.pack(length, next_new - n - length, next_old - o - length))
+        out.append(bytes((a - b) & 0xff for a, b in zip(new[n:n + length], old[o:o + length])))
+        out.append(new[n + length:next_new])
+    return b''.join(out)
+
+
+def apply_patch(old, patch):
+    """Rebuild the new image the same way the device does, used to check the patch before it is written"""
+    source_len, source_digest, target_len, target_digest = PATCH_HEADER.unpack_from(patch)
+    if source_len != len(old) or source_digest != hashlib.md5(old).digest():
+        raise ValueError('Patch is for a different image')
+    pos = PATCH_HEADER.size
+    offset = 0
+    new = bytearray()
+    while pos < len(patch):
+        add_len, copy_len, seek = PATCH_CONTROL.unpack_from(patch, pos)
+        pos += PATCH_CONTROL.size
+        new += bytes((a + b) & 0xff for a, b in zip(patch[pos:pos + add_len], old[offset:offset + add_len]))
+        pos += add_len
+        offset += add_len
+        new += patch[pos:pos + copy_len]
+        pos += copy_len
+        offset += seek
+    if len(new) != target_len or hashlib.md5(new).digest() != target_digest:
+        raise ValueError('Patched image does not match')
+    return bytes(new)
+
+
+def compress(data, window_bits):
+    compressor = zlib.compressobj(9, zlib.DEFLATED, window_bits)
+    return compressor.compress(data) + compressor.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate a delta OTA file between two homething builds')
+    parser.add_argument('old', help='Image running on the device')
+    parser.add_argument('new', help='Image to update to')
+    parser.add_argument('-o', '--output', required=True)
+    parser.add_argument('-w', '--window-bits', type=int, default=DEFAULT_WINDOW_BITS,
+                        help='Compression window, must not be more than UPDATER_WINDOW_BITS on the device')
+    args = parser.parse_args()
+
+    with open(args.old, 'rb') as f:
+        old = f.read()
+    with open(args.new, 'rb') as f:
+        new = f.read()
+
+    patch = make_patch(old, new)
+    apply_patch(old, patch)
+    data = compress(patch, args.window_bits)
+    with open(args.output, 'wb') as f:
+        f.write(OTA_SIG)
+        f.write(struct.pack('<l', len(data)))
+        f.write(hashlib.md5(data).digest())
+        f.write(data)
+
+    compressed_len = len(compress(new, args.window_bits))
+    print(f'{os.path.basename(args.output)}: {len(data)} bytes, image {len(new)} bytes '
+          f'({len(new) / len(data):.1f} times smaller), compressed image {compressed_len} bytes '
+          f'({compressed_len / len(data):.1f} times smaller)')
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""
+Serve OTA files to devices and report how long each download took.
+
+Used to benchmark updates against a local server, the rate limit can be set to approximate the throughput of the
+device's WiFi link so the time spent writing to flash shows up in the results. Range requests and keep-alive are
+supported, and --drop closes the connection part way through each response to test resuming downloads.
+
+    otaserver.py build --rate 300
+    otaserver.py build --drop 200
+"""
+import argparse
+import functools
+import http.server
+import os
+import re
+import time
+
+RANGE_RE = re.compile(r'bytes=(\d+)-(\d*)')
+
+
+class OtaRequestHandler(http.server.SimpleHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    rate = None  # KB/s, None for unlimited
+    drop = None  # KB sent before closing the connection, None to send everything
+    chunk_size = 1460
+
+    def send_head(self):
+        self.remaining = None
+        path = self.translate_path(self.path)
+        m = RANGE_RE.fullmatch(self.headers.get('Range', ''))
+        if not m or not os.path.isfile(path):
+            return super().send_head()
+        size = os.path.getsize(path)
+        start = int(m.group(1))
+        end = min(int(m.group(2)) if m.group(2) else size - 1, size - 1)
+        if start >= size or end < start:
+            self.send_response(416)
+            self.send_header('Content-Range', f'bytes */{size}')
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return None
+        f = open(path, 'rb')
+        f.seek(start)
+        self.send_response(206)
+        self.send_header('Content-Type', self.guess_type(path))
+        self.send_header('Content-Range', f'bytes {start}-{end}/{size}')
+        self.send_header('Content-Length', str(end - start + 1))
+        self.end_headers()
+        self.remaining = end - start + 1
+        return f
+
+    def end_headers(self):
+        self.send_header('Accept-Ranges', 'bytes')
+        super().end_headers()
+
+    def copyfile(self, source, outputfile):
+        start = time.monotonic()
+        link_free = start
+        sent = 0
+        while self.remaining is None or sent < self.remaining:
+            size = self.chunk_size if self.remaining is None else min(self.chunk_size, self.remaining - sent)
+            data = source.read(size)
+            if not data:
+                break
+            if self.drop and sent + len(data) > self.drop * 1024:
+                self.log_message('"%s" dropping connection after %d bytes', self.path, sent)
+                self.close_connection = True
+                return
+            outputfile.write(data)
+            sent += len(data)
+            if self.rate:
+                # Like a real link, time the device spends not reading can't be made up by sending faster later
+                link_free = max(link_free, time.monotonic()) + len(data) / (self.rate * 1024)
+                delay = link_free - time.monotonic()
+                if delay > 0:
+                    time.sleep(delay)
+        elapsed = time.monotonic() - start
+        self.log_message('"%s" sent %d bytes in %.2fs (%.1f KB/s)', self.path, sent, elapsed,
+                         sent / 1024 / elapsed if elapsed else 0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Serve OTA files and time each download')
+    parser.add_argument('directory', nargs='?', default='build', help='Directory containing the .ota files')
+    parser.add_argument('-p', '--port', type=int, default=8080)
+    parser.add_argument('-r', '--rate', type=float, help='Limit the send rate to this many KB/s')
+    parser.add_argument('-d', '--drop', type=int, help='Close the connection after sending this many KB of a file')
+    args = parser.parse_args()
+
+    OtaRequestHandler.rate = args.rate
+    OtaRequestHandler.drop = args.drop
+    handler = functools.partial(OtaRequestHandler, directory=os.path.abspath(args.directory))
+    server = http.server.ThreadingHTTPServer(('', args.port), handler)
+    print(f'Serving {args.directory} on port {args.port}' + (f' at {args.rate} KB/s' if args.rate else ''))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
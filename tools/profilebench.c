@@ -0,0 +1,137 @@
+/*
+ * Host benchmark for loading the device profile, times decoding the binary profile against parsing the JSON profile
+ * with the streaming parser and with the cJSON tree parser, and checks all three give the same config.
+ *
+ *   tools/encodeprofile.py profile.yml /tmp/profile
+ *   cc -O2 -Itools/host -Icomponents/deviceprofile -Icomponents/deviceprofile/include -Icomponents/utils/include \
+ *      -I$IDF_PATH/components/json/cJSON -o profilebench tools/profilebench.c tools/host/nvs_host.c \
+ *      components/deviceprofile/deviceprofile.c components/deviceprofile/deserialize.c \
+ *      components/deviceprofile/deserializeStream.c components/utils/jsonStream.c \
+ *      $IDF_PATH/components/json/cJSON/cJSON.c
+ *   ./profilebench /tmp/profile.json /tmp/profile.bin [iterations]
+ *
+ * Times are for the host, so are only useful for comparing the approaches and changes to them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "deviceprofile.h"
+#include "deserializeInternal.h"
+
+#define DEFAULT_ITERATIONS 20000
+
+typedef int (*loader_t)(const void *profile, size_t len, DeviceProfile_DeviceConfig_t *config);
+
+static int loadBinary(const void *profile, size_t len, DeviceProfile_DeviceConfig_t *config)
+{
+    return deviceProfileDecode(profile, len, config);
+}
+
+static int loadStream(const void *profile, size_t len, DeviceProfile_DeviceConfig_t *config)
+{
+    return deserializeStream(profile, config);
+}
+
+/* The host build has CONFIG_DEVICEPROFILE_CJSON_PARSER set, see tools/host/sdkconfig.h */
+static int loadTree(const void *profile, size_t len, DeviceProfile_DeviceConfig_t *config)
+{
+    return deviceProfileDeserialize(profile, config);
+}
+
+static void *readFile(const char *path, size_t *len)
+{
+    FILE *fp = fopen(path, "rb");
+    char *data;
+    long size;
+
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    /* Terminated so the JSON profile can be used as a string */
+    data = calloc(1, size + 1);
+    if ((data == NULL) || (fread(data, 1, size, fp) != size)) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        exit(1);
+    }
+    fclose(fp);
+    *len = size;
+    return data;
+}
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Returns the mean ns per load */
+static uint64_t bench(loader_t loader, const void *profile, size_t len, int iterations)
+{
+    DeviceProfile_DeviceConfig_t config;
+    uint64_t start, total = 0;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        start = nowNs();
+        if (loader(profile, len, &config)) {
+            fprintf(stderr, "Failed to load profile\n");
+            exit(1);
+        }
+        total += nowNs() - start;
+        deviceProfileFree(&config);
+    }
+    return total / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    DeviceProfile_DeviceConfig_t binary, stream, tree;
+    const char *changed;
+    size_t jsonLen, binaryLen;
+    void *json, *bin;
+    int iterations;
+
+    if ((argc < 3) || (argc > 4)) {
+        fprintf(stderr, "usage: %s <profile.json> <profile.bin> [iterations]\n", argv[0]);
+        return 1;
+    }
+    json = readFile(argv[1], &jsonLen);
+    bin = readFile(argv[2], &binaryLen);
+    iterations = (argc > 3) ? atoi(argv[3]) : DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        fprintf(stderr, "iterations must be positive\n");
+        return 1;
+    }
+
+    if (loadBinary(bin, binaryLen, &binary) || loadStream(json, jsonLen, &stream) || loadTree(json, jsonLen, &tree)) {
+        fprintf(stderr, "Failed to load profile\n");
+        return 1;
+    }
+    changed = deviceProfileFindChange(&binary, &tree, NULL);
+    if (changed == NULL) {
+        changed = deviceProfileFindChange(&stream, &tree, NULL);
+    }
+    if (changed != NULL) {
+        fprintf(stderr, "Loaders disagree about %s\n", changed);
+        return 1;
+    }
+    deviceProfileFree(&binary);
+    deviceProfileFree(&stream);
+    deviceProfileFree(&tree);
+
+    printf("%-8s %8s %10s\n", "loader", "bytes", "ns/load");
+    printf("%-8s %8zu %10llu\n", "binary", binaryLen, (unsigned long long)bench(loadBinary, bin, binaryLen, iterations));
+    printf("%-8s %8zu %10llu\n", "stream", jsonLen, (unsigned long long)bench(loadStream, json, jsonLen, iterations));
+    printf("%-8s %8zu %10llu\n", "cjson", jsonLen, (unsigned long long)bench(loadTree, json, jsonLen, iterations));
+    free(json);
+    free(bin);
+    return 0;
+}
@@ -0,0 +1,315 @@
+/*
+ * Host differential test for the streaming profile parser, checks deserializeStream accepts and rejects the same
+ * profiles as the cJSON tree parser and produces the same config, and that jsonStream gives the same events however
+ * the document is split into chunks and whatever the size of its token buffer.
+ *
+ *   cc -O2 -Itools/host -Icomponents/deviceprofile -Icomponents/deviceprofile/include -Icomponents/utils/include \
+ *      -I$IDF_PATH/components/json/cJSON -o profiletest tools/profiletest.c tools/host/nvs_host.c \
+ *      components/deviceprofile/deviceprofile.c components/deviceprofile/deserialize.c \
+ *      components/deviceprofile/deserializeStream.c components/utils/jsonStream.c \
+ *      $IDF_PATH/components/json/cJSON/cJSON.c
+ *   ./profiletest [profile.json...]
+ *
+ * Profiles given on the command line are checked as well as the built in cases. Exits non-zero if any case fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "deviceprofile.h"
+#include "deserializeInternal.h"
+#include "jsonStream.h"
+
+#define PROFILE_START "{\"version\":\"1.0\",\"components\":{"
+#define PROFILE_END   "}}"
+
+struct transcript {
+    char *text;
+    size_t len;
+    size_t size;
+    bool inPart; /* The last event was a part, so the next event carries on the same value */
+};
+
+static const char *cases[] = {
+    PROFILE_START "\"relay\":[{\"pin\":5,\"level\":1},{\"pin\":6,\"level\":0}]" PROFILE_END,
+    /* Keys are matched ignoring case and only the first of each is used */
+    PROFILE_START "\"RELAY\":[{\"pin\":5,\"PIN\":7,\"level\":1,\"x\":{\"a\":[1,2]}}],\"relay\":[{\"pin\":9,\"level\":0}]" PROFILE_END,
+    "{\"components\":{\"relay\":[{\"pin\":5,\"level\":1}]},\"version\":\"1.0\",\"version\":\"2.0\"}",
+    /* Components that fail validation are dropped */
+    PROFILE_START "\"relay\":[{\"pin\":5}],\"switch\":[{\"pin\":1,\"type\":\"toggle\"}]" PROFILE_END,
+    PROFILE_START "\"relay\":[{\"pin\":\"5\",\"level\":1}],\"switch\":{\"pin\":1}" PROFILE_END,
+    PROFILE_START "\"relay\":[1,{\"pin\":6,\"level\":0}]" PROFILE_END,
+    PROFILE_START "\"switch\":[{\"pin\":1,\"type\":\"toggle\",\"name\":\"a\\u00e9\\ud83d\\ude00\\n\\\"\"}]" PROFILE_END,
+    /* Invalid profiles */
+    "{\"version\":\"1.1\",\"components\":{}}",
+    "{\"version\":\"1.0\",\"components\":[]}",
+    "{\"version\":\"1.0\"}",
+    "[1,2]",
+    "\"1.0\"",
+    PROFILE_START "\"relay\":[{\"pin\":5,\"level\":1}]",
+    PROFILE_START "\"relay\":[{\"pin\":5,\"level\":01x}]" PROFILE_END,
+    PROFILE_START "\"switch\":[{\"pin\":1,\"type\":\"toggle\",\"name\":\"\\ud83d\"}]" PROFILE_END,
+    /* Anything after the profile is ignored */
+    PROFILE_START "\"relay\":[{\"pin\":5,\"level\":1}]" PROFILE_END " trailing",
+};
+#define NROF_CASES (sizeof(cases) / sizeof(cases[0]))
+
+/* Lengths around the streaming parser's 256 byte token buffer */
+static const size_t longLengths[] = {254, 255, 256, 257, 511, 512, 513, 4000};
+#define NROF_LONG_LENGTHS (sizeof(longLengths) / sizeof(longLengths[0]))
+
+/* Around cJSON's nesting limit */
+static const int depths[] = {31, 32, 33, 999, 1000, 1001};
+#define NROF_DEPTHS (sizeof(depths) / sizeof(depths[0]))
+
+static int failures;
+
+static void checkChunks(const char *name, const char *doc);
+
+static char *repeat(const char *text, size_t count)
+{
+    size_t len = strlen(text);
+    char *out = malloc((len * count) + 1);
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        memcpy(out + (i * len), text, len);
+    }
+    out[len * count] = 0;
+    return out;
+}
+
+static char *format(const char *fmt, const char *a, const char *b)
+{
+    size_t len = strlen(fmt) + strlen(a) + strlen(b) + 1;
+    char *out = malloc(len);
+
+    snprintf(out, len, fmt, a, b);
+    return out;
+}
+
+static void check(const char *name, const char *profile)
+{
+    DeviceProfile_DeviceConfig_t tree, stream;
+    int treeResult, streamResult;
+    const char *changed = NULL;
+
+    treeResult = deviceProfileDeserialize(profile, &tree);
+    streamResult = deserializeStream(profile, &stream);
+    if ((treeResult == 0) && (streamResult == 0)) {
+        changed = deviceProfileFindChange(&tree, &stream, NULL);
+    }
+    if ((treeResult != streamResult) || (changed != NULL)) {
+        printf("FAIL %s: cJSON %d stream %d%s%s\n", name, treeResult, streamResult, changed ? " differ in " : "",
+               changed ? changed : "");
+        failures++;
+    } else {
+        printf("ok   %s (%s)\n", name, (treeResult == 0) ? "accepted" : "rejected");
+    }
+    if (treeResult == 0) {
+        deviceProfileFree(&tree);
+    }
+    if (streamResult == 0) {
+        deviceProfileFree(&stream);
+    }
+}
+
+static void checkLongStrings(void)
+{
+    char name[64];
+    unsigned int i;
+
+    for (i = 0; i < NROF_LONG_LENGTHS; i++) {
+        size_t len = longLengths[i];
+        char *text = repeat("x", len);
+        /* Escapes that straddle the end of the token buffer */
+        char *escaped = repeat("\\u00e9\\\"y", len / 7);
+        char *profile;
+
+        profile = format(PROFILE_START "\"switch\":[{\"pin\":1,\"type\":\"toggle\",\"name\":\"%s\",\"icon\":\"%s\"}]"
+                         PROFILE_END, text, escaped);
+        snprintf(name, sizeof(name), "string field %zu", len);
+        check(name, profile);
+        checkChunks(name, profile);
+        free(profile);
+
+        profile = format(PROFILE_START "\"relay\":[{\"pin\":5,\"level\":1,\"%s\":\"%s\"}]" PROFILE_END, text, text);
+        snprintf(name, sizeof(name), "unknown key and value %zu", len);
+        check(name, profile);
+        free(profile);
+
+        profile = format("{\"%s\":[\"%s\"],\"version\":\"1.0\",\"components\":{\"relay\":[{\"pin\":5,\"level\":1}]}}",
+                         text, escaped);
+        snprintf(name, sizeof(name), "unknown root key %zu", len);
+        check(name, profile);
+        free(profile);
+
+        profile = format("{\"version\":\"%s\",\"components\":{%s}}", text, "");
+        snprintf(name, sizeof(name), "long version %zu", len);
+        check(name, profile);
+        free(profile);
+
+        free(text);
+        free(escaped);
+    }
+}
+
+static void checkDepths(void)
+{
+    char name[64];
+    unsigned int i;
+
+    for (i = 0; i < NROF_DEPTHS; i++) {
+        /* The profile itself is 4 levels deep */
+        int depth = depths[i];
+        char *open = repeat("[", depth - 4);
+        char *close = repeat("]", depth - 4);
+        char *profile;
+
+        profile = format(PROFILE_START "\"relay\":[{\"pin\":5,\"level\":1,\"x\":%s%s}]" PROFILE_END, open, close);
+        snprintf(name, sizeof(name), "nested unknown field %d", depth);
+        check(name, profile);
+        free(profile);
+
+        profile = format(PROFILE_START "\"relay\":[{\"pin\":5,\"level\":1,\"restore\":%s%s}]" PROFILE_END, open, close);
+        snprintf(name, sizeof(name), "nested field value %d", depth);
+        check(name, profile);
+        free(profile);
+
+        free(open);
+        free(close);
+    }
+}
+
+static void transcriptAdd(struct transcript *transcript, const char *text, size_t len)
+{
+    if (transcript->len + len + 1 > transcript->size) {
+        transcript->size = (transcript->len + len + 1) * 2;
+        transcript->text = realloc(transcript->text, transcript->size);
+    }
+    memcpy(transcript->text + transcript->len, text, len);
+    transcript->len += len;
+    transcript->text[transcript->len] = 0;
+}
+
+static int transcriptEvent(void *user, JsonStreamEvent_e event, const char *value, size_t len)
+{
+    struct transcript *transcript = user;
+    char tag = '0' + event;
+
+    /* Parts are recorded as if the whole value had been passed in one event */
+    if (!transcript->inPart) {
+        if (event == JSON_STREAM_KEY_PART) {
+            tag = '0' + JSON_STREAM_KEY;
+        } else if (event == JSON_STREAM_STRING_PART) {
+            tag = '0' + JSON_STREAM_STRING;
+        }
+        transcriptAdd(transcript, &tag, 1);
+    }
+    if (value != NULL) {
+        transcriptAdd(transcript, value, len);
+    }
+    transcript->inPart = (event == JSON_STREAM_KEY_PART) || (event == JSON_STREAM_STRING_PART);
+    if (!transcript->inPart) {
+        transcriptAdd(transcript, "\n", 1);
+    }
+    return 0;
+}
+
+static int transcribe(const char *doc, size_t chunk, size_t bufferSize, bool split, struct transcript *transcript)
+{
+    JsonStream_t stream;
+    char *buffer = malloc(bufferSize);
+    size_t len = strlen(doc), pos;
+    int result = 0;
+
+    memset(transcript, 0, sizeof(*transcript));
+    transcriptAdd(transcript, "", 0);
+    jsonStreamInit(&stream, buffer, bufferSize, transcriptEvent, transcript);
+    jsonStreamSplitStrings(&stream, split);
+    for (pos = 0; (pos < len) && (result == 0); pos += chunk) {
+        result = jsonStreamFeed(&stream, doc + pos, ((len - pos) < chunk) ? (len - pos) : chunk);
+    }
+    if (result == 0) {
+        result = jsonStreamFinish(&stream);
+    }
+    free(buffer);
+    return result;
+}
+
+/* Splitting strings or feeding in chunks must not change the events, numbers always have to fit in the buffer */
+static void checkChunks(const char *name, const char *doc)
+{
+    static const size_t chunks[] = {1, 2, 3, 7, 64};
+    static const size_t bufferSizes[] = {8, 13, 256};
+    struct transcript reference, transcript;
+    unsigned int c, b;
+    int referenceResult, result;
+
+    referenceResult = transcribe(doc, strlen(doc) + 1, strlen(doc) + 1, false, &reference);
+    for (c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        for (b = 0; b < sizeof(bufferSizes) / sizeof(bufferSizes[0]); b++) {
+            result = transcribe(doc, chunks[c], bufferSizes[b], true, &transcript);
+            if ((result != referenceResult) || ((result == 0) && (strcmp(reference.text, transcript.text) != 0))) {
+                printf("FAIL %s: chunk %zu buffer %zu\n", name, chunks[c], bufferSizes[b]);
+                failures++;
+                free(transcript.text);
+                free(reference.text);
+                return;
+            }
+            free(transcript.text);
+        }
+    }
+    printf("ok   %s chunked\n", name);
+    free(reference.text);
+}
+
+static char *readFile(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    char *data;
+    long size;
+
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = calloc(1, size + 1);
+    if ((data == NULL) || (fread(data, 1, size, fp) != size)) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        exit(1);
+    }
+    fclose(fp);
+    return data;
+}
+
+int main(int argc, char *argv[])
+{
+    char name[32];
+    unsigned int i;
+    int arg;
+
+    for (i = 0; i < NROF_CASES; i++) {
+        snprintf(name, sizeof(name), "case %u", i);
+        check(name, cases[i]);
+        checkChunks(name, cases[i]);
+    }
+    checkLongStrings();
+    checkDepths();
+    for (arg = 1; arg < argc; arg++) {
+        char *profile = readFile(argv[arg]);
+        check(argv[arg], profile);
+        checkChunks(argv[arg], profile);
+        free(profile);
+    }
+
+    if (failures) {
+        printf("%d failed\n", failures);
+        return 1;
+    }
+    printf("All passed\n");
+    return 0;
+}
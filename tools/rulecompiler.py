@@ -0,0 +1,420 @@
+#!/usr/bin/env python3
+"""
+Compile the rules in a device profile into the bytecode run by components/rules on the device.
+
+Rules are written in the profile as:
+
+    rule:
+      - name: Landing light
+        when: motion and landing_lux < 50
+        then: landing_light on for 2m
+      - when: bathroom.humidity > 75 or bathroom.temperature > 24.5
+        then: fan on
+        otherwise: fan off
+
+`when` is a condition made of ids from the profile compared with numbers or on/off, joined with and, or, not and
+brackets. Switches and relays are on/off (switches are on when pressed, on, motion detected or open), sensors are
+compared in their own units (C, %RH, hPa and lux). Sensors with more than one value need the value naming, e.g.
+bathroom.humidity. `then` runs when the condition becomes true and `otherwise` when it becomes false, both are comma
+separated lists of `<relay> on|off|toggle [for <n>[s|m|h]]`, the relay being switched back when the time is up.
+
+The compiled rule is added to the profile as `refs`, the ids used, and `code`, the bytecode as hex:
+
+    u8 version, u8 number of refs, u8 number of timers, u8 kind of each ref
+    then for when, then and otherwise: u8 length, instructions
+
+Running this directly prints what each rule in a profile compiles to:
+
+    rulecompiler.py myprofile.yml
+"""
+import re
+import struct
+import sys
+import yaml
+
+VERSION = 1
+MAX_STACK = 8
+MAX_STRING = 255  # Longest string in a binary profile
+
+KIND_SWITCH = 0
+KIND_RELAY = 1
+KIND_TEMPERATURE = 2
+KIND_HUMIDITY = 3
+KIND_PRESSURE = 4
+KIND_ILLUMINANCE = 5
+
+KIND_NAMES = {
+    'temperature': KIND_TEMPERATURE,
+    'humidity': KIND_HUMIDITY,
+    'pressure': KIND_PRESSURE,
+    'lux': KIND_ILLUMINANCE,
+    'illuminance': KIND_ILLUMINANCE,
+}
+
+# Sensor values are sent in hundredths apart from lux
+KIND_SCALE = {
+    KIND_TEMPERATURE: 100,
+    KIND_HUMIDITY: 100,
+    KIND_PRESSURE: 100,
+    KIND_ILLUMINANCE: 1,
+}
+
+COMPONENT_KINDS = {
+    'switch': (KIND_SWITCH,),
+    'relay': (KIND_RELAY,),
+    'relay_lockout': (KIND_RELAY,),
+    'draytonscr': (KIND_RELAY,),
+    'tsl2561': (KIND_ILLUMINANCE,),
+    'ds18x20': (KIND_TEMPERATURE,),
+    'dht22': (KIND_TEMPERATURE, KIND_HUMIDITY),
+    'si7021': (KIND_TEMPERATURE, KIND_HUMIDITY),
+    'bme280': (KIND_TEMPERATURE, KIND_HUMIDITY, KIND_PRESSURE),
+}
+
+# Level of the switch input when it is "on", toggle switches change level each time so have no on state
+SWITCH_ACTIVE_LEVEL = {
+    'momentary': 0,
+    'onOff': 0,
+    'motion': 1,
+    'contact': 1,
+}
+
+OP_PUSH_REF = 0x01
+OP_PUSH_INT8 = 0x02
+OP_PUSH_INT32 = 0x03
+OP_EQ = 0x10
+OP_NE = 0x11
+OP_LT = 0x12
+OP_LE = 0x13
+OP_GT = 0x14
+OP_GE = 0x15
+OP_AND = 0x18
+OP_OR = 0x19
+OP_NOT = 0x1a
+OP_SET = 0x20
+OP_SET_FOR = 0x21
+
+COMPARISONS = {'==': OP_EQ, '!=': OP_NE, '<': OP_LT, '<=': OP_LE, '>': OP_GT, '>=': OP_GE}
+STATES = {'off': 0, 'on': 1, 'toggle': 2}
+DURATIONS = {'s': 1, 'm': 60, 'h': 3600}
+
+TOKEN_RE = re.compile(r'\s*(?:(-?\d+(?:\.\d+)?)|([A-Za-z_][\w-]*(?:\.[A-Za-z]+)?)|(==|!=|<=|>=|[<>(),]))')
+
+BOOL = 'bool'
+
+
+class RuleError(Exception):
+    pass
+
+
+def tokenize(text):
+    tokens = []
+    pos = 0
+    text = text.rstrip()
+    while pos < len(text):
+        match = TOKEN_RE.match(text, pos)
+        if match is None:
+            raise RuleError(f'Unexpected "{text[pos:].strip()}"')
+        number, name, symbol = match.groups()
+        if number is not None:
+            tokens.append(('number', float(number) if '.' in number else int(number)))
+        elif name is not None:
+            tokens.append(('name', name))
+        else:
+            tokens.append(('symbol', symbol))
+        pos = match.end()
+    return tokens
+
+
+class Compiler:
+    def __init__(self, ids) -> None:
+        self.ids = ids  # id -> (component, instance details)
+        self.refs = []  # (id, kind)
+        self.timers = 0
+
+    def ref(self, name, kind):
+        if (name, kind) not in self.refs:
+            self.refs.append((name, kind))
+        if len(self.refs) > 255:
+            raise RuleError('Too many ids')
+        return self.refs.index((name, kind))
+
+    def lookup(self, name):
+        """Return (id, kind, component details) for a name used in a rule"""
+        id_name, _, value = name.partition('.')
+        if id_name not in self.ids:
+            raise RuleError(f'Unknown id {id_name}')
+        component, details = self.ids[id_name]
+        kinds = COMPONENT_KINDS.get(component)
+        if kinds is None:
+            raise RuleError(f'{id_name} is a {component} which can\'t be used in rules')
+        if value:
+            kind = KIND_NAMES.get(value.lower())
+            if kind not in kinds:
+                raise RuleError(f'{id_name} is a {component} which has no {value}')
+        elif len(kinds) > 1:
+            names = ', '.join(f'{id_name}.{n}' for n, k in KIND_NAMES.items() if k in kinds and n != 'illuminance')
+            raise RuleError(f'{id_name} has more than one value, use one of {names}')
+        else:
+            kind = kinds[0]
+        return id_name, kind, details
+
+    # Expressions, each emits code leaving a single value on the stack and returns the type of that value
+
+    def expression(self, tokens):
+        self.tokens = tokens
+        self.pos = 0
+        self.depth = 0
+        self.max_depth = 0
+        code = bytearray()
+        value_type = self.or_expr(code)
+        if self.pos != len(self.tokens):
+            raise RuleError(f'Unexpected "{self.tokens[self.pos][1]}"')
+        if value_type != BOOL:
+            raise RuleError('Condition must be true or false, not a sensor value')
+        if self.max_depth > MAX_STACK:
+            raise RuleError('Condition is too complicated')
+        return bytes(code)
+
+    def peek(self):
+        if self.pos < len(self.tokens):
+            return self.tokens[self.pos]
+        return (None, None)
+
+    def next(self):
+        token = self.peek()
+        if token[0] is None:
+            raise RuleError('Unexpected end of rule')
+        self.pos += 1
+        return token
+
+    def push(self, code, data):
+        code += data
+        self.depth += 1
+        self.max_depth = max(self.max_depth, self.depth)
+
+    def binary(self, code, op):
+        code.append(op)
+        self.depth -= 1
+
+    def boolean(self, value_type, op_name):
+        if value_type != BOOL:
+            raise RuleError(f'"{op_name}" needs true or false, not a sensor value')
+
+    def or_expr(self, code):
+        value_type = self.and_expr(code)
+        while self.peek() == ('name', 'or'):
+            self.next()
+            self.boolean(value_type, 'or')
+            self.boolean(self.and_expr(code), 'or')
+            self.binary(code, OP_OR)
+        return value_type
+
+    def and_expr(self, code):
+        value_type = self.not_expr(code)
+        while self.peek() == ('name', 'and'):
+            self.next()
+            self.boolean(value_type, 'and')
+            self.boolean(self.not_expr(code), 'and')
+            self.binary(code, OP_AND)
+        return value_type
+
+    def not_expr(self, code):
+        if self.peek() == ('name', 'not'):
+            self.next()
+            self.boolean(self.not_expr(code), 'not')
+            code.append(OP_NOT)
+            return BOOL
+        return self.comparison(code)
+
+    def comparison(self, code):
+        start = len(code)
+        left_type, left_number = self.operand(code)
+        kind, op = self.peek()
+        if kind != 'symbol' or op not in COMPARISONS:
+            if left_number is not None:
+                raise RuleError(f'{left_number} on its own is not a condition')
+            return left_type
+        self.next()
+        right_start = len(code)
+        right_type, right_number = self.operand(code)
+        if left_number is not None and right_number is not None:
+            raise RuleError('Comparing two numbers')
+        # Numbers take the type of what they are compared to so can be scaled to match
+        if left_number is not None:
+            left_type = right_type
+            code[start:right_start] = b''
+            self.depth -= 1
+            self.constant(code, left_number, left_type)
+            # Constant pushed after the value, so swap the comparison round
+            op = {'<': '>', '<=': '>=', '>': '<', '>=': '<='}.get(op, op)
+        elif right_number is not None:
+            right_type = left_type
+            del code[right_start:]
+            self.depth -= 1
+            self.constant(code, right_number, right_type)
+        if left_type != right_type:
+            raise RuleError(f'Can\'t compare {type_name(left_type)} with {type_name(right_type)}')
+        if left_type == BOOL and op not in ('==', '!='):
+            raise RuleError(f'"{op}" can\'t be used with on/off values')
+        self.binary(code, COMPARISONS[op])
+        return BOOL
+
+    def constant(self, code, number, value_type):
+        if value_type == BOOL:
+            raise RuleError(f'Can\'t compare on/off with {number}')
+        value = round(number * KIND_SCALE[value_type])
+        if -128 <= value <= 127:
+            self.push(code, struct.pack('<Bb', OP_PUSH_INT8, value))
+        elif -0x80000000 <= value <= 0x7fffffff:
+            self.push(code, struct.pack('<Bl', OP_PUSH_INT32, value))
+        else:
+            raise RuleError(f'{number} is too big')
+
+    def operand(self, code):
+        """Returns the type and, for numbers, the value which is only emitted once the type it is compared to is known"""
+        kind, value = self.next()
+        if kind == 'number':
+            # Placeholder so depth and code position are consistent, replaced in comparison()
+            self.push(code, struct.pack('<Bb', OP_PUSH_INT8, 0))
+            return None, value
+        if kind == 'symbol':
+            if value != '(':
+                raise RuleError(f'Unexpected "{value}"')
+            value_type = self.or_expr(code)
+            if self.next() != ('symbol', ')'):
+                raise RuleError('Missing ")"')
+            return value_type, None
+        if value in ('on', 'true'):
+            self.push(code, struct.pack('<Bb', OP_PUSH_INT8, 1))
+            return BOOL, None
+        if value in ('off', 'false'):
+            self.push(code, struct.pack('<Bb', OP_PUSH_INT8, 0))
+            return BOOL, None
+        if value in ('and', 'or', 'not'):
+            raise RuleError(f'Unexpected "{value}"')
+        id_name, ref_kind, details = self.lookup(value)
+        self.push(code, struct.pack('<BB', OP_PUSH_REF, self.ref(id_name, ref_kind)))
+        if ref_kind == KIND_SWITCH:
+            switch_type = details.get('type')
+            if switch_type not in SWITCH_ACTIVE_LEVEL:
+                raise RuleError(f'{id_name} is a {switch_type} switch which has no on/off state')
+            if SWITCH_ACTIVE_LEVEL[switch_type] == 0:
+                code.append(OP_NOT)
+        if ref_kind in (KIND_SWITCH, KIND_RELAY):
+            return BOOL, None
+        return ref_kind, None
+
+    def actions(self, text):
+        code = bytearray()
+        if text is None:
+            return bytes(code)
+        for action in text.split(','):
+            tokens = tokenize(action)
+            if len(tokens) < 2 or tokens[0][0] != 'name' or tokens[1] not in [('name', s) for s in STATES]:
+                raise RuleError(f'Expected "<relay> on|off|toggle [for <time>]" not "{action.strip()}"')
+            id_name, ref_kind, _ = self.lookup(tokens[0][1])
+            if ref_kind != KIND_RELAY:
+                raise RuleError(f'{id_name} is not a relay')
+            ref = self.ref(id_name, ref_kind)
+            state = STATES[tokens[1][1]]
+            if len(tokens) == 2:
+                code += struct.pack('<BBB', OP_SET, ref, state)
+                continue
+            if tokens[2] != ('name', 'for') or len(tokens) not in (4, 5) or tokens[3][0] != 'number':
+                raise RuleError(f'Expected "for <time>" in "{action.strip()}"')
+            unit = 's'
+            if len(tokens) == 5:
+                unit = tokens[4][1]
+                if unit not in DURATIONS:
+                    raise RuleError(f'Unknown time unit "{unit}", use s, m or h')
+            seconds = round(tokens[3][1] * DURATIONS[unit])
+            if not 0 < seconds <= 0xffffffff:
+                raise RuleError(f'Time out of range in "{action.strip()}"')
+            if self.timers == 255:
+                raise RuleError('Too many timed actions')
+            code += struct.pack('<BBBBL', OP_SET_FOR, ref, state, self.timers, seconds)
+            self.timers += 1
+        return bytes(code)
+
+
+def type_name(value_type):
+    if value_type == BOOL:
+        return 'on/off'
+    for name, kind in KIND_NAMES.items():
+        if kind == value_type:
+            return name
+    return str(value_type)
+
+
+def find_ids(profile_dict):
+    ids = {}
+    for component, instances in profile_dict.items():
+        if not isinstance(instances, list):
+            continue
+        for details in instances:
+            if isinstance(details, dict) and 'id' in details:
+                ids[details['id']] = (component, details)
+    return ids
+
+
+def compile_rule(ids, rule):
+    """Returns (refs, code) for the rule"""
+    compiler = Compiler(ids)
+    if not isinstance(rule.get('when'), str):
+        raise RuleError('"when" must be given')
+    if not isinstance(rule.get('then'), str):
+        raise RuleError('"then" must be given')
+    when = compiler.expression(tokenize(rule['when']))
+    then = compiler.actions(rule['then'])
+    otherwise = compiler.actions(rule.get('otherwise'))
+    if max(len(when), len(then), len(otherwise)) > 255:
+        raise RuleError('Rule is too long')
+    code = struct.pack('<BBB', VERSION, len(compiler.refs), compiler.timers)
+    code += bytes(kind for _, kind in compiler.refs)
+    for section in (when, then, otherwise):
+        code += struct.pack('<B', len(section)) + section
+    refs = ','.join(name for name, _ in compiler.refs)
+    if len(refs.encode()) > MAX_STRING:
+        raise RuleError(f'Ids used are {len(refs)} characters, at most {MAX_STRING} fit in a profile')
+    if len(code) * 2 > MAX_STRING:
+        raise RuleError(f'Compiled rule is {len(code)} bytes, at most {MAX_STRING // 2} fit in a profile')
+    return refs, code.hex()
+
+
+def compile_rules(messages, profile_dict):
+    """Add refs and code to each rule in the profile, reporting problems to messages (see updateprofile.py)"""
+    if not isinstance(profile_dict, dict) or not isinstance(profile_dict.get('rule'), list):
+        return
+    ids = find_ids(profile_dict)
+    for idx, rule in enumerate(profile_dict['rule']):
+        if not isinstance(rule, dict):
+            continue
+        try:
+            rule['refs'], rule['code'] = compile_rule(ids, rule)
+        except RuleError as e:
+            messages.error(str(e), 'rule', idx)
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(f'Usage: {sys.argv[0]} <profile yaml>')
+        return 255
+    with open(sys.argv[1]) as fp:
+        profile_dict = yaml.safe_load(fp)
+    rules = profile_dict.get('rule') or []
+    ids = find_ids(profile_dict)
+    failed = False
+    for idx, rule in enumerate(rules):
+        try:
+            refs, code = compile_rule(ids, rule)
+        except RuleError as e:
+            print(f'rule:{idx}: {e}')
+            failed = True
+            continue
+        print(f'rule:{idx}: {rule.get("name", rule["when"])}\n    refs: {refs}\n    code: {code} ({len(code) // 2} bytes)')
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
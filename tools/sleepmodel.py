@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+import argparse
+import yaml
+
+# Timing model for the deep_sleep profile component.
+#
+# Each wake cycle is modelled as: boot, then the network bring up running in parallel with the
+# sensor reads, then the publish/flush and shutdown. Times are in milliseconds and currents in mA,
+# the defaults are typical figures for an ESP8266 and can be overridden on the command line.
+
+DEFAULTS = {
+    'boot_ms': 180,            # ROM + bootloader + app start up to app_main
+    'init_ms': 120,            # NVS, profile processing and driver init
+    'scan_ms': 1200,           # Full active scan across all channels
+    'assoc_ms': 90,            # Authentication and association with a known BSSID
+    'dhcp_ms': 600,            # DHCP discover/offer/request/ack
+    'arp_ms': 15,              # Gratuitous ARP when using the saved IP lease
+    'rtt_ms': 15,              # Round trip to the MQTT server
+    'flush_ms': 100,           # FLUSH_MS in deepsleep.c
+    'shutdown_ms': 20,         # Stopping MQTT and Wifi
+    'awake_ma': 75.0,          # Average current with the radio on
+    'sleep_ua': 20.0,          # Deep sleep current
+    'resume_max_uses': 32,     # RESUME_MAX_USES in wifi.c
+}
+
+# Worst case read times for each sensor type (ms)
+SENSOR_READ_MS = {
+    'dht22': 25,
+    'si7021': 35,
+    'tsl2561': 410,
+    'bme280': 45,
+    'ds18x20': {9: 94, 10: 188, 11: 375, 12: 750},
+}
+
+
+class Cycle:
+    def __init__(self, params, sensors, elements):
+        self.params = params
+        self.sensors = sensors
+        self.elements = elements
+
+    def sensor_ms(self):
+        longest = 0
+        for sensor in self.sensors:
+            read = SENSOR_READ_MS[sensor['type']]
+            if isinstance(read, dict):
+                read = read[sensor.get('resolution', 12)]
+            longest = max(longest, read)
+        return longest
+
+    def network_ms(self, resume, session_present):
+        p = self.params
+        if resume:
+            wifi = p['assoc_ms'] + p['arp_ms']
+        else:
+            wifi = p['scan_ms'] + p['assoc_ms'] + p['dhcp_ms']
+        # TCP handshake + CONNECT/CONNACK
+        mqtt = 2 * p['rtt_ms']
+        if not session_present:
+            # Common control subscription plus one per element
+            mqtt += (1 + self.elements) * p['rtt_ms']
+        return wifi + mqtt
+
+    def awake_ms(self, resume, session_present):
+        p = self.params
+        start = p['boot_ms'] + p['init_ms']
+        return start + max(self.network_ms(resume, session_present), self.sensor_ms()) + p['flush_ms'] + p['shutdown_ms']
+
+
+def load_profile(filename):
+    with open(filename) as f:
+        profile = yaml.safe_load(f)
+    sensors = []
+    elements = 1 # device element
+    interval = None
+    for component, entries in profile.items():
+        if component == 'deep_sleep':
+            interval = entries[0]['interval']
+            continue
+        for entry in entries:
+            elements += 1
+            if component in SENSOR_READ_MS:
+                entry = dict(entry)
+                entry['type'] = component
+                sensors.append(entry)
+    return sensors, elements, interval
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Estimate awake time per cycle and battery life for deep sleep mode.")
+    parser.add_argument("profile", help="Device profile (yaml)")
+    parser.add_argument("--interval", type=int, help="Sleep interval in seconds (overrides the profile)")
+    parser.add_argument("--cycles", type=int, default=100, help="Number of cycles to simulate")
+    parser.add_argument("--battery", type=float, default=2400, help="Battery capacity in mAh")
+    for key, value in DEFAULTS.items():
+        parser.add_argument("--" + key.replace('_', '-'), type=type(value), default=value)
+    args = parser.parse_args()
+
+    params = {key: getattr(args, key) for key in DEFAULTS}
+    sensors, elements, interval = load_profile(args.profile)
+    if args.interval:
+        interval = args.interval
+    if not interval:
+        parser.error("No deep_sleep interval in the profile, use --interval")
+
+    cycle = Cycle(params, sensors, elements)
+    total_ms = 0
+    resume = False
+    uses = 0
+    for n in range(args.cycles):
+        # First wake after a cold boot (or lease refresh) does a full connect and creates the session
+        awake = cycle.awake_ms(resume, session_present=n > 0)
+        print(f"cycle {n:4}: {'resume' if resume else 'full  '} awake {awake:5} ms")
+        total_ms += awake
+        if resume:
+            uses += 1
+            if uses >= params['resume_max_uses']:
+                resume = False
+        else:
+            resume = True
+            uses = 0
+
+    average_ms = total_ms / args.cycles
+    period_ms = max(interval * 1000, average_ms)
+    sleep_ms = period_ms - average_ms
+    average_ma = (average_ms * params['awake_ma'] + sleep_ms * params['sleep_ua'] / 1000) / period_ms
+    print()
+    print(f"sensors: {len(sensors)}, elements: {elements}, slowest read {cycle.sensor_ms()} ms")
+    print(f"full connect awake:   {cycle.awake_ms(False, False)} ms")
+    print(f"fast resume awake:    {cycle.awake_ms(True, True)} ms")
+    print(f"average awake:        {average_ms:.0f} ms per {interval} s cycle")
+    print(f"average current:      {average_ma:.3f} mA")
+    print(f"battery life:         {args.battery / average_ma / 24:.0f} days ({args.battery:.0f} mAh)")
+
+
+if __name__ == '__main__':
+    main()
@@ -3,6 +3,7 @@ import time
 import yaml
 import collections
 import gencomponents
+import rulecompiler
 import requests
 import json
 import sys
@@ -71,9 +72,10 @@ def load_profile(profile_file) -> dict:
     return profile_dict
 
 def validate_arg(messages, id_table, component, idx, argument, value):
-    if argument.type == 'choices':
+    if argument.type == 'choice':
+        # The binary profile stores the index of the choice, so an unknown one can't be sent
         if value not in argument.options['choices']:
-            messages.warning(f'choice "{value}" not known for this component, valid choices are {argument.options["choices"]}', component, idx)
+            messages.error(f'choice "{value}" not known for this component, valid choices are {argument.options["choices"]}', component, idx)
 
     elif argument.type in ('uint', 'gpioPin', 'gpioLevel', 'i2cAddr'):
         if not isinstance(value, int) or value < 0:
@@ -90,9 +92,13 @@ def validate_arg(messages, id_table, component, idx, argument, value):
     elif argument.type == 'string':
         if not isinstance(value, str):
             messages.error(f"{value} is not an string", component, idx)
+        elif len(value.encode()) > 255:
+            messages.error(f"{argument.name} is longer than the 255 bytes a binary profile can hold", component, idx)
 
     elif argument.type == 'id':
         id_table.use(value, f"{component.name}[{idx}].{argument.name}")
+        if len(str(value).encode()) > 255:
+            messages.error(f"{argument.name} is longer than the 255 bytes a binary profile can hold", component, idx)
 
 def validate_component(messages, id_table, component, idx, details):
     defined_args = set()
@@ -165,7 +171,7 @@ def get_device_ip(mqtt_host, device_id):
     return device_info['ip']
 
 
-def upload_profile(mqtt_host, device_id, profile):
+def upload_profile(mqtt_host, device_id, profile, binary_profile):
     device_info = {}
     client = mqtt.Client(userdata=device_info)
     
@@ -192,9 +198,10 @@ def upload_profile(mqtt_host, device_id, profile):
 
     print("Sending new profile")
     #client.publish(f"homething/{device_id}/device/ctrl", b"restart")
-    client.publish(f"homething/{device_id}/device/ctrl", b"setprofile\0" + profile)
+    client.publish(f"homething/{device_id}/device/ctrl", b"setprofile\0" + profile.encode() + b"\0" + binary_profile)
     
-    print("Waiting for device to restart...")
+    # The device republishes its profile once it has applied it, either live or after restarting
+    print("Waiting for device to apply the profile...")
     start_time = time.time()
     while (time.time() < start_time + 10) and device_info.get('profile') is None: 
         client.loop()
@@ -203,7 +210,7 @@ def upload_profile(mqtt_host, device_id, profile):
     if device_info.get("profile") is None:
         raise RuntimeError(f"No profile information recieved about {device_id}")
     
-    print("Device restarted.")
+    print("Device applied the profile.")
     if device_info['profile'] == original_profile:
         raise RuntimeError(f'Profile update of {device_id} failed') 
 
@@ -225,13 +232,17 @@ def main():
 
     profile_dict = load_profile(profile_file)
     messages = Messages()
+    if 'rule' in components:
+        rulecompiler.compile_rules(messages, profile_dict)
     validate_profile(messages, components, profile_dict)
     if messages.errors:
         messages.print()
         sys.exit(1)
 
     profile = { 'version': VERSION, 'components': profile_dict}
-    upload_profile(mqtt_host, device_id, json.dumps(profile))
+    binary_profile = gencomponents.encode_profile(components, profile_dict)
+    print(f"Profile size: JSON {len(json.dumps(profile))} bytes, binary {len(binary_profile)} bytes")
+    upload_profile(mqtt_host, device_id, json.dumps(profile), binary_profile)
     print("Profile updated!")
 
 